@@ -0,0 +1,204 @@
+/*
+ * cfs.c
+ *
+ * Implementation of a fair-share scheduler, after Linux's CFS.
+ *
+ * Each thread has a virtual runtime: the processor time it has used, as
+ * measured by thread_account at every switch, scaled down by the weight of
+ * its priority. The ready thread with the least virtual runtime runs next,
+ * so over time every thread gets processor time in proportion to its weight.
+ * The ready threads are kept in a pairing heap ordered by virtual runtime,
+ * linked through the child field of thread->sched.cfs and, among siblings,
+ * next and prev. A thread's prev is its left sibling, or its parent if it is
+ * the first child, so only the root of the heap has none.
+ *
+ * When the timer interrupt preempts a thread that is still behind every
+ * ready thread, it keeps running, otherwise heavier threads would only ever
+ * get one quantum in turn like the others.
+ */
+
+#include "ut369.h"
+#include "thread.h"
+#include "schedule.h"
+#include "interrupt.h"
+#include <stdlib.h>
+#include <assert.h>
+
+/* Weight of THREAD_PRIO_DEFAULT, whose virtual runtime is its runtime */
+#define CFS_WEIGHT_DEFAULT 1024
+
+/* How far behind the least virtual runtime a thread that was asleep may
+ * come back, in nanoseconds, so that it cannot bank the time it slept. */
+#define CFS_SLEEPER_CREDIT (SIG_INTERVAL * 1000LL)
+
+/* Weight of each priority: Linux's nice -16 to 15, each step about 1.25x */
+static const int weights[THREAD_PRIO_LEVELS] = {
+    36291, 29154, 23254, 18705, 14949, 11916, 9548, 7620,
+    6100,  4904,  3906,  3121,  2501,  1991,  1586, 1277,
+    1024,  820,   655,   526,   423,   335,   272,  215,
+    172,   137,   110,   87,    70,    56,    45,   36,
+};
+
+_Static_assert(THREAD_PRIO_DEFAULT == 16, "weights[16] is CFS_WEIGHT_DEFAULT");
+
+static struct thread *heap = NULL;
+
+/* Never decreases, the virtual runtime new and woken threads start near */
+static long long min_vruntime = 0;
+
+/* Add the runtime of thread since the last call to its virtual runtime */
+static void
+cfs_charge(struct thread *thread)
+{
+    long long delta = thread->runtime - thread->sched.cfs.vcharged;
+
+    thread->sched.cfs.vruntime += delta * CFS_WEIGHT_DEFAULT / weights[thread->prio];
+    thread->sched.cfs.vcharged = thread->runtime;
+}
+
+/* Merge two heaps, returning the root of the result */
+static struct thread *
+cfs_meld(struct thread *a, struct thread *b)
+{
+    if (a == NULL) {
+        return b;
+    }
+    if (b == NULL) {
+        return a;
+    }
+    if (b->sched.cfs.vruntime < a->sched.cfs.vruntime) {
+        struct thread *tmp = a;
+        a = b;
+        b = tmp;
+    }
+    b->sched.cfs.prev = a;
+    b->sched.cfs.next = a->sched.cfs.child;
+    if (a->sched.cfs.child != NULL) {
+        a->sched.cfs.child->sched.cfs.prev = b;
+    }
+    a->sched.cfs.child = b;
+    return a;
+}
+
+/* Merge the siblings from first on into one heap, in pairs from the left and
+ * then the pairs from the right, which keeps pops O(log n) amortized. */
+static struct thread *
+cfs_merge_pairs(struct thread *first)
+{
+    struct thread *pairs = NULL; // linked through next, last pair first
+    struct thread *root = NULL;
+
+    while (first != NULL) {
+        struct thread *a = first;
+        struct thread *b = a->sched.cfs.next;
+        first = b != NULL ? b->sched.cfs.next : NULL;
+        a->sched.cfs.next = a->sched.cfs.prev = NULL;
+        if (b != NULL) {
+            b->sched.cfs.next = b->sched.cfs.prev = NULL;
+        }
+        a = cfs_meld(a, b);
+        a->sched.cfs.next = pairs;
+        pairs = a;
+    }
+    while (pairs != NULL) {
+        struct thread *a = pairs;
+        pairs = a->sched.cfs.next;
+        a->sched.cfs.next = NULL;
+        root = cfs_meld(root, a);
+    }
+    return root;
+}
+
+/* Take thread out of the heap, which it must be in */
+static void
+cfs_unlink(struct thread *thread)
+{
+    if (thread != heap) {
+        if (thread->sched.cfs.prev->sched.cfs.child == thread) {
+            thread->sched.cfs.prev->sched.cfs.child = thread->sched.cfs.next;
+        }
+        else {
+            thread->sched.cfs.prev->sched.cfs.next = thread->sched.cfs.next;
+        }
+        if (thread->sched.cfs.next != NULL) {
+            thread->sched.cfs.next->sched.cfs.prev = thread->sched.cfs.prev;
+        }
+        heap = cfs_meld(heap, cfs_merge_pairs(thread->sched.cfs.child));
+    }
+    else {
+        heap = cfs_merge_pairs(thread->sched.cfs.child);
+    }
+    thread->sched.cfs.child = thread->sched.cfs.next = thread->sched.cfs.prev = NULL;
+}
+
+int
+cfs_init(void)
+{
+    heap = NULL;
+    min_vruntime = 0;
+    thread_measure_runtime();
+    return 0;
+}
+
+int
+cfs_enqueue(struct thread *thread)
+{
+    assert(!interrupt_enabled());
+    assert(thread->sched.cfs.child == NULL && thread->sched.cfs.prev == NULL);
+
+    cfs_charge(thread);
+    if (thread->sched.cfs.vruntime < min_vruntime - CFS_SLEEPER_CREDIT) {
+        thread->sched.cfs.vruntime = min_vruntime - CFS_SLEEPER_CREDIT;
+    }
+    thread->sched.cfs.next = thread->sched.cfs.prev = NULL;
+    heap = cfs_meld(heap, thread);
+    return 0;
+}
+
+struct thread *
+cfs_dequeue(void)
+{
+    struct thread *ret = heap;
+
+    assert(!interrupt_enabled());
+    if (ret == NULL) {
+        return NULL;
+    }
+
+    struct thread *current = thread_get(thread_id());
+    if (current->preempted && current->state == RUNNING) {
+        thread_account();
+        cfs_charge(current);
+        if (current->sched.cfs.vruntime <= ret->sched.cfs.vruntime) {
+            // thread_preempt keeps running the current thread
+            return NULL;
+        }
+    }
+
+    cfs_unlink(ret);
+    if (ret->sched.cfs.vruntime > min_vruntime) {
+        min_vruntime = ret->sched.cfs.vruntime;
+    }
+    return ret;
+}
+
+struct thread *
+cfs_remove(Tid tid)
+{
+    struct thread *ret = thread_get(tid);
+
+    assert(!interrupt_enabled());
+    // Every thread in the heap but its root has a prev
+    if (ret == NULL || (ret != heap && ret->sched.cfs.prev == NULL)) {
+        return NULL;
+    }
+    cfs_unlink(ret);
+    return ret;
+}
+
+void
+cfs_destroy(void)
+{
+    assert(heap == NULL);
+    heap = NULL;
+}
@@ -0,0 +1,173 @@
+/*
+ * context.c
+ *
+ * Switching between thread stacks on x86-64 and aarch64, see context.h.
+ */
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include "context.h"
+
+/* Where a thread starts running after the first context_switch() to it:
+ * moves fn and arg, left in callee-saved registers by context_init(), into
+ * the argument registers and calls entry. */
+void context_start(void);
+
+#if defined(__x86_64__)
+
+/* Frame pushed by context_switch(), from the saved stack pointer up */
+struct frame
+{
+	uint16_t fpucw;   /* x87 control word */
+	uint16_t pad;
+	uint32_t mxcsr;   /* SSE control and status */
+	uint64_t r15;
+	uint64_t r14;     /* arg */
+	uint64_t r13;     /* fn */
+	uint64_t r12;     /* entry */
+	uint64_t rbx;
+	uint64_t rbp;
+	uint64_t ret;     /* context_start */
+};
+
+__asm__(
+	".text\n"
+	".globl context_switch\n"
+	".type context_switch, @function\n"
+	"context_switch:\n"
+	"	pushq %rbp\n"
+	"	pushq %rbx\n"
+	"	pushq %r12\n"
+	"	pushq %r13\n"
+	"	pushq %r14\n"
+	"	pushq %r15\n"
+	"	subq $8, %rsp\n"
+	"	fnstcw (%rsp)\n"
+	"	stmxcsr 4(%rsp)\n"
+	"	movq %rsp, (%rdi)\n"
+	"	movq %rsi, %rsp\n"
+	"	fldcw (%rsp)\n"
+	"	ldmxcsr 4(%rsp)\n"
+	"	addq $8, %rsp\n"
+	"	popq %r15\n"
+	"	popq %r14\n"
+	"	popq %r13\n"
+	"	popq %r12\n"
+	"	popq %rbx\n"
+	"	popq %rbp\n"
+	"	ret\n"
+	".size context_switch, .-context_switch\n"
+	"\n"
+	".globl context_start\n"
+	".hidden context_start\n"
+	".type context_start, @function\n"
+	"context_start:\n"
+	"	movq %r13, %rdi\n"
+	"	movq %r14, %rsi\n"
+	"	callq *%r12\n"
+	"	ud2\n"
+	".size context_start, .-context_start\n"
+);
+
+void *
+context_init(void *base, size_t size, void (*entry)(int (*)(void *), void *),
+             int (*fn)(void *), void *arg)
+{
+	uintptr_t top = ((uintptr_t)base + size) & ~(uintptr_t)0xF;
+	struct frame *frame = (struct frame *)top - 1;
+
+	/* context_start calls entry with the stack 16-byte aligned */
+	assert(((uintptr_t)frame & 0xF) == 0 && sizeof(*frame) % 16 == 0);
+	memset(frame, 0, sizeof(*frame));
+	frame->fpucw = 0x037F;
+	frame->mxcsr = 0x1F80;
+	frame->r12 = (uintptr_t)entry;
+	frame->r13 = (uintptr_t)fn;
+	frame->r14 = (uintptr_t)arg;
+	frame->ret = (uintptr_t)context_start;
+	return frame;
+}
+
+#elif defined(__aarch64__)
+
+/* Frame stored by context_switch(), from the saved stack pointer up */
+struct frame
+{
+	uint64_t x19;     /* entry */
+	uint64_t x20;     /* fn */
+	uint64_t x21;     /* arg */
+	uint64_t x22_28[7];
+	uint64_t x29;     /* frame pointer */
+	uint64_t x30;     /* link register, context_start */
+	uint64_t d8_15[8];
+	uint64_t fpcr;
+	uint64_t pad;
+};
+
+__asm__(
+	".text\n"
+	".globl context_switch\n"
+	".type context_switch, %function\n"
+	"context_switch:\n"
+	"	sub sp, sp, #176\n"
+	"	stp x19, x20, [sp, #0]\n"
+	"	stp x21, x22, [sp, #16]\n"
+	"	stp x23, x24, [sp, #32]\n"
+	"	stp x25, x26, [sp, #48]\n"
+	"	stp x27, x28, [sp, #64]\n"
+	"	stp x29, x30, [sp, #80]\n"
+	"	stp d8, d9, [sp, #96]\n"
+	"	stp d10, d11, [sp, #112]\n"
+	"	stp d12, d13, [sp, #128]\n"
+	"	stp d14, d15, [sp, #144]\n"
+	"	mrs x9, fpcr\n"
+	"	str x9, [sp, #160]\n"
+	"	mov x9, sp\n"
+	"	str x9, [x0]\n"
+	"	mov sp, x1\n"
+	"	ldr x9, [sp, #160]\n"
+	"	msr fpcr, x9\n"
+	"	ldp x19, x20, [sp, #0]\n"
+	"	ldp x21, x22, [sp, #16]\n"
+	"	ldp x23, x24, [sp, #32]\n"
+	"	ldp x25, x26, [sp, #48]\n"
+	"	ldp x27, x28, [sp, #64]\n"
+	"	ldp x29, x30, [sp, #80]\n"
+	"	ldp d8, d9, [sp, #96]\n"
+	"	ldp d10, d11, [sp, #112]\n"
+	"	ldp d12, d13, [sp, #128]\n"
+	"	ldp d14, d15, [sp, #144]\n"
+	"	add sp, sp, #176\n"
+	"	ret\n"
+	".size context_switch, .-context_switch\n"
+	"\n"
+	".globl context_start\n"
+	".hidden context_start\n"
+	".type context_start, %function\n"
+	"context_start:\n"
+	"	mov x0, x20\n"
+	"	mov x1, x21\n"
+	"	blr x19\n"
+	"	brk #0\n"
+	".size context_start, .-context_start\n"
+);
+
+void *
+context_init(void *base, size_t size, void (*entry)(int (*)(void *), void *),
+             int (*fn)(void *), void *arg)
+{
+	uintptr_t top = ((uintptr_t)base + size) & ~(uintptr_t)0xF;
+	struct frame *frame = (struct frame *)top - 1;
+
+	assert(((uintptr_t)frame & 0xF) == 0 && sizeof(*frame) == 176);
+	memset(frame, 0, sizeof(*frame));
+	frame->x19 = (uintptr_t)entry;
+	frame->x20 = (uintptr_t)fn;
+	frame->x21 = (uintptr_t)arg;
+	frame->x30 = (uintptr_t)context_start;
+	return frame;
+}
+
+#else
+#error "context switching is only implemented for x86-64 and aarch64"
+#endif
@@ -0,0 +1,31 @@
+/*
+ * context.h
+ *
+ * Switching between thread stacks, in place of getcontext/setcontext.
+ *
+ * A suspended thread is just its stack pointer: context_switch() pushes the
+ * callee-saved registers and the floating point control words on the stack
+ * it leaves, and pops those of the stack it switches to. Everything else is
+ * either caller-saved, and so already saved by the C code calling it, or
+ * per-process state that does not change between threads. In particular the
+ * signal mask is not switched, interrupts being masked in software (see
+ * interrupt.c).
+ */
+
+#ifndef _CONTEXT_H_
+#define _CONTEXT_H_
+
+#include <stddef.h>
+
+/* Save the registers of the current thread on its stack, store its stack
+ * pointer in *save_sp and resume the thread whose stack pointer is sp. */
+void context_switch(void **save_sp, void *sp);
+
+/* Lay out, at the top of a new stack of size bytes at base, the frame that
+ * makes the first context_switch() to the returned stack pointer call
+ * entry(fn, arg). entry must not return. */
+void *context_init(void *base, size_t size,
+                   void (*entry)(int (*)(void *), void *),
+                   int (*fn)(void *), void *arg);
+
+#endif /* _CONTEXT_H_ */
@@ -7,17 +7,34 @@
 #include <unistd.h>
 #include <sys/time.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 #include "ut369.h"
 #include "interrupt.h"
+#include "thread.h"
+#include "processor.h"
+
+/* glibc only names the field from 2.35 on */
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
 
 static void interrupt_handler(int sig, siginfo_t *sip, void *contextVP);
 static void set_interrupt(void);
-static void set_signal(sigset_t *setp);
 
 static int init = 0;
 static int loud = 0;
 
+/* Interrupts are masked in software, so that interrupt_set() needs no system
+ * call: SIG_TYPE is never blocked outside of its handler, which only records
+ * an interrupt arriving while `disabled` is set in `pending`. The yield it
+ * would have made is then made by interrupt_set() as interrupts are enabled
+ * again. Both are per processor, each with a timer of its own when there are
+ * several, and disabling interrupts also takes the kernel lock then, see
+ * processor.h. */
+
 /* Called as part of ut369_start. Many of the calls won't
  * make sense at first -- study the man pages!
  */
@@ -34,18 +51,47 @@ void interrupt_init(int verbose)
 	error = sigemptyset(&action.sa_mask);
 	assert(!error);
 
-	/* use sa_sigaction as handler instead of sa_handler */
-	action.sa_flags = SA_SIGINFO;
+	/* use sa_sigaction as handler instead of sa_handler. SIG_TYPE is not
+	 * blocked while the handler runs, since the handler may switch to
+	 * another thread that will not return through it for a while: the
+	 * handler disables interrupts in software before it rearms the timer
+	 * instead, which avoids recursive interrupts where an interrupt occurs
+	 * before the previous interrupt handler has finished running. */
+	action.sa_flags = SA_SIGINFO | SA_NODEFER;
 	if (sigaction(SIG_TYPE, &action, NULL))
 	{
 		perror("Setting up signal handler");
 		assert(0);
 	}
 
-	/* block SIG_TYPE while interrupt_handler() is running. This will avoid
-	 * recursive interrupts where an interrupt occurs before the previous
-	 * interrupt handler has finished running.  */
 	interrupt_off();
+	processor_self()->pending = 0;
+	interrupt_start();
+}
+
+/* Arm the timer of the calling processor, once interrupt_init has been called.
+ * A lone processor uses the process-wide interval timer, several each have a
+ * timer that signals their own kernel thread. */
+void interrupt_start(void)
+{
+	if (!init)
+		return;
+
+	if (nr_processors > 1)
+	{
+		struct processor *self = processor_self();
+		struct sigevent sev;
+
+		memset(&sev, 0, sizeof(sev));
+		sev.sigev_notify = SIGEV_THREAD_ID;
+		sev.sigev_signo = SIG_TYPE;
+		sev.sigev_notify_thread_id = gettid();
+		if (timer_create(CLOCK_MONOTONIC, &sev, &self->timer))
+		{
+			perror("Creating processor timer");
+			assert(0);
+		}
+	}
 	set_interrupt();
 }
 
@@ -70,35 +116,52 @@ int interrupt_off(void)
 
 /* enables or disables interrupts, and returns whether interrupts were enabled
  * or not previously. */
-int interrupt_set(int enabled)
+INTERRUPT_NOPREEMPT int interrupt_set(int enabled)
 {
-	int ret;
-	sigset_t mask, omask;
+	struct processor *self = processor_self();
+	int was_enabled = !self->disabled;
 
-	set_signal(&mask);
-	if (enabled)
+	/* the fences keep the compiler from moving accesses to the data that
+	 * interrupts are disabled for across the change of the flag. The flag
+	 * is set before the lock is taken, and cleared after it is released,
+	 * so that the handler never waits for the lock its processor holds. */
+	atomic_signal_fence(memory_order_seq_cst);
+	if (was_enabled && !enabled)
 	{
-		ret = sigprocmask(SIG_UNBLOCK, &mask, &omask);
+		self->disabled = 1;
+		atomic_signal_fence(memory_order_seq_cst);
+		if (nr_processors > 1)
+			kernel_lock();
 	}
-	else
+	else if (!was_enabled && enabled)
 	{
-		ret = sigprocmask(SIG_BLOCK, &mask, &omask);
+		/* take the interrupts that arrived while interrupts were
+		 * disabled before enabling them, and in a loop: the yield may
+		 * resume the caller on another processor with one pending
+		 * already, and taking each with interrupts enabled would nest
+		 * one more call per interrupt on the caller's stack */
+		while (self->pending && init)
+		{
+			self->pending = 0;
+			thread_preempt();
+			self = processor_self();
+		}
+		self->pending = 0;
+		if (nr_processors > 1)
+			kernel_unlock();
+		atomic_signal_fence(memory_order_seq_cst);
+		self->disabled = 0;
 	}
-	assert(!ret);
-	return (sigismember(&omask, SIG_TYPE) ? 0 : 1);
+	atomic_signal_fence(memory_order_seq_cst);
+	return was_enabled;
 }
 
-int interrupt_enabled(void)
+INTERRUPT_NOPREEMPT int interrupt_enabled(void)
 {
-	sigset_t mask;
-	int ret;
-
 	if (!init)
 		return 0;
 
-	ret = sigprocmask(0, NULL, &mask);
-	assert(!ret);
-	return (sigismember(&mask, SIG_TYPE) ? 0 : 1);
+	return !processor_self()->disabled;
 }
 
 void interrupt_quiet(void)
@@ -141,20 +204,23 @@ int unintr_printf(const char *fmt, ...)
 
 /* static functions */
 
-static void
-set_signal(sigset_t *setp)
-{
-	int ret;
-	ret = sigemptyset(setp);
-	assert(!ret);
-	ret = sigaddset(setp, SIG_TYPE);
-	assert(!ret);
-	return;
-}
-
 static int first = 1;
 static struct timeval start, end, diff = {0, 0};
 
+/* Whether the interrupted code is INTERRUPT_NOPREEMPT code, between the
+ * bounds the linker gives the section. */
+static int
+interrupt_in_nopreempt(ucontext_t *context)
+{
+#if defined(__x86_64__)
+	char *pc = (char *)context->uc_mcontext.gregs[REG_RIP];
+#elif defined(__aarch64__)
+	char *pc = (char *)context->uc_mcontext.pc;
+#endif
+	return pc >= __start_interrupt_nopreempt &&
+	       pc < __stop_interrupt_nopreempt;
+}
+
 /*
  * STUB: once interrupt_init() is called, this routine
  * gets called each time SIG_TYPE is sent to this process
@@ -163,12 +229,24 @@ static void
 interrupt_handler(int sig, siginfo_t *sip, void *contextVP)
 {
 	ucontext_t *context = (ucontext_t *)contextVP;
+	struct processor *self = processor_self();
 	(void)sig;
 	(void)sip;
 
-	/* check that SIG_TYPE is blocked on entry.
-	 * this signal should be blocked because of the sigemptyset call in
-	 * register_interrupt_handler(). */
+	/* defer the interrupt until interrupts are enabled again, or until the
+	 * caller has left code that must not move to another processor */
+	if (self->disabled ||
+	    (nr_processors > 1 && interrupt_in_nopreempt(context)))
+	{
+		self->pending = 1;
+		set_interrupt();
+		return;
+	}
+
+	/* the handler runs with interrupts disabled, so that the interrupt
+	 * set_interrupt() schedules below is deferred until it is done */
+	interrupt_off();
+	self->pending = 0;
 	assert(!interrupt_enabled());
 	if (loud)
 	{
@@ -191,17 +269,29 @@ interrupt_handler(int sig, siginfo_t *sip, void *contextVP)
 
 	set_interrupt();
 	/* implement preemptive threading by calling thread_yield */
-	thread_yield(THREAD_ANY);
+	thread_preempt();
+	interrupt_on();
 }
 
 /*
  * Use the setitimer() system call to set an alarm in the future. At that time,
- * this process will receive a SIGALRM signal.
+ * this process will receive a SIGALRM signal. With several processors, the
+ * timer of the calling processor signals its own kernel thread instead.
  */
 static void
 set_interrupt(void)
 {
 	int ret;
+
+	if (nr_processors > 1)
+	{
+		struct itimerspec spec = { { 0, 0 }, { 0, SIG_INTERVAL * 1000 } };
+
+		ret = timer_settime(processor_self()->timer, 0, &spec, NULL);
+		assert(!ret);
+		return;
+	}
+
 	struct itimerval val;
 
 	val.it_interval.tv_sec = 0;
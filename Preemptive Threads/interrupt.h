@@ -9,7 +9,15 @@
 /* in preemptive mode, the interrupt will be delivered every 200 usec */
 #define SIG_INTERVAL 200
 
+/* Code that finds the processor it runs on, and uses it, before the timer may
+ * move it to another one. With several processors, an interrupt that arrives
+ * while such code runs is deferred, as if interrupts were disabled. */
+#define INTERRUPT_NOPREEMPT \
+	__attribute__((noinline, section("interrupt_nopreempt")))
+extern char __start_interrupt_nopreempt[], __stop_interrupt_nopreempt[];
+
 void interrupt_init(int verbose);
+void interrupt_start(void);
 void interrupt_end(void);
 
 int interrupt_on(void);
@@ -0,0 +1,186 @@
+/*
+ * mlfq.c
+ *
+ * Implementation of a multi-level feedback queue scheduler.
+ *
+ * A thread starts at the top level. It moves down a level whenever it has
+ * used a whole SIG_INTERVAL quantum of processor time at its level, however
+ * many times it gave up the processor in between, so that a thread cannot
+ * stay up by yielding just before the timer interrupt, and one switched in
+ * just before it is not moved down for the rest of a quantum it did not use.
+ * The highest non-empty level always runs first, round-robin within the
+ * level, so that threads that mostly wait are not queued behind those that
+ * compute. Every MLFQ_BOOST_INTERVAL all the threads return to the top
+ * level, so that the ones at the bottom are not starved forever.
+ *
+ * The timer is not re-armed at each switch, so the time a thread used is
+ * measured: the running thread is charged whenever the scheduler picks the
+ * thread to run next, which it then starts timing.
+ */
+
+#include "ut369.h"
+#include "queue.h"
+#include "thread.h"
+#include "schedule.h"
+#include "interrupt.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+
+#define MLFQ_LEVELS 8
+#define MLFQ_QUANTUM (SIG_INTERVAL * 1000LL) /* ns */
+#define MLFQ_BOOST_INTERVAL 50000000LL /* ns */
+
+static fifo_queue_t *levels[MLFQ_LEVELS];
+
+/* Bit i is set if levels[i] is not empty */
+static unsigned nonempty = 0;
+
+/* When threads last returned to the top level, in ns */
+static long long boosted_at = 0;
+
+static long long
+mlfq_now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/* Charge the running thread for the time it ran until now, moving it down a
+ * level once that makes a whole quantum. */
+static void
+mlfq_charge(struct thread *thread, long long now)
+{
+    if (thread->sched.mlfq.since != 0) {
+        thread->sched.mlfq.used += now - thread->sched.mlfq.since;
+    }
+    thread->sched.mlfq.since = now;
+    if (thread->sched.mlfq.used >= MLFQ_QUANTUM) {
+        thread->sched.mlfq.used = 0;
+        if (thread->sched.mlfq.level < MLFQ_LEVELS - 1) {
+            thread->sched.mlfq.level++;
+        }
+    }
+}
+
+/* Charge the running thread and start timing next, which runs instead */
+static void
+mlfq_switch(struct thread *next, long long now)
+{
+    struct thread *current = thread_get(thread_id());
+    if (current != NULL) {
+        mlfq_charge(current, now);
+    }
+    next->sched.mlfq.since = now;
+}
+
+static void
+mlfq_push(struct thread *thread)
+{
+    int ret = queue_push(levels[thread->sched.mlfq.level], thread);
+    assert(ret == 0);
+    (void)ret;
+    nonempty |= 1u << thread->sched.mlfq.level;
+}
+
+/* Move every ready thread to the top level. */
+static void
+mlfq_boost(long long now)
+{
+    for (int i = 1; i < MLFQ_LEVELS; i++) {
+        struct thread *thread;
+        while ((thread = queue_pop(levels[i])) != NULL) {
+            thread->sched.mlfq.level = 0;
+            thread->sched.mlfq.used = 0;
+            mlfq_push(thread);
+        }
+    }
+    nonempty &= 1u;
+    struct thread *current = thread_get(thread_id());
+    if (current != NULL) {
+        current->sched.mlfq.level = 0;
+        current->sched.mlfq.used = 0;
+    }
+    boosted_at = now;
+}
+
+int
+mlfq_init(void)
+{
+    for (int i = 0; i < MLFQ_LEVELS; i++) {
+        levels[i] = queue_create(INT_MAX);
+        if (levels[i] == NULL) {
+            while (i-- > 0) {
+                queue_destroy(levels[i]);
+                levels[i] = NULL;
+            }
+            return THREAD_NOMEMORY;
+        }
+    }
+    nonempty = 0;
+    boosted_at = mlfq_now();
+    return 0;
+}
+
+int
+mlfq_enqueue(struct thread *thread)
+{
+    assert(!interrupt_enabled());
+    mlfq_push(thread);
+    return 0;
+}
+
+struct thread *
+mlfq_dequeue(void)
+{
+    assert(!interrupt_enabled());
+    long long now = mlfq_now();
+    if (now - boosted_at >= MLFQ_BOOST_INTERVAL) {
+        mlfq_boost(now);
+    }
+    if (nonempty == 0) {
+        return NULL;
+    }
+
+    int level = __builtin_ctz(nonempty);
+    struct thread *ret = queue_pop(levels[level]);
+    if (queue_count(levels[level]) == 0) {
+        nonempty &= ~(1u << level);
+    }
+    mlfq_switch(ret, now);
+    return ret;
+}
+
+struct thread *
+mlfq_remove(Tid tid)
+{
+    struct thread *ret = thread_get(tid);
+
+    assert(!interrupt_enabled());
+    if (ret == NULL) {
+        return NULL;
+    }
+    ret = queue_remove(levels[ret->sched.mlfq.level], tid);
+    if (ret == NULL) {
+        return NULL;
+    }
+    if (queue_count(levels[ret->sched.mlfq.level]) == 0) {
+        nonempty &= ~(1u << ret->sched.mlfq.level);
+    }
+    // thread_yield runs it next, and thread_setprio puts it back at once
+    mlfq_switch(ret, mlfq_now());
+    return ret;
+}
+
+void
+mlfq_destroy(void)
+{
+    for (int i = 0; i < MLFQ_LEVELS; i++) {
+        queue_destroy(levels[i]);
+        levels[i] = NULL;
+    }
+    nonempty = 0;
+}
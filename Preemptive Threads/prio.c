@@ -0,0 +1,98 @@
+/*
+ * prio.c
+ *
+ * Implementation of a fixed-priority scheduler: the ready thread with the
+ * highest priority, as set with thread_setprio, always runs first, and
+ * threads of equal priority take turns. A bitmap of the non-empty levels
+ * finds the highest one in constant time.
+ */
+
+#include "ut369.h"
+#include "queue.h"
+#include "thread.h"
+#include "schedule.h"
+#include "interrupt.h"
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <assert.h>
+
+_Static_assert(THREAD_PRIO_LEVELS <= 32, "nonempty has a bit per level");
+
+static fifo_queue_t *levels[THREAD_PRIO_LEVELS];
+
+/* Bit i is set if levels[i] is not empty */
+static uint32_t nonempty = 0;
+
+int
+prio_init(void)
+{
+    for (int i = 0; i < THREAD_PRIO_LEVELS; i++) {
+        levels[i] = queue_create(INT_MAX);
+        if (levels[i] == NULL) {
+            while (i-- > 0) {
+                queue_destroy(levels[i]);
+                levels[i] = NULL;
+            }
+            return THREAD_NOMEMORY;
+        }
+    }
+    nonempty = 0;
+    return 0;
+}
+
+int
+prio_enqueue(struct thread *thread)
+{
+    assert(!interrupt_enabled());
+    assert(thread->prio >= 0 && thread->prio < THREAD_PRIO_LEVELS);
+
+    if (queue_push(levels[thread->prio], thread) < 0) {
+        return THREAD_NOMORE;
+    }
+    nonempty |= UINT32_C(1) << thread->prio;
+    return 0;
+}
+
+struct thread *
+prio_dequeue(void)
+{
+    assert(!interrupt_enabled());
+    if (nonempty == 0) {
+        return NULL;
+    }
+
+    // priority 0 is the highest
+    int level = __builtin_ctz(nonempty);
+    struct thread *ret = queue_pop(levels[level]);
+    if (queue_count(levels[level]) == 0) {
+        nonempty &= ~(UINT32_C(1) << level);
+    }
+    return ret;
+}
+
+struct thread *
+prio_remove(Tid tid)
+{
+    struct thread *ret = thread_get(tid);
+
+    assert(!interrupt_enabled());
+    if (ret == NULL) {
+        return NULL;
+    }
+    ret = queue_remove(levels[ret->prio], tid);
+    if (ret != NULL && queue_count(levels[ret->prio]) == 0) {
+        nonempty &= ~(UINT32_C(1) << ret->prio);
+    }
+    return ret;
+}
+
+void
+prio_destroy(void)
+{
+    for (int i = 0; i < THREAD_PRIO_LEVELS; i++) {
+        queue_destroy(levels[i]);
+        levels[i] = NULL;
+    }
+    nonempty = 0;
+}
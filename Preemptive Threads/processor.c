@@ -0,0 +1,172 @@
+/*
+ * processor.c
+ *
+ * Kernel threads running ut369 threads, and the kernel lock, see
+ * processor.h.
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <assert.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "ut369.h"
+#include "interrupt.h"
+#include "processor.h"
+
+/* Size of the stack the SIGSEGV handler runs on, per processor */
+#define PROCESSOR_ALTSTACK 65536
+
+int nr_processors = 1;
+
+/* Interrupts are disabled until ut369_start enables them */
+struct processor processors[PROCESSOR_MAX] = { [0] = { .disabled = 1 } };
+
+static __thread struct processor *self = &processors[0];
+
+/* The kernel lock. On fewer cores than processors, a processor waiting for it
+ * only runs while the holder does not, so the holder yields its core to the
+ * waiters as it releases it: otherwise one that takes it again at once, as a
+ * thread yielding in a loop does, would almost always hold it, and the others
+ * would not get it for up to hundreds of milliseconds at a time. */
+static atomic_flag kernel = ATOMIC_FLAG_INIT;
+static atomic_int kernel_waiting = 0;   /* processors spinning for it */
+
+/* Set by processor_end, and counts the processors that saw it */
+static atomic_bool stopping = false;
+static atomic_int parked = 0;
+
+/* Not inline, so that the compiler cannot keep the address of self, which
+ * belongs to the kernel thread, across a context switch that may resume the
+ * caller on another one, and not preempted, see interrupt.h. */
+INTERRUPT_NOPREEMPT struct processor *
+processor_self(void)
+{
+	return self;
+}
+
+void processor_init(int n)
+{
+	assert(n >= 1 && n <= PROCESSOR_MAX);
+	nr_processors = n;
+	for (int i = 0; i < n; i++)
+	{
+		memset(&processors[i], 0, sizeof(processors[i]));
+		processors[i].id = i;
+		processors[i].disabled = 1;
+	}
+	self = &processors[0];
+	atomic_store(&stopping, false);
+	atomic_store(&parked, 0);
+}
+
+static void *
+processor_main(void *arg)
+{
+	stack_t altstack;
+
+	self = arg;
+	self->altstack = malloc(PROCESSOR_ALTSTACK);
+	if (self->altstack != NULL)
+	{
+		altstack.ss_sp = self->altstack;
+		altstack.ss_size = PROCESSOR_ALTSTACK;
+		altstack.ss_flags = 0;
+		sigaltstack(&altstack, NULL);
+	}
+	interrupt_start();
+	thread_idle();
+	assert(false);
+	return NULL;
+}
+
+void processor_start(void)
+{
+	for (int i = 1; i < nr_processors; i++)
+	{
+		if (pthread_create(&processors[i].pthread, NULL, processor_main,
+				   &processors[i]) != 0)
+		{
+			perror("pthread_create");
+			abort();
+		}
+	}
+}
+
+void processor_end(void)
+{
+	if (nr_processors == 1)
+	{
+		return;
+	}
+	atomic_store(&stopping, true);
+	for (int spins = 0; atomic_load(&parked) < nr_processors - 1; spins++)
+	{
+		processor_relax(spins);
+	}
+}
+
+void processor_check_stop(void)
+{
+	if (atomic_load_explicit(&stopping, memory_order_relaxed))
+	{
+		atomic_fetch_add(&parked, 1);
+		// exit() ends the process from the processor that stopped us
+		for (;;)
+		{
+			pause();
+		}
+	}
+}
+
+void processor_relax(int spins)
+{
+	if (spins < 64)
+	{
+#if defined(__x86_64__)
+		__builtin_ia32_pause();
+#elif defined(__aarch64__)
+		__asm__ __volatile__("yield");
+#endif
+	}
+	else if (spins < 128)
+	{
+		sched_yield();
+	}
+	else
+	{
+		struct timespec pause = { 0, SIG_INTERVAL * 1000 / 4 };
+		nanosleep(&pause, NULL);
+	}
+}
+
+void kernel_lock(void)
+{
+	if (!atomic_flag_test_and_set_explicit(&kernel, memory_order_acquire))
+	{
+		return;
+	}
+	atomic_fetch_add_explicit(&kernel_waiting, 1, memory_order_relaxed);
+	for (int spins = 0;
+	     atomic_flag_test_and_set_explicit(&kernel, memory_order_acquire);
+	     spins++)
+	{
+		// the holder may be waiting for the CPU we spin on
+		processor_relax(spins < 64 ? spins : 64);
+	}
+	atomic_fetch_sub_explicit(&kernel_waiting, 1, memory_order_relaxed);
+}
+
+void kernel_unlock(void)
+{
+	atomic_flag_clear_explicit(&kernel, memory_order_release);
+	if (atomic_load_explicit(&kernel_waiting, memory_order_relaxed) > 0)
+	{
+		sched_yield();
+	}
+}
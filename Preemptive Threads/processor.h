@@ -0,0 +1,89 @@
+/*
+ * processor.h
+ *
+ * Processors: the kernel threads that ut369 threads run on.
+ *
+ * With config->processors above 1, ut369_start starts a pthread for each
+ * processor but the first, which is the one that called it. A ut369 thread
+ * may run on any processor, and moves between them through the run queues of
+ * the "steal" scheduler, one per processor.
+ *
+ * The state of the library is guarded by a single kernel lock, which a
+ * processor holds whenever it has interrupts disabled, see interrupt.c. Since
+ * every context switch happens with interrupts disabled, the lock passes from
+ * the thread that switches out to the one that switches in, just as disabled
+ * interrupts do on one processor, and all of the library is SMP-safe as it
+ * was made safe from interrupts. Threads run in parallel outside of it.
+ *
+ * This is a big kernel lock: every thread operation, lock and condition
+ * variable included, takes it, so only threads that compute without calling
+ * into the library can gain from more processors, see test/speedup.c.
+ * Programs that synchronize often run no faster than on one, and somewhat
+ * slower on fewer cores than processors, see test/contention.c. There are no
+ * per-object locks, and the run queues are not Chase-Lev deques: each take
+ * claims its entry with a CAS, the owner's too, see steal.c.
+ *
+ * A processor with no thread to run keeps interrupts disabled, but without
+ * the lock, and looks for a thread to steal, see thread_idle().
+ */
+
+#ifndef _PROCESSOR_H_
+#define _PROCESSOR_H_
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+#include "thread.h"
+
+#define PROCESSOR_MAX 64
+
+struct processor
+{
+	int id;
+	struct thread *running;           /* thread running on it */
+	struct thread idle;               /* its context while in thread_idle */
+	volatile sig_atomic_t disabled;   /* interrupts, see interrupt.c */
+	volatile sig_atomic_t pending;
+	timer_t timer;                    /* if there are several processors */
+	void *stack_to_free;              /* of the thread that exited last */
+	size_t stack_to_free_size;
+	long long charged_at;             /* see thread_account */
+	void *altstack;                   /* for the SIGSEGV handler */
+	pthread_t pthread;
+} __attribute__((aligned(64)));
+
+extern int nr_processors;
+extern struct processor processors[PROCESSOR_MAX];
+
+/* Return the processor running the caller. A ut369 thread may continue on
+ * another processor after any context switch, so the result must not be
+ * kept across one. */
+struct processor *processor_self(void);
+
+/* Set up n processors, the calling thread being the first. */
+void processor_init(int n);
+
+/* Start the pthreads of the other processors, which wait in thread_idle for
+ * threads to run. */
+void processor_start(void);
+
+/* Stop the other processors, which must be idle. Called by ut369_end before
+ * the threads and the scheduler are freed from under them. */
+void processor_end(void);
+
+/* Park the calling processor for good if processor_end is stopping it. */
+void processor_check_stop(void);
+
+/* Wait a little longer each time, spins being the number of times so far. */
+void processor_relax(int spins);
+
+/* The kernel lock. Taken and released through interrupt_set() but by the
+ * idle loop, which keeps interrupts disabled while it does not hold it. A
+ * processor that releases it while others wait for it yields its core to
+ * them, see processor.c. */
+void kernel_lock(void);
+void kernel_unlock(void);
+
+#endif /* _PROCESSOR_H_ */
@@ -23,19 +23,12 @@ void node_init(node_item_t *node, int id)
     (*node).id = id;
     (*node).next = NULL;
     (*node).prev = NULL;
-    (*node).in_or_not = 0;
+    (*node).in_queue = NULL;
 }
 
 bool node_in_queue(node_item_t *node)
 {
-    if ((*node).in_or_not == 1)
-    {
-        return true;
-    }
-    else
-    {
-        return false;
-    }
+    return (*node).in_queue != NULL;
 }
 
 fifo_queue_t *queue_create(unsigned capacity)
@@ -54,6 +47,7 @@ fifo_queue_t *queue_create(unsigned capacity)
     new_queue->tail = NULL;
     new_queue->capacity = capacity;
     new_queue->size = 0;
+    new_queue->owner = NULL;
 
     return new_queue;
 }
@@ -75,7 +69,7 @@ node_item_t *queue_pop(fifo_queue_t *queue)
     node_item_t *item = (*queue).head;
     (*queue).head = (*queue).head->next;
     (*queue).size--;
-    (*item).in_or_not = 0;
+    (*item).in_queue = NULL;
     if ((*queue).size > 0)
     {
         (*queue).head->prev = NULL;
@@ -124,44 +118,41 @@ int queue_push(fifo_queue_t *queue, node_item_t *node)
         (*queue).tail = node;
     }
     (*queue).size++;
-    (*node).in_or_not = 1;
+    (*node).in_queue = queue;
     return 0;
 }
 
 node_item_t *queue_remove(fifo_queue_t *queue, int id)
 {
+    // The node knows which queue it is in, so there is no need to search
+    node_item_t *start = thread_get(id);
+    if (start == NULL || start->in_queue != queue)
+    {
+        return NULL;
+    }
 
-    node_item_t *start = queue->head;
-    while (start != NULL)
+    if (start->prev != NULL)
+    {
+        start->prev->next = start->next;
+    }
+    else
     {
-        if (start->id == id)
-        {
-            if (start->prev != NULL)
-            {
-                start->prev->next = start->next;
-            }
-            else
-            {
-                queue->head = start->next;
-            }
-            if (start->next != NULL)
-            {
-                start->next->prev = start->prev;
-            }
-            else
-            {
-                queue->tail = start->prev;
-            }
-            start->in_or_not = 0;
-            (*queue).size--;
-
-            start->prev = NULL;
-            start->next = NULL;
-            return start;
-        }
-        start = start->next;
+        queue->head = start->next;
     }
-    return NULL;
+    if (start->next != NULL)
+    {
+        start->next->prev = start->prev;
+    }
+    else
+    {
+        queue->tail = start->prev;
+    }
+    start->in_queue = NULL;
+    (*queue).size--;
+
+    start->prev = NULL;
+    start->next = NULL;
+    return start;
 }
 
 int queue_count(fifo_queue_t *queue)
@@ -64,6 +64,8 @@ int queue_push(fifo_queue_t * queue, node_item_t * node);
  * Return the node in the queue with the specified id and removes it from the queue.
  * You may assume all ids in a queue are unique.
  * Return NULL if no node in the queue has the specified id.
+ * Takes constant time: the node is the thread with that id, which records
+ * the queue it is in.
  */
 node_item_t * queue_remove(fifo_queue_t * queue, int id);
 
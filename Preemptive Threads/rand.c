@@ -11,16 +11,21 @@
 #include <stdlib.h>
 #include <assert.h>
 
+/* Initial capacity of the ready queue, which doubles whenever it is full */
+#define RAND_MIN_CAPACITY 64
+
 static struct thread ** prio_queue = NULL;
+static int capacity = 0;
 static int count = 0;
 
 int 
 rand_init(void)
 {
-    prio_queue = malloc(sizeof(struct thread *)*THREAD_MAX_THREADS);
+    prio_queue = malloc(sizeof(struct thread *)*RAND_MIN_CAPACITY);
     count = 0;
     
     if (prio_queue != NULL) {
+        capacity = RAND_MIN_CAPACITY;
         return 0;
     }
     else {
@@ -33,11 +38,18 @@ rand_enqueue(struct thread * thread)
 {
     assert(!interrupt_enabled());
     
-    if (count >= THREAD_MAX_THREADS) {
-        return THREAD_NOMORE;
+    if (count >= capacity) {
+        struct thread ** grown = realloc(prio_queue,
+                                         sizeof(struct thread *)*capacity*2);
+        if (grown == NULL) {
+            return THREAD_NOMEMORY;
+        }
+        prio_queue = grown;
+        capacity *= 2;
     }
 
     prio_queue[count++] = thread;
+    thread->sched.rand.slot = count;
     return 0;
 }
 
@@ -57,6 +69,8 @@ rand_dequeue(void)
     
     // override rq[i] with last element
     prio_queue[i] = prio_queue[--count];
+    prio_queue[i]->sched.rand.slot = i + 1;
+    ret->sched.rand.slot = 0;
 
     return ret;
 }
@@ -64,22 +78,21 @@ rand_dequeue(void)
 struct thread *
 rand_remove(Tid tid)
 {
-    struct thread * ret = NULL;
+    struct thread * ret = thread_get(tid);
     int i;
 
     assert(!interrupt_enabled());
-    for (i = 0; i < count; i++) {
-        if (prio_queue[i]->id == tid) {
-            ret = prio_queue[i];
-            break;
-        }
+    // each thread knows its position in the queue, if it is in it
+    if (ret == NULL || ret->sched.rand.slot == 0) {
+        return NULL;
     }
+    i = ret->sched.rand.slot - 1;
+    assert(i < count && prio_queue[i] == ret);
 
-    // override rq[i] with last element (if found)
-    if (ret != NULL) {  
-        assert(count > 0);
-        prio_queue[i] = prio_queue[--count];
-    }
+    // override rq[i] with last element
+    prio_queue[i] = prio_queue[--count];
+    prio_queue[i]->sched.rand.slot = i + 1;
+    ret->sched.rand.slot = 0;
 
     return ret;
 }
@@ -89,4 +102,6 @@ rand_destroy(void)
 {
     free(prio_queue);
     prio_queue = NULL;
+    capacity = 0;
+    count = 0;
 }
\ No newline at end of file
@@ -14,7 +14,11 @@ struct thread;
 
 #define SCHEDULERS \
     S(rand) \
-    S(fcfs) 
+    S(fcfs) \
+    S(mlfq) \
+    S(prio) \
+    S(cfs) \
+    S(steal)
 
 #define S(name) \
     int name ## _init(void); \
@@ -34,8 +38,8 @@ struct scheduler {
      */
     int (* init)(void);
 
-    /* add a thread to the scheduler's ready queue. Returns 0 on success,
-     * THREAD_NOMORE upon error, e.g., ready queue is full. 
+    /* add a thread to the scheduler's ready queue, which grows as needed.
+     * Returns 0 on success, THREAD_NOMEMORY if it cannot grow.
      */
     int (* enqueue)(struct thread *);
 
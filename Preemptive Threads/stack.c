@@ -0,0 +1,179 @@
+/*
+ * stack.c
+ *
+ * Guarded, pooled thread stacks, see stack.h.
+ */
+#include <assert.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "ut369.h"
+#include "stack.h"
+
+/* Number of distinct stack sizes that are pooled, and how many stacks of each
+ * are kept. Stacks of other sizes, or beyond a full pool, are unmapped. The
+ * first STACK_POOL_RESIDENT stacks freed to a pool keep their pages, so that a
+ * thread exiting just before another is created costs no system call. */
+#define STACK_POOL_SIZES 8
+#define STACK_POOL_MAX 64
+#define STACK_POOL_RESIDENT 4
+
+struct stack_pool
+{
+	size_t size;	/* 0 if the slot is unused */
+	void *head;	/* base of the most recently freed stack */
+	int count;
+};
+
+static struct stack_pool pools[STACK_POOL_SIZES];
+static unsigned long pool_hits;
+
+static size_t
+page_size(void)
+{
+	static size_t size = 0;
+
+	if (size == 0)
+	{
+		size = sysconf(_SC_PAGESIZE);
+	}
+	return size;
+}
+
+/* A pooled stack links to the next one through the last word of its top page,
+ * which is left resident: MADV_FREE may zero the others. */
+static void **
+stack_link(void *base, size_t size)
+{
+	return (void **)((char *)base + size) - 1;
+}
+
+static struct stack_pool *
+stack_pool_get(size_t size, bool create)
+{
+	struct stack_pool *unused = NULL;
+
+	for (int i = 0; i < STACK_POOL_SIZES; i++)
+	{
+		if (pools[i].size == size)
+		{
+			return &pools[i];
+		}
+		if (pools[i].size == 0 && unused == NULL)
+		{
+			unused = &pools[i];
+		}
+	}
+	if (create && unused)
+	{
+		unused->size = size;
+	}
+	return create ? unused : NULL;
+}
+
+size_t
+stack_round(size_t size)
+{
+	const size_t page = page_size();
+
+	if (size < THREAD_MIN_STACK)
+	{
+		size = THREAD_MIN_STACK;
+	}
+	if (size > SIZE_MAX - 2 * page)
+	{
+		return 0;
+	}
+	return (size + page - 1) & ~(page - 1);
+}
+
+void *
+stack_alloc(size_t size)
+{
+	const size_t page = page_size();
+	struct stack_pool *pool = stack_pool_get(size, false);
+
+	assert(size > 0 && size % page == 0);
+	if (pool && pool->head)
+	{
+		void *base = pool->head;
+
+		pool->head = *stack_link(base, size);
+		pool->count--;
+		pool_hits++;
+		return base;
+	}
+
+	char *map = mmap(NULL, size + page, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+	if (map == MAP_FAILED)
+	{
+		return NULL;
+	}
+	// Stacks grow down, towards the guard page
+	if (mprotect(map, page, PROT_NONE) != 0)
+	{
+		munmap(map, size + page);
+		return NULL;
+	}
+	return map + page;
+}
+
+unsigned long
+stack_pool_hits(void)
+{
+	return pool_hits;
+}
+
+void
+stack_free(void *base, size_t size)
+{
+	const size_t page = page_size();
+	struct stack_pool *pool = stack_pool_get(size, true);
+
+	if (pool == NULL || pool->count == STACK_POOL_MAX)
+	{
+		munmap((char *)base - page, size + page);
+		return;
+	}
+
+	// Keep the address space, but let the kernel reclaim the pages
+	if (pool->count >= STACK_POOL_RESIDENT)
+	{
+#ifdef MADV_FREE
+		madvise(base, size - page, MADV_FREE);
+#else
+		madvise(base, size - page, MADV_DONTNEED);
+#endif
+	}
+	*stack_link(base, size) = pool->head;
+	pool->head = base;
+	pool->count++;
+}
+
+bool
+stack_in_guard(const void *base, const void *addr)
+{
+	const uintptr_t low = (uintptr_t)base - page_size();
+
+	return (uintptr_t)addr >= low && (uintptr_t)addr < (uintptr_t)base;
+}
+
+void
+stack_end(void)
+{
+	for (int i = 0; i < STACK_POOL_SIZES; i++)
+	{
+		struct stack_pool *pool = &pools[i];
+
+		while (pool->head)
+		{
+			void *base = pool->head;
+
+			pool->head = *stack_link(base, pool->size);
+			munmap((char *)base - page_size(), pool->size + page_size());
+		}
+		pool->size = 0;
+		pool->count = 0;
+	}
+}
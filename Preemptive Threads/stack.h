@@ -0,0 +1,38 @@
+/*
+ * stack.h
+ *
+ * Thread stacks, mapped with mmap below a PROT_NONE guard page so that an
+ * overflow faults instead of silently corrupting whatever lies below. Freed
+ * stacks are kept in a pool per size and reused by later threads, with their
+ * pages handed back to the kernel with MADV_FREE in the meantime.
+ */
+
+#ifndef _STACK_H_
+#define _STACK_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Round size up to the stack size actually allocated for it: a whole number
+ * of pages, at least THREAD_MIN_STACK. */
+size_t stack_round(size_t size);
+
+/* Return the lowest usable address of a stack of size bytes, which must be
+ * the result of stack_round(), or NULL if it cannot be mapped. */
+void *stack_alloc(size_t size);
+
+/* Return a stack from stack_alloc() to its pool, or unmap it if the pool is
+ * full. */
+void stack_free(void *base, size_t size);
+
+/* Return whether addr lies in the guard page of the stack at base. */
+bool stack_in_guard(const void *base, const void *addr);
+
+/* Return how many stacks stack_alloc() has taken from a pool rather than
+ * mapped. */
+unsigned long stack_pool_hits(void);
+
+/* Unmap all the pooled stacks. */
+void stack_end(void);
+
+#endif /* _STACK_H_ */
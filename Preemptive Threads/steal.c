@@ -0,0 +1,210 @@
+/*
+ * steal.c
+ *
+ * Implementation of a work-stealing scheduler, with a run queue per
+ * processor, see processor.h.
+ *
+ * A thread made ready goes to the run queue of the processor that made it
+ * ready, and a processor runs the threads of its own queue first, oldest
+ * first. Once that is empty, it steals the oldest thread of another queue.
+ *
+ * Each queue is an array used as a ring, which only its owner pushes to, at
+ * the bottom, and which the owner and the thieves alike take from at the
+ * top, oldest first for round-robin order. Every take claims the top with a
+ * compare-and-swap, so an idle processor can steal without the kernel lock.
+ * This is the stealing half of a Chase-Lev deque, without the owner's cheaper
+ * pop at the bottom, which would run the newest thread first. A full queue
+ * grows into a larger array. The arrays it outgrew are kept until
+ * steal_destroy, since a thief may still be reading one.
+ *
+ * A thread cannot be taken out of the middle of a queue, so removing it by
+ * tid only clears its queued flag and leaves its entry behind. A take that
+ * finds the flag of its thread already clear skips it, and only the take
+ * that clears it runs the thread. Until some take reaches it, the entry also
+ * keeps the in_queue flag of its thread set, and steal_enqueue then sets the
+ * queued flag again instead of pushing another entry, so that the thread
+ * keeps its old place. A thread thus has at most one entry, and removing and
+ * enqueuing it over and over, as thread_setprio does, cannot grow a queue.
+ * Only the entry of a reused thread structure, which thread_create zeroes,
+ * is left over beyond that, one per reuse, until a take reaches it. The
+ * thread structures stay allocated until ut369_end for their sake.
+ */
+
+#include "ut369.h"
+#include "thread.h"
+#include "schedule.h"
+#include "interrupt.h"
+#include "processor.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <assert.h>
+
+/* Initial size of each queue, a power of two */
+#define STEAL_MIN_SIZE 64
+
+struct steal_array {
+    long size;
+    struct steal_array *retired;   /* array this one replaced */
+    _Atomic(struct thread *) slots[];
+};
+
+struct steal_queue {
+    atomic_long top;               /* next slot to take */
+    atomic_long bottom;            /* next slot to push, owner only */
+    _Atomic(struct steal_array *) array;
+} __attribute__((aligned(64)));
+
+static struct steal_queue queues[PROCESSOR_MAX];
+
+static struct steal_array *
+steal_array_create(long size)
+{
+    struct steal_array *array = malloc(sizeof(*array) +
+                                       size * sizeof(array->slots[0]));
+    if (array != NULL) {
+        array->size = size;
+        array->retired = NULL;
+    }
+    return array;
+}
+
+static void
+steal_push(struct steal_queue *queue, struct thread *thread)
+{
+    long bottom = atomic_load_explicit(&queue->bottom, memory_order_relaxed);
+    long top = atomic_load_explicit(&queue->top, memory_order_acquire);
+    struct steal_array *array = atomic_load_explicit(&queue->array,
+                                                     memory_order_relaxed);
+
+    if (bottom - top >= array->size) {
+        struct steal_array *grown = steal_array_create(array->size * 2);
+        assert(grown != NULL);
+        for (long i = top; i < bottom; i++) {
+            atomic_store_explicit(&grown->slots[i & (grown->size - 1)],
+                atomic_load_explicit(&array->slots[i & (array->size - 1)],
+                                     memory_order_relaxed),
+                memory_order_relaxed);
+        }
+        grown->retired = array;
+        atomic_store_explicit(&queue->array, grown, memory_order_release);
+        array = grown;
+    }
+    atomic_store_explicit(&array->slots[bottom & (array->size - 1)], thread,
+                          memory_order_relaxed);
+    atomic_store_explicit(&queue->bottom, bottom + 1, memory_order_release);
+}
+
+/* Take the oldest entry of queue, or return NULL if it is empty */
+static struct thread *
+steal_take(struct steal_queue *queue)
+{
+    for (;;) {
+        long top = atomic_load_explicit(&queue->top, memory_order_acquire);
+        atomic_thread_fence(memory_order_seq_cst);
+        long bottom = atomic_load_explicit(&queue->bottom,
+                                           memory_order_acquire);
+        if (top >= bottom) {
+            return NULL;
+        }
+
+        struct steal_array *array = atomic_load_explicit(&queue->array,
+                                                         memory_order_acquire);
+        struct thread *thread = atomic_load_explicit(
+            &array->slots[top & (array->size - 1)], memory_order_relaxed);
+        if (atomic_compare_exchange_strong_explicit(&queue->top, &top,
+                                                    top + 1,
+                                                    memory_order_seq_cst,
+                                                    memory_order_relaxed)) {
+            return thread;
+        }
+        // another processor took it first
+    }
+}
+
+/* Clear the queued flag of thread, returning whether it was set */
+static bool
+steal_claim(struct thread *thread)
+{
+    bool queued = true;
+    return atomic_compare_exchange_strong(&thread->sched.steal.queued,
+                                          &queued, false);
+}
+
+int
+steal_init(void)
+{
+    for (int i = 0; i < nr_processors; i++) {
+        struct steal_array *array = steal_array_create(STEAL_MIN_SIZE);
+        if (array == NULL) {
+            while (i-- > 0) {
+                free(atomic_load(&queues[i].array));
+            }
+            return THREAD_NOMEMORY;
+        }
+        atomic_store(&queues[i].top, 0);
+        atomic_store(&queues[i].bottom, 0);
+        atomic_store(&queues[i].array, array);
+    }
+    return 0;
+}
+
+int
+steal_enqueue(struct thread *thread)
+{
+    assert(!interrupt_enabled());
+
+    atomic_store(&thread->sched.steal.queued, true);
+    // seen after queued is set, or the take of its entry finds queued set
+    if (!atomic_load(&thread->sched.steal.in_queue)) {
+        atomic_store(&thread->sched.steal.in_queue, true);
+        steal_push(&queues[processor_self()->id], thread);
+    }
+    return 0;
+}
+
+struct thread *
+steal_dequeue(void)
+{
+    int self = processor_self()->id;
+
+    assert(!interrupt_enabled());
+    for (int i = 0; i < nr_processors; i++) {
+        struct steal_queue *queue = &queues[(self + i) % nr_processors];
+        struct thread *thread;
+
+        while ((thread = steal_take(queue)) != NULL) {
+            atomic_store(&thread->sched.steal.in_queue, false);
+            if (steal_claim(thread)) {
+                return thread;
+            }
+            // left behind by steal_remove
+        }
+    }
+    return NULL;
+}
+
+struct thread *
+steal_remove(Tid tid)
+{
+    struct thread *ret = thread_get(tid);
+
+    assert(!interrupt_enabled());
+    if (ret == NULL || !steal_claim(ret)) {
+        return NULL;
+    }
+    return ret;
+}
+
+void
+steal_destroy(void)
+{
+    for (int i = 0; i < nr_processors; i++) {
+        struct steal_array *array = atomic_load(&queues[i].array);
+        while (array != NULL) {
+            struct steal_array *retired = array->retired;
+            free(array);
+            array = retired;
+        }
+        atomic_store(&queues[i].array, NULL);
+    }
+}
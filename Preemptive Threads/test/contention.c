@@ -0,0 +1,105 @@
+#include "test.h"
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Threads take turns under a lock, spinning while they hold it and waking
+ * each other with cv_broadcast, as in the broadcast test, while the main
+ * thread yields in a loop until they are done. This runs once on one
+ * processor and once on the number given on the command line, each in a
+ * process of its own since ut369_start can only be called once. The threads
+ * mostly wait for each other, so more processors cannot make it faster, but
+ * they must not make it three times slower either, even on fewer cores than
+ * processors: the kernel lock must not keep a processor from the others. It
+ * takes about twice as long on one core, from the lock changing hands. */
+
+#define NTHREADS 32
+#define LOOPS 4
+#define WAKE_DELAY 1000 /* time each thread holds the lock, in us */
+
+static struct lock *lock;
+static struct cv *wake;
+static volatile long turn;
+static int done;
+
+static int
+test_turn_thread(long num)
+{
+	int i;
+
+	for (i = 0; i < LOOPS; i++) {
+		lock_acquire(lock);
+		while (turn != num)
+			cv_wait(wake);
+		turn = (turn + 1) % NTHREADS;
+		spin(WAKE_DELAY);
+		cv_broadcast(wake);
+		lock_release(lock);
+	}
+	__atomic_add_fetch(&done, 1, __ATOMIC_SEQ_CST);
+	return 0;
+}
+
+/* Run the threads on the given number of processors in a child process, and
+ * return how long it took, in us. */
+static long
+test_run(int processors)
+{
+	struct timeval start, end, diff;
+	Tid tids[NTHREADS];
+	int status;
+	long i;
+
+	fflush(stdout);
+	gettimeofday(&start, NULL);
+	pid_t pid = fork();
+	assert(pid >= 0);
+	if (pid == 0) {
+		struct config config = {
+			.sched_name = "steal", .preemptive = true,
+			.verbose = false, .processors = processors
+		};
+		ut369_start(&config);
+
+		lock = lock_create();
+		wake = cv_create(lock);
+		for (i = 0; i < NTHREADS; i++) {
+			tids[i] = thread_create((thread_entry_f)test_turn_thread,
+						(void *)i);
+			assert(thread_ret_ok(tids[i]));
+		}
+		while (__atomic_load_n(&done, __ATOMIC_SEQ_CST) < NTHREADS)
+			thread_yield(THREAD_ANY);
+		for (i = 0; i < NTHREADS; i++)
+			assert(thread_wait(tids[i], NULL) == tids[i]);
+		cv_destroy(wake);
+		lock_destroy(lock);
+		exit(EXIT_SUCCESS);
+	}
+	assert(waitpid(pid, &status, 0) == pid);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+	gettimeofday(&end, NULL);
+	timersub(&end, &start, &diff);
+	return diff.tv_sec * 1000000 + diff.tv_usec;
+}
+
+int
+main(int argc, const char *argv[])
+{
+	int processors = argc == 2 ? atoi(argv[1]) : 2;
+	if (argc > 2 || processors < 1) {
+		fprintf(stderr, "usage: %s [processors]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	printf("starting contention test with %d\n", processors);
+
+	long one = test_run(1);
+	printf("%d turns on 1 processor: %ld ms\n", NTHREADS * LOOPS,
+	       one / 1000);
+	long several = test_run(processors);
+	printf("%d turns on %d processors: %ld ms\n", NTHREADS * LOOPS,
+	       processors, several / 1000);
+	assert(several < one * 3);
+
+	printf("contention test done\n");
+	return 0;
+}
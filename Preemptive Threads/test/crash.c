@@ -180,6 +180,32 @@ test_wakeup_interrupt_enabled(void)
     return 0;
 }
 
+/* Recurse far past the end of the stack, keeping each frame from being
+ * optimized away */
+static int
+new_thread_overflow(int depth)
+{
+    volatile char frame[1024];
+
+    frame[0] = depth;
+    if (depth == 1 << 20)
+        return 0;
+    return new_thread_overflow(depth + 1) + frame[0];
+}
+
+int
+test_stack_overflow(void)
+{
+    int ret = thread_create((thread_entry_f) new_thread_overflow, 0);
+    thread_expect(ret >= 0);
+
+    // Should just crash, on the guard page of the new thread
+    thread_wait(ret, NULL);
+
+    // Test failed if it didn't crash
+    return 0;
+}
+
 testcase_t test_case[] = {
     { "Lock Destroy - Held by thread", test_lock_destroy_held_by_thread },
     { "Lock Destroy - CV associated", test_lock_destroy_cv_associated },
@@ -189,6 +215,7 @@ testcase_t test_case[] = {
     { "CV Destroy - Queue not empty", test_cv_wait_queue_not_empty },
     { "Thread Sleep - Interrupt enabled", test_sleep_interrupt_enabled },
     { "Thread Wakeup - Interrupt enabled", test_wakeup_interrupt_enabled },
+    { "Thread Stack - Overflow", test_stack_overflow },
 };
 
 int nr_cases = sizeof(test_case) / sizeof(struct _tc);
@@ -0,0 +1,117 @@
+#include "test.h"
+#include <string.h>
+
+/* CPU-bound threads compute without ever yielding, under the scheduler given
+ * on the command line. First they all have the same priority and
+ * thread_stats reports how evenly they shared the processor. Then half of
+ * them get a higher priority, which "cfs" should turn into a share about
+ * WEIGHT_RATIO times larger. */
+
+#define NTHREADS 8
+#define DURATION 1000000 /* us */
+#define HIGH_PRIO (THREAD_PRIO_DEFAULT - 4)
+#define WEIGHT_RATIO (2501.0 / 1024) /* cfs weights of HIGH_PRIO and default */
+
+static volatile int stop;
+static struct timeval start;
+static long loops[NTHREADS];
+
+static long
+elapsed_us(void)
+{
+	struct timeval now, diff;
+
+	gettimeofday(&now, NULL);
+	timersub(&now, &start, &diff);
+	return diff.tv_sec * 1000000 + diff.tv_usec;
+}
+
+static int
+test_fair_thread(long num)
+{
+	while (!stop) {
+		spin(100);
+		loops[num]++;
+	}
+	return 0;
+}
+
+/* Run NTHREADS threads, the first high of them with HIGH_PRIO, while the
+ * main thread computes alongside them for DURATION */
+static void
+test_fair_run(Tid *tids, int high, struct thread_stats *stats)
+{
+	int i;
+
+	stop = 0;
+	memset(loops, 0, sizeof(loops));
+	gettimeofday(&start, NULL);
+	for (i = 0; i < NTHREADS; i++) {
+		tids[i] = thread_create((thread_entry_f)test_fair_thread,
+					(void *)(long)i);
+		assert(thread_ret_ok(tids[i]));
+		if (i < high)
+			assert(thread_setprio(tids[i], HIGH_PRIO) == tids[i]);
+	}
+
+	while (elapsed_us() < DURATION)
+		spin(100);
+	assert(thread_stats(stats) == 0);
+	stop = 1;
+	for (i = 0; i < NTHREADS; i++)
+		assert(thread_wait(tids[i], NULL) == tids[i]);
+}
+
+int
+main(int argc, const char *argv[])
+{
+	struct thread_stats stats;
+	Tid tids[NTHREADS];
+	long high = 0, low = 0;
+	int i;
+
+	if (argc > 2) {
+		fprintf(stderr, "usage: %s [rand|fcfs|mlfq|prio|cfs]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	const char *sched = argc == 2 ? argv[1] : "cfs";
+	bool cfs = strcmp(sched, "cfs") == 0;
+	printf("starting fair test with %s\n", sched);
+
+	struct config config = {
+		.sched_name = sched, .preemptive = true, .verbose = false,
+		.stats = true
+	};
+	ut369_start(&config);
+
+	test_fair_run(tids, 0, &stats);
+	unintr_printf("%s: %d threads ran %lld to %lld ms, fairness %.2f\n",
+		      sched, stats.threads, stats.min_runtime / 1000000,
+		      stats.max_runtime / 1000000, stats.fairness);
+	assert(stats.threads == NTHREADS + 1);
+	if (cfs)
+		assert(stats.fairness > 0.0 && stats.fairness < 1.5);
+
+	/* under prio, the main thread would never run again to end the test */
+	if (strcmp(sched, "prio") == 0) {
+		unintr_printf("fair test done\n");
+		return 0;
+	}
+	test_fair_run(tids, NTHREADS / 2, &stats);
+	for (i = 0; i < NTHREADS; i++) {
+		if (i < NTHREADS / 2)
+			high += loops[i];
+		else
+			low += loops[i];
+	}
+
+	double ratio = low > 0 ? (double)high / low : 0.0;
+	unintr_printf("%s: priority %d ran %.2f times as long as %d, "
+		      "cfs weights %.2f\n", sched, HIGH_PRIO, ratio,
+		      THREAD_PRIO_DEFAULT, WEIGHT_RATIO);
+	if (cfs)
+		assert(ratio > WEIGHT_RATIO * 0.75 && ratio < WEIGHT_RATIO * 1.25);
+
+	unintr_printf("fair test done\n");
+	return 0;
+}
@@ -0,0 +1,132 @@
+#include "test.h"
+#include <string.h>
+
+/* CPU-bound threads compute without ever yielding, while interactive threads
+ * do a little work and yield. Measures how long interactive threads wait to
+ * run again after yielding, under the scheduler given on the command line. */
+
+#define NCPU 8
+#define NINTERACTIVE 4
+#define DURATION 2000000 /* us */
+#define WORK 20 /* us of work between yields */
+
+#define BUCKET 10 /* us */
+#define NBUCKETS 2000
+
+static volatile int stop;
+static int nr_interactive_done;
+static long cpu_loops[NCPU];
+
+static long nr_samples;
+static long total_us;
+static long max_us;
+static long histogram[NBUCKETS];
+
+static long
+elapsed_us(const struct timeval *from)
+{
+	struct timeval now, diff;
+
+	gettimeofday(&now, NULL);
+	timersub(&now, from, &diff);
+	return diff.tv_sec * 1000000 + diff.tv_usec;
+}
+
+static int
+test_cpu_thread(long num)
+{
+	while (!stop) {
+		spin(100);
+		cpu_loops[num]++;
+	}
+	return 0;
+}
+
+static int
+test_interactive_thread(void)
+{
+	struct timeval start, yielded;
+
+	gettimeofday(&start, NULL);
+	while (elapsed_us(&start) < DURATION) {
+		spin(WORK);
+		gettimeofday(&yielded, NULL);
+		thread_yield(THREAD_ANY);
+		long us = elapsed_us(&yielded);
+
+		int enabled = interrupt_off();
+		nr_samples++;
+		total_us += us;
+		if (us > max_us)
+			max_us = us;
+		histogram[us / BUCKET < NBUCKETS ? us / BUCKET : NBUCKETS - 1]++;
+		interrupt_set(enabled);
+	}
+	if (__sync_add_and_fetch(&nr_interactive_done, 1) == NINTERACTIVE)
+		stop = 1;
+	return 0;
+}
+
+/* smallest latency that at least fraction of the samples did not exceed */
+static long
+percentile(double fraction)
+{
+	long seen = 0;
+	int i;
+
+	for (i = 0; i < NBUCKETS - 1; i++) {
+		seen += histogram[i];
+		if (seen >= fraction * nr_samples)
+			break;
+	}
+	return (i + 1) * BUCKET;
+}
+
+int
+main(int argc, const char *argv[])
+{
+	Tid cpu[NCPU], interactive[NINTERACTIVE];
+	long loops = 0;
+	int i;
+
+	if (argc > 2) {
+		fprintf(stderr, "usage: %s [rand|fcfs|mlfq|prio|cfs]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	const char *sched = argc == 2 ? argv[1] : "fcfs";
+	printf("starting latency test with %s\n", sched);
+
+	struct config config = {
+		.sched_name = sched, .preemptive = true, .verbose = false
+	};
+	ut369_start(&config);
+
+	for (i = 0; i < NCPU; i++) {
+		cpu[i] = thread_create((thread_entry_f)test_cpu_thread,
+				       (void *)(long)i);
+		assert(thread_ret_ok(cpu[i]));
+	}
+	for (i = 0; i < NINTERACTIVE; i++) {
+		interactive[i] = thread_create(
+			(thread_entry_f)test_interactive_thread, NULL);
+		assert(thread_ret_ok(interactive[i]));
+		/* only the prio scheduler is told which threads these are */
+		assert(thread_setprio(interactive[i], 0) == interactive[i]);
+	}
+
+	for (i = 0; i < NINTERACTIVE; i++)
+		assert(thread_wait(interactive[i], NULL) == interactive[i]);
+	for (i = 0; i < NCPU; i++) {
+		assert(thread_wait(cpu[i], NULL) == cpu[i]);
+		loops += cpu_loops[i];
+	}
+
+	unintr_printf("%s: %ld yields, wait to run again: mean %ld us, "
+		      "p50 %ld us, p99 %ld us, max %ld us\n", sched,
+		      nr_samples, nr_samples ? total_us / nr_samples : 0,
+		      percentile(0.5), percentile(0.99), max_us);
+	unintr_printf("%s: cpu-bound threads ran %ld ms\n", sched,
+		      loops / 10);
+	unintr_printf("latency test done\n");
+	return 0;
+}
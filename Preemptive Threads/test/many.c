@@ -0,0 +1,68 @@
+#include "test.h"
+
+/* well past THREAD_MAX_THREADS, but with two mappings per thread stack still
+ * under the default vm.max_map_count of 65530 */
+#define NTHREADS 20000
+
+static Tid child[NTHREADS];
+static int nr_done;
+
+static int
+test_many_thread(long num)
+{
+	/* everyone runs at least once more after all have been created */
+	thread_yield(THREAD_ANY);
+	nr_done++;
+	return (int)num;
+}
+
+int
+main()
+{
+	struct timeval start, end, diff;
+	int exit_code;
+	Tid ret;
+	int i;
+
+	printf("starting many test\n");
+
+	struct config config = {
+		.sched_name = "fcfs", .preemptive = false, .verbose = false,
+		.max_threads = NTHREADS + 1,
+	};
+	ut369_start(&config);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < NTHREADS; i++) {
+		child[i] = thread_create((thread_entry_f)test_many_thread,
+					 (void *)(long)i);
+		assert(thread_ret_ok(child[i]));
+	}
+	gettimeofday(&end, NULL);
+	timersub(&end, &start, &diff);
+
+	/* the limit includes the main thread */
+	ret = thread_create((thread_entry_f)test_many_thread, NULL);
+	assert(ret == THREAD_NOMORE);
+
+	/* wait in reverse, so that most waits sleep until the thread exits */
+	for (i = NTHREADS - 1; i >= 0; i--) {
+		ret = thread_wait(child[i], &exit_code);
+		assert(ret == child[i]);
+		assert(exit_code == i);
+	}
+	assert(nr_done == NTHREADS);
+	unintr_printf("%d threads created in %ld.%06ld s\n", NTHREADS,
+		      (long)diff.tv_sec, (long)diff.tv_usec);
+
+	/* the tid waited for last is reused first */
+	ret = thread_create((thread_entry_f)test_many_thread, NULL);
+	assert(ret == child[0]);
+	ret = thread_create((thread_entry_f)test_many_thread, NULL);
+	assert(ret == child[1]);
+
+	unintr_printf("many test done\n");
+	thread_exit(0);
+	assert(false);
+	return 0;
+}
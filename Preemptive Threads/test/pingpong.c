@@ -0,0 +1,55 @@
+#include "test.h"
+
+/* two threads yield to each other; every yield is one context switch */
+#define NSWITCHES 2000000
+
+static Tid partner;
+
+static int
+test_pingpong_thread(Tid parent)
+{
+	int i;
+
+	for (i = 0; i < NSWITCHES / 2; i++) {
+		int ret = thread_yield(parent);
+		assert(ret == parent);
+	}
+	return 0;
+}
+
+int
+main()
+{
+	struct timeval start, end, diff;
+	double usecs;
+	int i;
+
+	printf("starting pingpong test\n");
+
+	struct config config = {
+		.sched_name = "fcfs", .preemptive = false, .verbose = false
+	};
+	ut369_start(&config);
+
+	partner = thread_create((thread_entry_f)test_pingpong_thread,
+				(void *)(long)thread_id());
+	assert(thread_ret_ok(partner));
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < NSWITCHES / 2; i++) {
+		int ret = thread_yield(partner);
+		assert(ret == partner);
+	}
+	gettimeofday(&end, NULL);
+
+	timersub(&end, &start, &diff);
+	usecs = diff.tv_sec * 1000000.0 + diff.tv_usec;
+	unintr_printf("%d switches in %.0f us, %.1f ns per switch\n",
+		      NSWITCHES, usecs, usecs * 1000.0 / NSWITCHES);
+
+	assert(thread_wait(partner, NULL) == partner);
+	unintr_printf("pingpong test done\n");
+	thread_exit(0);
+	assert(false);
+	return 0;
+}
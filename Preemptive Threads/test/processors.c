@@ -0,0 +1,154 @@
+#include "test.h"
+#include <malloc.h>
+
+/* Threads on the number of processors given on the command line increment a
+ * counter under a lock, and hand a token around with a condition variable,
+ * which must all add up as on one processor. Then they compute without
+ * sharing anything, which should take about 1/processors as long as with
+ * one, given as many cores. Last, the main thread moves threads that may be
+ * ready between priorities over and over, which must not grow the run
+ * queues. */
+
+#define NTHREADS 8
+#define NINCREMENTS 20000
+#define NPASSES 2000 /* token passes per thread */
+#define WORK 200000000L /* loop iterations of the compute phase, in all */
+#define NSETPRIO 200000 /* thread_setprio calls */
+
+static struct lock *lock;
+static struct cv *turn;
+static long counter;
+static int token;
+static volatile int stop;
+
+static int
+test_counter_thread(void)
+{
+	int i;
+
+	for (i = 0; i < NINCREMENTS; i++) {
+		lock_acquire(lock);
+		counter++;
+		lock_release(lock);
+	}
+	return 0;
+}
+
+static int
+test_token_thread(long num)
+{
+	int i;
+
+	lock_acquire(lock);
+	for (i = 0; i < NPASSES; i++) {
+		while (token % NTHREADS != num)
+			cv_wait(turn);
+		token++;
+		cv_broadcast(turn);
+	}
+	lock_release(lock);
+	return 0;
+}
+
+static int
+test_compute_thread(void)
+{
+	volatile long sum = 0;
+	long i;
+
+	for (i = 0; i < WORK / NTHREADS; i++)
+		sum += i;
+	return 0;
+}
+
+static int
+test_yield_thread(void)
+{
+	while (!stop)
+		thread_yield(THREAD_ANY);
+	return 0;
+}
+
+static void
+test_create(thread_entry_f fn, Tid tids[])
+{
+	int i;
+
+	for (i = 0; i < NTHREADS; i++) {
+		tids[i] = thread_create(fn, (void *)(long)i);
+		assert(thread_ret_ok(tids[i]));
+	}
+}
+
+static void
+test_join(Tid tids[])
+{
+	int i;
+
+	for (i = 0; i < NTHREADS; i++)
+		assert(thread_wait(tids[i], NULL) == tids[i]);
+}
+
+static void
+test_run(thread_entry_f fn)
+{
+	Tid tids[NTHREADS];
+
+	test_create(fn, tids);
+	test_join(tids);
+}
+
+int
+main(int argc, const char *argv[])
+{
+	struct timeval start, end, diff;
+	int i;
+
+	int processors = argc == 2 ? atoi(argv[1]) : 4;
+	if (argc > 2 || processors < 1) {
+		fprintf(stderr, "usage: %s [processors]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	printf("starting processors test with %d\n", processors);
+
+	struct config config = {
+		.sched_name = "steal", .preemptive = true, .verbose = false,
+		.processors = processors
+	};
+	ut369_start(&config);
+
+	lock = lock_create();
+	turn = cv_create(lock);
+
+	test_run((thread_entry_f)test_counter_thread);
+	assert(counter == (long)NTHREADS * NINCREMENTS);
+	unintr_printf("counter: %ld increments under the lock\n", counter);
+
+	test_run((thread_entry_f)test_token_thread);
+	assert(token == NTHREADS * NPASSES);
+	unintr_printf("token: passed %d times in order\n", token);
+
+	gettimeofday(&start, NULL);
+	test_run((thread_entry_f)test_compute_thread);
+	gettimeofday(&end, NULL);
+	timersub(&end, &start, &diff);
+	unintr_printf("compute: %ld ms on %d processors\n",
+		      diff.tv_sec * 1000 + diff.tv_usec / 1000, processors);
+
+	Tid tids[NTHREADS];
+	struct mallinfo2 before = mallinfo2();
+	test_create((thread_entry_f)test_yield_thread, tids);
+	for (i = 0; i < NSETPRIO; i++)
+		thread_setprio(tids[i % NTHREADS], i % THREAD_PRIO_LEVELS);
+	stop = 1;
+	test_join(tids);
+	struct mallinfo2 after = mallinfo2();
+	unintr_printf("setprio: %d calls, %zu bytes more in use\n",
+		      NSETPRIO, after.uordblks - before.uordblks);
+	assert(after.uordblks < before.uordblks + 65536);
+
+	cv_destroy(turn);
+	lock_destroy(lock);
+	unintr_printf("processors test done\n");
+	return 0;
+}
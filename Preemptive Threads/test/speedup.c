@@ -0,0 +1,88 @@
+#include "test.h"
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Threads compute without calling into the library, and without sharing
+ * anything, once on one processor and once on the number given on the
+ * command line, each in a process of its own since ut369_start can only be
+ * called once. This is the work that the kernel lock lets run in parallel,
+ * so given at least as many cores as processors, it must go at least three
+ * quarters of that many times faster. With fewer cores, the times are only
+ * reported. */
+
+#define NTHREADS 8
+#define WORK 400000000L /* loop iterations, in all */
+
+static int
+test_compute_thread(void)
+{
+	volatile long sum = 0;
+	long i;
+
+	for (i = 0; i < WORK / NTHREADS; i++)
+		sum += i;
+	return 0;
+}
+
+/* Run the threads on the given number of processors in a child process, and
+ * return how long it took, in us. */
+static long
+test_run(int processors)
+{
+	struct timeval start, end, diff;
+	Tid tids[NTHREADS];
+	int status;
+	long i;
+
+	fflush(stdout);
+	gettimeofday(&start, NULL);
+	pid_t pid = fork();
+	assert(pid >= 0);
+	if (pid == 0) {
+		struct config config = {
+			.sched_name = "steal", .preemptive = true,
+			.verbose = false, .processors = processors
+		};
+		ut369_start(&config);
+
+		for (i = 0; i < NTHREADS; i++) {
+			tids[i] = thread_create(
+				(thread_entry_f)test_compute_thread, NULL);
+			assert(thread_ret_ok(tids[i]));
+		}
+		for (i = 0; i < NTHREADS; i++)
+			assert(thread_wait(tids[i], NULL) == tids[i]);
+		exit(EXIT_SUCCESS);
+	}
+	assert(waitpid(pid, &status, 0) == pid);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+	gettimeofday(&end, NULL);
+	timersub(&end, &start, &diff);
+	return diff.tv_sec * 1000000 + diff.tv_usec;
+}
+
+int
+main(int argc, const char *argv[])
+{
+	int processors = argc == 2 ? atoi(argv[1]) : 2;
+	if (argc > 2 || processors < 1) {
+		fprintf(stderr, "usage: %s [processors]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	printf("starting speedup test with %d\n", processors);
+
+	long one = test_run(1);
+	printf("%d threads on 1 processor: %ld ms\n", NTHREADS, one / 1000);
+	long several = test_run(processors);
+	printf("%d threads on %d processors: %ld ms, speedup %.2f\n", NTHREADS,
+	       processors, several / 1000, (double)one / several);
+
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cores >= processors)
+		assert(several * processors * 3 < one * 4);
+	else
+		printf("only %ld cores, speedup not checked\n", cores);
+
+	printf("speedup test done\n");
+	return 0;
+}
@@ -0,0 +1,85 @@
+#include "test.h"
+#include "../stack.h"
+
+#define BIG_STACK (1 << 20)
+#define NCHURN 20000
+
+/* use about depth KiB of stack, returning how many frames were corrupted */
+static int
+test_stack_recurse(int depth)
+{
+	volatile char frame[1024];
+	int bad;
+
+	frame[0] = frame[1023] = (char)depth;
+	if (depth == 0)
+		return 0;
+	bad = test_stack_recurse(depth - 1);
+	return bad + (frame[0] != (char)depth || frame[1023] != (char)depth);
+}
+
+static int
+test_stack_thread(long depth)
+{
+	return test_stack_recurse(depth);
+}
+
+int
+main()
+{
+	struct timeval start, end, diff;
+	struct thread_attr attr;
+	unsigned long hits;
+	int exit_code;
+	Tid ret;
+	int i;
+
+	printf("starting stack test\n");
+
+	struct config config = {
+		.sched_name = "fcfs", .preemptive = false, .verbose = false
+	};
+	ut369_start(&config);
+
+	/* a thread with a big stack can use most of it */
+	attr.stack_size = BIG_STACK;
+	ret = thread_create_ex((thread_entry_f)test_stack_thread,
+			       (void *)(long)(BIG_STACK / 1024 * 3 / 4), &attr);
+	assert(thread_ret_ok(ret));
+	assert(thread_yield(ret) == ret);
+	assert(thread_wait(ret, &exit_code) == ret);
+	assert(exit_code == 0);
+
+	/* sizes below THREAD_MIN_STACK are raised to it */
+	attr.stack_size = 1;
+	ret = thread_create_ex((thread_entry_f)test_stack_thread,
+			       (void *)(long)(THREAD_MIN_STACK / 1024 / 2), &attr);
+	assert(thread_ret_ok(ret));
+	assert(thread_yield(ret) == ret);
+	assert(thread_wait(ret, &exit_code) == ret);
+	assert(exit_code == 0);
+
+	/* exited stacks are reused rather than mapped again: after the first
+	 * thread of each size, every stack comes from the pool */
+	hits = stack_pool_hits();
+	gettimeofday(&start, NULL);
+	for (i = 0; i < NCHURN; i++) {
+		attr.stack_size = i % 2 ? BIG_STACK : 0;
+		ret = thread_create_ex((thread_entry_f)test_stack_thread,
+				       (void *)4L, &attr);
+		assert(thread_ret_ok(ret));
+		assert(thread_yield(ret) == ret);
+		assert(thread_wait(ret, &exit_code) == ret);
+		assert(exit_code == 0);
+	}
+	gettimeofday(&end, NULL);
+	assert(stack_pool_hits() - hits >= NCHURN - 2);
+	timersub(&end, &start, &diff);
+	unintr_printf("%d threads created and waited for in %ld.%06ld s\n",
+		      NCHURN, (long)diff.tv_sec, (long)diff.tv_usec);
+
+	unintr_printf("stack test done\n");
+	thread_exit(0);
+	assert(false);
+	return 0;
+}
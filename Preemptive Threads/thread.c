@@ -7,82 +7,250 @@
 #define _GNU_SOURCE
 #endif
 #include <assert.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include "ut369.h"
+#include "context.h"
+#include "stack.h"
 #include "queue.h"
 #include "thread.h"
 #include "schedule.h"
 #include "interrupt.h"
-#include <ucontext.h>
-#include <sys/ucontext.h>
-#include <stdint.h>
+#include "processor.h"
 
-static struct thread *current;
-static bool tid_used[THREAD_MAX_THREADS];
+/* The thread running on the calling processor */
+#define current (processor_self()->running)
 
 static struct thread *kernel_thread = NULL;
 
-/* List of threads */
-static struct thread *thread_list[THREAD_MAX_THREADS];
-static void *stack_to_free = NULL;
+/* Upper bound on the number of threads, see struct config */
+static int max_threads = THREAD_MAX_THREADS;
+
+/* Initial size of thread_list, which doubles up to max_threads as needed */
+#define THREAD_LIST_MIN 64
+
+/* List of threads, indexed by tid */
+static struct thread **thread_list = NULL;
+static int thread_list_size = 0;
+
+/* Tids released by thread_destroy, reused last in first out so that a new
+ * thread takes the slot of thread_list that was touched most recently. Tids
+ * from next_tid up have never been handed out. */
+static Tid *free_tids = NULL;
+static int nr_free_tids = 0;
+static Tid next_tid = 1;
+
+/* Number of threads in the READY state, including those an idle processor
+ * has taken from a run queue but not switched to yet, and number of
+ * processors running a thread rather than idling. The last thread is the one
+ * that finds neither any other. */
+static int nr_ready = 0;
+static int nr_busy = 1;
+
+/* Structures of destroyed threads, reused by thread_create. Only freed by
+ * thread_end, since the run queues of steal.c may still point to them. */
+static struct thread *spare_threads = NULL;
+
+/* Whether the processor time of each thread is measured, see
+ * thread_measure_runtime */
+static bool measure_runtime = false;
+
+static void thread_idle_stub(int (*fn)(void *), void *arg);
+
+/* The SIGSEGV handler cannot run on the stack that just overflowed */
+static char overflow_stack[65536] __attribute__((aligned(16)));
 
 /**************************************************************************
  * Cooperative threads: Refer to ut369.h and this file for the detailed
  *                      descriptions of the functions you need to implement.
  **************************************************************************/
 
+/* Report which thread ran into the guard page of its stack, see stack.h */
+static void
+thread_overflow_handler(int sig, siginfo_t *sip, void *contextVP)
+{
+	(void)contextVP;
+	for (int i = 1; i < next_tid; i++)
+	{
+		struct thread *thread = thread_list[i];
+		if (thread && thread->stack_base &&
+		    stack_in_guard(thread->stack_base, sip->si_addr))
+		{
+			char msg[64];
+			int len = snprintf(msg, sizeof(msg),
+					   "thread %d overflowed its stack\n",
+					   thread->id);
+			ssize_t ret = write(STDERR_FILENO, msg, len);
+			(void)ret;
+			abort();
+		}
+	}
+	// Not an overflow: fault again, with the default action
+	signal(sig, SIG_DFL);
+}
+
+/* Double the size of thread_list and free_tids, up to max_threads. Returns 0
+ * on success, THREAD_NOMEMORY if out of memory. */
+static int
+thread_list_grow(void)
+{
+	int size = thread_list_size * 2;
+	if (size > max_threads)
+	{
+		size = max_threads;
+	}
+
+	struct thread **list = realloc(thread_list, size * sizeof(*list));
+	if (list == NULL)
+	{
+		return THREAD_NOMEMORY;
+	}
+	thread_list = list;
+	Tid *tids = realloc(free_tids, size * sizeof(*tids));
+	if (tids == NULL)
+	{
+		return THREAD_NOMEMORY;
+	}
+	free_tids = tids;
+
+	for (int i = thread_list_size; i < size; i++)
+	{
+		thread_list[i] = NULL;
+	}
+	thread_list_size = size;
+	return 0;
+}
+
+/* Return an unused tid, or THREAD_NOMORE if there are max_threads threads
+ * already, or THREAD_NOMEMORY if thread_list cannot grow. */
+static Tid
+thread_tid_alloc(void)
+{
+	if (nr_free_tids > 0)
+	{
+		return free_tids[--nr_free_tids];
+	}
+	if (next_tid >= max_threads)
+	{
+		return THREAD_NOMORE;
+	}
+	if (next_tid == thread_list_size)
+	{
+		int ret = thread_list_grow();
+		if (ret < 0)
+		{
+			return ret;
+		}
+	}
+	return next_tid++;
+}
+
+/* Make tid available for reuse */
+static void
+thread_tid_free(Tid tid)
+{
+	// Every tid below next_tid fits in free_tids
+	free_tids[nr_free_tids++] = tid;
+}
+
 /* Initialize the thread subsystem */
-void thread_init(void)
+void thread_init(int max)
 {
 	static struct thread first_thread;
+	struct sigaction action;
+	stack_t altstack;
 
-	// First create the tid list from 1 to THREAD_MAX_THREADS - 1
-	// Do not inlucde Thread 0,becuase that is the kernal thread
-	for (int i = 0; i < THREAD_MAX_THREADS; i++)
+	altstack.ss_sp = overflow_stack;
+	altstack.ss_size = sizeof(overflow_stack);
+	altstack.ss_flags = 0;
+	if (sigaltstack(&altstack, NULL) == 0)
 	{
-		tid_used[i] = false;
+		action.sa_sigaction = thread_overflow_handler;
+		action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+		sigfillset(&action.sa_mask);
+		sigaction(SIGSEGV, &action, NULL);
 	}
-	tid_used[0] = true;
+
+	// The tid list starts small and grows as threads are created
+	max_threads = max > 0 ? max : THREAD_MAX_THREADS;
+	thread_list_size = max_threads < THREAD_LIST_MIN ? max_threads
+							 : THREAD_LIST_MIN;
+	thread_list = calloc(thread_list_size, sizeof(*thread_list));
+	free_tids = malloc(thread_list_size * sizeof(*free_tids));
+	assert(thread_list && free_tids);
+	nr_free_tids = 0;
+	next_tid = 1;
+	nr_ready = 0;
+	nr_busy = 1;
+
 	// Initialize the first thread, i.e., the kernel thread
 	// The kernel thread always has tid 0
 	first_thread.id = 0;
 	first_thread.state = RUNNING;
-	first_thread.in_or_not = 0;
+	first_thread.in_queue = NULL;
+	memset(&first_thread.sched, 0, sizeof(first_thread.sched));
+	first_thread.prio = THREAD_PRIO_DEFAULT;
+	first_thread.preempted = false;
+	first_thread.runtime = 0;
 	first_thread.next = NULL;
 	first_thread.prev = NULL;
 	first_thread.stack_base = NULL;
 	first_thread.stack_size = 0;
-	getcontext(&(first_thread.context));
+	first_thread.sp = NULL;
 	first_thread.exit_code = 0;
 	first_thread.start_fn = NULL;
 	first_thread.parg = NULL;
 	first_thread.killed = false;
 	current = &first_thread;
 	thread_list[0] = &first_thread;
-	current->resumed = false;
 	kernel_thread = &first_thread;
 	first_thread.wait_queue = NULL;
 	first_thread.join_queue = NULL;
 	first_thread.reaped = false;
 	first_thread.w_exit = false;
+	first_thread.waiters = 0;
+	first_thread.joining = NULL;
 	first_thread.yield_tid = 0;
+
+	// The other processors start out idle, see thread_idle
+	for (int i = 0; i < nr_processors; i++)
+	{
+		processors[i].idle.id = THREAD_NONE;
+		processors[i].idle.state = SLEEPING;
+		if (i > 0)
+		{
+			processors[i].running = &processors[i].idle;
+		}
+	}
+	if (nr_processors > 1)
+	{
+		struct thread *idle = &processors[0].idle;
+		idle->stack_size = stack_round(0);
+		idle->stack_base = stack_alloc(idle->stack_size);
+		assert(idle->stack_base);
+		idle->sp = context_init(idle->stack_base, idle->stack_size,
+					thread_idle_stub, NULL, NULL);
+	}
 }
 
 /* Returns the tid of the current running thread. */
-Tid thread_id(void)
+INTERRUPT_NOPREEMPT Tid thread_id(void)
 {
 	return current->id;
 }
 
 /* Return the thread structure of the thread with identifier tid, or NULL if
  * does not exist. Used by thread_yield and thread_wait's placeholder
- * implementation.
+ * implementation, and by the queues to remove a thread by tid.
  */
-static struct thread *
+struct thread *
 thread_get(Tid tid)
 {
-	if (tid >= 0 && tid < THREAD_MAX_THREADS)
+	if (tid >= 0 && tid < thread_list_size)
 	{
 		return thread_list[tid];
 	}
@@ -102,39 +270,134 @@ __attribute__((unused)) static bool thread_runnable(Tid tid)
 	return (thread_get(tid)->state == READY || thread_get(tid)->state == RUNNING);
 }
 
-/* Context switch to the next thread. Used by thread_yield. */
+/* Free the stack of the thread that exited last, now that it no longer runs on
+ * it. */
 static void
-thread_switch(struct thread *next)
+thread_free_exited_stack(void)
 {
-	getcontext(&current->context);
-	if (current->resumed)
+	struct processor *self = processor_self();
+
+	if (self->stack_to_free)
 	{
-		current->resumed = false;
-		if (stack_to_free)
-		{
-			free(stack_to_free);
-			stack_to_free = NULL;
-		}
-		return;
+		stack_free(self->stack_to_free, self->stack_to_free_size);
+		self->stack_to_free = NULL;
+		self->stack_to_free_size = 0;
 	}
+}
+
+/* Processor time used by the calling processor so far, in nanoseconds. The
+ * part between two switches is the time of the thread that ran in between. */
+static long long
+thread_cputime(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Start measuring the processor time of each thread. Costs a system call per
+ * context switch, so only done for the schedulers that need it and for
+ * thread_stats. */
+void thread_measure_runtime(void)
+{
+	measure_runtime = true;
+	processor_self()->charged_at = thread_cputime();
+}
+
+/* Add the processor time used since the last switch to current->runtime */
+void thread_account(void)
+{
+	if (measure_runtime)
+	{
+		struct processor *self = processor_self();
+		long long now = thread_cputime();
+		self->running->runtime += now - self->charged_at;
+		self->charged_at = now;
+	}
+}
 
-	current->resumed = true;
-	if (current->state == RUNNING)
+/* Make thread, which is not running, ready to run */
+static void
+thread_make_ready(struct thread *thread)
+{
+	thread->state = READY;
+	nr_ready++;
+	scheduler->enqueue(thread);
+}
+
+/* Context switch to the next thread, or to the idle loop of the processor.
+ * Used by thread_yield. Returns once the calling thread is switched back to,
+ * possibly on another processor. */
+static void
+thread_switch(struct thread *next)
+{
+	struct processor *self = processor_self();
+	struct thread *prev = self->running;
+	struct thread *idle = &self->idle;
+
+	thread_account();
+	if (prev->state == RUNNING)
+	{
+		thread_make_ready(prev);
+	}
+	if (next != idle)
 	{
-		current->state = READY;
-		scheduler->enqueue(current);
+		next->state = RUNNING;
+		nr_ready--;
 	}
-	next->state = RUNNING;
-	current = next;
+	nr_busy += (next != idle) - (prev != idle);
+	self->running = next;
+	context_switch(&prev->sp, next->sp);
+
+	// Running prev again, possibly on behalf of a thread that just exited
+	thread_free_exited_stack();
 	if (current->killed)
 	{
 		thread_exit(THREAD_KILLED);
 	}
-	if (next->killed)
+}
+
+/* Loop of a processor with no thread to run. Keeps interrupts disabled, so
+ * that the timer leaves it alone, but not the kernel lock, which it only takes
+ * to switch to a thread it took from a run queue: only the "steal" scheduler
+ * runs several processors, and its dequeue is safe without the lock. The
+ * idle context of a processor only ever runs on it.
+ */
+void thread_idle(void)
+{
+	struct processor *self = processor_self();
+	int spins = 0;
+
+	assert(self->disabled && self->running == &self->idle);
+	for (;;)
 	{
-		thread_exit(THREAD_KILLED);
+		processor_check_stop();
+		struct thread *next = scheduler->dequeue();
+		if (next == NULL)
+		{
+			processor_relax(spins++);
+			continue;
+		}
+		spins = 0;
+		kernel_lock();
+		self->pending = 0;
+		thread_switch(next);
+		// Back when a thread on this processor had none to switch to
+		kernel_unlock();
 	}
-	setcontext(&next->context);
+}
+
+/* Entry point of the idle context of the first processor, whose other
+ * processors start in thread_idle on the stack of their pthread. Entered from
+ * thread_switch, with the kernel lock. */
+static void
+thread_idle_stub(int (*fn)(void *), void *arg)
+{
+	(void)fn;
+	(void)arg;
+	thread_free_exited_stack();
+	kernel_unlock();
+	thread_idle();
 }
 
 /* Voluntarily pauses the execution of current thread and invokes scheduler
@@ -197,6 +460,91 @@ Tid thread_yield(Tid want_tid)
 	return ret;
 }
 
+/* Yield on behalf of the timer interrupt, letting the scheduler know that the
+ * current thread used up its whole quantum.
+ */
+Tid thread_preempt(void)
+{
+	int previous_status = interrupt_set(0);
+	current->preempted = true;
+	Tid ret = thread_yield(THREAD_ANY);
+	current->preempted = false;
+	interrupt_set(previous_status);
+	return ret;
+}
+
+Tid thread_setprio(Tid tid, int prio)
+{
+	if (prio < 0 || prio >= THREAD_PRIO_LEVELS)
+	{
+		return THREAD_INVALID;
+	}
+
+	int previous_status = interrupt_set(0);
+	struct thread *thread = thread_get(tid);
+	if (thread == NULL || thread->state == ZOMBIE)
+	{
+		interrupt_set(previous_status);
+		return THREAD_INVALID;
+	}
+
+	// A ready thread moves to the level of its new priority
+	if (thread->state == READY && scheduler->remove(tid) != NULL)
+	{
+		thread->prio = prio;
+		scheduler->enqueue(thread);
+	}
+	else
+	{
+		thread->prio = prio;
+	}
+	interrupt_set(previous_status);
+	return tid;
+}
+
+int thread_stats(struct thread_stats *stats)
+{
+	if (stats == NULL || !measure_runtime)
+	{
+		return THREAD_INVALID;
+	}
+
+	int previous_status = interrupt_set(0);
+	thread_account();
+	stats->threads = 0;
+	stats->min_runtime = 0;
+	stats->max_runtime = 0;
+	for (int i = 0; i < next_tid; i++)
+	{
+		struct thread *thread = thread_list[i];
+		if (!thread || (thread->state != RUNNING && thread->state != READY))
+		{
+			continue;
+		}
+		if (stats->threads == 0 || thread->runtime < stats->min_runtime)
+		{
+			stats->min_runtime = thread->runtime;
+		}
+		if (stats->threads == 0 || thread->runtime > stats->max_runtime)
+		{
+			stats->max_runtime = thread->runtime;
+		}
+		stats->threads++;
+	}
+	stats->fairness = stats->min_runtime > 0
+		? (double)stats->max_runtime / stats->min_runtime : 0.0;
+	interrupt_set(previous_status);
+	return 0;
+}
+
+/* Keep the structure of a thread that is gone for thread_create to reuse */
+static void
+thread_free_struct(struct thread *thread)
+{
+	thread->next = spare_threads;
+	spare_threads = thread;
+}
+
 /* Fully clean up a thread structure and make its tid available for reuse.
  * Used by thread_wait's placeholder implementation
  */
@@ -208,7 +556,7 @@ thread_destroy(struct thread *dead)
 
 	if (dead->stack_base)
 	{
-		free(dead->stack_base);
+		stack_free(dead->stack_base, dead->stack_size);
 		dead->stack_base = NULL;
 		dead->stack_size = 0;
 	}
@@ -220,15 +568,11 @@ thread_destroy(struct thread *dead)
 	}
 
 	thread_list[dead->id] = NULL;
-
-	if (dead->id >= 0 && dead->id < THREAD_MAX_THREADS)
-	{
-		tid_used[dead->id] = false;
-	}
+	thread_tid_free(dead->id);
 
 	if (dead != kernel_thread)
 	{
-		free(dead);
+		thread_free_struct(dead);
 	}
 	interrupt_set(previous_status);
 }
@@ -239,11 +583,7 @@ thread_destroy(struct thread *dead)
 static void
 thread_stub(int (*thread_main)(void *), void *arg)
 {
-	if (stack_to_free)
-	{
-		free(stack_to_free);
-		stack_to_free = NULL;
-	}
+	thread_free_exited_stack();
 	interrupt_on();
 	if (current->killed)
 	{
@@ -255,73 +595,74 @@ thread_stub(int (*thread_main)(void *), void *arg)
 
 Tid thread_create(int (*fn)(void *), void *parg)
 {
-	int previous_status = interrupt_set(0);
-	struct thread *new_thread = malloc(sizeof(struct thread));
-	if (new_thread == NULL)
+	return thread_create_ex(fn, parg, NULL);
+}
+
+Tid thread_create_ex(int (*fn)(void *), void *parg,
+		     const struct thread_attr *attr)
+{
+	size_t stack_size = stack_round(attr ? attr->stack_size : 0);
+	if (stack_size == 0)
 	{
-		interrupt_set(previous_status);
 		return THREAD_NOMEMORY;
 	}
 
-	int tid = -1;
-	for (int i = THREAD_MAX_THREADS - 1; i >= 0; --i)
+	int previous_status = interrupt_set(0);
+	struct thread *new_thread = spare_threads;
+	if (new_thread != NULL)
 	{
-		if (!tid_used[i])
-		{
-			tid_used[i] = true;
-			tid = i;
-			break;
-		}
+		spare_threads = new_thread->next;
 	}
+	else if ((new_thread = malloc(sizeof(struct thread))) == NULL)
+	{
+		interrupt_set(previous_status);
+		return THREAD_NOMEMORY;
+	}
+
+	Tid tid = thread_tid_alloc();
 	if (tid < 0)
 	{
-		free(new_thread);
+		thread_free_struct(new_thread);
 		interrupt_set(previous_status);
-		return THREAD_NOMORE;
+		return tid;
 	}
 
 	new_thread->id = tid;
-	new_thread->state = READY;
-	new_thread->in_or_not = 0;
+	new_thread->state = SLEEPING;
+	new_thread->in_queue = NULL;
+	memset(&new_thread->sched, 0, sizeof(new_thread->sched));
+	new_thread->prio = THREAD_PRIO_DEFAULT;
+	new_thread->preempted = false;
+	new_thread->runtime = 0;
 	new_thread->next = NULL;
 	new_thread->prev = NULL;
-	new_thread->stack_size = THREAD_MIN_STACK;
+	new_thread->stack_size = stack_size;
 	new_thread->exit_code = 0;
 	new_thread->start_fn = fn;
 	new_thread->parg = parg;
 	new_thread->killed = false;
-	new_thread->resumed = false;
 	new_thread->wait_queue = NULL;
 	new_thread->join_queue = NULL;
 	new_thread->reaped = false;
 	new_thread->w_exit = false;
+	new_thread->waiters = 0;
+	new_thread->joining = NULL;
 	new_thread->yield_tid = 0;
 
-	new_thread->stack_base = malloc(THREAD_MIN_STACK);
+	new_thread->stack_base = stack_alloc(stack_size);
 	if (!new_thread->stack_base)
 	{
-		free(new_thread);
+		thread_tid_free(tid);
+		thread_free_struct(new_thread);
 		interrupt_set(previous_status);
 		return THREAD_NOMEMORY;
 	}
-	getcontext(&(new_thread->context));
-
-	uintptr_t top = (uintptr_t)new_thread->stack_base + THREAD_MIN_STACK;
-	top &= ~(uintptr_t)0xF;
-	top -= 8;
-
-	new_thread->context.uc_stack.ss_sp = new_thread->stack_base;
-	new_thread->context.uc_stack.ss_size = new_thread->stack_size;
-	new_thread->context.uc_stack.ss_flags = 0;
-	new_thread->context.uc_link = NULL;
-
-	new_thread->context.uc_mcontext.gregs[REG_RIP] = (greg_t)thread_stub;
-	new_thread->context.uc_mcontext.gregs[REG_RSP] = (greg_t)top;
-	new_thread->context.uc_mcontext.gregs[REG_RDI] = (greg_t)fn;
-	new_thread->context.uc_mcontext.gregs[REG_RSI] = (greg_t)parg;
+	// The first switch to the thread calls thread_stub(fn, parg)
+	new_thread->sp = context_init(new_thread->stack_base,
+				      new_thread->stack_size, thread_stub, fn, parg);
 
 	thread_list[new_thread->id] = new_thread;
-	scheduler->enqueue(new_thread);
+	thread_make_ready(new_thread);
 	interrupt_set(previous_status);
 
 	return new_thread->id;
@@ -357,37 +698,64 @@ Tid thread_kill(Tid tid)
 			queue_remove(target->wait_queue, target->id);
 			target->wait_queue = NULL;
 		}
-		target->state = READY;
-		scheduler->enqueue(target);
+		target->joining = NULL;
+		thread_make_ready(target);
 	}
 	interrupt_set(previous_status);
 	return tid;
 }
 
+/* Called by a thread that was woken by the exit of the thread it waited for,
+ * once done with it. The last of the waiters woken destroys the thread. */
+static void
+thread_join_done(struct thread *waiter)
+{
+	struct thread *target = waiter->joining;
+
+	waiter->joining = NULL;
+	if (--target->waiters == 0 && !target->reaped)
+	{
+		target->reaped = true;
+		thread_destroy(target);
+	}
+}
+
 void thread_exit(int exit_code)
 {
 	int previous_status = interrupt_set(0);
 
+	// Killed after being woken from thread_wait, but before running again
+	if (current->joining)
+	{
+		thread_join_done(current);
+	}
+
 	current->exit_code = exit_code;
 	current->state = ZOMBIE;
 
 	if (current->join_queue && queue_count(current->join_queue) > 0)
 	{
 		current->w_exit = true;
-		thread_wakeup(current->join_queue, 1);
+		current->waiters = thread_wakeup(current->join_queue, 1);
 	}
 
 	struct thread *next_thread = scheduler->dequeue();
 	if (next_thread == NULL)
 	{
-		thread_end();
-		interrupt_end();
-		ut369_exit(exit_code);
+		if (nr_ready == 0 && nr_busy == 1)
+		{
+			// ut369_end frees this thread's stack, once off it
+			ut369_exit(exit_code);
+		}
+		// Another processor is still running a thread, or about to
+		next_thread = &processor_self()->idle;
 	}
 
 	if (current->id != 0 && current->stack_base)
 	{
-		stack_to_free = current->stack_base;
+		struct processor *self = processor_self();
+		self->stack_to_free = current->stack_base;
+		self->stack_to_free_size = current->stack_size;
 		current->stack_base = NULL;
 		current->stack_size = 0;
 	}
@@ -402,21 +770,43 @@ void thread_exit(int exit_code)
 void thread_end(void)
 {
 	int previous_status = interrupt_set(0);
-	for (int i = 1; i < THREAD_MAX_THREADS; i++)
+	for (int i = 0; i < next_tid; i++)
 	{
 		struct thread *thread = thread_list[i];
-		if (!thread)
+		if (!thread || thread == kernel_thread)
 		{
 			continue;
 		}
 		if (thread->stack_base)
 		{
-			free(thread->stack_base);
+			stack_free(thread->stack_base, thread->stack_size);
 			thread->stack_base = NULL;
 		}
 		free(thread);
 		thread_list[i] = NULL;
 	}
+	while (spare_threads != NULL)
+	{
+		struct thread *spare = spare_threads;
+		spare_threads = spare->next;
+		free(spare);
+	}
+	if (processors[0].idle.stack_base)
+	{
+		stack_free(processors[0].idle.stack_base,
+			   processors[0].idle.stack_size);
+		processors[0].idle.stack_base = NULL;
+	}
+	free(thread_list);
+	free(free_tids);
+	thread_list = NULL;
+	free_tids = NULL;
+	thread_list_size = 0;
+	nr_free_tids = 0;
+	next_tid = 1;
+	measure_runtime = false;
+	thread_free_exited_stack();
+	stack_end();
 	interrupt_set(previous_status);
 }
 
@@ -429,7 +819,7 @@ Tid thread_wait(Tid tid, int *exit_code)
 {
 	int previous_status = interrupt_set(0);
 
-	if (tid < 0 || tid >= THREAD_MAX_THREADS)
+	if (tid < 0 || tid >= thread_list_size)
 	{
 		interrupt_set(previous_status);
 		return THREAD_INVALID;
@@ -472,35 +862,32 @@ Tid thread_wait(Tid tid, int *exit_code)
 
 	if (!target->join_queue)
 	{
-		target->join_queue = queue_create(THREAD_MAX_THREADS);
+		target->join_queue = queue_create(max_threads);
 		queue_set_owner(target->join_queue, target);
 	}
 
+	current->joining = target;
 	int sleep = thread_sleep(target->join_queue);
 	if (sleep == THREAD_DEADLOCK)
 	{
+		current->joining = NULL;
 		interrupt_set(previous_status);
 		return sleep;
 	}
 	if (sleep == THREAD_NONE)
 	{
+		current->joining = NULL;
 		interrupt_set(previous_status);
 		return sleep;
 	}
 
-	target = thread_get(tid);
-	if (target)
+	// Woken by the exit of target, which stays until its last waiter is done
+	assert(current->joining == target && target->state == ZOMBIE);
+	if (exit_code)
 	{
-		if (exit_code)
-		{
-			*exit_code = target->exit_code;
-		}
-		if (!target->reaped && target->state == ZOMBIE && !target->w_exit)
-		{
-			target->reaped = true;
-			thread_destroy(target);
-		}
+		*exit_code = target->exit_code;
 	}
+	thread_join_done(current);
 
 	interrupt_set(previous_status);
 	return tid;
@@ -530,15 +917,20 @@ Tid thread_sleep(fifo_queue_t *queue)
 	}
 
 	struct thread *next = scheduler->dequeue();
+	Tid return_id = next != NULL ? next->id : thread_id();
 	if (next == NULL)
 	{
-		return THREAD_NONE;
+		if (nr_ready == 0 && nr_busy == 1)
+		{
+			return THREAD_NONE;
+		}
+		// A thread on another processor may yet wake this one up
+		next = &processor_self()->idle;
 	}
 
 	current->state = SLEEPING;
 	current->wait_queue = queue;
 	queue_push(queue, current);
-	Tid return_id = next->id;
 	thread_switch(next);
 
 	return return_id;
@@ -563,8 +955,7 @@ int thread_wakeup(fifo_queue_t *queue, int all)
 		if (th != NULL)
 		{
 			th->wait_queue = NULL;
-			th->state = READY;
-			scheduler->enqueue(th);
+			thread_make_ready(th);
 			woken = 1;
 		}
 	}
@@ -574,8 +965,7 @@ int thread_wakeup(fifo_queue_t *queue, int all)
 		while ((th = queue_pop(queue)) != NULL)
 		{
 			th->wait_queue = NULL;
-			th->state = READY;
-			scheduler->enqueue(th);
+			thread_make_ready(th);
 			woken++;
 		}
 	}
@@ -602,7 +992,7 @@ lock_create()
 		return NULL;
 	}
 	lock->holder = NULL;
-	lock->wait_queue = queue_create(THREAD_MAX_THREADS);
+	lock->wait_queue = queue_create(max_threads);
 	lock->condition_variables = 0;
 	queue_set_owner(lock->wait_queue, NULL);
 	interrupt_set(prev);
@@ -674,7 +1064,7 @@ cv_create(struct lock *lock)
 	int prev = interrupt_set(0);
 	cv = malloc(sizeof(struct cv));
 	cv->l = lock;
-	cv->wait_queue = queue_create(THREAD_MAX_THREADS);
+	cv->wait_queue = queue_create(max_threads);
 	queue_set_owner(cv->wait_queue, NULL);
 	lock->condition_variables++;
 	interrupt_set(prev);
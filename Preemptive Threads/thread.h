@@ -10,8 +10,44 @@
 #define _THREAD_H_
 
 #include "ut369.h"
+#include <stdatomic.h>
 #include <stdbool.h>
-#include <ucontext.h>
+#include <stddef.h>
+
+/* What the scheduler in use keeps in each thread, as thread->sched, through
+ * the member of its own name. It is zeroed when the thread is created.
+ * Threads in a fifo queue, such as fcfs's, are linked through next and prev
+ * in struct thread instead.
+ */
+struct sched_node
+{
+    union
+    {
+        struct
+        {
+            int slot;        /* position in the ready array + 1, or 0 */
+        } rand;
+        struct
+        {
+            int level;       /* level of its queue */
+            long long since; /* when it last ran or was charged, in ns */
+            long long used;  /* processor time used at its level, in ns */
+        } mlfq;
+        struct
+        {
+            long long vruntime;    /* runtime weighted by priority */
+            long long vcharged;    /* runtime already counted into vruntime */
+            struct thread *child;  /* first child in the heap */
+            struct thread *next;   /* right sibling */
+            struct thread *prev;   /* left sibling, or parent of a first child */
+        } cfs;
+        struct
+        {
+            atomic_bool queued;    /* ready, not yet taken to run */
+            atomic_bool in_queue;  /* has an entry in a run queue */
+        } steal;
+    };
+};
 
 struct thread
 {
@@ -19,7 +55,11 @@ struct thread
 
     struct thread *next;
     struct thread *prev;
-    int in_or_not;
+    fifo_queue_t *in_queue;  /* queue that next and prev link it into */
+    struct sched_node sched; /* state of the scheduler, see above */
+    int prio;                /* see thread_setprio */
+    bool preempted;          /* switched out by the timer interrupt */
+    long long runtime;       /* nanoseconds on the processor, if measured */
     enum thread_state
     {
         RUNNING,
@@ -30,21 +70,27 @@ struct thread
 
     void *stack_base;
     size_t stack_size;
-    ucontext_t context;
+    void *sp; /* saved stack pointer while not running, see context.h */
     int exit_code;
     int (*start_fn)(void *);
     void *parg;
     bool killed;
     Tid yield_tid;
     fifo_queue_t *wait_queue;
-    bool resumed;
     fifo_queue_t *join_queue;
     bool reaped;
     bool w_exit;
+    int waiters;             /* woken by its exit, not yet done with it */
+    struct thread *joining;  /* thread waited for in thread_wait */
 };
 
 // functions defined in thread.c
-void thread_init(void);
+void thread_init(int max_threads);
+struct thread *thread_get(Tid tid);
+Tid thread_preempt(void);
+void thread_measure_runtime(void);
+void thread_account(void);
+void thread_idle(void);
 void thread_end(void);
 
 // functions defined in ut369.c
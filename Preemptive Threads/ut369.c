@@ -2,21 +2,21 @@
 #include "interrupt.h"
 #include "thread.h"
 #include "schedule.h"
+#include "context.h"
+#include "processor.h"
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <malloc.h>
 
 /* Exit status of the process */
 static int exit_status = 0;
 
-/* Context of main thread for future clean-up */
-static ucontext_t main_context;     
-
-/* This must be here because we return from ut369_start, which means
- * there will be a stack mismatch when we restore context. To deal with
- * this, we make this variable global instead.
+/* Stack that ut369_end runs on, so that it can free the stack of the last
+ * thread, which called ut369_exit.
  */
-static volatile int called = 0;     
+static char end_stack[THREAD_MIN_STACK] __attribute__((aligned(16)));
 
 /* The one end function that calls all other end functions before 
  * exiting the process with exit_status.
@@ -25,35 +25,59 @@ static void
 ut369_end(void)
 {
     assert(!interrupt_enabled());
+    processor_end();
     interrupt_end();
     thread_end();
     scheduler_end();
     exit(exit_status);
 }
 
+/* Entry point of end_stack, see context_init */
+static void
+ut369_end_stub(int (*fn)(void *), void *arg)
+{
+    (void)fn;
+    (void)arg;
+    ut369_end();
+}
+
 /* Start the ut369 user thread system using the given configuration
  * settings.
  */
 void 
 ut369_start(struct config * config)
 {
+    int processors = config->processors;
+    const char *env = getenv("UT369_PROCESSORS");
+
+    // lets existing programs run on several processors unchanged
+    if (processors <= 0)
+        processors = env != NULL ? atoi(env) : 1;
+    if (processors < 1)
+        processors = 1;
+    if (processors > PROCESSOR_MAX)
+        processors = PROCESSOR_MAX;
+
+    // only the steal scheduler runs on several processors, see ut369.h
+    const char *sched_name = config->sched_name;
+    if (processors > 1) {
+        if (sched_name != NULL && strcmp(sched_name, "steal") != 0)
+            fprintf(stderr, "ut369: scheduler %s replaced by steal to run "
+                    "on %d processors\n", sched_name, processors);
+        sched_name = "steal";
+    }
+
     srand(0);
-    scheduler_init(config->sched_name);
-    thread_init();
+    processor_init(processors);
+    scheduler_init(sched_name);
+    thread_init(config->max_threads);
+    if (config->stats)
+        thread_measure_runtime();
     if (config->preemptive)
         interrupt_init(config->verbose ? 1 : 0);
-    
-    // make sure interrupt is off before we getcontext
-    assert(!interrupt_enabled());
+    processor_start();
 
-    // save main thread's context so we can exit the system gracefully
-    getcontext(&main_context);
-    if (called == 1) {
-        // arrived here from ut369_exit
-        ut369_end();
-        assert(false);
-    }
-    called = 1;
+    assert(!interrupt_enabled());
 
     // interrupt is enabled from this point forward
     interrupt_on();
@@ -68,7 +92,9 @@ void ut369_exit(int exit_code)
     assert(!interrupt_enabled());
     exit_status = exit_code;
 
-    // context switch to main thread and run ut369_end function
-    setcontext(&main_context);
+    // context switch to end_stack and run ut369_end function
+    void *unused;
+    context_switch(&unused, context_init(end_stack, sizeof(end_stack),
+                                         ut369_end_stub, NULL, NULL));
     assert(false);
 }
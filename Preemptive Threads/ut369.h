@@ -11,16 +11,21 @@
 #define _UT369_H_
 
 #include <stdbool.h>
+#include <stddef.h>
 
-#define THREAD_MAX_THREADS 1024 /* maximum number of threads */
+#define THREAD_MAX_THREADS 1024 /* default maximum number of threads */
 #define THREAD_MIN_STACK  32768 /* minimum per-thread execution stack */
+#define THREAD_PRIO_LEVELS   32 /* priorities, from 0 (highest) to 31 */
+#define THREAD_PRIO_DEFAULT  16 /* priority of a new thread */
 
 typedef int Tid; /* A thread identifier */
 
 /*
- * Valid thread identifiers (Tid) range between 0 and THREAD_MAX_THREADS-1. The
- * first thread to run must have a thread id of 0. Note that this thread is the
- * main thread, i.e., it is created before the first call to thread_create.
+ * Valid thread identifiers (Tid) range between 0 and config->max_threads-1
+ * (THREAD_MAX_THREADS-1 by default). The first thread to run must have a thread
+ * id of 0. Note that this thread is the main thread, i.e., it is created before
+ * the first call to thread_create. The identifier of a thread that has been
+ * waited for is the first to be reused.
  *
  * Negative Tid values are used for error codes or control codes.
  */
@@ -42,11 +47,23 @@ struct config {
     const char * sched_name;
     bool preemptive;
 	bool verbose;
+	int max_threads; /* 0 for THREAD_MAX_THREADS, including the main thread */
+	bool stats;      /* measure runtimes for thread_stats, always on in cfs */
+	int processors;  /* kernel threads to run on, 0 for $UT369_PROCESSORS or 1;
+	                  * more than one overrides sched_name with "steal",
+	                  * with a warning on stderr if it named another */
 };
 
 /*
  * Initializes the threading system (already implemented in ut369.c)
  * Must be called before using the threading system.
+ *
+ * With more than one processor, threads run in parallel on as many kernel
+ * threads, and are scheduled by the "steal" scheduler in place of sched_name
+ * (see processors above): each processor runs the threads it made ready in
+ * turn, and steals from the others once it has none left. A program that
+ * shares data between threads must then protect it with locks, or with
+ * interrupts disabled, which excludes the other processors as well.
  */
 void ut369_start(struct config * config);
 
@@ -71,12 +88,35 @@ Tid thread_id(void);
  * - On success: Returns the identifier of the newly created thread.
  * - On failure: Returns one of the following error codes:
  *   - THREAD_NOMORE: The system cannot create additional threads because
- *     the maximum thread limit has been reached.
+ *     the maximum thread limit, config->max_threads, has been reached.
  *   - THREAD_NOMEMORY: There is insufficient memory to allocate a stack
  *     or other resources required for the new thread.
  */
 Tid thread_create(thread_entry_f fn, void *arg);
 
+/* attributes of a new thread, see thread_create_ex */
+struct thread_attr {
+	size_t stack_size; /* 0 for the default of THREAD_MIN_STACK */
+};
+
+/*
+ * Create a new thread like thread_create, with the given attributes.
+ *
+ * Parameters:
+ * - attr: The attributes of the new thread, or NULL for the defaults.
+ *
+ * Behaviors:
+ * - The stack of the new thread holds at least attr->stack_size bytes,
+ *   rounded up to a whole number of pages and to no less than
+ *   THREAD_MIN_STACK. It is followed by a guard page: a thread that
+ *   overflows its stack crashes the program with a message naming it.
+ *
+ * Return Values:
+ * - Same as thread_create.
+ */
+Tid thread_create_ex(thread_entry_f fn, void *arg,
+		     const struct thread_attr *attr);
+
 /*
  * Terminate the execution of the calling thread.
  *
@@ -149,6 +189,57 @@ Tid thread_kill(Tid tid);
  */
 Tid thread_yield(Tid tid);
 
+/*
+ * Set the priority of the thread specified by the identifier tid.
+ *
+ * Parameters:
+ * - tid: Identifier of the thread, which may be the calling thread.
+ * - prio: The new priority, from 0 (highest) to THREAD_PRIO_LEVELS-1.
+ *
+ * Behaviors:
+ * - The "prio" scheduler always runs the ready thread with the highest
+ *   priority next, and round-robin among threads of the same priority.
+ *   The "cfs" scheduler gives each thread a share of the processor that
+ *   grows by about a quarter per level of priority. Other schedulers
+ *   ignore priorities.
+ * - Raising the priority of a ready thread above that of the calling thread
+ *   does not switch to it before the calling thread next yields or is
+ *   preempted.
+ *
+ * Return Values:
+ * - On success, returns tid.
+ * - THREAD_INVALID: tid does not correspond to a valid thread that has not
+ *   exited, or prio is out of range.
+ */
+Tid thread_setprio(Tid tid, int prio);
+
+/* How evenly the processor is shared, see thread_stats */
+struct thread_stats {
+    int threads;           /* runnable threads, including the caller */
+    long long min_runtime; /* least processor time of one, in nanoseconds */
+    long long max_runtime; /* most processor time of one, in nanoseconds */
+    double fairness;       /* max_runtime / min_runtime, 1.0 is even */
+};
+
+/*
+ * Report the processor time used so far by the threads that are running or
+ * ready to run. Threads that are sleeping or have exited are left out, since
+ * they are not competing for the processor.
+ *
+ * Behaviors:
+ * - Runtimes are only measured under the "cfs" scheduler, or when
+ *   ut369_start was given a config with stats set, since measuring them
+ *   costs a system call per context switch.
+ * - fairness is 0.0 while some runnable thread has not run yet.
+ * - Under "cfs", the runtimes are in proportion to the weights of the
+ *   threads' priorities, so fairness is 1.0 only among equal priorities.
+ *
+ * Return Values:
+ * - On success, returns 0 and fills in *stats.
+ * - THREAD_INVALID: stats is NULL or runtimes are not measured.
+ */
+int thread_stats(struct thread_stats *stats);
+
 /**************************************************************************
  * (A2) API function and type declarations for preemptive threads only
  **************************************************************************/
@@ -0,0 +1,544 @@
+/** @file adapt.c
+ * @brief Adaptive replacement, switching algorithms at runtime by dueling.
+ *
+ * The candidates run unchanged on the coremap. Their shadows are small
+ * reimplementations of the same algorithms on slots of a shadow memory,
+ * indexed by page rather than frame: a page is the pid of the task
+ * referencing it and the virtual page number its frame is mapped at. The
+ * shadows draw random victims from a generator of their own, leaving the
+ * random() sequence of the simulation alone.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "adapt.h"
+#include "checkpoint.h"
+#include "coremap.h"
+#include "khash.h"
+#include "malloc369.h"
+#include "multiprocessing.h"
+#include "ptrarray.h"
+#include "sim.h"
+#include "types.h"
+
+#define NO_SLOT UINT32_MAX
+
+enum shadow_kind {
+	SHADOW_RAND,
+	SHADOW_RR,
+	SHADOW_CLOCK,
+	SHADOW_S2Q,
+};
+
+struct algorithm {
+	const char *name;
+	void (*init)();
+	void (*cleanup)();
+	void (*ref)(pfn_t);
+	pfn_t (*evict)();
+	void (*checkpoint)(struct checkpoint *);
+	void (*forget)(pfn_t);      /* Frame evicted by another algorithm */
+	enum shadow_kind shadow;
+};
+
+static const struct algorithm algorithms[] = {
+	{ "rand", rand_init, rand_cleanup, rand_ref, rand_evict,
+	  rand_checkpoint, NULL, SHADOW_RAND },
+	{ "rr", rr_init, rr_cleanup, rr_ref, rr_evict,
+	  rr_checkpoint, NULL, SHADOW_RR },
+	{ "clock", clock_init, clock_cleanup, clock_ref, clock_evict,
+	  clock_checkpoint, NULL, SHADOW_CLOCK },
+	{ "s2q", s2q_init, s2q_cleanup, s2q_ref, s2q_evict,
+	  s2q_checkpoint, s2q_forget, SHADOW_S2Q },
+};
+static const u32 nr_algorithms = sizeof(algorithms) / sizeof(algorithms[0]);
+
+/* Page -> its slot in a shadow memory */
+KHASH_MAP_INIT_INT64(shadow, u32)
+
+/* One candidate run on the sampled pages, in a memory of nr_slots slots */
+struct shadow {
+	khash_t(shadow) *slots;
+	u64 *pages;             /* Page held by every slot */
+	bool *refd;             /* clock */
+	u8 *state;              /* s2q, as in s2q.c */
+	u32 *next;
+	u32 *prev;
+	u32 a1_head, a1_tail;
+	u32 a2_head, a2_tail;
+	u32 a1_size;
+	u32 used;               /* Slots filled so far */
+	u32 hand;               /* rr and clock */
+	u64 rng;                /* rand */
+	size_t misses;          /* In the current window */
+	size_t total_misses;
+	size_t windows_led;
+};
+
+enum { S2Q_NONE, S2Q_A1, S2Q_A2 };
+
+static struct adapt_config config = { .nr_candidates = 0 };
+static bool running = false;
+
+static const struct algorithm *candidates[ADAPT_MAX_CANDIDATES];
+static struct shadow shadows[ADAPT_MAX_CANDIDATES];
+static u32 nr_candidates = 0;
+static u32 leader = 0;
+
+/* Challenger beating the leader, and for how many windows in a row */
+static u32 challenger = 0;
+static u32 streak = 0;
+
+/* Pages are sampled if the low sample_shift bits of their hash are 0 */
+static u32 sample_shift = 0;
+static u32 nr_slots = 0;
+static u32 a1_threshold = 0;
+
+static size_t refs = 0;
+static size_t refs_in_window = 0;
+static size_t window_index = 0;
+static size_t switches = 0;
+
+static FILE *log_out = NULL;
+
+/* splitmix64 finalizer */
+static inline u64
+page_hash(u64 page)
+{
+	page ^= page >> 30;
+	page *= 0xbf58476d1ce4e5b9ULL;
+	page ^= page >> 27;
+	page *= 0x94d049bb133111ebULL;
+	page ^= page >> 31;
+	return page;
+}
+
+/* xorshift64*, as in bench.c */
+static inline u64
+shadow_random(struct shadow *s)
+{
+	s->rng ^= s->rng >> 12;
+	s->rng ^= s->rng << 25;
+	s->rng ^= s->rng >> 27;
+	return s->rng * 0x2545f4914f6cdd1dULL;
+}
+
+/*
+ * Shadow memories
+ */
+
+static void
+queue_push_back(struct shadow *s, u32 *head, u32 *tail, u32 slot)
+{
+	s->next[slot] = NO_SLOT;
+	s->prev[slot] = *tail;
+	if (*head == NO_SLOT)
+		*head = slot;
+	else
+		s->next[*tail] = slot;
+	*tail = slot;
+}
+
+static void
+queue_remove(struct shadow *s, u32 *head, u32 *tail, u32 slot)
+{
+	const u32 p = s->prev[slot];
+	const u32 n = s->next[slot];
+
+	if (p != NO_SLOT)
+		s->next[p] = n;
+	else
+		*head = n;
+	if (n != NO_SLOT)
+		s->prev[n] = p;
+	else
+		*tail = p;
+}
+
+/* Account for a reference to the page in `slot`, new if `fresh`. */
+static void
+shadow_touch(struct shadow *s, enum shadow_kind kind, u32 slot, bool fresh)
+{
+	switch (kind) {
+	case SHADOW_RAND:
+	case SHADOW_RR:
+		break;
+	case SHADOW_CLOCK:
+		s->refd[slot] = true;
+		break;
+	case SHADOW_S2Q:
+		if (fresh) {
+			queue_push_back(s, &s->a1_head, &s->a1_tail, slot);
+			s->a1_size += 1;
+			s->state[slot] = S2Q_A1;
+		} else if (s->state[slot] == S2Q_A1) {
+			queue_remove(s, &s->a1_head, &s->a1_tail, slot);
+			s->a1_size -= 1;
+			queue_push_back(s, &s->a2_head, &s->a2_tail, slot);
+			s->state[slot] = S2Q_A2;
+		} else {
+			queue_remove(s, &s->a2_head, &s->a2_tail, slot);
+			queue_push_back(s, &s->a2_head, &s->a2_tail, slot);
+		}
+		break;
+	}
+}
+
+/* Pick the slot to give to a new page once the shadow memory is full. */
+static u32
+shadow_victim(struct shadow *s, enum shadow_kind kind)
+{
+	u32 victim;
+
+	switch (kind) {
+	case SHADOW_RAND:
+		return shadow_random(s) % nr_slots;
+	case SHADOW_RR:
+		victim = s->hand;
+		s->hand = (s->hand + 1) % nr_slots;
+		return victim;
+	case SHADOW_CLOCK:
+		while (s->refd[s->hand]) {
+			s->refd[s->hand] = false;
+			s->hand = (s->hand + 1) % nr_slots;
+		}
+		victim = s->hand;
+		s->hand = (s->hand + 1) % nr_slots;
+		return victim;
+	case SHADOW_S2Q:
+		if ((s->a1_size > a1_threshold && s->a1_head != NO_SLOT)
+		    || s->a2_head == NO_SLOT) {
+			victim = s->a1_head;
+			queue_remove(s, &s->a1_head, &s->a1_tail, victim);
+			s->a1_size -= 1;
+		} else {
+			victim = s->a2_head;
+			queue_remove(s, &s->a2_head, &s->a2_tail, victim);
+		}
+		s->state[victim] = S2Q_NONE;
+		return victim;
+	}
+	return 0;
+}
+
+static void
+shadow_ref(struct shadow *s, enum shadow_kind kind, u64 page)
+{
+	khiter_t it = kh_get(shadow, s->slots, page);
+	if (it != kh_end(s->slots)) {
+		shadow_touch(s, kind, kh_value(s->slots, it), false);
+		return;
+	}
+
+	s->misses += 1;
+	u32 slot;
+	if (s->used < nr_slots) {
+		slot = s->used++;
+	} else {
+		slot = shadow_victim(s, kind);
+		kh_del(shadow, s->slots, kh_get(shadow, s->slots, s->pages[slot]));
+	}
+
+	i32 ret;
+	it = kh_put(shadow, s->slots, page, &ret);
+	kh_value(s->slots, it) = slot;
+	s->pages[slot] = page;
+	shadow_touch(s, kind, slot, true);
+}
+
+static void
+shadow_init(struct shadow *s, u64 seed)
+{
+	memset(s, 0, sizeof(*s));
+	s->slots = kh_init(shadow);
+	s->pages = malloc369(nr_slots * sizeof(*s->pages));
+	s->refd = malloc369(nr_slots * sizeof(*s->refd));
+	s->state = malloc369(nr_slots * sizeof(*s->state));
+	s->next = malloc369(nr_slots * sizeof(*s->next));
+	s->prev = malloc369(nr_slots * sizeof(*s->prev));
+	if (s->slots == NULL || s->pages == NULL || s->refd == NULL
+	    || s->state == NULL || s->next == NULL || s->prev == NULL) {
+		perror("Failed to allocate a shadow memory");
+		exit(1);
+	}
+	memset(s->refd, 0, nr_slots * sizeof(*s->refd));
+	memset(s->state, 0, nr_slots * sizeof(*s->state));
+	s->a1_head = s->a1_tail = NO_SLOT;
+	s->a2_head = s->a2_tail = NO_SLOT;
+	s->rng = seed;
+}
+
+static void
+shadow_destroy(struct shadow *s)
+{
+	kh_destroy(shadow, s->slots);
+	free369(s->pages);
+	free369(s->refd);
+	free369(s->state);
+	free369(s->next);
+	free369(s->prev);
+	memset(s, 0, sizeof(*s));
+}
+
+/*
+ * Dueling
+ */
+
+/* Page held by `framenum`, named by the pid and vpn of its first pte, or 0
+ * if the frame no longer maps any page.
+ */
+static u64
+frame_page(pfn_t framenum)
+{
+	const ptrarray_slice_t ptes = get_referring_ptes(frame_from_number(framenum));
+	if (ptes.len == 0)
+		return 0;
+
+	const pt_entry_t *pte = ptes.ptr[0];
+	return (u64)pid_from_pte(pte) << 36 | (vpn_from_pte(pte) & VPN_MASK);
+}
+
+static void
+end_window(void)
+{
+	struct shadow *const lead = &shadows[leader];
+	u32 best = leader;
+
+	for (u32 i = 0; i < nr_candidates; i++) {
+		if (shadows[i].misses < shadows[best].misses)
+			best = i;
+	}
+
+	// The leader is only replaced by a clear and lasting winner. Windows
+	// too quiet to tell leave the streak as it was.
+	if (lead->misses >= ADAPT_MIN_MISSES) {
+		if (best != leader && shadows[best].misses * 100
+		    <= lead->misses * (100 - ADAPT_MARGIN)) {
+			streak = best == challenger ? streak + 1 : 1;
+			challenger = best;
+		} else {
+			streak = 0;
+		}
+	}
+
+	lead->windows_led += 1;
+	if (log_out != NULL) {
+		fprintf(log_out, "%zu,%zu,%s", window_index, refs,
+			candidates[leader]->name);
+		for (u32 i = 0; i < nr_candidates; i++)
+			fprintf(log_out, ",%zu", shadows[i].misses);
+		fprintf(log_out, ",%s\n", streak >= ADAPT_PATIENCE
+			? candidates[challenger]->name : "");
+	}
+
+	if (streak >= ADAPT_PATIENCE) {
+		leader = challenger;
+		streak = 0;
+		switches += 1;
+	}
+
+	for (u32 i = 0; i < nr_candidates; i++) {
+		shadows[i].total_misses += shadows[i].misses;
+		shadows[i].misses = 0;
+	}
+	refs_in_window = 0;
+	window_index += 1;
+}
+
+void
+adapt_ref(pfn_t framenum)
+{
+	for (u32 i = 0; i < nr_candidates; i++)
+		candidates[i]->ref(framenum);
+
+	const u64 page = frame_page(framenum);
+	if (page != 0
+	    && (page_hash(page) & ((1ULL << sample_shift) - 1)) == 0) {
+		for (u32 i = 0; i < nr_candidates; i++)
+			shadow_ref(&shadows[i], candidates[i]->shadow, page);
+	}
+
+	refs += 1;
+	if (++refs_in_window == config.window)
+		end_window();
+}
+
+/* s2q and the shadows count references */
+const bool adapt_compaction_safe = false;
+
+pfn_t
+adapt_evict(void)
+{
+	const pfn_t victim = candidates[leader]->evict();
+
+	for (u32 i = 0; i < nr_candidates; i++) {
+		if (i != leader && candidates[i]->forget != NULL)
+			candidates[i]->forget(victim);
+	}
+	return victim;
+}
+
+i32
+adapt_parse(struct adapt_config *cfg, const char *spec)
+{
+	char *names = strdup(spec);
+	char *save = NULL;
+	i32 err = 0;
+
+	if (names == NULL)
+		return -1;
+
+	cfg->nr_candidates = 0;
+	for (char *tok = strtok_r(names, ",", &save); tok != NULL && err == 0;
+	     tok = strtok_r(NULL, ",", &save)) {
+		u32 a = 0;
+		while (a < nr_algorithms && strcmp(tok, algorithms[a].name) != 0)
+			a++;
+
+		if (a == nr_algorithms || cfg->nr_candidates == ADAPT_MAX_CANDIDATES)
+			err = -1;
+		for (u32 i = 0; i < cfg->nr_candidates; i++)
+			err = cfg->candidates[i] == a ? -1 : err;
+		if (err == 0)
+			cfg->candidates[cfg->nr_candidates++] = a;
+	}
+	free(names);
+	return err == 0 && cfg->nr_candidates > 0 ? 0 : -1;
+}
+
+void
+adapt_configure(const struct adapt_config *cfg)
+{
+	config = *cfg;
+}
+
+void
+adapt_init(void)
+{
+	if (config.nr_candidates == 0) {
+		adapt_parse(&config, ADAPT_DEFAULT_CANDIDATES);
+		config.window = ADAPT_DEFAULT_WINDOW;
+		config.path = NULL;
+	}
+
+	nr_candidates = config.nr_candidates;
+	for (u32 i = 0; i < nr_candidates; i++) {
+		candidates[i] = &algorithms[config.candidates[i]];
+		candidates[i]->init();
+	}
+	leader = 0;
+	challenger = 0;
+	streak = 0;
+	refs = 0;
+	refs_in_window = 0;
+	window_index = 0;
+	switches = 0;
+
+	// Sample one page in 2^sample_shift, for shadows of at most
+	// ADAPT_SHADOW_FRAMES frames
+	sample_shift = 0;
+	while (cdiv(memsize, 1ULL << sample_shift) > ADAPT_SHADOW_FRAMES)
+		sample_shift++;
+	nr_slots = cdiv(memsize, 1ULL << sample_shift);
+	a1_threshold = nr_slots / 10 > 0 ? nr_slots / 10 : 1;
+	for (u32 i = 0; i < nr_candidates; i++)
+		shadow_init(&shadows[i], 369 + i);
+
+	if (config.path != NULL) {
+		log_out = fopen(config.path, "w");
+		if (log_out == NULL) {
+			perror(config.path);
+			exit(1);
+		}
+		fprintf(log_out, "window,refs,leader");
+		for (u32 i = 0; i < nr_candidates; i++)
+			fprintf(log_out, ",%s", candidates[i]->name);
+		fprintf(log_out, ",switch\n");
+	}
+	running = true;
+}
+
+void
+adapt_cleanup(void)
+{
+	for (u32 i = 0; i < nr_candidates; i++) {
+		candidates[i]->cleanup();
+		shadow_destroy(&shadows[i]);
+	}
+	if (log_out != NULL) {
+		fclose(log_out);
+		log_out = NULL;
+	}
+	nr_candidates = 0;
+	running = false;
+}
+
+void
+adapt_checkpoint(struct checkpoint *cp)
+{
+	checkpoint_check(cp, nr_candidates, "number of candidates");
+	for (u32 i = 0; i < nr_candidates; i++)
+		checkpoint_check(cp, config.candidates[i], "candidate algorithm");
+	checkpoint_check(cp, config.window, "adaptive window");
+	checkpoint_check(cp, nr_slots, "shadow memory size");
+
+	for (u32 i = 0; i < nr_candidates; i++) {
+		struct shadow *s = &shadows[i];
+
+		candidates[i]->checkpoint(cp);
+		checkpoint_data(cp, s->pages, nr_slots * sizeof(*s->pages));
+		checkpoint_data(cp, s->refd, nr_slots * sizeof(*s->refd));
+		checkpoint_data(cp, s->state, nr_slots * sizeof(*s->state));
+		checkpoint_data(cp, s->next, nr_slots * sizeof(*s->next));
+		checkpoint_data(cp, s->prev, nr_slots * sizeof(*s->prev));
+		checkpoint_var(cp, s->a1_head);
+		checkpoint_var(cp, s->a1_tail);
+		checkpoint_var(cp, s->a2_head);
+		checkpoint_var(cp, s->a2_tail);
+		checkpoint_var(cp, s->a1_size);
+		checkpoint_var(cp, s->used);
+		checkpoint_var(cp, s->hand);
+		checkpoint_var(cp, s->rng);
+		checkpoint_var(cp, s->misses);
+		checkpoint_var(cp, s->total_misses);
+		checkpoint_var(cp, s->windows_led);
+
+		if (!checkpoint_restoring(cp))
+			continue;
+
+		// The page index is rebuilt from the slots
+		kh_clear(shadow, s->slots);
+		for (u32 slot = 0; slot < s->used; slot++) {
+			i32 ret;
+			khiter_t it = kh_put(shadow, s->slots, s->pages[slot], &ret);
+			kh_value(s->slots, it) = slot;
+		}
+	}
+	checkpoint_var(cp, leader);
+	checkpoint_var(cp, challenger);
+	checkpoint_var(cp, streak);
+	checkpoint_var(cp, refs);
+	checkpoint_var(cp, refs_in_window);
+	checkpoint_var(cp, window_index);
+	checkpoint_var(cp, switches);
+}
+
+void
+adapt_report(void)
+{
+	if (!running)
+		return;
+
+	printf("Adaptive leader: %s, %zu switches in %zu windows\n",
+	       candidates[leader]->name, switches, window_index);
+	printf("Adaptive shadows: 1 page in %llu, %u frames\n",
+	       1ULL << sample_shift, nr_slots);
+	for (u32 i = 0; i < nr_candidates; i++) {
+		const struct shadow *s = &shadows[i];
+		printf("Adaptive %s: led %zu windows, %zu shadow misses\n",
+		       candidates[i]->name, s->windows_led,
+		       s->total_misses + s->misses);
+	}
+}
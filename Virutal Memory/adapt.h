@@ -0,0 +1,71 @@
+/** @file adapt.h
+ * @brief Adaptive replacement, switching algorithms at runtime by dueling.
+ *
+ * `-a adapt` runs several candidate algorithms on the coremap at once.
+ * Every reference goes to all of them, so that each keeps its state warm,
+ * but only the leader picks victims, the others forgetting the frames it
+ * evicts.
+ *
+ * Like the leader sets of set dueling, each candidate also runs alone on a
+ * shadow memory: the pages whose hash falls in a sample, in a memory
+ * scaled down by the same rate. At the end of every window of references,
+ * the candidate with the fewest shadow misses in the window takes the lead
+ * if it missed at least ADAPT_MARGIN percent less than the leader for
+ * ADAPT_PATIENCE windows in a row, so that noise does not make the lead
+ * flap between close candidates. Windows where the leader missed fewer
+ * than ADAPT_MIN_MISSES times in its shadow are too quiet to count: they
+ * neither extend nor break a run.
+ *
+ * Every window is logged as the CSV row
+ *
+ *   window,refs,leader,<misses of each candidate>...,switch
+ *
+ * where refs counts the references so far, leader is the algorithm that
+ * ran the window and switch names the new leader if the window made one.
+ */
+
+#ifndef __ADAPT_H__
+#define __ADAPT_H__
+
+#include "types.h"
+
+#define ADAPT_DEFAULT_CANDIDATES "clock,s2q,rr,rand"
+#define ADAPT_DEFAULT_WINDOW 10000
+#define DEFAULT_PHASE_LOG_PATH "phases.csv"
+
+/* Frames of every shadow memory, at most, which sets the sampling rate */
+#define ADAPT_SHADOW_FRAMES 512
+
+/* Hysteresis of a switch of leader */
+#define ADAPT_MARGIN 5
+#define ADAPT_PATIENCE 2
+#define ADAPT_MIN_MISSES 32
+
+/**
+ * @brief Parse the candidates given on the command line, as a list of
+ * algorithm names name,... the first one leading at the start.
+ *
+ * @return 0 on success, -1 if a name is not a replacement algorithm with a
+ * shadow, or is listed twice.
+ *
+ * @see adapt.c
+ */
+i32 adapt_parse(struct adapt_config *cfg, const char *spec);
+
+/**
+ * @brief Set the candidates, window and log of the next adapt_init().
+ * Without it, adapt_init() runs the default candidates with no log.
+ *
+ * @see adapt.c
+ */
+void adapt_configure(const struct adapt_config *cfg);
+
+/**
+ * @brief Print the leader and how each candidate fared, if the adaptive
+ * algorithm runs.
+ *
+ * @see adapt.c
+ */
+void adapt_report(void);
+
+#endif /* __ADAPT_H__ */
@@ -0,0 +1,864 @@
+/** @file bench.c
+ * @brief Microbenchmarks for the hot paths of the simulator.
+ *
+ * Modelled on Google Benchmark: every benchmark runs its timed loop with a
+ * growing number of iterations until one run takes at least the minimum
+ * time, and that run is reported in Google Benchmark's JSON format so that
+ * results can be tracked with its tooling (e.g. tools/compare.py).
+ *
+ *   simbench [-f regex] [-t seconds] [-o file]
+ *
+ * Address patterns are precomputed outside the timed loops. `make bench`
+ * runs this suite, plus the tlbp and cache_access benchmarks of a build
+ * without AVX2.
+ */
+
+#include <assert.h>
+#include <getopt.h>
+#include <math.h>
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "malloc369.h"
+#include "sim.h"
+#include "cache.h"
+#include "coremap.h"
+#include "latency.h"
+#include "numa.h"
+#include "swap.h"
+#include "tlb.h"
+#include "multiprocessing.h"
+#include "types.h"
+#include "parse_trace.h"
+
+/* Counters for paging-related events. Set in pagetable.c */
+extern size_t ram_miss_count;
+extern size_t ref_count;
+
+// Define global variables declared in sim.h
+size_t memsize = 0;
+i32 debug = 0;
+u8 *physmem = NULL;
+struct frame *coremap = NULL;
+void (*ref_func)(pfn_t) = NULL;
+pfn_t (*evict_func)() = NULL;
+
+#if defined(__x86_64__) && defined(__AVX2__)
+#define TLBP "tlbp_avx2"
+#define CACHE_ACCESS "cache_access_avx2"
+#else
+#define TLBP "tlbp_generic"
+#define CACHE_ACCESS "cache_access_generic"
+#endif
+
+#define DEFAULT_MIN_TIME 0.5
+#define MAX_ITERATIONS 1000000000ULL
+
+/* Keep the compiler from discarding a computed value */
+#define escape(x) __asm__ volatile("" : : "r"(x) : "memory")
+
+/*
+ * Harness
+ */
+
+struct bench_state {
+	u64 iterations;
+	u64 remaining;
+	bool started;
+	f64 real_start, cpu_start;
+	f64 real_time, cpu_time;   /* Seconds spent in the timed loop */
+
+	/* Set by the benchmark */
+	u64 items;                 /* Items processed per iteration */
+	u64 bytes;                 /* Bytes processed per iteration */
+	const char *counter;       /* Optional user counter */
+	f64 counter_value;
+};
+
+static f64
+now(clockid_t clock)
+{
+	struct timespec t;
+	clock_gettime(clock, &t);
+	return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+/* Stop timing, e.g. around per-iteration setup. */
+static void
+bench_pause(struct bench_state *st)
+{
+	st->real_time += now(CLOCK_MONOTONIC) - st->real_start;
+	st->cpu_time += now(CLOCK_PROCESS_CPUTIME_ID) - st->cpu_start;
+}
+
+static void
+bench_resume(struct bench_state *st)
+{
+	st->real_start = now(CLOCK_MONOTONIC);
+	st->cpu_start = now(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+/* Loop condition of every timed loop, starting the timer on the first
+ * iteration and stopping it after the last.
+ */
+static inline bool
+keep_running(struct bench_state *st)
+{
+	if (__builtin_expect(st->remaining > 0, true)) {
+		if (__builtin_expect(!st->started, false)) {
+			st->started = true;
+			bench_resume(st);
+		}
+		st->remaining -= 1;
+		return true;
+	}
+
+	bench_pause(st);
+	return false;
+}
+
+/*
+ * Address patterns
+ */
+
+enum pattern_kind {
+	SEQUENTIAL,
+	STRIDED,        /* PATTERN_STRIDE pages apart, wrapping with an offset */
+	RANDOM,         /* A random permutation, every page once per cycle */
+	ZIPF,
+};
+
+#define PATTERN_STRIDE 512      /* One leaf of the page table per step */
+#define ZIPF_SAMPLES (1 << 16)
+#define ZIPF_SKEW 0.99
+
+struct pattern {
+	u32 *pages;
+	size_t len;
+	size_t pos;
+};
+
+static u64 rng_state = 369;
+
+/* xorshift64*, leaving random() to the replacement algorithms and tlb */
+static u64
+rng_next(void)
+{
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+static void
+shuffle(u32 *pages, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		pages[i] = i;
+	for (size_t i = n - 1; i > 0; i--) {
+		const size_t j = rng_next() % (i + 1);
+		const u32 tmp = pages[i];
+		pages[i] = pages[j];
+		pages[j] = tmp;
+	}
+}
+
+/* Fill `p` with page indices in [0, range) following `kind`. */
+static void
+pattern_init(struct pattern *p, enum pattern_kind kind, size_t range)
+{
+	p->len = kind == ZIPF ? ZIPF_SAMPLES : range;
+	p->pos = 0;
+	p->pages = malloc(p->len * sizeof(u32));
+	assert(p->pages != NULL);
+
+	switch (kind) {
+	case SEQUENTIAL:
+		for (size_t i = 0; i < range; i++)
+			p->pages[i] = i;
+		break;
+	case STRIDED:
+		for (size_t i = 0; i < range; i++)
+			p->pages[i] = (i * PATTERN_STRIDE + i * PATTERN_STRIDE / range)
+				% range;
+		break;
+	case RANDOM:
+		shuffle(p->pages, range);
+		break;
+	case ZIPF: {
+		// Sample ranks by inverting the cdf, then scatter the ranks so
+		// that the hot pages are not adjacent
+		f64 *cdf = malloc(range * sizeof(f64));
+		u32 *scatter = malloc(range * sizeof(u32));
+		assert(cdf != NULL && scatter != NULL);
+
+		f64 sum = 0;
+		for (size_t k = 0; k < range; k++) {
+			sum += 1.0 / pow(k + 1, ZIPF_SKEW);
+			cdf[k] = sum;
+		}
+		shuffle(scatter, range);
+
+		for (size_t i = 0; i < p->len; i++) {
+			const f64 u = (rng_next() >> 11) * 0x1.0p-53 * sum;
+			size_t lo = 0;
+			size_t hi = range - 1;
+			while (lo < hi) {
+				const size_t mid = (lo + hi) / 2;
+				if (cdf[mid] < u)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+			p->pages[i] = scatter[lo];
+		}
+		free(cdf);
+		free(scatter);
+		break;
+	}
+	}
+}
+
+static void
+pattern_destroy(struct pattern *p)
+{
+	free(p->pages);
+	p->pages = NULL;
+}
+
+static inline u32
+pattern_next(struct pattern *p)
+{
+	const u32 page = p->pages[p->pos];
+	if (++p->pos == p->len)
+		p->pos = 0;
+	return page;
+}
+
+/*
+ * Simulated machine
+ */
+
+#define BENCH_TLB_SIZE 64
+#define BENCH_SWAP_RATIO 4      /* Swap slots per frame */
+
+struct functions {
+	const char *name;
+	void (*init)();
+	void (*cleanup)();
+	void (*ref)(pfn_t);
+	pfn_t (*evict)();
+};
+
+static struct functions algs[] = {
+#define RA(name) \
+	{ #name, name ## _init, name ## _cleanup, name ## _ref, name ## _evict },
+REPLACEMENT_ALGORITHMS
+#undef RA
+};
+static i32 num_algs = sizeof(algs) / sizeof(algs[0]);
+
+static void (*cleanup_func)() = NULL;
+
+static void
+tlb_setup(tlb_index_t size)
+{
+	struct tlb_config cfg = { .seed = 369, .size = size };
+	destroy_soft_tlb();
+	init_soft_tlb(&cfg);
+}
+
+/* Bring up a machine of `frames` frames managed by `policy`, running a
+ * single task with an empty address space.
+ */
+static void
+vm_setup(size_t frames, const char *policy)
+{
+	struct mp_config mp_cfg = { .max_nr_tasks = -1 };
+	struct numa_config numa_cfg = { .nodes = 1 };
+	struct latency_config latency_cfg = {
+	    .tlb_lookup = LAT_DEFAULT_TLB_LOOKUP,
+	    .walk_step = LAT_DEFAULT_WALK_STEP,
+	    .fault = LAT_DEFAULT_FAULT,
+	    .swap_in = LAT_DEFAULT_SWAP_IN,
+	    .swap_out = LAT_DEFAULT_SWAP_OUT,
+	    .shootdown = LAT_DEFAULT_SHOOTDOWN,
+	    .remote = LAT_DEFAULT_REMOTE,
+	    .ghz = LAT_DEFAULT_GHZ,
+	};
+
+	tlb_setup(BENCH_TLB_SIZE);
+	memsize = frames;
+	init_coremap();
+	physmem = mmap369(memsize * SIMPAGESIZE);
+	assert(physmem != NULL);
+	swap_init(memsize * BENCH_SWAP_RATIO);
+	numa_init(&numa_cfg);
+	init_multiprocessing(&mp_cfg);
+	latency_init(&latency_cfg);
+
+	for (i32 i = 0; i < num_algs; ++i) {
+		if (strcmp(algs[i].name, policy) == 0) {
+			cleanup_func = algs[i].cleanup;
+			ref_func = algs[i].ref;
+			evict_func = algs[i].evict;
+			algs[i].init();
+			break;
+		}
+	}
+	assert(evict_func != NULL);
+
+	task_switch(create_task(0));
+}
+
+static void
+vm_teardown(void)
+{
+	for (i32 i = 0; i < get_max_nr_tasks(); ++i) {
+		if (get_task_by_id(i)->mm != NULL)
+			free_task(get_task_by_id(i));
+	}
+
+	cleanup_func();
+	latency_destroy();
+	numa_destroy();
+	destroy_coremap();
+	munmap369(physmem, memsize * SIMPAGESIZE);
+	physmem = NULL;
+	swap_destroy();
+	free_multiprocessing();
+	ref_func = NULL;
+	evict_func = NULL;
+	tlb_setup(BENCH_TLB_SIZE);
+}
+
+static pagetable_t *
+current_pagetable(void)
+{
+	return get_pagetable(current_task()->mm);
+}
+
+/* Fault in pages [0, npages) of `pt` by writing them. */
+static void
+populate(pagetable_t *pt, size_t npages)
+{
+	for (size_t i = 0; i < npages; i++)
+		page_walk(pt, (vaddr_t)i << PAGE_SHIFT, 'S');
+}
+
+/*
+ * Benchmarks
+ */
+
+struct bench_args {
+	enum pattern_kind pattern;
+	size_t pages;           /* tlb size, working set or memory size */
+	const char *policy;
+};
+
+/* tlbp on a full tlb, looking up entries it holds. */
+static void
+bm_tlbp_hit(struct bench_state *st, const struct bench_args *args)
+{
+	struct pattern p;
+	tlb_index_t sink = 0;
+
+	tlb_setup(args->pages);
+	for (size_t i = 0; i < args->pages; i++) {
+		tlb_entry_t entry = { .fields = {
+			.pfn = i, .dirty = true, .vpn = i, .valid = true, .asid = 0,
+		} };
+		tlbwi(i, &entry);
+	}
+	pattern_init(&p, args->pattern, args->pages);
+
+	while (keep_running(st))
+		sink ^= tlbp(0, pattern_next(&p));
+	escape(sink);
+
+	st->items = 1;
+	pattern_destroy(&p);
+	tlb_setup(BENCH_TLB_SIZE);
+}
+
+/* tlbp on a full tlb, looking up entries it does not hold. */
+static void
+bm_tlbp_miss(struct bench_state *st, const struct bench_args *args)
+{
+	struct pattern p;
+	tlb_index_t sink = 0;
+
+	tlb_setup(args->pages);
+	for (size_t i = 0; i < args->pages; i++) {
+		tlb_entry_t entry = { .fields = {
+			.pfn = i, .dirty = true, .vpn = i, .valid = true, .asid = 0,
+		} };
+		tlbwi(i, &entry);
+	}
+	pattern_init(&p, args->pattern, args->pages);
+
+	while (keep_running(st))
+		sink ^= tlbp(0, args->pages + pattern_next(&p));
+	escape(sink);
+
+	st->items = 1;
+	pattern_destroy(&p);
+	tlb_setup(BENCH_TLB_SIZE);
+}
+
+/* Loads to `pages` distinct lines through a three level hierarchy, with
+ * the inclusion policy named by `policy`.
+ */
+static void
+bm_cache_access(struct bench_state *st, const struct bench_args *args)
+{
+	struct cache_config cfg = { .line = CACHE_DEFAULT_LINE };
+	struct pattern p;
+
+	cache_parse(&cfg, "32k:8,256k:8,8m:16");
+	cfg.inclusion = cache_parse_inclusion(args->policy);
+	cache_init(&cfg);
+	pattern_init(&p, args->pattern, args->pages);
+
+	while (keep_running(st))
+		cache_access((paddr_t)pattern_next(&p) * CACHE_DEFAULT_LINE, false);
+
+	st->items = 1;
+	pattern_destroy(&p);
+	cache_destroy();
+}
+
+/* Loads through tlb_translate over a resident working set. */
+static void
+bm_tlb_translate(struct bench_state *st, const struct bench_args *args)
+{
+	struct pattern p;
+	paddr_t sink = 0;
+
+	vm_setup(args->pages * 2, "clock");
+	pagetable_t *pt = current_pagetable();
+	for (size_t i = 0; i < args->pages; i++)
+		tlb_translate('S', 0, pt, (vaddr_t)i << PAGE_SHIFT);
+	pattern_init(&p, args->pattern, args->pages);
+
+	while (keep_running(st)) {
+		const vaddr_t vaddr = (vaddr_t)pattern_next(&p) << PAGE_SHIFT;
+		sink ^= tlb_translate('L', 0, pt, vaddr);
+	}
+	escape(sink);
+
+	st->items = 1;
+	pattern_destroy(&p);
+	vm_teardown();
+}
+
+/* page_walk to resident pages. */
+static void
+bm_page_walk_hit(struct bench_state *st, const struct bench_args *args)
+{
+	struct pattern p;
+
+	vm_setup(args->pages * 2, "clock");
+	pagetable_t *pt = current_pagetable();
+	populate(pt, args->pages);
+	pattern_init(&p, args->pattern, args->pages);
+
+	while (keep_running(st)) {
+		pt_entry_t *pte = page_walk(pt, (vaddr_t)pattern_next(&p) << PAGE_SHIFT, 'L');
+		escape(pte);
+	}
+
+	st->items = 1;
+	pattern_destroy(&p);
+	vm_teardown();
+}
+
+/* page_walk to pages never touched before, with free frames to hold them.
+ * The address space is replaced whenever every page has been touched.
+ */
+static void
+bm_page_walk_miss(struct bench_state *st, const struct bench_args *args)
+{
+	struct pattern p;
+	size_t touched = 0;
+
+	vm_setup(args->pages, "clock");
+	pagetable_t *pt = current_pagetable();
+	pattern_init(&p, args->pattern, args->pages);
+
+	while (keep_running(st)) {
+		if (touched == args->pages) {
+			bench_pause(st);
+			free_task(current_task());
+			task_switch(create_task(0));
+			pt = current_pagetable();
+			touched = 0;
+			bench_resume(st);
+		}
+		pt_entry_t *pte = page_walk(pt, (vaddr_t)pattern_next(&p) << PAGE_SHIFT, 'L');
+		escape(pte);
+		touched += 1;
+	}
+
+	st->items = 1;
+	pattern_destroy(&p);
+	vm_teardown();
+}
+
+/* Fork of an address space with `pages` resident pages. */
+static void
+bm_duplicate_pagetable(struct bench_state *st, const struct bench_args *args)
+{
+	vm_setup(args->pages * 2, "clock");
+	pagetable_t *pt = current_pagetable();
+	populate(pt, args->pages);
+
+	while (keep_running(st)) {
+		pagetable_t *child = duplicate_pagetable(pt, 0);
+		bench_pause(st);
+		free_pagetable(child);
+		bench_resume(st);
+	}
+
+	st->items = args->pages;
+	vm_teardown();
+}
+
+/* Teardown of an address space with `pages` resident pages. */
+static void
+bm_free_pagetable(struct bench_state *st, const struct bench_args *args)
+{
+	vm_setup(args->pages * 2, "clock");
+
+	while (keep_running(st)) {
+		bench_pause(st);
+		pagetable_t *pt = create_pagetable();
+		populate(pt, args->pages);
+		bench_resume(st);
+		free_pagetable(pt);
+	}
+
+	st->items = args->pages;
+	vm_teardown();
+}
+
+/* Loads to a working set twice the size of memory, so that most faults
+ * allocate a frame by evicting another.
+ */
+static void
+bm_allocate_frame(struct bench_state *st, const struct bench_args *args)
+{
+	struct pattern p;
+
+	vm_setup(args->pages / 2, args->policy);
+	pagetable_t *pt = current_pagetable();
+	populate(pt, args->pages);
+	pattern_init(&p, args->pattern, args->pages);
+
+	const size_t refs = ref_count;
+	const size_t misses = ram_miss_count;
+	while (keep_running(st)) {
+		const pfn_t frame = framenum_from_pte(
+			page_walk(pt, (vaddr_t)pattern_next(&p) << PAGE_SHIFT, 'L'));
+		ref_func(frame);
+	}
+
+	st->items = 1;
+	st->counter = "miss_rate";
+	st->counter_value = (f64)(ram_miss_count - misses) / (ref_count - refs);
+	pattern_destroy(&p);
+	vm_teardown();
+}
+
+/* Victim selection in a full memory, each victim being referenced again
+ * as if it had been reallocated, between references following `pattern`.
+ */
+static void
+bm_evict(struct bench_state *st, const struct bench_args *args)
+{
+	struct pattern p;
+	pfn_t sink = 0;
+
+	vm_setup(args->pages, args->policy);
+	populate(current_pagetable(), args->pages);
+	for (size_t i = 0; i < args->pages; i++)
+		ref_func(i);
+	pattern_init(&p, args->pattern, args->pages);
+
+	while (keep_running(st)) {
+		ref_func(pattern_next(&p));
+		const pfn_t victim = evict_func();
+		ref_func(victim);
+		sink ^= victim;
+	}
+	escape(sink);
+
+	st->items = 1;
+	pattern_destroy(&p);
+	vm_teardown();
+}
+
+/* get_traceline over a synthetic trace of `pages` lines. */
+static void
+bm_get_traceline(struct bench_state *st, const struct bench_args *args)
+{
+	char path[] = "/tmp/simbench-XXXXXX";
+	struct pattern p;
+	struct trace_line tl = { .vpid = 0, .reftype = 'L' };
+	vaddr_t sink = 0;
+
+	const int fd = mkstemp(path);
+	assert(fd >= 0);
+	FILE *f = fdopen(fd, "w");
+	assert(f != NULL);
+	pattern_init(&p, args->pattern, args->pages);
+	for (size_t i = 0; i < args->pages; i++) {
+		tl.vaddr = (vaddr_t)pattern_next(&p) << PAGE_SHIFT;
+		fwrite(&tl, sizeof(tl), 1, f);
+	}
+	fclose(f);
+	pattern_destroy(&p);
+
+	init_parse_trace(path);
+	while (keep_running(st)) {
+		if (!get_traceline(&tl)) {
+			bench_pause(st);
+			destroy_parse_trace();
+			init_parse_trace(path);
+			bench_resume(st);
+			get_traceline(&tl);
+		}
+		sink ^= tl.vaddr;
+	}
+	escape(sink);
+	destroy_parse_trace();
+	unlink(path);
+
+	st->items = 1;
+	st->bytes = sizeof(struct trace_line);
+}
+
+struct benchmark {
+	const char *name;
+	void (*fn)(struct bench_state *, const struct bench_args *);
+	struct bench_args args;
+};
+
+#define POLICY_BENCHMARKS(name, pattern, pattern_name) \
+	{ "evict/" #name "/" pattern_name, bm_evict, { pattern, 4096, #name } }, \
+	{ "allocate_frame/" #name "/" pattern_name, bm_allocate_frame, \
+	  { pattern, 8192, #name } },
+
+static const struct benchmark benchmarks[] = {
+	{ TLBP "/hit/16", bm_tlbp_hit, { RANDOM, 16, NULL } },
+	{ TLBP "/hit/64", bm_tlbp_hit, { RANDOM, 64, NULL } },
+	{ TLBP "/hit/255", bm_tlbp_hit, { RANDOM, 255, NULL } },
+	{ TLBP "/miss/16", bm_tlbp_miss, { RANDOM, 16, NULL } },
+	{ TLBP "/miss/64", bm_tlbp_miss, { RANDOM, 64, NULL } },
+	{ TLBP "/miss/255", bm_tlbp_miss, { RANDOM, 255, NULL } },
+
+	{ CACHE_ACCESS "/nine/random/512", bm_cache_access, { RANDOM, 512, "nine" } },
+	{ CACHE_ACCESS "/nine/random/4096", bm_cache_access, { RANDOM, 4096, "nine" } },
+	{ CACHE_ACCESS "/nine/random/131072", bm_cache_access, { RANDOM, 131072, "nine" } },
+	{ CACHE_ACCESS "/nine/random/1048576", bm_cache_access, { RANDOM, 1 << 20, "nine" } },
+	{ CACHE_ACCESS "/nine/zipf/1048576", bm_cache_access, { ZIPF, 1 << 20, "nine" } },
+	{ CACHE_ACCESS "/inclusive/random/1048576", bm_cache_access,
+	  { RANDOM, 1 << 20, "inclusive" } },
+	{ CACHE_ACCESS "/exclusive/random/1048576", bm_cache_access,
+	  { RANDOM, 1 << 20, "exclusive" } },
+
+	{ "tlb_translate/sequential/64", bm_tlb_translate, { SEQUENTIAL, 64, NULL } },
+	{ "tlb_translate/random/64", bm_tlb_translate, { RANDOM, 64, NULL } },
+	{ "tlb_translate/sequential/16384", bm_tlb_translate, { SEQUENTIAL, 16384, NULL } },
+	{ "tlb_translate/strided/16384", bm_tlb_translate, { STRIDED, 16384, NULL } },
+	{ "tlb_translate/random/16384", bm_tlb_translate, { RANDOM, 16384, NULL } },
+	{ "tlb_translate/zipf/16384", bm_tlb_translate, { ZIPF, 16384, NULL } },
+
+	{ "page_walk/hit/sequential/16384", bm_page_walk_hit, { SEQUENTIAL, 16384, NULL } },
+	{ "page_walk/hit/strided/16384", bm_page_walk_hit, { STRIDED, 16384, NULL } },
+	{ "page_walk/hit/random/16384", bm_page_walk_hit, { RANDOM, 16384, NULL } },
+	{ "page_walk/hit/zipf/16384", bm_page_walk_hit, { ZIPF, 16384, NULL } },
+	{ "page_walk/miss/sequential/16384", bm_page_walk_miss, { SEQUENTIAL, 16384, NULL } },
+	{ "page_walk/miss/strided/16384", bm_page_walk_miss, { STRIDED, 16384, NULL } },
+	{ "page_walk/miss/random/16384", bm_page_walk_miss, { RANDOM, 16384, NULL } },
+
+	{ "duplicate_pagetable/1024", bm_duplicate_pagetable, { SEQUENTIAL, 1024, NULL } },
+	{ "duplicate_pagetable/16384", bm_duplicate_pagetable, { SEQUENTIAL, 16384, NULL } },
+	{ "free_pagetable/1024", bm_free_pagetable, { SEQUENTIAL, 1024, NULL } },
+	{ "free_pagetable/16384", bm_free_pagetable, { SEQUENTIAL, 16384, NULL } },
+
+#define RA(name) \
+	POLICY_BENCHMARKS(name, SEQUENTIAL, "sequential") \
+	POLICY_BENCHMARKS(name, RANDOM, "random") \
+	POLICY_BENCHMARKS(name, ZIPF, "zipf")
+REPLACEMENT_ALGORITHMS
+#undef RA
+
+	{ "get_traceline/sequential/1048576", bm_get_traceline, { SEQUENTIAL, 1 << 20, NULL } },
+};
+static const i32 num_benchmarks = sizeof(benchmarks) / sizeof(benchmarks[0]);
+
+/*
+ * Reporting
+ */
+
+static void
+report_context(FILE *out, const char *executable)
+{
+	char date[64];
+	char host[256] = "";
+	const time_t t = time(NULL);
+
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&t));
+	gethostname(host, sizeof(host) - 1);
+
+	fprintf(out, "{\n  \"context\": {\n");
+	fprintf(out, "    \"date\": \"%s\",\n", date);
+	fprintf(out, "    \"host_name\": \"%s\",\n", host);
+	fprintf(out, "    \"executable\": \"%s\",\n", executable);
+	fprintf(out, "    \"num_cpus\": %ld,\n", sysconf(_SC_NPROCESSORS_ONLN));
+	fprintf(out, "    \"tlbp\": \"%s\",\n", TLBP);
+#ifdef __OPTIMIZE__
+	fprintf(out, "    \"library_build_type\": \"release\"\n");
+#else
+	fprintf(out, "    \"library_build_type\": \"debug\"\n");
+#endif
+	fprintf(out, "  },\n  \"benchmarks\": [");
+}
+
+static void
+report_run(FILE *out, bool first, const char *name, const struct bench_state *st)
+{
+	const f64 real_ns = st->real_time * 1e9 / st->iterations;
+	const f64 cpu_ns = st->cpu_time * 1e9 / st->iterations;
+
+	fprintf(out, "%s\n    {\n", first ? "" : ",");
+	fprintf(out, "      \"name\": \"%s\",\n", name);
+	fprintf(out, "      \"run_name\": \"%s\",\n", name);
+	fprintf(out, "      \"run_type\": \"iteration\",\n");
+	fprintf(out, "      \"repetitions\": 1,\n");
+	fprintf(out, "      \"repetition_index\": 0,\n");
+	fprintf(out, "      \"threads\": 1,\n");
+	fprintf(out, "      \"iterations\": %lu,\n", st->iterations);
+	fprintf(out, "      \"real_time\": %e,\n", real_ns);
+	fprintf(out, "      \"cpu_time\": %e,\n", cpu_ns);
+	if (st->items > 0) {
+		fprintf(out, "      \"items_per_second\": %e,\n",
+			st->items * st->iterations / st->real_time);
+	}
+	if (st->bytes > 0) {
+		fprintf(out, "      \"bytes_per_second\": %e,\n",
+			st->bytes * st->iterations / st->real_time);
+	}
+	if (st->counter != NULL) {
+		fprintf(out, "      \"%s\": %e,\n", st->counter, st->counter_value);
+	}
+	fprintf(out, "      \"time_unit\": \"ns\"\n    }");
+
+	fprintf(stderr, "%-40s %12.1f ns %12.1f ns %12lu\n",
+		name, real_ns, cpu_ns, st->iterations);
+}
+
+/* Run `b` with more and more iterations until it takes `min_time`, the
+ * same way Google Benchmark does, and return the last run.
+ */
+static struct bench_state
+run_benchmark(const struct benchmark *b, f64 min_time)
+{
+	u64 iterations = 1;
+	struct bench_state st;
+
+	while (true) {
+		st = (struct bench_state) {
+			.iterations = iterations,
+			.remaining = iterations,
+		};
+		b->fn(&st, &b->args);
+
+		if (st.real_time >= min_time || iterations >= MAX_ITERATIONS)
+			return st;
+
+		f64 multiplier = min_time * 1.4 / fmax(st.real_time, 1e-9);
+		if (st.real_time / min_time <= 0.1)
+			multiplier = 10.0;
+
+		const f64 next = fmax(multiplier * iterations, iterations + 1);
+		iterations = next < MAX_ITERATIONS ? (u64)next : MAX_ITERATIONS;
+	}
+}
+
+void
+usage(char *prog)
+{
+	fprintf(stderr, "USAGE: %s [-f regex] [-t seconds] [-o file]\n", prog);
+	fprintf(stderr, "\t-f regex   - only run benchmarks whose name matches\n");
+	fprintf(stderr, "\t-t seconds - minimum time of each benchmark (default %.1f)\n",
+		DEFAULT_MIN_TIME);
+	fprintf(stderr, "\t-o file    - write the json report to file (default stdout)\n");
+}
+
+i32
+main(i32 argc, char *argv[])
+{
+	const char *filter = ".";
+	f64 min_time = DEFAULT_MIN_TIME;
+	FILE *out = stdout;
+	regex_t re;
+	i32 opt;
+
+	while ((opt = getopt(argc, argv, "f:t:o:h")) != -1) {
+		switch (opt) {
+		case 'f':
+			filter = optarg;
+			break;
+		case 't':
+			min_time = strtod(optarg, NULL);
+			break;
+		case 'o':
+			out = fopen(optarg, "w");
+			if (out == NULL) {
+				perror(optarg);
+				return 1;
+			}
+			break;
+		case 'h':
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (regcomp(&re, filter, REG_EXTENDED | REG_NOSUB) != 0) {
+		fprintf(stderr, "Error: invalid filter - %s\n", filter);
+		return 1;
+	}
+
+	init_csc369_malloc(false);
+	tlb_setup(BENCH_TLB_SIZE);
+
+	report_context(out, argv[0]);
+	fprintf(stderr, "%-40s %15s %15s %12s\n",
+		"Benchmark", "Time", "CPU", "Iterations");
+
+	bool first = true;
+	for (i32 i = 0; i < num_benchmarks; ++i) {
+		if (regexec(&re, benchmarks[i].name, 0, NULL, 0) != 0)
+			continue;
+
+		const struct bench_state st = run_benchmark(&benchmarks[i], min_time);
+		report_run(out, first, benchmarks[i].name, &st);
+		first = false;
+	}
+	fprintf(out, "\n  ]\n}\n");
+
+	regfree(&re);
+	if (out != stdout)
+		fclose(out);
+	destroy_csc369_malloc();
+	destroy_soft_tlb();
+	return 0;
+}
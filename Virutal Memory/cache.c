@@ -0,0 +1,525 @@
+/** @file cache.c
+ * @brief Set-associative caches on physical addresses.
+ *
+ * Every cache keeps, for each set, the tags of its ways back to back and
+ * padded to a multiple of four, so that a lookup is a few vector compares,
+ * and the last use of every way apart from them, only read to pick a
+ * victim. A tag is the line number with a valid and a dirty bit, and an
+ * unused way is all zero.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "checkpoint.h"
+#include "malloc369.h"
+#include "sim.h"
+#include "tlb.h"
+#include "types.h"
+
+#if defined(__x86_64__) && defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#define TAG_VALID (1ULL << 63)
+#define TAG_DIRTY (1ULL << 62)
+#define TAG_LINE (TAG_DIRTY - 1)
+
+struct cache {
+	u64 *tags;          /* `stride` tags per set */
+	u64 *stamps;        /* Last use of every way */
+	u32 nr_sets;
+	u32 ways;
+	u32 stride;         /* Ways rounded up to a multiple of four */
+	u32 level;
+};
+
+u32 cache_nr_levels = 0;
+u32 cache_nr_colours = 0;
+
+static const char *const inclusion_names[CACHE_NR_INCLUSIONS] = {
+	[CACHE_NINE] = "nine",
+	[CACHE_INCLUSIVE] = "inclusive",
+	[CACHE_EXCLUSIVE] = "exclusive",
+};
+
+static enum cache_inclusion inclusion = CACHE_NINE;
+static u32 line_shift = 0;
+
+/* The private levels of every cpu, then the shared last level */
+static struct cache caches[TLB_MAX_CPUS * (CACHE_MAX_LEVELS - 1) + 1];
+static u32 nr_caches = 0;
+
+/* Levels private to each cpu, all but the last */
+static u32 nr_private = 0;
+static u32 nr_cpus = 1;
+
+/* The caches seen by every cpu, L1 first */
+static struct cache *hierarchy[TLB_MAX_CPUS][CACHE_MAX_LEVELS];
+
+/* Stamp of the latest lookup */
+static u64 tick = 0;
+
+static struct cache_level_stats stats[CACHE_MAX_LEVELS];
+static size_t memory_writebacks = 0;
+static size_t coherence_invalidations = 0;
+
+/* Frames allocated with page colouring, and those in the right colour */
+static size_t frames_placed = 0;
+static size_t frames_coloured = 0;
+
+/* Find the way of the set at `set` holding `tag`, or return -1. */
+#if defined(__x86_64__) && defined(__AVX2__)
+[[gnu::hot]]
+static inline i32
+probe(const u64 *set, u32 stride, u64 tag)
+{
+	const __m256i mask_vec = _mm256_set1_epi64x(~TAG_DIRTY);
+	const __m256i target_vec = _mm256_set1_epi64x(tag);
+
+	for (u32 w = 0; w < stride; w += 4) {
+		__m256i current_vec = _mm256_load_si256((const __m256i *)&set[w]);
+		__m256i comparison = _mm256_cmpeq_epi64(
+			_mm256_and_si256(current_vec, mask_vec), target_vec);
+		i32 movemask = _mm256_movemask_epi8(comparison);
+
+		if (movemask != 0)
+			return w + (__builtin_ctz(movemask) >> 3);
+	}
+	return -1;
+}
+#else
+[[gnu::hot]]
+static inline i32
+probe(const u64 *set, u32 stride, u64 tag)
+{
+	for (u32 w = 0; w < stride; w++) {
+		if ((set[w] & ~TAG_DIRTY) == tag)
+			return w;
+	}
+	return -1;
+}
+#endif
+
+static inline size_t
+set_base(const struct cache *c, u64 line)
+{
+	return (line & (c->nr_sets - 1)) * c->stride;
+}
+
+/* Return the tag of `line` in `c`, or NULL if `c` does not hold it. */
+static inline u64 *
+find(const struct cache *c, u64 line)
+{
+	const size_t base = set_base(c, line);
+	const i32 way = probe(&c->tags[base], c->stride, TAG_VALID | line);
+	return way >= 0 ? &c->tags[base + way] : NULL;
+}
+
+/* As find(), making the line the most recently used of its set. */
+static inline u64 *
+lookup(struct cache *c, u64 line)
+{
+	u64 *tag = find(c, line);
+	if (tag != NULL)
+		c->stamps[tag - c->tags] = ++tick;
+	return tag;
+}
+
+/* Put `line`, which `c` does not hold, in a free way of its set or in place
+ * of the least recently used one, and return the tag replaced, 0 if none.
+ */
+static u64
+insert(struct cache *c, u64 line, bool dirty)
+{
+	const size_t base = set_base(c, line);
+	u64 *tags = &c->tags[base];
+	u64 *stamps = &c->stamps[base];
+	u32 victim = 0;
+
+	for (u32 w = 0; w < c->ways; w++) {
+		if ((tags[w] & TAG_VALID) == 0) {
+			victim = w;
+			break;
+		}
+		if (stamps[w] < stamps[victim])
+			victim = w;
+	}
+
+	const u64 old = tags[victim];
+	tags[victim] = TAG_VALID | (dirty ? TAG_DIRTY : 0) | line;
+	stamps[victim] = ++tick;
+	return old;
+}
+
+/* Drop `line` from `c`, returning its tag, 0 if `c` did not hold it. */
+static inline u64
+drop(struct cache *c, u64 line)
+{
+	u64 *tag = find(c, line);
+	if (tag == NULL)
+		return 0;
+
+	const u64 old = *tag;
+	*tag = 0;
+	return old;
+}
+
+/* Write a dirty line evicted from `level` to the first level below that
+ * holds it, or to memory.
+ */
+static void
+write_back(struct cache **h, u32 level, u64 line)
+{
+	stats[level].writebacks += 1;
+	for (u32 l = level + 1; l < cache_nr_levels; l++) {
+		u64 *tag = find(h[l], line);
+		if (tag != NULL) {
+			*tag |= TAG_DIRTY;
+			return;
+		}
+	}
+	memory_writebacks += 1;
+}
+
+/* Drop `line` from the levels above `level` of every cpu sharing it, and
+ * return whether one of the copies dropped was dirty.
+ */
+static bool
+back_invalidate(u32 cpu, u32 level, u64 line)
+{
+	const bool shared = level == nr_private;
+	const u32 first = shared ? 0 : cpu;
+	const u32 last = shared ? nr_cpus : cpu + 1;
+	bool dirty = false;
+
+	for (u32 c = first; c < last; c++) {
+		for (u32 l = 0; l < level; l++) {
+			const u64 old = drop(hierarchy[c][l], line);
+			if (old != 0) {
+				stats[l].back_invalidations += 1;
+				dirty |= (old & TAG_DIRTY) != 0;
+			}
+		}
+	}
+	return dirty;
+}
+
+/* Move `line` into L1, each level's victim moving to the level below. */
+static void
+spill(struct cache **h, u64 line, bool dirty)
+{
+	for (u32 l = 0; l < cache_nr_levels; l++) {
+		// Another cpu may have left a copy in the shared level
+		u64 *tag = find(h[l], line);
+		if (tag != NULL) {
+			*tag |= dirty ? TAG_DIRTY : 0;
+			return;
+		}
+
+		const u64 victim = insert(h[l], line, dirty);
+		if (victim == 0)
+			return;
+
+		line = victim & TAG_LINE;
+		dirty = (victim & TAG_DIRTY) != 0;
+		if (dirty)
+			stats[l].writebacks += 1;
+	}
+	if (dirty)
+		memory_writebacks += 1;
+}
+
+/* Drop `line` from the private levels of the cpus other than `cpu`, which
+ * is writing it.
+ */
+static void
+invalidate_others(u32 cpu, u64 line)
+{
+	for (u32 c = 0; c < nr_cpus; c++) {
+		if (c == cpu)
+			continue;
+		for (u32 l = 0; l < nr_private; l++) {
+			if (drop(hierarchy[c][l], line) != 0)
+				coherence_invalidations += 1;
+		}
+	}
+}
+
+void
+cache_access(paddr_t paddr, bool write)
+{
+	const u32 cpu = tlb_current_cpu();
+	struct cache **h = hierarchy[cpu];
+	const u64 line = paddr >> line_shift;
+	u64 *tag = NULL;
+	u32 level;
+
+	for (level = 0; level < cache_nr_levels; level++) {
+		tag = lookup(h[level], line);
+		if (tag != NULL)
+			break;
+		stats[level].misses += 1;
+	}
+	if (tag != NULL)
+		stats[level].hits += 1;
+
+	if (level == 0) {
+		*tag |= write ? TAG_DIRTY : 0;
+	} else if (inclusion == CACHE_EXCLUSIVE) {
+		bool dirty = write;
+		if (tag != NULL) {
+			dirty |= (*tag & TAG_DIRTY) != 0;
+			*tag = 0;
+		}
+		spill(h, line, dirty);
+	} else {
+		// Fill the levels that missed, bottom up
+		for (u32 l = level; l-- > 0;) {
+			const u64 victim = insert(h[l], line, write && l == 0);
+			if (victim == 0)
+				continue;
+
+			bool dirty = (victim & TAG_DIRTY) != 0;
+			if (inclusion == CACHE_INCLUSIVE)
+				dirty |= back_invalidate(cpu, l, victim & TAG_LINE);
+			if (dirty)
+				write_back(h, l, victim & TAG_LINE);
+		}
+	}
+
+	if (write && nr_cpus > 1 && nr_private > 0)
+		invalidate_others(cpu, line);
+}
+
+void
+cache_drop_frame(pfn_t framenum)
+{
+	const u64 first = (u64)framenum << (PAGE_SHIFT - line_shift);
+	const u64 end = first + (1ULL << (PAGE_SHIFT - line_shift));
+
+	for (u32 i = 0; i < nr_caches; i++) {
+		for (u64 line = first; line < end; line++) {
+			if (drop(&caches[i], line) & TAG_DIRTY)
+				memory_writebacks += 1;
+		}
+	}
+}
+
+void
+cache_count_colour(bool matched)
+{
+	frames_placed += 1;
+	frames_coloured += matched ? 1 : 0;
+}
+
+static void
+new_cache(struct cache *c, const struct cache_config *cfg, u32 level)
+{
+	c->level = level;
+	c->ways = cfg->ways[level];
+	c->stride = cdiv(c->ways, 4) * 4;
+	c->nr_sets = cfg->size[level] / ((size_t)c->ways * cfg->line);
+
+	// Zeroed lazily, so that large caches cost nothing until used
+	const size_t len = (size_t)c->nr_sets * c->stride * sizeof(u64);
+	c->tags = mmap369(len);
+	c->stamps = mmap369(len);
+	if (c->tags == NULL || c->stamps == NULL) {
+		perror("Failed to map the cache tags");
+		exit(1);
+	}
+}
+
+void
+cache_init(struct cache_config *cfg)
+{
+	cache_nr_levels = cfg->nr_levels;
+	cache_nr_colours = 0;
+	nr_caches = 0;
+	tick = 0;
+	memset(stats, 0, sizeof(stats));
+	memory_writebacks = 0;
+	coherence_invalidations = 0;
+	frames_placed = 0;
+	frames_coloured = 0;
+	if (cache_nr_levels == 0)
+		return;
+
+	assert(cache_config_error(cfg) == NULL);
+	inclusion = cfg->inclusion;
+	line_shift = __builtin_ctz(cfg->line);
+	nr_cpus = tlb_nr_cpus();
+	nr_private = cache_nr_levels - 1;
+
+	for (u32 cpu = 0; cpu < nr_cpus; cpu++) {
+		for (u32 l = 0; l < nr_private; l++) {
+			new_cache(&caches[nr_caches], cfg, l);
+			hierarchy[cpu][l] = &caches[nr_caches++];
+		}
+	}
+	struct cache *llc = &caches[nr_caches++];
+	new_cache(llc, cfg, nr_private);
+	for (u32 cpu = 0; cpu < nr_cpus; cpu++)
+		hierarchy[cpu][nr_private] = llc;
+
+	if (cfg->colour) {
+		const size_t span = (size_t)llc->nr_sets << line_shift;
+		cache_nr_colours = span > PAGE_SIZE ? span / PAGE_SIZE : 1;
+	}
+}
+
+void
+cache_destroy(void)
+{
+	for (u32 i = 0; i < nr_caches; i++) {
+		const size_t len = (size_t)caches[i].nr_sets * caches[i].stride
+			* sizeof(u64);
+		munmap369(caches[i].tags, len);
+		munmap369(caches[i].stamps, len);
+	}
+	nr_caches = 0;
+	cache_nr_levels = 0;
+	cache_nr_colours = 0;
+}
+
+i32
+cache_parse(struct cache_config *cfg, const char *spec)
+{
+	const char *p = spec;
+	char *end;
+
+	cfg->nr_levels = 0;
+	while (*p != '\0') {
+		if (cfg->nr_levels == CACHE_MAX_LEVELS)
+			return -1;
+
+		const u32 l = cfg->nr_levels++;
+		cfg->size[l] = strtoul(p, &end, 10);
+		if (end == p)
+			return -1;
+		switch (*end) {
+		case 'k':
+		case 'K':
+			cfg->size[l] <<= 10;
+			end++;
+			break;
+		case 'm':
+		case 'M':
+			cfg->size[l] <<= 20;
+			end++;
+			break;
+		case 'g':
+		case 'G':
+			cfg->size[l] <<= 30;
+			end++;
+			break;
+		}
+		if (*end != ':')
+			return -1;
+
+		p = end + 1;
+		cfg->ways[l] = strtoul(p, &end, 10);
+		if (end == p || (*end != ',' && *end != '\0'))
+			return -1;
+		p = *end == ',' ? end + 1 : end;
+	}
+	return cfg->nr_levels > 0 ? 0 : -1;
+}
+
+enum cache_inclusion
+cache_parse_inclusion(const char *name)
+{
+	for (i32 i = 0; i < CACHE_NR_INCLUSIONS; ++i) {
+		if (strcmp(name, inclusion_names[i]) == 0)
+			return i;
+	}
+	return CACHE_NR_INCLUSIONS;
+}
+
+const char *
+cache_config_error(const struct cache_config *cfg)
+{
+	if (cfg->line == 0 || (cfg->line & (cfg->line - 1)) != 0
+	    || cfg->line > PAGE_SIZE)
+		return "the line size must be a power of two of at most a page";
+
+	for (u32 l = 0; l < cfg->nr_levels; l++) {
+		const size_t set_size = (size_t)cfg->ways[l] * cfg->line;
+
+		if (cfg->ways[l] == 0 || cfg->ways[l] > CACHE_MAX_WAYS)
+			return "every level must have 1 to 64 ways";
+		const size_t nr_sets = cfg->size[l] / set_size;
+		if (cfg->size[l] % set_size != 0 || nr_sets == 0
+		    || (nr_sets & (nr_sets - 1)) != 0 || nr_sets > UINT32_MAX)
+			return "every level must hold a power of two number of sets";
+	}
+	return NULL;
+}
+
+void
+cache_checkpoint(struct checkpoint *cp)
+{
+	checkpoint_check(cp, cache_nr_levels, "number of cache levels");
+	if (cache_nr_levels == 0)
+		return;
+
+	checkpoint_check(cp, line_shift, "cache line size");
+	checkpoint_check(cp, inclusion, "cache inclusion");
+	checkpoint_check(cp, cache_nr_colours, "number of page colours");
+	checkpoint_check(cp, nr_caches, "number of caches");
+	for (u32 i = 0; i < nr_caches; i++) {
+		struct cache *c = &caches[i];
+		const size_t len = (size_t)c->nr_sets * c->stride * sizeof(u64);
+
+		checkpoint_check(cp, c->nr_sets, "number of cache sets");
+		checkpoint_check(cp, c->ways, "number of cache ways");
+		checkpoint_block(cp, c->tags, len);
+		checkpoint_block(cp, c->stamps, len);
+	}
+	checkpoint_var(cp, tick);
+	checkpoint_var(cp, stats);
+	checkpoint_var(cp, memory_writebacks);
+	checkpoint_var(cp, coherence_invalidations);
+	checkpoint_var(cp, frames_placed);
+	checkpoint_var(cp, frames_coloured);
+}
+
+void
+cache_report(void)
+{
+	if (cache_nr_levels == 0)
+		return;
+
+	for (u32 l = 0; l < cache_nr_levels; l++) {
+		const struct cache *c = hierarchy[0][l];
+		const struct cache_level_stats *st = &stats[l];
+		const size_t accesses = st->hits + st->misses;
+
+		printf("L%u cache: %zu KB, %u ways, %u sets of %u B lines, %s\n",
+		       l + 1, ((size_t)c->nr_sets * c->ways << line_shift) / 1024,
+		       c->ways, c->nr_sets, 1U << line_shift,
+		       l < nr_private ? "private" : "shared");
+		printf("L%u cache: %zu hits, %zu misses, hit rate %.4f\n",
+		       l + 1, st->hits, st->misses,
+		       accesses > 0 ? (f64)st->hits / accesses * 100.0 : 0.0);
+		printf("L%u cache: %zu writebacks, %zu back-invalidations\n",
+		       l + 1, st->writebacks, st->back_invalidations);
+	}
+	printf("Cache inclusion: %s\n", inclusion_names[inclusion]);
+	printf("Cache writebacks to memory: %zu\n", memory_writebacks);
+	if (nr_cpus > 1 && nr_private > 0) {
+		printf("Cache invalidations by other cpus: %zu\n",
+		       coherence_invalidations);
+	}
+	if (cache_nr_colours > 0) {
+		printf("Page colours: %u\n", cache_nr_colours);
+		printf("Frames in the colour of their page: %zu of %zu, %.4f\n",
+		       frames_coloured, frames_placed, frames_placed > 0
+		       ? (f64)frames_coloured / frames_placed * 100.0
+		       : 0.0);
+	}
+}
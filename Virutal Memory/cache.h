@@ -0,0 +1,143 @@
+/** @file cache.h
+ * @brief Set-associative caches on physical addresses.
+ *
+ * The hierarchy has up to CACHE_MAX_LEVELS levels, L1 first, fed with the
+ * physical address of every access by access_mem() in sim.c. With several
+ * cpus, every level but the last is private to each cpu and the last level
+ * is shared, a write dropping the line from the private levels of the other
+ * cpus. Lines are replaced LRU within their set, and the tags of a set are
+ * packed together so that a lookup compares all of them at once.
+ *
+ * How the contents of the levels relate depends on the inclusion policy:
+ *
+ *   nine       lines are filled into every level missed and evicted from
+ *              each level independently (non-inclusive, non-exclusive)
+ *   inclusive  as nine, but a line evicted from a level is also dropped
+ *              from the levels above it that share it
+ *   exclusive  lines are filled into L1 only, each level's victims move to
+ *              the level below, and a hit below L1 moves the line to L1
+ *
+ * A frame given to a new page loses its lines, dirty ones being written
+ * back first, since the page arrives from swap or zeroed and not through
+ * the caches.
+ *
+ * With page colouring, allocate_frame() in coremap.c prefers a free frame
+ * whose colour, the sets of the last level it maps to, is that of the
+ * faulting virtual page, so that virtually contiguous pages do not compete
+ * for the same sets.
+ */
+
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include "types.h"
+
+#define CACHE_DEFAULT_LINE 64
+#define CACHE_MAX_WAYS 64
+
+/* Colour asked of allocate_on_node() when pages are not coloured */
+#define CACHE_NO_COLOUR UINT32_MAX
+
+enum cache_inclusion {
+	CACHE_NINE,
+	CACHE_INCLUSIVE,
+	CACHE_EXCLUSIVE,
+	CACHE_NR_INCLUSIONS
+};
+
+struct cache_level_stats {
+	size_t hits;
+	size_t misses;
+	size_t writebacks;          /* Dirty lines evicted from the level */
+	size_t back_invalidations;  /* Lines dropped by an inclusive eviction below */
+};
+
+extern u32 cache_nr_levels;
+
+/* Colours of the last level with page colouring, or 0 */
+extern u32 cache_nr_colours;
+
+// Cache functions used in sim.c for initialization and teardown
+void cache_init(struct cache_config *cfg);
+void cache_destroy(void);
+
+/**
+ * @brief Parse the levels given on the command line, as size:ways,...
+ * with sizes in bytes or with a k, m or g suffix, e.g. 32k:8,1m:16.
+ *
+ * @return 0 on success, -1 if the list is malformed.
+ *
+ * @see cache.c
+ */
+i32 cache_parse(struct cache_config *cfg, const char *spec);
+
+/**
+ * @brief Parse the name of an inclusion policy given on the command line.
+ *
+ * @return The policy, or CACHE_NR_INCLUSIONS if there is no such policy.
+ *
+ * @see cache.c
+ */
+enum cache_inclusion cache_parse_inclusion(const char *name);
+
+/**
+ * @brief Check that every level of `cfg` holds a power of two number of
+ * sets of its ways.
+ *
+ * @return NULL if the hierarchy can be built, or what is wrong with it.
+ *
+ * @see cache.c
+ */
+const char *cache_config_error(const struct cache_config *cfg);
+
+/**
+ * @brief Look up `paddr` in the hierarchy of the current cpu, filling the
+ * levels that missed.
+ *
+ * @see cache.c
+ */
+void cache_access(paddr_t paddr, bool write);
+
+/**
+ * @brief Drop the lines of frame `framenum`, which now holds another page.
+ *
+ * Called from coremap.c whenever a frame is allocated.
+ *
+ * @see cache.c
+ */
+void cache_drop_frame(pfn_t framenum);
+
+/**
+ * @brief Get the colour of a physical frame or virtual page number.
+ */
+static inline u32
+cache_colour_of(u64 pagenum)
+{
+	return pagenum % cache_nr_colours;
+}
+
+/**
+ * @brief Account for a frame allocated to a new page with page colouring,
+ * `matched` if the frame has the colour of the page.
+ *
+ * @see cache.c
+ */
+void cache_count_colour(bool matched);
+
+/**
+ * @brief Save or restore the tags of every cache and the counters, see
+ * checkpoint.h.
+ *
+ * @see cache.c
+ */
+void cache_checkpoint(struct checkpoint *cp);
+
+/**
+ * @brief Print the hits, misses and writebacks of every level, and how
+ * many frames page colouring placed.
+ *
+ * @see cache.c
+ */
+void cache_report(void);
+
+#endif /* __CACHE_H__ */
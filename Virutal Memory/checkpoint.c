@@ -0,0 +1,233 @@
+/** @file checkpoint.c
+ * @brief Checkpoint and restore of the complete simulator state.
+ *
+ * Snapshots are written with buffered stdio and restored from a read-only
+ * mapping of the whole file. The layout is the sequence of fields visited
+ * by checkpoint_state(), preceded by a magic number and format version.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "checkpoint.h"
+#include "coremap.h"
+#include "dedup.h"
+#include "latency.h"
+#include "multiprocessing.h"
+#include "numa.h"
+#include "profile.h"
+#include "quota.h"
+#include "readahead.h"
+#include "sim.h"
+#include "swap.h"
+#include "tlb.h"
+#include "types.h"
+
+/* Counters for paging-related events. Set in pagetable.c */
+extern size_t ram_hit_count;
+extern size_t ram_miss_count;
+extern size_t ref_count;
+extern size_t evict_clean_count;
+extern size_t evict_dirty_count;
+extern size_t cow_fault_count;
+extern size_t write_fault_count;
+
+/* Loads not checked against the trace, counted by sim.c. Defined here
+ * rather than in sim.c so that simbench, which links everything but sim.o,
+ * has it too.
+ */
+size_t unchecked_load_count = 0;
+
+#define CHECKPOINT_MAGIC "SIM369CP"
+#define CHECKPOINT_VERSION 9
+
+/* Size of the default random() state (TYPE_3), shared by rand.c and
+ * tlbwr().
+ */
+#define RANDOM_STATE_SIZE 128
+
+struct checkpoint {
+	const char *path;
+	bool restoring;
+	size_t pos;
+
+	FILE *out;          /* Saving */
+
+	const u8 *map;      /* Restoring */
+	size_t size;
+};
+
+static void __attribute__((noreturn))
+checkpoint_fail(const struct checkpoint *cp, const char *msg)
+{
+	fprintf(stderr, "%s: %s\n", cp->path, msg);
+	exit(1);
+}
+
+void
+checkpoint_data(struct checkpoint *cp, void *ptr, size_t len)
+{
+	if (len == 0)
+		return;
+
+	if (cp->restoring) {
+		if (len > cp->size - cp->pos)
+			checkpoint_fail(cp, "truncated checkpoint");
+		memcpy(ptr, &cp->map[cp->pos], len);
+	} else if (fwrite(ptr, 1, len, cp->out) != len) {
+		checkpoint_fail(cp, "failed to write checkpoint");
+	}
+	cp->pos += len;
+}
+
+void
+checkpoint_block(struct checkpoint *cp, void *ptr, size_t len)
+{
+	const size_t pad = cdiv(cp->pos, CHECKPOINT_ALIGN) * CHECKPOINT_ALIGN
+		- cp->pos;
+
+	if (cp->restoring) {
+		if (pad > cp->size - cp->pos)
+			checkpoint_fail(cp, "truncated checkpoint");
+		cp->pos += pad;
+	} else {
+		static const u8 zeros[CHECKPOINT_ALIGN];
+		checkpoint_data(cp, (void *)zeros, pad);
+	}
+	checkpoint_data(cp, ptr, len);
+}
+
+void
+checkpoint_check(struct checkpoint *cp, u64 value, const char *what)
+{
+	u64 saved = value;
+	checkpoint_var(cp, saved);
+	if (saved != value) {
+		fprintf(stderr, "%s: checkpoint was taken with %s %lu, not %lu\n",
+			cp->path, what, saved, value);
+		exit(1);
+	}
+}
+
+bool
+checkpoint_restoring(const struct checkpoint *cp)
+{
+	return cp->restoring;
+}
+
+/* Save or restore the state of random(). initstate() hands back the state
+ * it replaces with the generator position written into it, and setstate()
+ * resumes from the position found in the state it is given.
+ */
+static void
+checkpoint_random(struct checkpoint *cp)
+{
+	static char scratch[RANDOM_STATE_SIZE];
+	char *state = initstate(1, scratch, sizeof(scratch));
+	checkpoint_data(cp, state, RANDOM_STATE_SIZE);
+	setstate(state);
+}
+
+static void
+checkpoint_counters(struct checkpoint *cp)
+{
+	checkpoint_var(cp, ram_hit_count);
+	checkpoint_var(cp, ram_miss_count);
+	checkpoint_var(cp, ref_count);
+	checkpoint_var(cp, evict_clean_count);
+	checkpoint_var(cp, evict_dirty_count);
+	checkpoint_var(cp, cow_fault_count);
+	checkpoint_var(cp, write_fault_count);
+	checkpoint_var(cp, unchecked_load_count);
+}
+
+static void
+checkpoint_state(struct checkpoint *cp, const char *alg,
+		 void (*alg_checkpoint)(struct checkpoint *), size_t *line)
+{
+	char magic[sizeof(CHECKPOINT_MAGIC)] = CHECKPOINT_MAGIC;
+	checkpoint_var(cp, magic);
+	if (memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0)
+		checkpoint_fail(cp, "not a checkpoint");
+	checkpoint_check(cp, CHECKPOINT_VERSION, "format version");
+
+	char name[32] = { 0 };
+	strncpy(name, alg, sizeof(name) - 1);
+	checkpoint_var(cp, name);
+	if (strncmp(name, alg, sizeof(name) - 1) != 0)
+		checkpoint_fail(cp, "checkpoint was taken with another algorithm");
+
+	checkpoint_var(cp, *line);
+	checkpoint_random(cp);
+	checkpoint_counters(cp);
+
+	// Frames before page tables, which link their entries back into the
+	// coremap, and the tlb after, since it points into page table entries
+	coremap_checkpoint(cp);
+	swap_checkpoint(cp);
+	multiprocessing_checkpoint(cp);
+	coremap_checkpoint_finish(cp);
+	tlb_checkpoint(cp);
+
+	alg_checkpoint(cp);
+	dedup_checkpoint(cp);
+	profile_checkpoint(cp);
+	latency_checkpoint(cp);
+	readahead_checkpoint(cp);
+	numa_checkpoint(cp);
+	quota_checkpoint(cp);
+	cache_checkpoint(cp);
+}
+
+void
+checkpoint_save(const char *path, const char *alg,
+		void (*alg_checkpoint)(struct checkpoint *), size_t line)
+{
+	struct checkpoint cp = { .path = path, .restoring = false };
+
+	cp.out = fopen(path, "wb");
+	if (cp.out == NULL) {
+		perror(path);
+		exit(1);
+	}
+
+	checkpoint_state(&cp, alg, alg_checkpoint, &line);
+
+	if (fclose(cp.out) != 0)
+		checkpoint_fail(&cp, "failed to write checkpoint");
+}
+
+size_t
+checkpoint_restore(const char *path, const char *alg,
+		   void (*alg_checkpoint)(struct checkpoint *))
+{
+	struct checkpoint cp = { .path = path, .restoring = true };
+	struct stat sb;
+	size_t line = 0;
+
+	const int fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &sb) != 0) {
+		perror(path);
+		exit(1);
+	}
+
+	cp.size = sb.st_size;
+	cp.map = mmap(NULL, cp.size, PROT_READ, MAP_PRIVATE | MAP_POPULATE,
+		      fd, 0);
+	if (cp.map == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	close(fd);
+
+	checkpoint_state(&cp, alg, alg_checkpoint, &line);
+
+	munmap((void *)cp.map, cp.size);
+	return line;
+}
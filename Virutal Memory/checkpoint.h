@@ -0,0 +1,97 @@
+/** @file checkpoint.h
+ * @brief Checkpoint and restore of the complete simulator state.
+ *
+ * A checkpoint is written by walking every module's state through its
+ * `*_checkpoint()` function. The same function reads the state back on
+ * restore, so the two directions cannot drift apart: each module describes
+ * its state once with checkpoint_data() and checkpoint_block() and branches
+ * on checkpoint_restoring() only where pointers have to be rebuilt.
+ *
+ * Small fields are packed back to back. Large raw blocks (physmem and the
+ * swap space) are aligned to CHECKPOINT_ALIGN in the file, so a snapshot
+ * can be mapped and restored with a few large copies.
+ *
+ * A restored run reports the same statistics as the uninterrupted one, except
+ * for its running time and the memory used by sim itself: the page tables and
+ * reverse maps that restore rebuilds are sized for the state in the snapshot,
+ * not grown and shrunk as they were on the way there.
+ */
+
+#ifndef __CHECKPOINT_H__
+#define __CHECKPOINT_H__
+
+#include "types.h"
+
+#define CHECKPOINT_ALIGN 4096
+
+#define DEFAULT_CHECKPOINT_PATH "sim.ckpt"
+
+struct checkpoint;
+
+/* Loads of a partial or compacted replay that depend on stores it skipped,
+ * and so read a value other than the trace's. Counted by sim.c and saved in
+ * snapshots.
+ */
+extern size_t unchecked_load_count;
+
+/**
+ * @brief Save or restore `len` bytes at `ptr`.
+ *
+ * @see checkpoint.c
+ */
+void checkpoint_data(struct checkpoint *cp, void *ptr, size_t len);
+
+/**
+ * @brief Save or restore a large raw block, aligned to CHECKPOINT_ALIGN
+ * within the snapshot.
+ *
+ * @see checkpoint.c
+ */
+void checkpoint_block(struct checkpoint *cp, void *ptr, size_t len);
+
+/**
+ * @brief Save `value`, or on restore make sure the snapshot holds the same
+ * value, exiting with an error naming `what` otherwise.
+ *
+ * Used for the configuration the state depends on (memory size, swap
+ * size, ...) which must be given again on the command line.
+ *
+ * @see checkpoint.c
+ */
+void checkpoint_check(struct checkpoint *cp, u64 value, const char *what);
+
+/**
+ * @brief Return `true` if `cp` is being restored rather than saved.
+ */
+bool checkpoint_restoring(const struct checkpoint *cp);
+
+#define checkpoint_var(cp, var) checkpoint_data((cp), &(var), sizeof(var))
+
+/**
+ * @brief Write the state of the simulation to `path`.
+ *
+ * @param path[in] The snapshot to create.
+ * @param alg[in] The name of the replacement algorithm.
+ * @param alg_checkpoint[in] The checkpoint function of the algorithm.
+ * @param line[in] The number of trace lines replayed so far.
+ *
+ * @see checkpoint.c
+ */
+void checkpoint_save(const char *path, const char *alg,
+		     void (*alg_checkpoint)(struct checkpoint *), size_t line);
+
+/**
+ * @brief Restore the state of the simulation from `path`.
+ *
+ * Every module must have been initialized with the same configuration as
+ * when the snapshot was taken. The caller is left to skip the trace lines
+ * replayed before the snapshot.
+ *
+ * @return The number of trace lines replayed before the snapshot.
+ *
+ * @see checkpoint.c
+ */
+size_t checkpoint_restore(const char *path, const char *alg,
+			  void (*alg_checkpoint)(struct checkpoint *));
+
+#endif /* __CHECKPOINT_H__ */
@@ -2,6 +2,7 @@
 #include "coremap.h"
 #include "sim.h"
 #include "malloc369.h"
+#include "checkpoint.h"
 
 #include <assert.h>
 #include <string.h>
@@ -22,6 +23,12 @@ pfn_t clock_evict(void)
 		}
 
 		frame_t *frame = frame_from_number(clock_c);
+		if (!frame_reclaimable(frame))
+		{
+			// Leave the reference bits of frames out of reach alone
+			clock_c = (clock_c + 1) % (pfn_t)memsize;
+			continue;
+		}
 		if (!get_referenced(frame))
 		{
 			pfn_t victim = clock_c;
@@ -50,20 +57,19 @@ void clock_ref(pfn_t framenum)
 	set_referenced(frame, true);
 }
 
+/**
+ * @brief Setting the reference bit again changes nothing, so CLOCK may
+ * replay compacted traces.
+ */
+const bool clock_compaction_safe = true;
+
 /**
  * @brief Initialize data structures for the CLOCK algorithm.
  */
 void clock_init(void)
 {
+	// Frames of a fresh coremap are all unreferenced already
 	clock_c = 0;
-	for (pfn_t i = 0; (size_t)i < memsize; i++)
-	{
-		frame_t *frame = frame_from_number(i);
-		if (frame != NULL)
-		{
-			set_referenced(frame, false);
-		}
-	}
 }
 
 /**
@@ -72,4 +78,12 @@ void clock_init(void)
 void clock_cleanup(void)
 {
 	clock_c = 0;
+}
+
+/**
+ * @brief Save or restore the state of the CLOCK algorithm.
+ */
+void clock_checkpoint(struct checkpoint *cp)
+{
+	checkpoint_var(cp, clock_c);
 }
\ No newline at end of file
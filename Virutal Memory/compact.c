@@ -0,0 +1,142 @@
+/** @file compact.c
+ * @brief Compacts a binary trace for `sim -Z`.
+ *
+ *   trace-compact [-o traceout] tracefile
+ *
+ * Back-to-back references of a process to the same page with the same kind
+ * of access, reads (I, L) or writes (S, M), are collapsed into the first of
+ * them, whose weight counts them all. After the first reference the page is
+ * resident and in the tlb with the rights the access needs, so the others
+ * only hit in the tlb and leave the page tables, the coremap and swap as they
+ * are. Replacement algorithms that do not count references, the ones whose
+ * <name>_compaction_safe is true, then see the same faults and evictions on
+ * the compacted trace, and sim adds the tlb hits of the dropped references
+ * back from the weights.
+ *
+ * The values stored by dropped writes are lost, so sim does not check the
+ * values loaded from a compacted trace. It counts the loads that read a value
+ * other than the trace's as "Loads depending on skipped stores", which is the
+ * one line of its report that differs from a replay of the original trace,
+ * where it is not printed at all.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdnoreturn.h>
+#include <string.h>
+
+#include "parse_trace.h" // struct trace_line
+#include "sim.h"
+#include "types.h"
+
+noreturn void help_usage(char **argv)
+{
+	fprintf(stdout,
+		"Collapses runs of references to the same page into weighted "
+		"lines, for sim -Z.\n"
+	);
+	fprintf(stdout, "usage: %s [-o traceout] tracefile\n", argv[0]);
+	fprintf(stdout, "\t-o traceout - compacted trace (default "
+		"tracefile.compact)\n");
+	exit(EXIT_FAILURE);
+}
+
+static bool is_write(u8 reftype)
+{
+	return reftype == 'S' || reftype == 'M';
+}
+
+/* Whether `tl` continues the run of references that `run` starts. */
+static bool extends_run(const struct trace_line *run, const struct trace_line *tl)
+{
+	return strchr("ILSM", tl->reftype) != NULL
+		&& tl->vpid == run->vpid
+		&& tl->vaddr / PAGE_SIZE == run->vaddr / PAGE_SIZE
+		&& is_write(tl->reftype) == is_write(run->reftype)
+		&& run->weight < UINT16_MAX;
+}
+
+int main(int argc, char ** argv)
+{
+	int opt;
+	char * outpath = NULL;
+	while ((opt = getopt(argc, argv, "o:h")) != -1) {
+		switch (opt) {
+			case 'o':
+			outpath = optarg;
+			break;
+			case 'h':
+			default:
+			help_usage(argv);
+		}
+	}
+
+	if (optind != argc - 1) {
+		help_usage(argv);
+	}
+	const char * inpath = argv[optind];
+
+	char * defpath = NULL;
+	if (outpath == NULL) {
+		defpath = malloc(strlen(inpath) + sizeof(".compact"));
+		if (defpath == NULL) {
+			perror("malloc");
+			return 1;
+		}
+		strcpy(defpath, inpath);
+		strcat(defpath, ".compact");
+		outpath = defpath;
+	}
+
+	FILE * fout = fopen(outpath, "w");
+	if (fout == NULL) {
+		perror(outpath);
+		free(defpath);
+		return 1;
+	}
+	init_parse_trace(inpath);
+
+	// The pending run, flushed once a line does not extend it
+	struct trace_line run;
+	bool pending = false;
+	size_t in = 0;
+	size_t out = 0;
+
+	struct trace_line tl;
+	while (get_traceline(&tl)) {
+		in++;
+		if (pending && extends_run(&run, &tl)) {
+			run.weight++;
+			continue;
+		}
+		if (pending) {
+			fwrite(&run, sizeof(run), 1, fout);
+			out++;
+		}
+
+		tl.weight = 1;
+		pending = strchr("ILSM", tl.reftype) != NULL;
+		if (pending) {
+			run = tl;
+		} else {
+			fwrite(&tl, sizeof(tl), 1, fout);
+			out++;
+		}
+	}
+	if (pending) {
+		fwrite(&run, sizeof(run), 1, fout);
+		out++;
+	}
+	destroy_parse_trace();
+
+	if (fclose(fout) != 0) {
+		perror(outpath);
+		free(defpath);
+		return 1;
+	}
+	printf("%s: %zu lines compacted to %zu (%.2f%%)\n", outpath, in, out,
+	       in > 0 ? (double)out / in * 100.0 : 0.0);
+	free(defpath);
+	return 0;
+}
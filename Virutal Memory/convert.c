@@ -63,6 +63,7 @@ int main(int argc, char ** argv)
 			 &tl.vpid, &tl.reftype, &tl.vaddr, &tl.value) != 4) {
 			fprintf(stderr, "invalid line: %s\n", line);
 		}
+		tl.weight = 1;
 		fwrite(&tl, sizeof(tl), 1, fout);
 	}
 	fclose(fin);
@@ -1,9 +1,13 @@
 #include "multiprocessing.h"
+#include "cache.h"
+#include "checkpoint.h"
 #include "coremap.h"
 #include "ptrarray.h"
 #include "types.h"
 #include "malloc369.h"
 #include "list.h"
+#include "numa.h"
+#include "quota.h"
 
 #include <string.h>
 #include <assert.h>
@@ -16,8 +20,13 @@ struct frame {
 	/* For evict algorithm */
 	list_entry framelist_entry;
 
-	/* The ASID the frame belongs to, or INVALID_ASID */
-	asid_t asid;
+	/* The ASID the frame belongs to plus one, so that the zeroed entries
+	 * of a fresh coremap belong to INVALID_ASID. See frame_asid().
+	 */
+	asid_t asid_plus1;
+
+	/* The quota group the frame is charged to */
+	u16 group;
 
 	/* Recently referenced marker */
 	bool refd;
@@ -25,6 +34,35 @@ struct frame {
 
 static size_t mem_usage = 0;
 
+/* Frames that were ever given a reverse map, which they keep until the
+ * coremap is destroyed
+ */
+static size_t nr_refs = 0;
+
+/* Frames in use on every node, and the frame of the node allocated last,
+ * counted from the start of the node
+ */
+static size_t node_usage[NUMA_MAX_NODES];
+static i32 last_alloc[NUMA_MAX_NODES];
+
+/* Reverse maps read back by frame_checkpoint_pte(), the entries of frame i
+ * being restore_refs[restore_base[i]] up to restore_refs[restore_base[i+1]].
+ */
+static pt_entry_t **restore_refs = NULL;
+static size_t *restore_base = NULL;
+
+static inline asid_t
+frame_asid(const frame_t *frame)
+{
+	return (asid_t)(frame->asid_plus1 - 1);
+}
+
+static inline void
+set_frame_asid(frame_t *frame, asid_t asid)
+{
+	frame->asid_plus1 = (asid_t)(asid + 1);
+}
+
 static inline ptrarray_t *
 get_refs(const frame_t *frame)
 {
@@ -37,6 +75,15 @@ set_refs(frame_t *frame, ptrarray_t *arr)
 	frame->refs = arr;
 }
 
+static inline void
+init_refs(frame_t *frame, size_t capacity)
+{
+	if (get_refs(frame) == NULL) {
+		set_refs(frame, ptrarray_init(capacity, PTRARRAY_DEFAULT_PRESSURE));
+		nr_refs += 1;
+	}
+}
+
 bool
 frame_in_use(const frame_t *frame)
 {
@@ -50,7 +97,20 @@ frame_in_use(const frame_t *frame)
 bool
 frame_is_shared(const frame_t *frame)
 {
-	return ptrarray_get_size(get_refs(frame)) > 1;
+	const ptrarray_t *const refs = get_refs(frame);
+	if (refs == NULL)
+		return false;
+
+	return ptrarray_get_size(refs) > 1;
+}
+
+bool
+frame_reclaimable(const frame_t *frame)
+{
+	if (quota_nr_groups == 0)
+		return true;
+
+	return quota_may_reclaim(frame->group, frame_in_use(frame));
 }
 
 frame_t *
@@ -98,53 +158,194 @@ set_referenced(frame_t *frame, bool val)
 	frame->refd = val;
 }
 
-pfn_t
-allocate_frame(pt_entry_t *pte)
+/* Allocate an available frame of colour `colour` among the `nr_frames`
+ * frames of `node` starting at `start`, from where we left off last time on
+ * that node, or return INVALID_FRAME if none is free.
+ */
+static pfn_t
+allocate_coloured(u32 node, pfn_t start, size_t nr_frames, u32 colour)
+{
+	const size_t step = cache_nr_colours;
+	const size_t first = (colour + step - cache_colour_of(start)) % step;
+
+	if (first >= nr_frames)
+		return INVALID_FRAME;
+
+	// Frames of the colour are first, first + step, ...
+	const size_t count = cdiv(nr_frames - first, step);
+	const size_t next = (size_t)(last_alloc[node] + 1);
+	const size_t from = next > first ? cdiv(next - first, step) : 0;
+
+	for (size_t n = 0; n < count; n += 1) {
+		const size_t i = first + ((from + n) % count) * step;
+		if (!frame_in_use(&coremap[start + i])) {
+			last_alloc[node] = i;
+			return start + i;
+		}
+	}
+	return INVALID_FRAME;
+}
+
+/* Allocate an available frame of `node` from where we left off last time
+ * on that node, of colour `colour` if possible unless it is
+ * CACHE_NO_COLOUR, or return INVALID_FRAME if all of its frames are in use.
+ */
+static pfn_t
+allocate_on_node(u32 node, u32 colour)
 {
-	static i32 last_alloc = -1;
-	pfn_t frame = INVALID_FRAME;
-
-	// Allocate an available frame from where we left off last time
-	if (mem_usage < memsize) {
-		i32 i = (last_alloc + 1) % memsize;
-		while (i != last_alloc) {
-			if (!frame_in_use(&coremap[i])) {
-				frame = i;
-				last_alloc = i;
-				mem_usage += 1;
-				break;
-			}
-			i = (i + 1) % memsize;
+	size_t nr_frames;
+	const pfn_t start = numa_node_start(node, &nr_frames);
+
+	if (node_usage[node] >= nr_frames)
+		return INVALID_FRAME;
+
+	if (colour != CACHE_NO_COLOUR) {
+		const pfn_t frame = allocate_coloured(node, start, nr_frames, colour);
+		if (frame != INVALID_FRAME)
+			return frame;
+	}
+
+	for (size_t n = 1; n <= nr_frames; n += 1) {
+		i32 i = (last_alloc[node] + n) % nr_frames;
+		if (!frame_in_use(&coremap[start + i])) {
+			last_alloc[node] = i;
+			return start + i;
 		}
 	}
+	return INVALID_FRAME;
+}
+
+/* Allocate an available frame on the nodes the placement policy allows for
+ * the current task, preferring frames of colour `colour` on every node, or
+ * return INVALID_FRAME if none of them has one.
+ */
+static pfn_t
+allocate_placed(u32 colour)
+{
+	u32 order[NUMA_MAX_NODES];
+
+	if (mem_usage >= memsize)
+		return INVALID_FRAME;
+
+	const u32 n = numa_placement(get_mm_numa(current_task()->mm), order);
+	for (u32 i = 0; i < n; i += 1) {
+		const pfn_t frame = allocate_on_node(order[i], colour);
+		if (frame != INVALID_FRAME)
+			return frame;
+	}
+	return INVALID_FRAME;
+}
+
+/* Colour of the frame wanted for the page of `pte`, see cache.h */
+static u32
+page_colour(const pt_entry_t *pte)
+{
+	if (cache_nr_colours == 0)
+		return CACHE_NO_COLOUR;
+	return cache_colour_of(vpn_from_pte(pte));
+}
+
+/* Count a free frame as used by a new page, charged to `group`, and give it
+ * the reverse map of the page table entry `pte`, if any.
+ */
+static void
+claim_frame(pfn_t frame, pt_entry_t *pte, u32 group)
+{
+	frame_t *const f = frame_from_number(frame);
+	assert(f != NULL);
+
+	mem_usage += 1;
+	node_usage[numa_node_of(frame)] += 1;
+	numa_frame_reset(frame);
+	if (cache_nr_levels > 0)
+		cache_drop_frame(frame);
+	f->group = group;
+	quota_charge(group);
+
+	// Record information for virtual page that will now be stored in frame
+	init_refs(f, 1);
+	if (pte != NULL)
+		ptrarray_append(get_refs(f), pte);
+}
+
+pfn_t
+allocate_frame(pt_entry_t *pte)
+{
+	const u32 group = get_mm_quota(current_task()->mm)->group;
+	const bool over_limit = quota_over_limit(group);
+	const u32 colour = page_colour(pte);
+	pfn_t frame = over_limit ? INVALID_FRAME : allocate_placed(colour);
 	frame_t *f = frame_from_number(frame);
 
-	if (frame == INVALID_FRAME) { // Didn't find a free page.
-		// Call replacement algorithm's evict function to select victim
+	if (frame == INVALID_FRAME) { // Didn't find a free page, or may not take one.
+		// Call replacement algorithm's evict function to select victim,
+		// among the frames of the group if it is over its limit
+		quota_reclaim_begin(group, over_limit);
 		frame = evict_func();
 		f = frame_from_number(frame);
-
-		// All frames were in use, so victim frame must hold some page
-		// Write victim page to swap, if needed, and update page table
 		assert(f != NULL);
-		assert(frame_in_use(f));
 
-		handle_frame_evict(frame, f->asid);
-		ptrarray_clear(get_refs(f));
+		// Frames are in use at least on the nodes we may allocate from.
+		// Write victim page to swap, if needed, and update page table
+		if (frame_in_use(f)) {
+			quota_evicted(f->group);
+			handle_frame_evict(frame, frame_asid(f));
+			ptrarray_clear(get_refs(f));
+		}
+		quota_reclaim_end();
 	}
 
 	assert(f != NULL);
+	assert(!frame_in_use(f));
 
-	// Record information for virtual page that will now be stored in frame
-	if (get_refs(f) == NULL)
-		set_refs(f, ptrarray_init(1, PTRARRAY_DEFAULT_PRESSURE));
-	ptrarray_append(get_refs(f), pte);
-	f->asid = current_task_id();
+	claim_frame(frame, pte, group);
+	set_frame_asid(f, get_asid(current_task()->mm));
+	if (colour != CACHE_NO_COLOUR)
+		cache_count_colour(cache_colour_of(frame) == colour);
 
 	assert(frame != INVALID_FRAME);
 	return frame;
 }
 
+pfn_t
+allocate_free_frame(pt_entry_t *pte)
+{
+	const u32 group = get_mm_quota(current_task()->mm)->group;
+	if (quota_over_limit(group))
+		return INVALID_FRAME;
+
+	const u32 colour = page_colour(pte);
+	const pfn_t frame = allocate_placed(colour);
+	if (frame == INVALID_FRAME)
+		return INVALID_FRAME;
+
+	claim_frame(frame, pte, group);
+	set_frame_asid(frame_from_number(frame), get_asid(current_task()->mm));
+	if (colour != CACHE_NO_COLOUR)
+		cache_count_colour(cache_colour_of(frame) == colour);
+	return frame;
+}
+
+pfn_t
+migrate_frame(pfn_t src, u32 node)
+{
+	// The page keeps its colour if a frame of it is free
+	const u32 colour = cache_nr_colours > 0
+		? cache_colour_of(src) : CACHE_NO_COLOUR;
+	const pfn_t dst = allocate_on_node(node, colour);
+	if (dst == INVALID_FRAME)
+		return INVALID_FRAME;
+
+	frame_t *const f = frame_from_number(dst);
+	claim_frame(dst, NULL, frame_from_number(src)->group);
+	set_frame_asid(f, frame_asid(frame_from_number(src)));
+	handle_frame_migrate(dst, src);
+
+	// Let the replacement algorithm see the page arrive
+	ref_func(dst);
+	return dst;
+}
+
 void
 frame_link_pte(pfn_t framenum, pt_entry_t *pte)
 {
@@ -161,28 +362,123 @@ frame_unlink_pte(pfn_t framenum, pt_entry_t *pte)
 	ptrarray_remove(get_refs(f), pte);
 	if (ptrarray_get_size(get_refs(f)) == 0) {
 		mem_usage--;
+		node_usage[numa_node_of(framenum)]--;
+		quota_uncharge(f->group);
 	}
 }
 
 void
 init_coremap(void)
 {
-	coremap = malloc369(memsize * sizeof(struct frame));
+	// All-zero frames are free and unreferenced, with no reverse map yet
+	coremap = mmap369(memsize * sizeof(struct frame));
 	assert(coremap != NULL);
-	memset(coremap, 0, memsize * sizeof(struct frame));
-	for (size_t i = 0; i < memsize; i += 1)
-		coremap[i].asid = INVALID_ASID;
+
+	mem_usage = 0;
+	nr_refs = 0;
+	for (u32 i = 0; i < NUMA_MAX_NODES; i += 1) {
+		node_usage[i] = 0;
+		last_alloc[i] = -1;
+	}
 }
 
 void
 destroy_coremap(void)
 {
-	for (size_t i = 0; i < memsize; i += 1) {
-		if (get_refs(&coremap[i]) != NULL)
+	// Stop at the last reverse map rather than touch every frame
+	for (size_t i = 0; nr_refs > 0 && i < memsize; i += 1) {
+		if (get_refs(&coremap[i]) != NULL) {
 			ptrarray_destroy(get_refs(&coremap[i]));
+			nr_refs -= 1;
+		}
+	}
+
+	munmap369(coremap, memsize * sizeof(struct frame));
+}
+
+void
+coremap_checkpoint(struct checkpoint *cp)
+{
+	checkpoint_check(cp, memsize, "memory size");
+	checkpoint_block(cp, physmem, memsize * SIMPAGESIZE);
+	checkpoint_var(cp, mem_usage);
+	checkpoint_var(cp, node_usage);
+	checkpoint_var(cp, last_alloc);
+
+	if (checkpoint_restoring(cp)) {
+		restore_base = malloc369((memsize + 1) * sizeof(size_t));
+		assert(restore_base != NULL);
+	}
+
+	size_t total = 0;
+	for (size_t i = 0; i < memsize; i += 1) {
+		frame_t *f = &coremap[i];
+		u16 nrefs = get_refs(f) != NULL ? ptrarray_get_size(get_refs(f)) : 0;
+
+		checkpoint_var(cp, f->asid_plus1);
+		checkpoint_var(cp, f->group);
+		checkpoint_var(cp, f->refd);
+		checkpoint_var(cp, nrefs);
+		if (checkpoint_restoring(cp)) {
+			if (get_refs(f) != NULL)
+				ptrarray_clear(get_refs(f));
+			restore_base[i] = total;
+		}
+		total += nrefs;
+	}
+
+	if (checkpoint_restoring(cp)) {
+		restore_base[memsize] = total;
+		restore_refs = malloc369((total + 1) * sizeof(pt_entry_t *));
+		assert(restore_refs != NULL);
+		memset(restore_refs, 0, (total + 1) * sizeof(pt_entry_t *));
+	}
+}
+
+void
+frame_checkpoint_pte(struct checkpoint *cp, pfn_t framenum, pt_entry_t *pte)
+{
+	u16 slot = 0;
+
+	if (!checkpoint_restoring(cp)) {
+		ptrarray_slice_t ptes = get_referring_ptes(frame_from_number(framenum));
+		while (ptes.ptr[slot] != pte) {
+			slot += 1;
+			assert(slot < ptes.len);
+		}
+	}
+
+	checkpoint_var(cp, slot);
+
+	if (checkpoint_restoring(cp)) {
+		const size_t i = restore_base[framenum] + slot;
+		assert(i < restore_base[framenum + 1]);
+		restore_refs[i] = pte;
+	}
+}
+
+void
+coremap_checkpoint_finish(struct checkpoint *cp)
+{
+	if (!checkpoint_restoring(cp))
+		return;
+
+	for (size_t i = 0; i < memsize; i += 1) {
+		const size_t n = restore_base[i + 1] - restore_base[i];
+		if (n == 0)
+			continue;
+
+		init_refs(&coremap[i], n);
+		for (size_t j = restore_base[i]; j < restore_base[i + 1]; j += 1) {
+			assert(restore_refs[j] != NULL);
+			ptrarray_append(get_refs(&coremap[i]), restore_refs[j]);
+		}
 	}
 
-	free369(coremap);
+	free369(restore_refs);
+	free369(restore_base);
+	restore_refs = NULL;
+	restore_base = NULL;
 }
 
 /*
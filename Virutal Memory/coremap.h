@@ -43,6 +43,31 @@ void destroy_coremap(void);
  * @see coremap.c
  */
 pfn_t allocate_frame(pt_entry_t *pte);
+
+/**
+ * @brief Allocate a frame for the virtual page represented by pte only if
+ * one is free, never evicting. Used to bring in pages ahead of demand.
+ *
+ * @param pte[in] Pointer to the page table entry representing the virtual page.
+ * @return The physical frame number allocated, or INVALID_FRAME if every
+ * frame is in use.
+ *
+ * @see coremap.c
+ */
+pfn_t allocate_free_frame(pt_entry_t *pte);
+
+/**
+ * @brief Move the page held by frame `src` to a free frame of NUMA node
+ * `node`, never evicting.
+ *
+ * @param src[in] The frame number of the page to move.
+ * @param node[in] The node to move it to.
+ * @return The physical frame number the page now lives in, or INVALID_FRAME
+ * if every frame of the node is in use.
+ *
+ * @see coremap.c, numa.h
+ */
+pfn_t migrate_frame(pfn_t src, u32 node);
 void init_frame(pfn_t frame);
 
 /**
@@ -61,6 +86,18 @@ list_entry *get_frame_list_entry(frame_t *pframe);
 bool frame_in_use(const frame_t *pframe);
 bool frame_is_shared(const frame_t *pframe);
 
+/**
+ * @brief Check whether the replacement algorithm may pick a frame as its
+ * victim. Every frame may be picked, unless quotas restrict the current
+ * reclaim to some groups, see quota.h.
+ *
+ * Replacement algorithms skip the frames for which this is false, and never
+ * pick a frame unless it is true.
+ *
+ * @see coremap.c
+ */
+bool frame_reclaimable(const frame_t *pframe);
+
 /**
  * @brief Link a page table entry to a physical frame.
  *
@@ -101,6 +138,35 @@ void frame_unlink_pte(pfn_t framenum, pt_entry_t *pte);
  */
 void handle_frame_evict(pfn_t framenum, asid_t asid);
 
+/**
+ * @brief Move every page table entry referring to frame `src` onto frame
+ * `dst`, leaving `src` free.
+ *
+ * Called from the dedup scanner once it has verified that both frames hold
+ * identical contents. Every entry of the merged frame becomes read-only, so
+ * the next write to it breaks sharing through the CoW path in
+ * handle_tlb_fault().
+ *
+ * @param dst[in] Frame number that will hold the shared contents.
+ * @param src[in] Frame number that will be released.
+ *
+ * @see pagetable.c, dedup.c
+ */
+void handle_frame_merge(pfn_t dst, pfn_t src);
+
+/**
+ * @brief Copy frame `src` to the free frame `dst` and move every page table
+ * entry referring to `src` onto `dst`, leaving `src` free.
+ *
+ * Called from migrate_frame() once `dst` is allocated.
+ *
+ * @param dst[in] Frame number that will hold the page.
+ * @param src[in] Frame number that will be released.
+ *
+ * @see pagetable.c, numa.c
+ */
+void handle_frame_migrate(pfn_t dst, pfn_t src);
+
 // Accessor functions for page table entries, to allow replacement
 // algorithms to obtain information from a PTE, without depending
 // on the internal implementation of the structure.
@@ -118,12 +184,45 @@ void set_referenced(frame_t *frame, bool val);
  */
 ptrarray_slice_t __nonnull() get_referring_ptes(const frame_t *frame);
 
+// Checkpoint functions, see checkpoint.h
+
+/**
+ * @brief Save or restore physmem and the coremap, except for the reverse
+ * maps which are rebuilt from the page tables.
+ *
+ * @see coremap.c
+ */
+void coremap_checkpoint(struct checkpoint *cp);
+
+/**
+ * @brief Save or restore the position of a valid page table entry in the
+ * reverse map of its frame.
+ *
+ * Called from pagetable_checkpoint() for every valid entry, after
+ * coremap_checkpoint().
+ *
+ * @param framenum[in] The frame the entry maps.
+ * @param pte[in] The page table entry.
+ *
+ * @see coremap.c
+ */
+void frame_checkpoint_pte(struct checkpoint *cp, pfn_t framenum,
+			  pt_entry_t *pte);
+
+/**
+ * @brief Rebuild the reverse maps once every page table is restored.
+ *
+ * @see coremap.c
+ */
+void coremap_checkpoint_finish(struct checkpoint *cp);
+
 // The replacement algorithms.
 #define REPLACEMENT_ALGORITHMS \
 	RA(rand) \
 	RA(rr) \
 	RA(clock) \
-	RA(s2q) 
+	RA(s2q) \
+	RA(adapt)
 // no longer part of the assignment: lru, mru, opt
 
 // Replacement algorithm functions.
@@ -132,8 +231,13 @@ ptrarray_slice_t __nonnull() get_referring_ptes(const frame_t *frame);
 	void name ## _init(); \
 	void name ## _cleanup(); \
 	void name ## _ref(pfn_t); \
-	pfn_t name ## _evict();
+	pfn_t name ## _evict(); \
+	void name ## _checkpoint(struct checkpoint *); \
+	extern const bool name ## _compaction_safe;
 REPLACEMENT_ALGORITHMS
 #undef RA
 
+// Drops a frame that another algorithm evicted, see adapt.c
+void s2q_forget(pfn_t framenum);
+
 #endif /* __COREMAP_H__ */
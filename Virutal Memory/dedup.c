@@ -0,0 +1,165 @@
+/** @file dedup.c
+ * @brief Same-content page deduplication (KSM-like) for the simulator.
+ *
+ * Every `interval` references, the contents of all in-use frames in physmem
+ * are hashed and frames with identical contents are folded into the lowest
+ * numbered one through handle_frame_merge(). The merged frame is read-only,
+ * so a later write breaks sharing through the regular CoW path.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "checkpoint.h"
+#include "malloc369.h"
+#include "sim.h"
+#include "coremap.h"
+#include "dedup.h"
+#include "types.h"
+
+struct frame_digest {
+	u64 hash;
+	pfn_t framenum;
+};
+
+static size_t interval = 0;
+static size_t max_sharing = DEDUP_DEFAULT_MAX_SHARING;
+static size_t refs_since_scan = 0;
+
+static size_t scan_count = 0;
+static size_t merge_count = 0;
+
+/* 64-bit FNV-1a over the contents of a simulated frame. */
+static u64
+hash_frame(pfn_t framenum)
+{
+	const u8 *mem = &physmem[framenum * SIMPAGESIZE];
+	u64 hash = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < SIMPAGESIZE; i += 1) {
+		hash ^= mem[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static bool
+same_contents(pfn_t a, pfn_t b)
+{
+	return memcmp(&physmem[a * SIMPAGESIZE], &physmem[b * SIMPAGESIZE],
+		      SIMPAGESIZE) == 0;
+}
+
+static size_t
+sharing_of(pfn_t framenum)
+{
+	return get_referring_ptes(frame_from_number(framenum)).len;
+}
+
+static int
+digest_cmp(const void *lhs, const void *rhs)
+{
+	const struct frame_digest *a = lhs;
+	const struct frame_digest *b = rhs;
+	if (a->hash != b->hash)
+		return a->hash < b->hash ? -1 : 1;
+	return (a->framenum > b->framenum) - (a->framenum < b->framenum);
+}
+
+void
+dedup_init(struct dedup_config *cfg)
+{
+	interval = cfg->interval;
+	max_sharing = cfg->max_sharing > 0
+		? cfg->max_sharing
+		: DEDUP_DEFAULT_MAX_SHARING;
+	refs_since_scan = 0;
+	scan_count = 0;
+	merge_count = 0;
+}
+
+void
+dedup_destroy(void)
+{
+	interval = 0;
+}
+
+void
+dedup_tick(void)
+{
+	if (interval == 0)
+		return;
+
+	refs_since_scan += 1;
+	if (refs_since_scan >= interval) {
+		refs_since_scan = 0;
+		dedup_scan();
+	}
+}
+
+size_t
+dedup_scan(void)
+{
+	struct frame_digest *digests =
+		malloc369(memsize * sizeof(struct frame_digest));
+	if (digests == NULL) {
+		perror("Failed to allocate dedup digests");
+		exit(1);
+	}
+
+	size_t n = 0;
+	for (size_t i = 0; i < memsize; i += 1) {
+		if (!frame_in_use(frame_from_number(i)))
+			continue;
+		digests[n].hash = hash_frame(i);
+		digests[n].framenum = i;
+		n += 1;
+	}
+
+	// Frames with equal hashes end up adjacent, lowest frame number first
+	qsort(digests, n, sizeof(struct frame_digest), digest_cmp);
+
+	size_t merged = 0;
+	size_t leader = 0;
+	for (size_t i = 1; i < n; i += 1) {
+		const pfn_t dst = digests[leader].framenum;
+		const pfn_t src = digests[i].framenum;
+
+		if (digests[i].hash != digests[leader].hash
+		    || !same_contents(dst, src)
+		    || sharing_of(dst) + sharing_of(src) > max_sharing) {
+			leader = i;
+			continue;
+		}
+
+		handle_frame_merge(dst, src);
+		assert(!frame_in_use(frame_from_number(src)));
+		merged += 1;
+	}
+
+	free369(digests);
+	scan_count += 1;
+	merge_count += merged;
+	return merged;
+}
+
+size_t
+dedup_scan_count(void)
+{
+	return scan_count;
+}
+
+size_t
+dedup_merge_count(void)
+{
+	return merge_count;
+}
+
+void
+dedup_checkpoint(struct checkpoint *cp)
+{
+	checkpoint_var(cp, refs_since_scan);
+	checkpoint_var(cp, scan_count);
+	checkpoint_var(cp, merge_count);
+}
@@ -0,0 +1,63 @@
+/** @file dedup.h
+ * @brief Same-content page deduplication (KSM-like) for the simulator.
+ */
+
+#ifndef __DEDUP_H__
+#define __DEDUP_H__
+
+#include "types.h"
+
+/* Default cap on the number of page table entries merged into one frame,
+ * mirroring KSM's max_page_sharing.
+ */
+#define DEDUP_DEFAULT_MAX_SHARING 256
+
+// Dedup functions used in sim.c for initialization and teardown
+void dedup_init(struct dedup_config *cfg);
+void dedup_destroy(void);
+
+/**
+ * @brief Account for one memory reference, running a scan whenever the
+ * configured interval has elapsed. Does nothing if dedup is disabled.
+ *
+ * @see dedup.c
+ */
+void dedup_tick(void);
+
+/**
+ * @brief Hash the contents of every in-use frame and merge frames holding
+ * identical contents into a single read-only shared frame.
+ *
+ * @return The number of frames released by this scan.
+ *
+ * @see dedup.c
+ */
+size_t dedup_scan(void);
+
+/**
+ * @brief Return the number of scans run thus far in the simulation.
+ *
+ * @return The number of scans.
+ *
+ * @see dedup.c
+ */
+size_t dedup_scan_count(void);
+
+/**
+ * @brief Return the number of frames released by merging thus far in the
+ * simulation.
+ *
+ * @return The number of merged frames.
+ *
+ * @see dedup.c
+ */
+size_t dedup_merge_count(void);
+
+/**
+ * @brief Save or restore the scan counters, see checkpoint.h.
+ *
+ * @see dedup.c
+ */
+void dedup_checkpoint(struct checkpoint *cp);
+
+#endif /* __DEDUP_H__ */
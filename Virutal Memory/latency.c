@@ -0,0 +1,175 @@
+/** @file latency.c
+ * @brief Per-event latency model and simulated clock.
+ *
+ * The simulated clock is the sum of the cycles charged to every address
+ * space. Address spaces carry their own tally while alive and fold it into
+ * a table indexed by pid when they exit, so the report covers processes
+ * that exited long before the end of the trace.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "checkpoint.h"
+#include "malloc369.h"
+#include "latency.h"
+#include "multiprocessing.h"
+#include "sim.h"
+#include "types.h"
+
+u64 latency_costs[LAT_NR_EVENTS];
+u64 latency_counts[LAT_NR_EVENTS];
+
+static const char *const event_names[LAT_NR_EVENTS] = {
+	[LAT_TLB_LOOKUP] = "tlb",
+	[LAT_WALK_STEP] = "walk",
+	[LAT_FAULT] = "fault",
+	[LAT_SWAP_IN] = "swapin",
+	[LAT_SWAP_OUT] = "swapout",
+	[LAT_SHOOTDOWN] = "ipi",
+	[LAT_REMOTE] = "remote",
+};
+
+static f64 ghz = LAT_DEFAULT_GHZ;
+
+/* Totals of exited processes, indexed by pid and grown on demand */
+static struct mm_latency *by_pid = NULL;
+static size_t nr_pids = 0;
+
+void
+latency_init(struct latency_config *cfg)
+{
+	latency_costs[LAT_TLB_LOOKUP] = cfg->tlb_lookup;
+	latency_costs[LAT_WALK_STEP] = cfg->walk_step;
+	latency_costs[LAT_FAULT] = cfg->fault;
+	latency_costs[LAT_SWAP_IN] = cfg->swap_in;
+	latency_costs[LAT_SWAP_OUT] = cfg->swap_out;
+	latency_costs[LAT_SHOOTDOWN] = cfg->shootdown;
+	latency_costs[LAT_REMOTE] = cfg->remote;
+	ghz = cfg->ghz > 0 ? cfg->ghz : LAT_DEFAULT_GHZ;
+	memset(latency_counts, 0, sizeof(latency_counts));
+	by_pid = NULL;
+	nr_pids = 0;
+}
+
+void
+latency_destroy(void)
+{
+	free369(by_pid);
+	by_pid = NULL;
+	nr_pids = 0;
+}
+
+i32
+latency_parse(struct latency_config *cfg, char *spec)
+{
+	char *const tokens[] = {
+		[LAT_TLB_LOOKUP] = (char *)event_names[LAT_TLB_LOOKUP],
+		[LAT_WALK_STEP] = (char *)event_names[LAT_WALK_STEP],
+		[LAT_FAULT] = (char *)event_names[LAT_FAULT],
+		[LAT_SWAP_IN] = (char *)event_names[LAT_SWAP_IN],
+		[LAT_SWAP_OUT] = (char *)event_names[LAT_SWAP_OUT],
+		[LAT_SHOOTDOWN] = (char *)event_names[LAT_SHOOTDOWN],
+		[LAT_REMOTE] = (char *)event_names[LAT_REMOTE],
+		[LAT_NR_EVENTS] = "ghz",
+		NULL,
+	};
+	u64 *const fields[LAT_NR_EVENTS] = {
+		[LAT_TLB_LOOKUP] = &cfg->tlb_lookup,
+		[LAT_WALK_STEP] = &cfg->walk_step,
+		[LAT_FAULT] = &cfg->fault,
+		[LAT_SWAP_IN] = &cfg->swap_in,
+		[LAT_SWAP_OUT] = &cfg->swap_out,
+		[LAT_SHOOTDOWN] = &cfg->shootdown,
+		[LAT_REMOTE] = &cfg->remote,
+	};
+	char *value;
+
+	while (*spec != '\0') {
+		const i32 i = getsubopt(&spec, tokens, &value);
+		if (i < 0 || value == NULL)
+			return -1;
+
+		if (i == LAT_NR_EVENTS)
+			cfg->ghz = strtod(value, NULL);
+		else
+			*fields[i] = strtoull(value, NULL, 10);
+	}
+	return 0;
+}
+
+void
+latency_exit(i32 pid, const struct mm_latency *lat)
+{
+	if ((size_t)pid >= nr_pids) {
+		size_t n = nr_pids > 0 ? nr_pids : 16;
+		while (n <= (size_t)pid)
+			n *= 2;
+
+		// realloc369() only accepts pointers it already tracks
+		by_pid = by_pid == NULL
+			? malloc369(n * sizeof(*by_pid))
+			: realloc369(by_pid, n * sizeof(*by_pid));
+		if (by_pid == NULL) {
+			perror("Failed to allocate latency table");
+			exit(1);
+		}
+		memset(&by_pid[nr_pids], 0, (n - nr_pids) * sizeof(*by_pid));
+		nr_pids = n;
+	}
+
+	by_pid[pid].refs += lat->refs;
+	by_pid[pid].cycles += lat->cycles;
+}
+
+void
+latency_checkpoint(struct checkpoint *cp)
+{
+	checkpoint_var(cp, latency_counts);
+
+	size_t n = nr_pids;
+	checkpoint_var(cp, n);
+	if (checkpoint_restoring(cp) && n > 0) {
+		// Grow the table to n entries
+		latency_exit(n - 1, &(struct mm_latency) { 0 });
+	}
+	checkpoint_data(cp, by_pid, n * sizeof(*by_pid));
+}
+
+void
+latency_report(void)
+{
+	// Processes still alive at the end of the trace
+	for (i32 i = 0; i < get_max_nr_tasks(); ++i) {
+		mm_t *mm = get_task_by_id(i)->mm;
+		if (mm != NULL)
+			latency_exit(get_pid(mm), get_mm_latency(mm));
+	}
+
+	u64 refs = 0;
+	u64 cycles = 0;
+	for (size_t i = 0; i < nr_pids; ++i) {
+		refs += by_pid[i].refs;
+		cycles += by_pid[i].cycles;
+	}
+
+	for (i32 e = 0; e < LAT_NR_EVENTS; ++e) {
+		printf("Cycles in %s: %lu (%lu x %lu)\n", event_names[e],
+		       latency_counts[e] * latency_costs[e],
+		       latency_counts[e], latency_costs[e]);
+	}
+	printf("Simulated cycles: %lu\n", cycles);
+	printf("Simulated time: %f at %.2f GHz\n", cycles / (ghz * 1e9), ghz);
+	printf("Effective access time: %.4f cycles\n",
+	       refs > 0 ? (f64)cycles / refs : 0.0);
+
+	for (size_t i = 0; i < nr_pids; ++i) {
+		if (by_pid[i].refs == 0)
+			continue;
+		printf("pid %zu effective access time: %.4f cycles "
+		       "(%lu references, %lu cycles)\n", i,
+		       (f64)by_pid[i].cycles / by_pid[i].refs,
+		       by_pid[i].refs, by_pid[i].cycles);
+	}
+}
@@ -0,0 +1,128 @@
+/** @file latency.h
+ * @brief Per-event latency model and simulated clock.
+ *
+ * Every simulated event is charged a configurable number of cycles, both to
+ * a global per-event tally and to the address space of the current task, so
+ * that the report can give effective access times instead of raw counts.
+ */
+
+#ifndef __LATENCY_H__
+#define __LATENCY_H__
+
+#include "multiprocessing.h"
+#include "types.h"
+
+enum latency_event {
+	LAT_TLB_LOOKUP,     /* Paid by every reference */
+	LAT_WALK_STEP,      /* One level of a page table walk */
+	LAT_FAULT,          /* Trap into the fault handler, incl. CoW copy */
+	LAT_SWAP_IN,
+	LAT_SWAP_OUT,
+	LAT_SHOOTDOWN,      /* IPI to invalidate the tlb of another cpu */
+	LAT_REMOTE,         /* One hop to the memory of another NUMA node */
+	LAT_NR_EVENTS
+};
+
+/* Default costs in cycles, roughly those of a current x86-64 server with
+ * NVMe-backed swap.
+ */
+#define LAT_DEFAULT_TLB_LOOKUP       1
+#define LAT_DEFAULT_WALK_STEP       25
+#define LAT_DEFAULT_FAULT         2000
+#define LAT_DEFAULT_SWAP_IN     100000
+#define LAT_DEFAULT_SWAP_OUT    100000
+#define LAT_DEFAULT_SHOOTDOWN     5000
+#define LAT_DEFAULT_REMOTE         150
+#define LAT_DEFAULT_GHZ            3.0
+
+/* Number of levels visited by page_walk() */
+#define LAT_WALK_LEVELS 4
+
+/* Simulated time of one address space, kept in its mm_s. */
+struct mm_latency {
+	u64 refs;
+	u64 cycles;
+};
+
+extern u64 latency_costs[LAT_NR_EVENTS];
+extern u64 latency_counts[LAT_NR_EVENTS];
+
+// Latency model functions used in sim.c for initialization and teardown
+void latency_init(struct latency_config *cfg);
+void latency_destroy(void);
+
+/**
+ * @brief Parse a latency model specification given on the command line.
+ *
+ * The specification is a comma separated list of `name=value` pairs, with
+ * names tlb, walk, fault, swapin, swapout, ipi, remote (in cycles) and ghz.
+ *
+ * @param cfg[out] The configuration to update.
+ * @param spec[in] The specification, modified in place.
+ * @return 0 on success, -1 on an unknown name or a missing value.
+ *
+ * @see latency.c
+ */
+i32 latency_parse(struct latency_config *cfg, char *spec);
+
+/**
+ * @brief Charge `n` occurrences of `event` to the current task.
+ */
+static inline void
+latency_charge_n(enum latency_event event, u64 n)
+{
+	latency_counts[event] += n;
+	get_mm_latency(current_task()->mm)->cycles += n * latency_costs[event];
+}
+
+static inline void
+latency_charge(enum latency_event event)
+{
+	latency_charge_n(event, 1);
+}
+
+/**
+ * @brief Account for `n` references made by the current task.
+ *
+ * Called from tlb_translate(), charges the tlb lookup every reference pays.
+ */
+static inline void
+latency_reference_n(u64 n)
+{
+	struct mm_latency *lat = get_mm_latency(current_task()->mm);
+	latency_counts[LAT_TLB_LOOKUP] += n;
+	lat->refs += n;
+	lat->cycles += n * latency_costs[LAT_TLB_LOOKUP];
+}
+
+static inline void
+latency_reference(void)
+{
+	latency_reference_n(1);
+}
+
+/**
+ * @brief Fold the simulated time of an exiting process into the per-pid
+ * totals.
+ *
+ * @see latency.c
+ */
+void latency_exit(i32 pid, const struct mm_latency *lat);
+
+/**
+ * @brief Save or restore the event counts and the per-pid totals, see
+ * checkpoint.h. Costs come from the command line of each run.
+ *
+ * @see latency.c
+ */
+void latency_checkpoint(struct checkpoint *cp);
+
+/**
+ * @brief Print the simulated time, the effective access time and the
+ * per-pid breakdown.
+ *
+ * @see latency.c
+ */
+void latency_report(void);
+
+#endif /* __LATENCY_H__ */
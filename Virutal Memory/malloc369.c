@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
+#include <sys/mman.h>
 #include "khash.h"
 #include "types.h"
 
@@ -221,6 +222,25 @@ free369(void *ptr)
 	
 }
 
+void *
+mmap369(size_t size)
+{
+	/* Anonymous pages read as zero until first written, and with
+	 * MAP_NORESERVE no swap is set aside for the untouched ones either.
+	 */
+	void *m = mmap(NULL, size > 0 ? size : 1, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	return m == MAP_FAILED ? NULL : m;
+}
+
+void
+munmap369(void *ptr, size_t size)
+{
+	if (ptr != NULL) {
+		munmap(ptr, size > 0 ? size : 1);
+	}
+}
+
 void
 init_csc369_malloc(bool verb)
 {
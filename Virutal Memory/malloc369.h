@@ -45,6 +45,30 @@ void *realloc369(void *ptr, size_t size);
  */
 void free369(void *ptr);
 
+/**
+ * @brief Map `size` bytes of zero-filled memory, that only takes up physical
+ * memory once touched, page by page. Not tracked by the csc369 subsystem.
+ *
+ * Used for the regions sized after the simulated memory and swap, so that
+ * starting a simulation costs the same whatever their size.
+ *
+ * @param size[in] The size in bytes of memory to be mapped.
+ * @return Null pointer if failed, pointer to `size` zero bytes if successful.
+ *
+ * @see malloc369.c
+ */
+void *mmap369(size_t size);
+
+/**
+ * @brief Unmap memory mapped by mmap369().
+ *
+ * @param ptr[in] The pointer returned by mmap369(), or NULL.
+ * @param size[in] The size passed to mmap369().
+ *
+ * @see malloc369.c
+ */
+void munmap369(void *ptr, size_t size);
+
 // malloc369 functions used in sim.c for initialization and teardown.
 void init_csc369_malloc(bool verbose);
 void destroy_csc369_malloc(void);
@@ -0,0 +1,112 @@
+/** @file mkindex.c
+ * @brief Builds the sidecar index of a binary trace, see trace_index.h.
+ *
+ *   trace-index [-n stride] [-j threads] [-o index] [-p] tracefile
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdnoreturn.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sim.h"
+#include "trace_index.h"
+#include "types.h"
+
+noreturn void help_usage(char **argv)
+{
+	fprintf(stdout,
+		"Writes the index of a binary trace, by default to "
+		"tracefile" TRACE_INDEX_SUFFIX ".\n"
+	);
+	fprintf(stdout, "usage: %s [-n stride] [-j threads] [-o index] [-p] "
+		"tracefile\n", argv[0]);
+	fprintf(stdout, "\t-n stride  - lines between seek points (default %d)\n",
+		TRACE_INDEX_DEFAULT_STRIDE);
+	fprintf(stdout, "\t-j threads - threads indexing the trace (default: "
+		"one per cpu)\n");
+	fprintf(stdout, "\t-p         - print the footprint of every process\n");
+	exit(EXIT_FAILURE);
+}
+
+/* Print what the index knows about every process that shows up. */
+static void print_footprints(const struct trace_index *idx)
+{
+	printf("vpid,refs,pages,dirty_pages,footprint_kb,runs,first,last\n");
+	for (u64 v = 0; v < idx->hdr->nr_vpids; v++) {
+		const struct trace_vpid *tv = &idx->vpids[v];
+		if (tv->first == UINT64_MAX)
+			continue;
+		printf("%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu\n", v, tv->refs, tv->pages,
+		       tv->dirty, tv->pages * PAGE_SIZE / 1024, tv->nr_runs,
+		       tv->first, tv->last);
+	}
+}
+
+int main(int argc, char ** argv)
+{
+	int opt;
+	char * outpath = NULL;
+	u32 stride = TRACE_INDEX_DEFAULT_STRIDE;
+	long nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	bool print = false;
+	while ((opt = getopt(argc, argv, "n:j:o:ph")) != -1) {
+		switch (opt) {
+			case 'n':
+			stride = strtoul(optarg, NULL, 10);
+			break;
+			case 'j':
+			nr_threads = strtol(optarg, NULL, 10);
+			break;
+			case 'o':
+			outpath = optarg;
+			break;
+			case 'p':
+			print = true;
+			break;
+			case 'h':
+			default:
+			help_usage(argv);
+		}
+	}
+
+	if (optind != argc - 1 || stride == 0 || nr_threads <= 0) {
+		help_usage(argv);
+	}
+	const char * tracepath = argv[optind];
+
+	char * defpath = NULL;
+	if (outpath == NULL) {
+		defpath = malloc(strlen(tracepath) + sizeof(TRACE_INDEX_SUFFIX));
+		if (defpath == NULL) {
+			perror("malloc");
+			return 1;
+		}
+		strcpy(defpath, tracepath);
+		strcat(defpath, TRACE_INDEX_SUFFIX);
+		outpath = defpath;
+	}
+
+	if (trace_index_build(tracepath, outpath, stride, nr_threads) != 0) {
+		fprintf(stderr, "Failed to index %s into %s: %s\n",
+			tracepath, outpath, strerror(errno));
+		free(defpath);
+		return 1;
+	}
+
+	if (print) {
+		struct trace_index idx;
+		if (trace_index_open(&idx, outpath, tracepath) != 0) {
+			fprintf(stderr, "Failed to read back %s\n", outpath);
+			free(defpath);
+			return 1;
+		}
+		print_footprints(&idx);
+		trace_index_close(&idx);
+	}
+	free(defpath);
+	return 0;
+}
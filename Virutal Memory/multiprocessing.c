@@ -18,20 +18,49 @@
 #include "multiprocessing.h"
 #include "malloc369.h"
 #include "pagetable.h"
+#include "checkpoint.h"
+#include "latency.h"
+#include "numa.h"
+#include "profile.h"
+#include "quota.h"
+#include "readahead.h"
 #include "sim.h"
+#include "tlb.h"
 #include "types.h"
 
 #define DEFAULT_MAX_NR_TASKS 128
 
 struct mm_s {
+	i32 pid;
 	asid_t asid;
+	u64 generation;     /* ASID generation of `asid`, 0 before the first run */
 	struct pagetable * pgtable;
+	struct mm_profile prof;
+	struct mm_latency lat;
+	struct mm_readahead ra;
+	struct mm_numa numa;
+	struct mm_quota quota;
 };
 
+/* Tasks indexed by vpid, grown as higher vpids show up */
 i32 max_nr_tasks;
 
 struct task_s * tasks;
-struct task_s * curtask;
+i32 curtask_id = -1;
+
+/* ASIDs are handed out in order within a generation, and never twice, so
+ * that the tlb entries an address space leaves behind when it exits or
+ * gets a new ASID can never be hit. Running out starts a new generation,
+ * in which every tlb is flushed once, lazily, and every address space gets
+ * a new ASID the next time it runs.
+ */
+static u32 nr_asids;
+static u64 asid_generation;
+static u32 next_asid;
+static size_t asid_rollovers;
+
+/* Address space holding each ASID of the current generation, or NULL */
+static mm_t **asid_mms;
 
 i32 get_max_nr_tasks()
 {
@@ -40,30 +69,72 @@ i32 get_max_nr_tasks()
 
 struct task_s * get_task_by_id(u32 id)
 {
+	assert(id < (u32)max_nr_tasks);
 	return &tasks[id];
 }
 
 struct task_s * current_task()
 {
-	return curtask;
+	return curtask_id >= 0 ? &tasks[curtask_id] : NULL;
 }
 
 int current_task_id()
 {
-	assert (curtask != NULL);
-	return (int) (curtask - tasks);
+	assert (curtask_id >= 0);
+	return curtask_id;
+}
+
+/* Make room in the task table for vpid `id`. */
+static void grow_tasks(u32 id)
+{
+	if (id < (u32)max_nr_tasks)
+		return;
+
+	assert(id < INT32_MAX / 2);
+	i32 n = max_nr_tasks;
+	while ((u32)n <= id)
+		n *= 2;
+	tasks = realloc369(tasks, n * sizeof(*tasks));
+	assert(tasks != NULL);
+	memset(&tasks[max_nr_tasks], 0, (n - max_nr_tasks) * sizeof(*tasks));
+	max_nr_tasks = n;
+}
+
+/* Give `mm` an ASID of the current generation if it has none. */
+static void assign_asid(mm_t *mm)
+{
+	if (mm->generation == asid_generation)
+		return;
+
+	if (next_asid == nr_asids) {
+		asid_generation += 1;
+		next_asid = 0;
+		asid_rollovers += 1;
+		memset(asid_mms, 0, nr_asids * sizeof(*asid_mms));
+		tlb_flush_deferred();
+	}
+	mm->asid = next_asid++;
+	mm->generation = asid_generation;
+	asid_mms[mm->asid] = mm;
 }
 
-mm_t *create_mm(asid_t asid, struct pagetable *pt)
+mm_t *create_mm(i32 pid, struct pagetable *pt)
 {
 	mm_t *res = malloc369(sizeof(mm_t));
 	assert(res != NULL);
-	*res = (mm_t) { .asid = asid, .pgtable = pt };
+	*res = (mm_t) { .pid = pid, .asid = INVALID_ASID, .pgtable = pt };
+	numa_mm_init(&res->numa, pid);
+	quota_mm_init(&res->quota, pid);
 	return res;
 }
 
 void free_mm(struct mm_s * mm)
 {
+	// The ASID stays taken until the next generation, see assign_asid()
+	if (mm->generation == asid_generation)
+		asid_mms[mm->asid] = NULL;
+	profile_exit(mm->pid, &mm->prof);
+	latency_exit(mm->pid, &mm->lat);
 	free_pagetable(mm->pgtable);
 	free369(mm);
 }
@@ -76,19 +147,68 @@ void init_multiprocessing(struct mp_config *cfg)
 	tasks = malloc369(max_nr_tasks * sizeof(*tasks));
 	assert(tasks != NULL);
 	memset(tasks, 0, max_nr_tasks * sizeof(*tasks));
+	curtask_id = -1;
+
+	assert(cfg->nr_asids < INVALID_ASID);
+	nr_asids = cfg->nr_asids > 0 ? cfg->nr_asids : DEFAULT_NR_ASIDS;
+	asid_mms = malloc369(nr_asids * sizeof(*asid_mms));
+	assert(asid_mms != NULL);
+	memset(asid_mms, 0, nr_asids * sizeof(*asid_mms));
+	asid_generation = 1;
+	next_asid = 0;
+	asid_rollovers = 0;
 };
 
 void free_multiprocessing()
 {
 	// tasks have to empty at the end
 	free369(tasks);
+	free369(asid_mms);
+}
+
+void multiprocessing_checkpoint(struct checkpoint *cp)
+{
+	checkpoint_check(cp, nr_asids, "number of ASIDs");
+
+	i32 nr_tasks = max_nr_tasks;
+	checkpoint_var(cp, nr_tasks);
+	if (checkpoint_restoring(cp))
+		grow_tasks(nr_tasks - 1);
+	checkpoint_var(cp, curtask_id);
+	checkpoint_var(cp, asid_generation);
+	checkpoint_var(cp, next_asid);
+	checkpoint_var(cp, asid_rollovers);
+
+	for (i32 i = 0; i < nr_tasks; ++i) {
+		bool present = tasks[i].mm != NULL;
+		checkpoint_var(cp, present);
+		if (!present)
+			continue;
+
+		if (checkpoint_restoring(cp))
+			tasks[i].mm = create_mm(i, NULL);
+
+		mm_t *mm = tasks[i].mm;
+		checkpoint_var(cp, mm->asid);
+		checkpoint_var(cp, mm->generation);
+		if (mm->generation == asid_generation)
+			asid_mms[mm->asid] = mm;
+		checkpoint_var(cp, mm->prof);
+		checkpoint_var(cp, mm->lat);
+		checkpoint_var(cp, mm->ra);
+		checkpoint_var(cp, mm->numa);
+		checkpoint_var(cp, mm->quota);
+		pagetable_checkpoint(cp, &mm->pgtable);
+	}
 }
 
 i64 task_switch(struct task_s * newtask)
 {
 	assert(newtask->mm != NULL);
 
-	curtask = newtask;
+	curtask_id = newtask - tasks;
+	assign_asid(newtask->mm);
+	tlb_activate(curtask_id % tlb_nr_cpus());
 	return 0;
 }
 
@@ -97,13 +217,54 @@ asid_t get_asid(struct mm_s * mm)
 	return mm->asid;
 }
 
+i32 get_pid(struct mm_s * mm)
+{
+	return mm->pid;
+}
+
+mm_t * get_mm_by_asid(asid_t asid)
+{
+	return asid < nr_asids ? asid_mms[asid] : NULL;
+}
+
+size_t asid_rollover_count()
+{
+	return asid_rollovers;
+}
+
 struct pagetable * get_pagetable(struct mm_s * mm)
 {
 	return mm->pgtable;
 }
 
+struct mm_profile * get_mm_profile(struct mm_s * mm)
+{
+	return &mm->prof;
+}
+
+struct mm_latency * get_mm_latency(struct mm_s * mm)
+{
+	return &mm->lat;
+}
+
+struct mm_readahead * get_mm_readahead(struct mm_s * mm)
+{
+	return &mm->ra;
+}
+
+struct mm_numa * get_mm_numa(struct mm_s * mm)
+{
+	return &mm->numa;
+}
+
+struct mm_quota * get_mm_quota(struct mm_s * mm)
+{
+	return &mm->quota;
+}
+
 struct task_s * create_task(int pid)
 {
+	grow_tasks(pid);
 	struct task_s *tsk = &tasks[pid];
 	assert(tsk->mm == NULL);
 	tsk->mm = create_mm(pid, create_pagetable());
@@ -118,10 +279,15 @@ void free_task(struct task_s * tsk)
 
 i64 fork369(int parent_id, int child_id)
 {
-	tasks[child_id].mm = create_mm(
-		child_id,
-		duplicate_pagetable(tasks[parent_id].mm->pgtable, parent_id)
-	);
+	grow_tasks(child_id);
+	mm_t *parent = tasks[parent_id].mm;
+	pagetable_t *pt = duplicate_pagetable(parent->pgtable, parent->asid);
+	if (pt == NULL)
+	{
+		return -1;
+	}
+	tasks[child_id].mm = create_mm(child_id, pt);
+	profile_fork(&tasks[child_id].mm->prof, &tasks[parent_id].mm->prof);
 	return 0;
 }
 
@@ -19,6 +19,9 @@
 #include "sim.h"
 #include "pagetable.h"
 
+/* ASIDs tagged in the tlb unless set otherwise, as many as x86 PCIDs */
+#define DEFAULT_NR_ASIDS 4096
+
 /* memory manager */
 typedef struct mm_s mm_t;
 
@@ -30,8 +33,9 @@ struct task_s {
 /* Multiprocessing startup and breakdown */
 void init_multiprocessing(struct mp_config *cfg);
 void free_multiprocessing();
+void multiprocessing_checkpoint(struct checkpoint *cp);
 
-/* task utilities */
+/* task utilities, tasks being indexed by vpid */
 i32 get_max_nr_tasks();
 struct task_s * get_task_by_id(u32 id);
 struct task_s * current_task();
@@ -41,9 +45,18 @@ void free_task(struct task_s * tsk);
 
 /* mm utilities */
 asid_t get_asid(mm_t * mm);
+i32 get_pid(mm_t * mm);
+mm_t * get_mm_by_asid(asid_t asid);
+size_t asid_rollover_count();
 pagetable_t * get_pagetable(mm_t * mm);
+struct mm_profile * get_mm_profile(mm_t * mm);
+struct mm_latency * get_mm_latency(mm_t * mm);
+struct mm_readahead * get_mm_readahead(mm_t * mm);
+struct mm_numa * get_mm_numa(mm_t * mm);
+struct mm_quota * get_mm_quota(mm_t * mm);
 
 /* fork utilities */
+/* Returns -1, with no child created, if swap ran out */
 i64 fork369(int parent_id, int child_id);
 
 #endif /* __MULTIPROCESSING_H__ */
@@ -0,0 +1,202 @@
+/** @file numa.c
+ * @brief Multi-node (NUMA) physical memory model.
+ *
+ * Only the topology, the placement order and the access counts live here.
+ * The free frames of every node are managed by coremap.c, and migrating a
+ * page between frames by pagetable.c.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "checkpoint.h"
+#include "coremap.h"
+#include "latency.h"
+#include "malloc369.h"
+#include "multiprocessing.h"
+#include "numa.h"
+#include "sim.h"
+#include "types.h"
+
+u32 numa_nr_nodes = 1;
+
+static enum numa_policy policy = NUMA_FIRST_TOUCH;
+static size_t migrate_threshold = 0;
+
+static const char *const policy_names[NUMA_NR_POLICIES] = {
+	[NUMA_FIRST_TOUCH] = "first-touch",
+	[NUMA_INTERLEAVE] = "interleave",
+	[NUMA_LOCAL_PREFERRED] = "local-preferred",
+};
+
+/* Remote accesses to every frame since it was allocated or last migrated,
+ * only kept with migration enabled
+ */
+static u32 *remote_refs = NULL;
+
+static struct numa_node_stats node_stats[NUMA_MAX_NODES];
+
+/* Hops between two nodes on the ring */
+static inline u32
+distance(u32 a, u32 b)
+{
+	const u32 d = a > b ? a - b : b - a;
+	return d < numa_nr_nodes - d ? d : numa_nr_nodes - d;
+}
+
+void
+numa_init(struct numa_config *cfg)
+{
+	assert(cfg->nodes <= NUMA_MAX_NODES);
+	numa_nr_nodes = cfg->nodes > 0 ? cfg->nodes : 1;
+	policy = cfg->policy;
+	migrate_threshold = numa_nr_nodes > 1 ? cfg->migrate : 0;
+	memset(node_stats, 0, sizeof(node_stats));
+
+	if (migrate_threshold > 0) {
+		remote_refs = malloc369(memsize * sizeof(*remote_refs));
+		if (remote_refs == NULL) {
+			perror("Failed to allocate NUMA access counts");
+			exit(1);
+		}
+		memset(remote_refs, 0, memsize * sizeof(*remote_refs));
+	}
+}
+
+void
+numa_destroy(void)
+{
+	free369(remote_refs);
+	remote_refs = NULL;
+	numa_nr_nodes = 1;
+}
+
+enum numa_policy
+numa_parse_policy(const char *name)
+{
+	for (i32 i = 0; i < NUMA_NR_POLICIES; ++i) {
+		if (strcmp(name, policy_names[i]) == 0)
+			return i;
+	}
+	return NUMA_NR_POLICIES;
+}
+
+void
+numa_mm_init(struct mm_numa *numa, i32 pid)
+{
+	numa->home = pid % numa_nr_nodes;
+	numa->interleave = numa->home;
+}
+
+pfn_t
+numa_node_start(u32 node, size_t *nr_frames)
+{
+	const size_t base = memsize / numa_nr_nodes;
+	const size_t rem = memsize % numa_nr_nodes;
+
+	*nr_frames = node < rem ? base + 1 : base;
+	return node < rem ? node * (base + 1) : rem * (base + 1) + (node - rem) * base;
+}
+
+u32
+numa_placement(struct mm_numa *numa, u32 *order)
+{
+	u32 first = numa->home;
+	if (policy == NUMA_INTERLEAVE) {
+		first = numa->interleave;
+		numa->interleave = (first + 1) % numa_nr_nodes;
+	}
+
+	order[0] = first;
+	if (policy == NUMA_FIRST_TOUCH)
+		return 1;
+
+	// Nearest nodes first, alternating between both ways round the ring
+	for (u32 k = 1; k < numa_nr_nodes; ++k) {
+		const u32 hop = (k + 1) / 2;
+		order[k] = k % 2 == 1
+			? (first + hop) % numa_nr_nodes
+			: (first + numa_nr_nodes - hop) % numa_nr_nodes;
+	}
+	return numa_nr_nodes;
+}
+
+void
+numa_frame_reset(pfn_t framenum)
+{
+	if (remote_refs != NULL)
+		remote_refs[framenum] = 0;
+}
+
+void
+numa_access(pfn_t framenum)
+{
+	const struct mm_numa *numa = get_mm_numa(current_task()->mm);
+	const u32 node = numa_node_of(framenum);
+	struct numa_node_stats *st = &node_stats[numa->home];
+
+	if (node == numa->home) {
+		st->local += 1;
+		return;
+	}
+
+	st->remote += 1;
+	latency_charge_n(LAT_REMOTE, distance(node, numa->home));
+
+	if (remote_refs == NULL || ++remote_refs[framenum] < migrate_threshold)
+		return;
+
+	// Pages shared by several tasks could end up bouncing between nodes
+	remote_refs[framenum] = 0;
+	if (frame_is_shared(frame_from_number(framenum)))
+		return;
+
+	if (migrate_frame(framenum, numa->home) != INVALID_FRAME) {
+		// The hinting fault that found the page misplaced
+		latency_charge(LAT_FAULT);
+		st->migrated += 1;
+	}
+}
+
+void
+numa_checkpoint(struct checkpoint *cp)
+{
+	checkpoint_check(cp, numa_nr_nodes, "number of NUMA nodes");
+	checkpoint_check(cp, remote_refs != NULL, "NUMA migration");
+	checkpoint_var(cp, node_stats);
+	if (remote_refs != NULL)
+		checkpoint_block(cp, remote_refs, memsize * sizeof(*remote_refs));
+}
+
+void
+numa_report(void)
+{
+	size_t local = 0;
+	size_t remote = 0;
+	size_t migrated = 0;
+
+	if (numa_nr_nodes <= 1)
+		return;
+
+	printf("NUMA placement: %s\n", policy_names[policy]);
+	for (u32 i = 0; i < numa_nr_nodes; ++i) {
+		const struct numa_node_stats *st = &node_stats[i];
+		size_t nr_frames;
+
+		numa_node_start(i, &nr_frames);
+		printf("Node %u: %zu frames, %zu local accesses, "
+		       "%zu remote accesses, %zu pages migrated in\n",
+		       i, nr_frames, st->local, st->remote, st->migrated);
+		local += st->local;
+		remote += st->remote;
+		migrated += st->migrated;
+	}
+	printf("NUMA local accesses: %zu\n", local);
+	printf("NUMA remote accesses: %zu\n", remote);
+	printf("NUMA remote access rate: %.4f\n", local + remote > 0
+	       ? (f64)remote / (local + remote) * 100.0
+	       : 0.0);
+	printf("NUMA migrations: %zu\n", migrated);
+}
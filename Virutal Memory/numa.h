@@ -0,0 +1,144 @@
+/** @file numa.h
+ * @brief Multi-node (NUMA) physical memory model.
+ *
+ * Physical frames are split into nodes of contiguous frame numbers, the
+ * first memsize % nodes nodes holding one frame more than the others. Nodes
+ * sit on a ring, and an access to a frame on another node than the one the
+ * task is homed on costs the remote latency once per hop between the two.
+ * Process vpid is homed on node vpid % nodes, which is the node of the cpu
+ * it runs on whenever the number of nodes divides the number of cpus.
+ *
+ * Each node keeps its own free frames, see allocate_frame() in coremap.c,
+ * and the placement policy decides which node a page is allocated on:
+ *
+ *   first-touch      the home node of the faulting task, reclaiming a frame
+ *                    once it is full even if other nodes have free frames
+ *   interleave       every node in turn, per address space, falling back to
+ *                    the nearest node with a free frame
+ *   local-preferred  the home node, falling back to the nearest node with a
+ *                    free frame before reclaiming
+ *
+ * Reclaim goes through the replacement algorithm, which is global, so the
+ * frame it frees may still lie on another node. With migration enabled,
+ * a frame mapped by a single page that its task accesses remotely a given
+ * number of times is moved to a free frame of the task's home node.
+ */
+
+#ifndef __NUMA_H__
+#define __NUMA_H__
+
+#include "types.h"
+
+#define NUMA_MAX_NODES 64
+
+enum numa_policy {
+	NUMA_FIRST_TOUCH,
+	NUMA_INTERLEAVE,
+	NUMA_LOCAL_PREFERRED,
+	NUMA_NR_POLICIES
+};
+
+/* Placement state of one address space, kept in its mm_s. */
+struct mm_numa {
+	u32 home;           /* Node the task runs on */
+	u32 interleave;     /* Next node for interleaved placement */
+};
+
+struct numa_node_stats {
+	size_t local;       /* Accesses by tasks homed here to frames here */
+	size_t remote;      /* Accesses by tasks homed here to other nodes */
+	size_t migrated;    /* Pages migrated onto this node */
+};
+
+extern u32 numa_nr_nodes;
+
+// NUMA functions used in sim.c for initialization and teardown
+void numa_init(struct numa_config *cfg);
+void numa_destroy(void);
+
+/**
+ * @brief Parse the name of a placement policy given on the command line.
+ *
+ * @return The policy, or NUMA_NR_POLICIES if there is no such policy.
+ *
+ * @see numa.c
+ */
+enum numa_policy numa_parse_policy(const char *name);
+
+/**
+ * @brief Home the new address space of process `pid` on its node.
+ *
+ * @see numa.c
+ */
+void numa_mm_init(struct mm_numa *numa, i32 pid);
+
+/**
+ * @brief Get the node holding physical frame `framenum`.
+ */
+static inline u32
+numa_node_of(pfn_t framenum)
+{
+	extern size_t memsize;
+	const size_t base = memsize / numa_nr_nodes;
+	const size_t rem = memsize % numa_nr_nodes;
+	const size_t boundary = rem * (base + 1);
+
+	return (size_t)framenum < boundary
+		? (size_t)framenum / (base + 1)
+		: rem + ((size_t)framenum - boundary) / base;
+}
+
+/**
+ * @brief Get the first frame and the number of frames of node `node`.
+ *
+ * @see numa.c
+ */
+pfn_t numa_node_start(u32 node, size_t *nr_frames);
+
+/**
+ * @brief Get the nodes to allocate a page of address space `numa` from, in
+ * order of preference, according to the placement policy.
+ *
+ * @param numa[in] The placement state of the faulting address space.
+ * @param order[out] Room for numa_nr_nodes nodes.
+ * @return The number of nodes to try before reclaiming a frame.
+ *
+ * @see numa.c
+ */
+u32 numa_placement(struct mm_numa *numa, u32 *order);
+
+/**
+ * @brief Account for an access by the current task to frame `framenum`,
+ * charging remote accesses and migrating the page if it became hot.
+ *
+ * Called from access_mem() in sim.c once the access is done.
+ *
+ * @see numa.c
+ */
+void numa_access(pfn_t framenum);
+
+/**
+ * @brief Forget the remote accesses counted against a frame that is
+ * allocated to a new page.
+ *
+ * @see numa.c
+ */
+void numa_frame_reset(pfn_t framenum);
+
+/**
+ * @brief Save or restore the access counts of frames and nodes, see
+ * checkpoint.h. The placement state of address spaces is kept by each mm_s.
+ *
+ * @see numa.c
+ */
+void numa_checkpoint(struct checkpoint *cp);
+
+/**
+ * @brief Print the local and remote accesses and the migrations of every
+ * node.
+ *
+ * @see numa.c
+ */
+void numa_report(void);
+
+#endif /* __NUMA_H__ */
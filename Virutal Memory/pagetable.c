@@ -25,8 +25,14 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "checkpoint.h"
+#include "latency.h"
 #include "malloc369.h"
+#include "multiprocessing.h"
 #include "ptrarray.h"
+#include "profile.h"
+#include "quota.h"
+#include "readahead.h"
 #include "sim.h"
 #include "coremap.h"
 #include "swap.h"
@@ -45,6 +51,9 @@ struct pt_entry_s
 	pfn_t pfn;
 	off_t swap_offset;
 	vpn_t vpn;
+	u64 last_ref; // profiler stamp, see profile.h
+	int prefetched; // read ahead and not referenced yet, see readahead.h
+	i32 pid; // process that last walked to it, see pid_from_pte()
 };
 struct pagetable_l4
 {
@@ -123,6 +132,16 @@ pfn_t __nonnull() framenum_from_pte(const pt_entry_t *pte)
 	return pte->pfn;
 }
 
+vpn_t __nonnull() vpn_from_pte(const pt_entry_t *pte)
+{
+	return pte->vpn;
+}
+
+i32 __nonnull() pid_from_pte(const pt_entry_t *pte)
+{
+	return pte->pid;
+}
+
 pagetable_t *create_pagetable(void)
 {
 	pagetable_t *pt = malloc369(sizeof(pagetable_t));
@@ -135,10 +154,10 @@ pagetable_t *create_pagetable(void)
 
 /* Update pte information after its referenced frame just got evicted.
  *
- * Update the tlb as well to ensure consistent state.
+ * Its tlb entries are already gone, see handle_frame_evict().
  */
 __attribute__((unused)) static void
-handle_pte_evict(pt_entry_t *pte, off_t swap_offset, asid_t asid)
+handle_pte_evict(pt_entry_t *pte, off_t swap_offset)
 {
 	pte->valid = 0;
 	if (swap_offset != INVALID_SWAP)
@@ -152,14 +171,91 @@ handle_pte_evict(pt_entry_t *pte, off_t swap_offset, asid_t asid)
 		pte->swap_offset = swap_offset;
 	}
 	pte->pfn = INVALID_FRAME;
-	tlb_index_t idx = tlbp(asid, pte->vpn);
-	if (idx != TLB_PROBE_NOTFOUND)
+}
+
+struct tlb_page
+{
+	asid_t asid;
+	vpn_t vpn;
+};
+
+static bool
+entry_maps_frame(const tlb_entry_t *entry, const void *framenum)
+{
+	return entry->fields.pfn == *(const pfn_t *)framenum;
+}
+
+static bool
+entry_in_asid(const tlb_entry_t *entry, const void *asid)
+{
+	return entry->fields.asid == *(const asid_t *)asid;
+}
+
+static bool
+entry_maps_page(const tlb_entry_t *entry, const void *arg)
+{
+	const struct tlb_page *page = arg;
+	return entry->fields.asid == page->asid && entry->fields.vpn == page->vpn;
+}
+
+/* Update every valid tlb entry, on every cpu, for which `match` holds,
+ * skipping the current cpu unless `local` is set.
+ *
+ * Entries are invalidated, or if `protect` is set, only lose their dirty bit
+ * so that the next write through them raises a write fault. Every other cpu
+ * whose tlb held such an entry is sent a shootdown IPI for `event`.
+ */
+static void
+tlb_sweep(bool (*match)(const tlb_entry_t *, const void *), const void *arg,
+		  bool protect, bool local, enum tlb_shootdown_event event)
+{
+	const u32 self = tlb_current_cpu();
+	for (u32 cpu = 0; cpu < tlb_nr_cpus(); cpu++)
 	{
-		tlb_entry_t entry;
-		tlbr(idx, &entry);
-		entry.fields.valid = false;
-		tlbwi(idx, &entry);
+		if (cpu == self && !local)
+		{
+			continue;
+		}
+		tlb_set_cpu(cpu);
+
+		bool swept = false;
+		for (tlb_index_t idx = 0; idx < TLB_MAXIMUM_SIZE; idx++)
+		{
+			tlb_entry_t entry;
+			if (tlbr(idx, &entry) != 0)
+			{
+				break;
+			}
+			if (!entry.fields.valid || !match(&entry, arg))
+			{
+				continue;
+			}
+			if (protect)
+			{
+				entry.fields.dirty = 0;
+			}
+			else
+			{
+				entry.fields.valid = false;
+			}
+			tlbwi(idx, &entry);
+			swept = true;
+		}
+
+		if (swept && cpu != self)
+		{
+			tlb_shootdown(event);
+		}
 	}
+	tlb_set_cpu(self);
+}
+
+/* Update every tlb entry, of any address space, that maps `framenum`.
+ */
+static void
+tlb_sweep_frame(pfn_t framenum, bool protect, enum tlb_shootdown_event event)
+{
+	tlb_sweep(entry_maps_frame, &framenum, protect, true, event);
 }
 
 __attribute__((unused)) void
@@ -168,10 +264,22 @@ handle_frame_evict(pfn_t framenum, asid_t asid)
 	frame_t *frame = frame_from_number(framenum);
 	ptrarray_slice_t ptes = get_referring_ptes(frame);
 
-	for (int i = 0; i < ptes.len; i++)
+	// The frame may be cached under any ASID that maps it, which after a
+	// fork or CoW fault need not be the one that allocated it, and `asid`
+	// may have been recycled since then.
+	(void)asid;
+	tlb_sweep_frame(framenum, false, TLB_SHOOTDOWN_EVICT);
+
+	// Walk backwards since frame_unlink_pte() compacts the array.
+	for (int i = ptes.len - 1; i >= 0; i--)
 	{
 		pt_entry_t *pte = (pt_entry_t *)ptes.ptr[i];
 		off_t swap_offset = INVALID_SWAP;
+		if (pte->prefetched)
+		{
+			readahead_stats.wasted++;
+			pte->prefetched = 0;
+		}
 		if (pte->dirty)
 		{
 			evict_dirty_count++;
@@ -183,11 +291,35 @@ handle_frame_evict(pfn_t framenum, asid_t asid)
 			evict_clean_count++;
 			swap_offset = pte->swap_offset;
 		}
-		handle_pte_evict(pte, swap_offset, asid);
+		handle_pte_evict(pte, swap_offset);
 		frame_unlink_pte(framenum, pte);
 	}
 }
 
+void
+handle_frame_merge(pfn_t dst, pfn_t src)
+{
+	// Write-protect the surviving frame, keeping its translations cached.
+	ptrarray_slice_t dst_ptes = get_referring_ptes(frame_from_number(dst));
+	for (int i = 0; i < dst_ptes.len; i++)
+	{
+		((pt_entry_t *)dst_ptes.ptr[i])->writable = 0;
+	}
+	tlb_sweep_frame(dst, true, TLB_SHOOTDOWN_MERGE);
+	tlb_sweep_frame(src, false, TLB_SHOOTDOWN_MERGE);
+
+	// Walk backwards since frame_unlink_pte() compacts the array.
+	ptrarray_slice_t src_ptes = get_referring_ptes(frame_from_number(src));
+	for (int i = src_ptes.len - 1; i >= 0; i--)
+	{
+		pt_entry_t *pte = (pt_entry_t *)src_ptes.ptr[i];
+		frame_unlink_pte(src, pte);
+		frame_link_pte(dst, pte);
+		pte->pfn = dst;
+		pte->writable = 0;
+	}
+}
+
 /* Copy the frame with number `src` to frame number `dst` and
  * return the pointer to the frame with number `dst`.
  */
@@ -195,12 +327,30 @@ __attribute__((unused)) static void *
 copy_frame(pfn_t dst, pfn_t src)
 {
 	extern u8 *physmem;
-	void *src_ptr = &physmem[src * PAGE_SIZE];
-	void *dst_ptr = &physmem[dst * PAGE_SIZE];
-	memcpy(dst_ptr, src_ptr, PAGE_SIZE);
+	void *src_ptr = &physmem[src * SIMPAGESIZE];
+	void *dst_ptr = &physmem[dst * SIMPAGESIZE];
+	memcpy(dst_ptr, src_ptr, SIMPAGESIZE);
 	return dst_ptr;
 }
 
+void
+handle_frame_migrate(pfn_t dst, pfn_t src)
+{
+	// Translations of the old frame must be gone before it is reused.
+	tlb_sweep_frame(src, false, TLB_SHOOTDOWN_MIGRATE);
+	copy_frame(dst, src);
+
+	// Walk backwards since frame_unlink_pte() compacts the array.
+	ptrarray_slice_t ptes = get_referring_ptes(frame_from_number(src));
+	for (int i = ptes.len - 1; i >= 0; i--)
+	{
+		pt_entry_t *pte = (pt_entry_t *)ptes.ptr[i];
+		frame_unlink_pte(src, pte);
+		frame_link_pte(dst, pte);
+		pte->pfn = dst;
+	}
+}
+
 /*
  * Locate the physical frame number for the given vaddr using the page table.
  *
@@ -233,6 +383,11 @@ find_frame_number(pt_entry_t *pte, char type)
 	if (pte->valid)
 	{
 		ram_hit_count++;
+		if (pte->prefetched)
+		{
+			readahead_stats.hits++;
+			pte->prefetched = 0;
+		}
 		if ((type == 'S' || type == 'M'))
 		{
 			pte->dirty = 1;
@@ -241,6 +396,12 @@ find_frame_number(pt_entry_t *pte, char type)
 	}
 
 	ram_miss_count++;
+	latency_charge(LAT_FAULT);
+	quota_fault();
+	if (profiling)
+	{
+		get_mm_profile(current_task()->mm)->faults++;
+	}
 	pfn_t frame = allocate_frame(pte);
 
 	if (pte->swapped)
@@ -265,9 +426,12 @@ find_frame_number(pt_entry_t *pte, char type)
 	return frame;
 }
 
-pt_entry_t *page_walk(pagetable_t *pt, vaddr_t vaddr, char type)
+/* Return the entry for `vpn`, creating the missing levels of the page table
+ * if `create` is set, or returning NULL otherwise.
+ */
+static pt_entry_t *
+find_pte(pagetable_t *pt, vpn_t vpn, bool create)
 {
-	vpn_t vpn = vaddr >> 12;
 	size_t i1 = (vpn >> 27) & 0x1FF;
 	size_t i2 = (vpn >> 18) & 0x1FF;
 	size_t i3 = (vpn >> 9) & 0x1FF;
@@ -275,6 +439,10 @@ pt_entry_t *page_walk(pagetable_t *pt, vaddr_t vaddr, char type)
 
 	if (pt->l1[i1] == NULL)
 	{
+		if (!create)
+		{
+			return NULL;
+		}
 		pt->l1[i1] = malloc369(sizeof(struct pagetable_l2));
 		memset(pt->l1[i1]->l2, 0, sizeof(pt->l1[i1]->l2));
 	}
@@ -282,6 +450,10 @@ pt_entry_t *page_walk(pagetable_t *pt, vaddr_t vaddr, char type)
 	struct pagetable_l2 *l2 = pt->l1[i1];
 	if (l2->l2[i2] == NULL)
 	{
+		if (!create)
+		{
+			return NULL;
+		}
 		l2->l2[i2] = malloc369(sizeof(struct pagetable_l3));
 		memset(l2->l2[i2]->l3, 0, sizeof(l2->l2[i2]->l3));
 	}
@@ -289,11 +461,70 @@ pt_entry_t *page_walk(pagetable_t *pt, vaddr_t vaddr, char type)
 	struct pagetable_l3 *l3 = l2->l2[i2];
 	if (l3->l3[i3] == NULL)
 	{
+		if (!create)
+		{
+			return NULL;
+		}
 		l3->l3[i3] = malloc369(sizeof(struct pagetable_l4));
 		memset(l3->l3[i3]->pages, 0, sizeof(l3->l3[i3]->pages));
 	}
 	struct pagetable_l4 *l4 = l3->l3[i3];
-	pt_entry_t *pte = &l4->pages[page_index];
+	return &l4->pages[page_index];
+}
+
+/* Read the pages that follow a swap-in fault on `pte` along the stride of
+ * its address space's faults into free frames, see readahead.h.
+ */
+static void
+read_ahead(pagetable_t *pt, pt_entry_t *pte)
+{
+	struct mm_readahead *ra = get_mm_readahead(current_task()->mm);
+	i64 stride;
+	size_t n = readahead_fault(ra, pte->vpn, &stride);
+
+	for (size_t i = 1; i <= n; i++)
+	{
+		vpn_t vpn = pte->vpn + (i64)i * stride;
+		if (vpn < 0 || vpn > VPN_MASK)
+		{
+			break;
+		}
+
+		pt_entry_t *next = find_pte(pt, vpn, false);
+		if (next == NULL || (!next->valid && !next->swapped))
+		{
+			continue;
+		}
+		if (!next->valid)
+		{
+			pfn_t frame = allocate_free_frame(next);
+			if (frame == INVALID_FRAME)
+			{
+				break;
+			}
+			swap_pagein(frame, next->swap_offset);
+			next->pid = current_task_id();
+			next->swapped = 0;
+			next->pfn = frame;
+			next->valid = 1;
+			next->prefetched = 1;
+			readahead_stats.pages++;
+
+			// Let the replacement algorithm see the page arrive unreferenced
+			ref_func(frame);
+			set_referenced(frame_from_number(frame), false);
+		}
+		// The stream carries on past the pages now resident
+		ra->last = vpn;
+	}
+}
+
+pt_entry_t *page_walk(pagetable_t *pt, vaddr_t vaddr, char type)
+{
+	vpn_t vpn = vaddr >> 12;
+
+	latency_charge_n(LAT_WALK_STEP, LAT_WALK_LEVELS);
+	pt_entry_t *pte = find_pte(pt, vpn, true);
 
 	if (!pte->valid && !pte->swapped && pte->pfn == 0 && pte->vpn == 0)
 	{
@@ -304,8 +535,15 @@ pt_entry_t *page_walk(pagetable_t *pt, vaddr_t vaddr, char type)
 		pte->swap_offset = INVALID_SWAP;
 		pte->pfn = INVALID_FRAME;
 	}
+	// A child's pte copied at fork holds its parent's pid until now
+	pte->pid = current_task_id();
 
+	bool swap_in = !pte->valid && pte->swapped;
 	(void)find_frame_number(pte, type);
+	if (swap_in && readahead_window > 0)
+	{
+		read_ahead(pt, pte);
+	}
 	return pte;
 }
 
@@ -341,6 +579,7 @@ void free_pagetable(pagetable_t *pt)
 					pt_entry_t *pte = &l4->pages[m];
 					if (pte->valid)
 					{
+						readahead_stats.wasted += pte->prefetched;
 						frame_unlink_pte(pte->pfn, pte);
 					}
 					if (pte->swapped && pte->swap_offset != INVALID_SWAP)
@@ -357,6 +596,102 @@ void free_pagetable(pagetable_t *pt)
 	free369(pt);
 }
 
+u64 *pagetable_stamp(pagetable_t *pt, vpn_t vpn)
+{
+	pt_entry_t *pte = find_pte(pt, vpn, false);
+	return pte != NULL ? &pte->last_ref : NULL;
+}
+
+/* Call `fn` on every used entry of the page table, in address order.
+ */
+static void
+for_each_pte(pagetable_t *pt, void (*fn)(pt_entry_t *, vpn_t, void *), void *arg)
+{
+	for (size_t i = 0; i < 512; i++)
+	{
+		struct pagetable_l2 *l2 = pt->l1[i];
+		if (l2 == NULL)
+		{
+			continue;
+		}
+		for (size_t j = 0; j < 512; j++)
+		{
+			struct pagetable_l3 *l3 = l2->l2[j];
+			if (l3 == NULL)
+			{
+				continue;
+			}
+			for (size_t k = 0; k < 512; k++)
+			{
+				struct pagetable_l4 *l4 = l3->l3[k];
+				if (l4 == NULL)
+				{
+					continue;
+				}
+				for (size_t m = 0; m < 512; m++)
+				{
+					pt_entry_t *pte = &l4->pages[m];
+					if (!pte->valid && !pte->swapped && pte->pfn == 0 && pte->vpn == 0)
+					{
+						continue;
+					}
+					fn(pte, (i << 27) | (j << 18) | (k << 9) | m, arg);
+				}
+			}
+		}
+	}
+}
+
+static void
+count_pte(pt_entry_t *pte, vpn_t vpn, void *arg)
+{
+	(void)pte;
+	(void)vpn;
+	*(u64 *)arg += 1;
+}
+
+static void
+save_pte(pt_entry_t *pte, vpn_t vpn, void *arg)
+{
+	struct checkpoint *cp = arg;
+	checkpoint_var(cp, vpn);
+	checkpoint_var(cp, *pte);
+	if (pte->valid)
+	{
+		frame_checkpoint_pte(cp, pte->pfn, pte);
+	}
+}
+
+void pagetable_checkpoint(struct checkpoint *cp, pagetable_t **pt)
+{
+	u64 count = 0;
+
+	if (!checkpoint_restoring(cp))
+	{
+		for_each_pte(*pt, count_pte, &count);
+		checkpoint_var(cp, count);
+		for_each_pte(*pt, save_pte, cp);
+		return;
+	}
+
+	checkpoint_var(cp, count);
+	*pt = create_pagetable();
+	for (u64 n = 0; n < count; n++)
+	{
+		vpn_t vpn;
+		pt_entry_t saved;
+		checkpoint_var(cp, vpn);
+		checkpoint_var(cp, saved);
+
+		pt_entry_t *pte = find_pte(*pt, vpn, true);
+		*pte = saved;
+		if (pte->valid)
+		{
+			frame_checkpoint_pte(cp, pte->pfn, pte);
+		}
+	}
+}
+
 pagetable_t *
 duplicate_pagetable(pagetable_t *src, asid_t src_asid)
 {
@@ -389,7 +724,7 @@ duplicate_pagetable(pagetable_t *src, asid_t src_asid)
 				for (size_t m = 0; m < 512; m++)
 				{
 					pt_entry_t *src_pte = &l4->pages[m];
-					if (!src_pte->valid)
+					if (!src_pte->valid && !src_pte->swapped)
 					{
 						continue;
 					}
@@ -415,37 +750,76 @@ duplicate_pagetable(pagetable_t *src, asid_t src_asid)
 					pt_entry_t *child_pte = &child->l1[i]->l2[j]->l3[k]->pages[m];
 					// Copy src pte to child pte
 					*child_pte = *src_pte;
+					// A swapped out page gets its own copy in swap
+					if (!src_pte->valid)
+					{
+						child_pte->swap_offset = swap_dup(src_pte->swap_offset);
+						if (child_pte->swap_offset == INVALID_SWAP)
+						{
+							// Out of swap: undo the copy and fail the fork
+							child_pte->swapped = 0;
+							free_pagetable(child);
+							child = NULL;
+							goto out;
+						}
+						continue;
+					}
 					// Set both src and child pte to read-only
 					src_pte->writable = 0;
 					child_pte->writable = 0;
+					// The child has no swap slot of its own yet
+					child_pte->dirty = 1;
+					child_pte->prefetched = 0;
+					child_pte->swap_offset = INVALID_SWAP;
 					// Link child pte to frame
 					frame_link_pte(child_pte->pfn, child_pte);
 				}
 			}
 		}
 	}
+out:
 	// set TLB dirty to unwritable
-	for (tlb_index_t idx = 0; idx < TLB_MAXIMUM_SIZE; idx++)
+	tlb_sweep(entry_in_asid, &src_asid, false, true, TLB_SHOOTDOWN_FORK);
+	return child;
+}
+
+/* Load the translations of the resident neighbours of `vpn` into the tlb,
+ * see readahead.h. They are loaded clean so that a write through them
+ * still faults and marks the page dirty.
+ */
+static void
+map_around(asid_t asid, pagetable_t *pt, vpn_t vpn)
+{
+	vpn_t start = vpn - vpn % (vpn_t)fault_around;
+	for (vpn_t v = start; v < start + (vpn_t)fault_around; v++)
 	{
-		tlb_entry_t entry;
-		if (tlbr(idx, &entry) != 0)
+		if (v == vpn)
 		{
 			continue;
 		}
-
-		if (!entry.fields.valid)
+		// Pages read ahead are left to count their own first reference
+		pt_entry_t *pte = find_pte(pt, v, false);
+		if (pte == NULL || !pte->valid || pte->prefetched
+			|| tlbp(asid, v) != TLB_PROBE_NOTFOUND)
 		{
 			continue;
 		}
 
-		if (entry.fields.asid != src_asid)
+		tlb_entry_t entry;
+		memset(&entry, 0, sizeof(entry));
+		entry.fields.vpn = v;
+		entry.fields.pfn = pte->pfn;
+		entry.fields.asid = asid;
+		entry.fields.valid = 1;
+		entry.fields.premapped = 1;
+		tlbwr(&entry);
+		readahead_stats.around_pages++;
+
+		if (profiling)
 		{
-			continue;
+			tlb_set_stamp(tlbp(asid, v), &pte->last_ref);
 		}
-		entry.fields.valid = false;
-		tlbwi(idx, &entry);
 	}
-	return child;
 }
 
 void handle_tlb_fault(asid_t asid, pagetable_t *pt, vaddr_t vaddr, char type, bool write)
@@ -460,21 +834,38 @@ void handle_tlb_fault(asid_t asid, pagetable_t *pt, vaddr_t vaddr, char type, bo
 		{
 			// Treat any write to a valid read-only page as a CoW fault.
 			cow_fault_count++;
+			latency_charge(LAT_FAULT);
 
 			pfn_t old_frame = pte->pfn;
 			frame_t *old_fr = frame_from_number(old_frame);
 			assert(old_fr != NULL);
 
-			pfn_t new_frame = allocate_frame(pte);
-			copy_frame(new_frame, old_frame);
+			// The last mapping of a frame can simply be made writable.
+			if (frame_is_shared(old_fr))
+			{
+				// Unlink first so that allocate_frame() may pick the old
+				// frame as its victim without touching this pte.
+				u8 data[SIMPAGESIZE];
+				memcpy(data, &physmem[old_frame * SIMPAGESIZE], SIMPAGESIZE);
+				frame_unlink_pte(old_frame, pte);
 
-			// Fix frame <-> pte links
-			frame_unlink_pte(old_frame, pte);
-			frame_link_pte(new_frame, pte);
+				pfn_t new_frame = allocate_frame(pte);
+				memcpy(&physmem[new_frame * SIMPAGESIZE], data, SIMPAGESIZE);
 
-			pte->pfn = new_frame;
-			pte->swapped = 0;
-			pte->swap_offset = INVALID_SWAP;
+				if (pte->swap_offset != INVALID_SWAP)
+				{
+					swap_free(pte->swap_offset);
+				}
+				pte->pfn = new_frame;
+				pte->swapped = 0;
+				pte->swap_offset = INVALID_SWAP;
+
+				// The local entry is rewritten below, other cpus may
+				// still map the old frame
+				struct tlb_page page = { asid, vaddr >> PAGE_SHIFT };
+				tlb_sweep(entry_maps_page, &page, false, false,
+						  TLB_SHOOTDOWN_COW);
+			}
 			pte->writable = 1;
 		}
 
@@ -500,6 +891,12 @@ void handle_tlb_fault(asid_t asid, pagetable_t *pt, vaddr_t vaddr, char type, bo
 		entry.fields.dirty = 0;
 	}
 
+	// Before the entry is written, so that it cannot be replaced
+	if (fault_around > 1 && !write)
+	{
+		map_around(asid, pt, vpn);
+	}
+
 	tlb_index_t idx = tlbp(asid, vpn);
 	if (idx != TLB_PROBE_NOTFOUND)
 	{
@@ -509,4 +906,9 @@ void handle_tlb_fault(asid_t asid, pagetable_t *pt, vaddr_t vaddr, char type, bo
 	{
 		tlbwr(&entry);
 	}
+
+	if (profiling)
+	{
+		tlb_set_stamp(tlbp(asid, vpn), &pte->last_ref);
+	}
 }
@@ -65,7 +65,8 @@ void free_pagetable(pagetable_t *pt);
  *
  * @param[in] src The pagetable of the parent process.
  * @param[in] src_asid The address space identifier of the parent process.
- * @return The page table of the child process.
+ * @return The page table of the child process, or NULL if there is no swap
+ *         left for a copy of its swapped out pages.
  * @pre The parent process must be fully initialized and in a valid state.
  * @post All parent and child page table entries must be in a read-only state.
  *
@@ -90,6 +91,31 @@ pagetable_t *duplicate_pagetable(pagetable_t *src, asid_t src_asid);
  */
 pt_entry_t *page_walk(pagetable_t *pt, vaddr_t vaddr, char type);
 
+/**
+ * @brief Find the profiler stamp of a page, without faulting it in.
+ *
+ * @param[in] pt The page table being searched.
+ * @param[in] vpn The virtual page number of the page.
+ * @return A pointer to the stamp, or a null pointer if the page table has no
+ * entry for the page.
+ *
+ * @see pagetable.c, profile.h
+ */
+u64 *pagetable_stamp(pagetable_t *pt, vpn_t vpn);
+
+/**
+ * @brief Save or restore every used entry of a page table.
+ *
+ * On restore, `*pt` is set to a newly created page table, and every valid
+ * entry is linked back into the reverse map of its frame.
+ *
+ * @param[in] cp The checkpoint being saved or restored.
+ * @param[in,out] pt The page table.
+ *
+ * @see pagetable.c, checkpoint.h
+ */
+void pagetable_checkpoint(struct checkpoint *cp, pagetable_t **pt);
+
 /**
  * @brief Test if a page table entry refers to a read-only page.
  *
@@ -154,5 +180,28 @@ bool __nonnull() is_swapped_pte(const pt_entry_t *pte);
  */
 pfn_t __nonnull() framenum_from_pte(const pt_entry_t *pte);
 
+/**
+ * @brief Get the virtual page number of the page of this page table entry.
+ *
+ * @param[in] pte The read-only pointer to the page table entry in question.
+ * @return The virtual page number.
+ *
+ * @see pagetable.c
+ */
+vpn_t __nonnull() vpn_from_pte(const pt_entry_t *pte);
+
+/**
+ * @brief Get the pid of the process whose page table holds this entry.
+ *
+ * A child's entries copied at fork give its parent's pid until the child
+ * first walks to them, while they still map the parent's page.
+ *
+ * @param[in] pte The read-only pointer to the page table entry in question.
+ * @return The pid.
+ *
+ * @see pagetable.c
+ */
+i32 __nonnull() pid_from_pte(const pt_entry_t *pte);
+
 
 #endif /* __PAGETABLE_H__ */
@@ -31,6 +31,7 @@ struct trace_line {
 	u32 vpid;
 	u8 reftype;
 	u8 value;
+	u16 weight; // references of a line of a compacted trace, see compact.c
 	vaddr_t vaddr;
 };
 
@@ -107,6 +108,29 @@ void init_parse_trace(const char *fname)
 	next_chunk();
 }
 
+/**
+ * Skips the first 'nlines' trace lines, mapping the chunk that holds the
+ * next one. Returns false if the trace has fewer lines.
+ */
+static inline
+bool seek_parse_trace(size_t nlines)
+{
+	const size_t size = data_offset + rem_data;
+	const size_t pos = nlines * sizeof(struct trace_line);
+	const size_t start = pos / (PT_CHUNKSIZE) * (PT_CHUNKSIZE);
+	if (pos > size) {
+		return false;
+	}
+
+	assert(munmap(trace_data, chunk_size) == 0);
+	trace_data = NULL;
+	data_offset = start;
+	rem_data = size - start;
+	next_chunk();
+	chunk_offset = pos - start;
+	return true;
+}
+
 static inline
 void destroy_parse_trace()
 {
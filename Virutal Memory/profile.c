@@ -0,0 +1,135 @@
+/** @file profile.c
+ * @brief Per-process working-set and reuse-distance profiler.
+ *
+ * Every `window` references, one CSV row is written for each process that
+ * made references during the window:
+ *
+ *   window,pid,refs,ws_pages,faults,fault_rate,tlb_misses,tlb_miss_rate,
+ *   cold,r0,...,r23
+ *
+ * where rN counts reuses at a distance in [2^N, 2^(N+1)) references of the
+ * same address space. Rows for processes that exit mid-window are emitted
+ * at exit, tagged with the window they exited in.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "checkpoint.h"
+#include "multiprocessing.h"
+#include "profile.h"
+#include "sim.h"
+#include "types.h"
+
+bool profiling = false;
+
+static FILE *out = NULL;
+static size_t window = 0;
+static size_t refs_in_window = 0;
+static size_t window_index = 0;
+
+static void
+emit_row(i32 pid, const struct mm_profile *prof)
+{
+	fprintf(out, "%zu,%d,%lu,%lu,%lu,%.4f,%lu,%.4f,%lu",
+		window_index, pid, prof->refs, prof->ws_pages,
+		prof->faults, (f64)prof->faults / prof->refs,
+		prof->tlb_misses, (f64)prof->tlb_misses / prof->refs,
+		prof->cold);
+	for (i32 i = 0; i < PROFILE_NBUCKETS; ++i) {
+		fprintf(out, ",%lu", prof->reuse[i]);
+	}
+	fputc('\n', out);
+}
+
+static void
+reset_window(struct mm_profile *prof)
+{
+	const u64 clock = prof->clock;
+	memset(prof, 0, sizeof(*prof));
+	prof->clock = clock;
+	prof->window_start = clock;
+}
+
+void
+profile_init(struct profile_config *cfg)
+{
+	window = cfg->window;
+	refs_in_window = 0;
+	window_index = 0;
+	profiling = window > 0;
+	if (!profiling)
+		return;
+
+	out = fopen(cfg->path, "w");
+	if (out == NULL) {
+		perror(cfg->path);
+		exit(1);
+	}
+
+	fprintf(out, "window,pid,refs,ws_pages,faults,fault_rate,"
+		"tlb_misses,tlb_miss_rate,cold");
+	for (i32 i = 0; i < PROFILE_NBUCKETS; ++i) {
+		fprintf(out, ",r%d", i);
+	}
+	fputc('\n', out);
+}
+
+void
+profile_destroy(void)
+{
+	if (!profiling)
+		return;
+
+	fclose(out);
+	out = NULL;
+	profiling = false;
+}
+
+void
+profile_tick(void)
+{
+	if (!profiling)
+		return;
+
+	refs_in_window += 1;
+	if (refs_in_window < window)
+		return;
+
+	for (i32 i = 0; i < get_max_nr_tasks(); ++i) {
+		mm_t *mm = get_task_by_id(i)->mm;
+		if (mm == NULL)
+			continue;
+
+		struct mm_profile *prof = get_mm_profile(mm);
+		if (prof->refs > 0)
+			emit_row(get_pid(mm), prof);
+		reset_window(prof);
+	}
+
+	refs_in_window = 0;
+	window_index += 1;
+}
+
+void
+profile_exit(i32 pid, struct mm_profile *prof)
+{
+	if (profiling && prof->refs > 0)
+		emit_row(pid, prof);
+}
+
+void
+profile_checkpoint(struct checkpoint *cp)
+{
+	checkpoint_var(cp, refs_in_window);
+	checkpoint_var(cp, window_index);
+}
+
+void
+profile_fork(struct mm_profile *child, const struct mm_profile *parent)
+{
+	memset(child, 0, sizeof(*child));
+	child->clock = parent->clock;
+	child->window_start = parent->clock;
+}
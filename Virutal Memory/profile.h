@@ -0,0 +1,112 @@
+/** @file profile.h
+ * @brief Per-process working-set and reuse-distance profiler.
+ *
+ * Every address space keeps a `struct mm_profile` in its mm_s. Each
+ * reference stamps the page table entry it resolves to with the address
+ * space's reference clock; the tlb keeps a pointer to that stamp for every
+ * slot it fills, so tlb hits update it without a page walk or any hashing.
+ */
+
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include "types.h"
+
+/* Reuse distances are bucketed by floor(log2(distance)), the last bucket
+ * collecting everything at or beyond 2^(PROFILE_NBUCKETS - 1) references.
+ */
+#define PROFILE_NBUCKETS 24
+
+struct mm_profile {
+	u64 clock;          /* References made by this address space so far */
+	u64 window_start;   /* Value of clock when the current window began */
+
+	/* Counters for the current window */
+	u64 refs;
+	u64 ws_pages;       /* Distinct pages referenced */
+	u64 faults;         /* References that missed in RAM */
+	u64 tlb_misses;
+	u64 cold;           /* First references to a page */
+	u64 reuse[PROFILE_NBUCKETS];
+};
+
+/* Set when the profiler is enabled, checked on the hot path. */
+extern bool profiling;
+
+// Profiler functions used in sim.c for initialization and teardown
+void profile_init(struct profile_config *cfg);
+void profile_destroy(void);
+
+/**
+ * @brief Account for one reference to the page whose stamp is `last_ref`.
+ *
+ * Called from tlb_translate() once the reference has been translated.
+ *
+ * @param prof[in] The profile of the referencing address space.
+ * @param last_ref[in] The stamp of the referenced page, 0 if never used.
+ * @param tlb_miss[in] `true` if the reference missed in the tlb.
+ */
+static inline void __nonnull()
+profile_touch(struct mm_profile *prof, u64 *last_ref, bool tlb_miss)
+{
+	const u64 last = *last_ref;
+
+	prof->clock += 1;
+	prof->refs += 1;
+	prof->tlb_misses += tlb_miss;
+
+	if (last == 0) {
+		prof->cold += 1;
+	} else {
+		const u64 bucket = 63 - __builtin_clzll(prof->clock - last);
+		prof->reuse[bucket < PROFILE_NBUCKETS ? bucket : PROFILE_NBUCKETS - 1] += 1;
+	}
+
+	if (last <= prof->window_start)
+		prof->ws_pages += 1;
+
+	*last_ref = prof->clock;
+}
+
+/**
+ * @brief Count one reference towards the current window, emitting a row for
+ * every active address space when the window is complete. Does nothing if
+ * the profiler is disabled.
+ *
+ * @see profile.c
+ */
+void profile_tick(void);
+
+/**
+ * @brief Emit the partial window of an exiting address space.
+ *
+ * @param pid[in] The pid of the exiting process.
+ * @param prof[in] Its profile.
+ *
+ * @see profile.c
+ */
+void profile_exit(i32 pid, struct mm_profile *prof);
+
+/**
+ * @brief Start the profile of a forked child from its parent's.
+ *
+ * The child inherits the parent's page stamps, so it also inherits the
+ * parent's clock to keep reuse distances meaningful.
+ *
+ * @param child[out] The profile of the child.
+ * @param parent[in] The profile of the parent.
+ *
+ * @see profile.c
+ */
+void profile_fork(struct mm_profile *child, const struct mm_profile *parent);
+
+/**
+ * @brief Save or restore the position within the current window, see
+ * checkpoint.h. The profiles themselves are kept by each mm_s, and rows
+ * written before a checkpoint are not written again after a restore.
+ *
+ * @see profile.c
+ */
+void profile_checkpoint(struct checkpoint *cp);
+
+#endif /* __PROFILE_H__ */
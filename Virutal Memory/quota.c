@@ -0,0 +1,200 @@
+/** @file quota.c
+ * @brief Per-group frame quotas (cgroup-like) with local replacement.
+ *
+ * Frames are charged to groups by coremap.c, which also keeps the group of
+ * every frame. This only keeps the charges and the counters of the groups,
+ * and tells the replacement algorithms which frames the current reclaim
+ * may pick, through frame_reclaimable().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "checkpoint.h"
+#include "multiprocessing.h"
+#include "quota.h"
+#include "sim.h"
+#include "types.h"
+
+/* No reclaim in progress, or a global one */
+#define QUOTA_GLOBAL UINT32_MAX
+
+u32 quota_nr_groups = 0;
+
+static size_t limits[QUOTA_MAX_GROUPS];
+static size_t reserves[QUOTA_MAX_GROUPS];
+static size_t usage[QUOTA_MAX_GROUPS];
+static struct quota_group_stats stats[QUOTA_MAX_GROUPS];
+
+/* Group reclaiming its own frames, or QUOTA_GLOBAL */
+static u32 reclaiming = QUOTA_GLOBAL;
+
+/* Whether the current global reclaim spares groups within their reserve */
+static bool protecting = false;
+
+static inline u32
+current_group(void)
+{
+	return get_mm_quota(current_task()->mm)->group;
+}
+
+void
+quota_init(struct quota_config *cfg)
+{
+	quota_nr_groups = cfg->nr_groups;
+	memcpy(limits, cfg->max, sizeof(limits));
+	memcpy(reserves, cfg->min, sizeof(reserves));
+	memset(usage, 0, sizeof(usage));
+	memset(stats, 0, sizeof(stats));
+	reclaiming = QUOTA_GLOBAL;
+	protecting = false;
+}
+
+i32
+quota_parse(struct quota_config *cfg, const char *spec)
+{
+	const char *p = spec;
+	char *end;
+
+	cfg->nr_groups = 0;
+	while (*p != '\0') {
+		if (cfg->nr_groups == QUOTA_MAX_GROUPS)
+			return -1;
+
+		const u32 g = cfg->nr_groups++;
+		cfg->max[g] = strtoul(p, &end, 10);
+		cfg->min[g] = 0;
+		if (end == p)
+			return -1;
+		if (*end == ':') {
+			p = end + 1;
+			cfg->min[g] = strtoul(p, &end, 10);
+			if (end == p)
+				return -1;
+		}
+		if (*end != ',' && *end != '\0')
+			return -1;
+		p = *end == ',' ? end + 1 : end;
+	}
+	return cfg->nr_groups > 0 ? 0 : -1;
+}
+
+void
+quota_mm_init(struct mm_quota *quota, i32 pid)
+{
+	quota->group = quota_nr_groups > 0 ? pid % quota_nr_groups : 0;
+}
+
+void
+quota_reference(void)
+{
+	stats[current_group()].refs += 1;
+}
+
+void
+quota_fault(void)
+{
+	if (quota_nr_groups > 0)
+		stats[current_group()].faults += 1;
+}
+
+void
+quota_charge(u32 group)
+{
+	if (quota_nr_groups == 0)
+		return;
+
+	usage[group] += 1;
+	if (usage[group] > stats[group].peak)
+		stats[group].peak = usage[group];
+}
+
+void
+quota_uncharge(u32 group)
+{
+	if (quota_nr_groups > 0)
+		usage[group] -= 1;
+}
+
+bool
+quota_over_limit(u32 group)
+{
+	return quota_nr_groups > 0 && limits[group] > 0
+		&& usage[group] >= limits[group];
+}
+
+void
+quota_reclaim_begin(u32 group, bool local)
+{
+	if (quota_nr_groups == 0)
+		return;
+
+	if (local) {
+		reclaiming = group;
+		return;
+	}
+
+	// Reservations only hold while some group has frames to give up
+	bool reserved = false;
+	bool spare = false;
+	for (u32 g = 0; g < quota_nr_groups; g++) {
+		reserved |= reserves[g] > 0;
+		spare |= usage[g] > reserves[g];
+	}
+	protecting = reserved && spare;
+}
+
+void
+quota_reclaim_end(void)
+{
+	reclaiming = QUOTA_GLOBAL;
+	protecting = false;
+}
+
+bool
+quota_may_reclaim(u32 group, bool in_use)
+{
+	if (reclaiming != QUOTA_GLOBAL)
+		return in_use && group == reclaiming;
+
+	return !in_use || !protecting || usage[group] > reserves[group];
+}
+
+void
+quota_evicted(u32 group)
+{
+	if (quota_nr_groups == 0)
+		return;
+
+	stats[group].evictions += 1;
+	if (reclaiming == group)
+		stats[group].local += 1;
+}
+
+void
+quota_checkpoint(struct checkpoint *cp)
+{
+	checkpoint_check(cp, quota_nr_groups, "number of quota groups");
+	checkpoint_var(cp, usage);
+	checkpoint_var(cp, stats);
+}
+
+void
+quota_report(void)
+{
+	for (u32 g = 0; g < quota_nr_groups; g++) {
+		const struct quota_group_stats *st = &stats[g];
+		char limit[32] = "unlimited";
+
+		if (limits[g] > 0)
+			snprintf(limit, sizeof(limit), "limit %zu", limits[g]);
+		printf("Group %u: %s, reserve %zu, %zu frames at peak\n",
+		       g, limit, reserves[g], st->peak);
+		printf("Group %u: %zu references, %zu faults, fault rate %.4f\n",
+		       g, st->refs, st->faults,
+		       st->refs > 0 ? (f64)st->faults / st->refs * 100.0 : 0.0);
+		printf("Group %u: %zu evictions, %zu by its own limit\n",
+		       g, st->evictions, st->local);
+	}
+}
@@ -0,0 +1,135 @@
+/** @file quota.h
+ * @brief Per-group frame quotas (cgroup-like) with local replacement.
+ *
+ * Every process, forked or not, is in group vpid % groups, so that with as
+ * many groups as processes every ASID has limits of its own. Every frame in
+ * use is charged to the group of the task that allocated it, and stays
+ * charged to it while shared with other groups after a fork, like pages
+ * are charged to a memory cgroup.
+ *
+ * A group may have a limit and a reservation, in frames. A task whose group
+ * holds its limit or more frames must make room among them: the replacement
+ * algorithm then only picks victims charged to that group (local
+ * replacement), even if other frames are free. Otherwise frames are
+ * allocated and reclaimed globally as before, except that the frames of a
+ * group holding no more than its reservation are never picked as long as
+ * some other group holds more than its own.
+ */
+
+#ifndef __QUOTA_H__
+#define __QUOTA_H__
+
+#include "types.h"
+
+/* Quota group of one address space, kept in its mm_s. */
+struct mm_quota {
+	u32 group;
+};
+
+struct quota_group_stats {
+	size_t refs;            /* References by tasks of the group */
+	size_t faults;          /* Page faults taken by tasks of the group */
+	size_t evictions;       /* Frames of the group evicted */
+	size_t local;           /* Of those, evicted because of its own limit */
+	size_t peak;            /* Most frames charged to the group at once */
+};
+
+/* Number of groups, 0 if quotas are disabled. Checked on every reference. */
+extern u32 quota_nr_groups;
+
+// Quota functions used in sim.c for initialization
+void quota_init(struct quota_config *cfg);
+
+/**
+ * @brief Parse the limits of the groups given on the command line.
+ *
+ * The specification is a comma separated list of `max[:min]` frame counts,
+ * one per group, where a `max` of 0 leaves the group unlimited.
+ *
+ * @param cfg[out] The configuration to update.
+ * @param spec[in] The specification.
+ * @return 0 on success, -1 on a malformed specification or too many groups.
+ *
+ * @see quota.c
+ */
+i32 quota_parse(struct quota_config *cfg, const char *spec);
+
+/**
+ * @brief Put the new address space of process `pid` in its group.
+ *
+ * @see quota.c
+ */
+void quota_mm_init(struct mm_quota *quota, i32 pid);
+
+/**
+ * @brief Account for one reference or one frame-allocating fault by the
+ * current task.
+ *
+ * @see quota.c
+ */
+void quota_reference(void);
+void quota_fault(void);
+
+/**
+ * @brief Charge a newly used frame to `group`, or uncharge a freed one.
+ *
+ * Called from coremap.c whenever a frame starts or stops being in use.
+ *
+ * @see quota.c
+ */
+void quota_charge(u32 group);
+void quota_uncharge(u32 group);
+
+/**
+ * @brief Check whether `group` must reclaim one of its own frames before it
+ * is given another one.
+ *
+ * @see quota.c
+ */
+bool quota_over_limit(u32 group);
+
+/**
+ * @brief Restrict the frames the replacement algorithm may pick until
+ * quota_reclaim_end(), to those of `group` if `local` is set, or else to
+ * those not protected by a reservation.
+ *
+ * @see quota.c
+ */
+void quota_reclaim_begin(u32 group, bool local);
+void quota_reclaim_end(void);
+
+/**
+ * @brief Check whether a frame charged to `group` may be picked by the
+ * replacement algorithm in the current reclaim.
+ *
+ * @param group[in] The group the frame is charged to.
+ * @param in_use[in] Whether the frame is in use at all.
+ *
+ * @see quota.c, frame_reclaimable() in coremap.h
+ */
+bool quota_may_reclaim(u32 group, bool in_use);
+
+/**
+ * @brief Account for the eviction of a frame charged to `group` by the
+ * current reclaim.
+ *
+ * @see quota.c
+ */
+void quota_evicted(u32 group);
+
+/**
+ * @brief Save or restore the charges and the counters of every group, see
+ * checkpoint.h. Limits come from the command line of each run.
+ *
+ * @see quota.c
+ */
+void quota_checkpoint(struct checkpoint *cp);
+
+/**
+ * @brief Print the limits, the fault rate and the evictions of every group.
+ *
+ * @see quota.c
+ */
+void quota_report(void);
+
+#endif /* __QUOTA_H__ */
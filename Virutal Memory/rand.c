@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include "checkpoint.h"
 #include "sim.h"
 #include "coremap.h"
 #include "types.h"
@@ -13,11 +14,19 @@ pfn_t rand_evict(void)
 	//NOTE: We keep the default seed (don't call srandom) for repeatable results
 	pfn_t result = INVALID_FRAME;
 	frame_t *f = NULL;
+	size_t tries = 0;
 	do {
 		result = random() % memsize;
 		f = frame_from_number(result);
-	} while (frame_is_shared(f));
+		tries += 1;
+	} while ((frame_is_shared(f) || !frame_reclaimable(f)) && tries < memsize);
 
+	// Fall back to a shared frame when (nearly) all frames are shared, and
+	// to the next one that may be reclaimed when few of them may
+	while (!frame_reclaimable(f)) {
+		result = (result + 1) % memsize;
+		f = frame_from_number(result);
+	}
 	return result;
 }
 
@@ -32,6 +41,11 @@ void rand_ref(pfn_t framenum)
 	(void)framenum;
 }
 
+/**
+ * @brief RAND ignores references, so it may replay compacted traces.
+ */
+const bool rand_compaction_safe = true;
+
 /**
  * @brief Initialize data structures for the RAND algorithm.
  */
@@ -44,4 +58,13 @@ void rand_init(void)
  */
 void rand_cleanup(void)
 {
+}
+
+/**
+ * @brief Save or restore the state of the RAND algorithm.
+ */
+void rand_checkpoint(struct checkpoint *cp)
+{
+	// The random() state is shared with the tlb and saved by checkpoint.c
+	(void)cp;
 }
\ No newline at end of file
@@ -0,0 +1,82 @@
+/** @file readahead.c
+ * @brief Swap readahead and tlb fault-around.
+ *
+ * The pages themselves are brought in by pagetable.c, which marks every
+ * page table entry it reads ahead until its first reference, and every tlb
+ * entry it loads by fault-around until its first hit, so that both can be
+ * told apart from demand faults.
+ */
+
+#include <stdio.h>
+
+#include "checkpoint.h"
+#include "readahead.h"
+#include "sim.h"
+#include "swap.h"
+#include "types.h"
+
+size_t readahead_window = 0;
+size_t fault_around = 0;
+
+struct readahead_stats readahead_stats;
+
+void
+readahead_init(struct readahead_config *cfg)
+{
+	readahead_window = cfg->window;
+	fault_around = cfg->around;
+	readahead_stats = (struct readahead_stats) { 0 };
+}
+
+size_t
+readahead_fault(struct mm_readahead *ra, vpn_t vpn, i64 *stride)
+{
+	const i64 delta = vpn - ra->last;
+
+	if (delta != 0 && delta == ra->stride) {
+		ra->streak += 1;
+	} else {
+		ra->stride = delta;
+		ra->streak = 0;
+	}
+	ra->last = vpn;
+	*stride = ra->stride;
+
+	if (readahead_window == 0 || ra->streak == 0)
+		return 0;
+
+	// Ramp up from 2 pages on the first fault that confirms the stride
+	return ra->streak < 32 && (1UL << ra->streak) < readahead_window
+		? 1UL << ra->streak
+		: readahead_window;
+}
+
+void
+readahead_checkpoint(struct checkpoint *cp)
+{
+	checkpoint_var(cp, readahead_stats);
+}
+
+void
+readahead_report(void)
+{
+	const struct readahead_stats *st = &readahead_stats;
+
+	if (readahead_window > 0) {
+		printf("Readahead pages: %zu\n", st->pages);
+		printf("Readahead hits: %zu\n", st->hits);
+		printf("Readahead wasted: %zu\n", st->wasted);
+		printf("Readahead accuracy: %.4f\n",
+		       st->pages > 0 ? (f64)st->hits / st->pages * 100.0 : 0.0);
+		printf("Demand swap-ins: %zu\n",
+		       swap_pagein_count() - st->pages);
+	}
+	if (fault_around > 0) {
+		printf("Fault-around mappings: %zu\n", st->around_pages);
+		printf("Fault-around hits: %zu\n", st->around_hits);
+		printf("Fault-around accuracy: %.4f\n",
+		       st->around_pages > 0
+		       ? (f64)st->around_hits / st->around_pages * 100.0
+		       : 0.0);
+	}
+}
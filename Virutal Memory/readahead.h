@@ -0,0 +1,76 @@
+/** @file readahead.h
+ * @brief Swap readahead and tlb fault-around.
+ *
+ * Readahead watches the swap-in faults of every address space for a
+ * constant stride between faulting pages. Once the same stride is seen
+ * twice in a row, the pages that follow along it are read from swap into
+ * free frames, doubling the number of pages on every further fault in the
+ * stream up to the configured window.
+ *
+ * Fault-around loads the translations of the resident neighbours of a
+ * page into the tlb along with the page itself, within an aligned block of
+ * the configured number of pages, so that a scan through resident pages
+ * takes one tlb fault per block instead of one per page.
+ */
+
+#ifndef __READAHEAD_H__
+#define __READAHEAD_H__
+
+#include "types.h"
+
+/* Readahead state of one address space, kept in its mm_s. */
+struct mm_readahead {
+	vpn_t last;         /* Last page faulted in or read ahead */
+	i64 stride;         /* Distance between the last two faults */
+	u32 streak;         /* Faults in a row at that stride, minus one */
+};
+
+struct readahead_stats {
+	size_t pages;           /* Pages read ahead from swap */
+	size_t hits;            /* Of those, pages referenced while resident */
+	size_t wasted;          /* Of those, pages evicted or freed unreferenced */
+	size_t around_pages;    /* Translations loaded by fault-around */
+	size_t around_hits;     /* Of those, translations hit in the tlb */
+};
+
+/* Pages read ahead and fault-around block size, 0 if disabled. Checked
+ * on the fault path.
+ */
+extern size_t readahead_window;
+extern size_t fault_around;
+
+extern struct readahead_stats readahead_stats;
+
+// Readahead functions used in sim.c for initialization
+void readahead_init(struct readahead_config *cfg);
+
+/**
+ * @brief Account for a swap-in fault on `vpn` and decide how far to read
+ * ahead.
+ *
+ * @param ra[in] The readahead state of the faulting address space.
+ * @param vpn[in] The faulting page.
+ * @param stride[out] The distance between the pages to read ahead.
+ * @return The number of pages to read ahead, 0 if no stream is detected.
+ *
+ * @see readahead.c
+ */
+size_t readahead_fault(struct mm_readahead *ra, vpn_t vpn, i64 *stride);
+
+/**
+ * @brief Print the readahead and fault-around counters, with demand
+ * swap-ins counted apart from the pages read ahead.
+ *
+ * @see readahead.c
+ */
+void readahead_report(void);
+
+/**
+ * @brief Save or restore the readahead counters, see checkpoint.h. The
+ * per-address space state is kept by each mm_s.
+ *
+ * @see readahead.c
+ */
+void readahead_checkpoint(struct checkpoint *cp);
+
+#endif /* __READAHEAD_H__ */
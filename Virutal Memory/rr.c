@@ -1,29 +1,41 @@
+#include "checkpoint.h"
 #include "sim.h"
 #include "coremap.h"
 #include "types.h"
 
+/* Next frame to consider for eviction */
+static pfn_t hand = 0;
+
 /**
  * @brief Select a page to evict using the Round Robin algorithm.
  *
  * Equivalent to FIFO for single-process traces. In multiprocess scenarios,
- * shared frames are skipped and never selected for eviction.
+ * shared frames are skipped unless every frame is shared. Frames that may
+ * not be reclaimed are always skipped.
  *
  * @return The frame number (index in the coremap) of the page to evict.
  */
 pfn_t rr_evict(void)
 {
-	static pfn_t i = 0;
 	pfn_t victim = INVALID_FRAME;
 
-	for (size_t count = 0; count < memsize; count += 1, i = (i + 1) % memsize) {
-		frame_t *fi = frame_from_number(i);
-		if (!frame_is_shared(fi)) {
-			victim = i;
-			i = (i + 1) % memsize;
+	for (size_t count = 0; count < memsize; count += 1, hand = (hand + 1) % memsize) {
+		frame_t *fi = frame_from_number(hand);
+		if (!frame_is_shared(fi) && frame_reclaimable(fi)) {
+			victim = hand;
+			hand = (hand + 1) % memsize;
 			break;
 		}
 	}
 
+	// Every frame is shared, so evict the next one regardless
+	if (victim == INVALID_FRAME) {
+		while (!frame_reclaimable(frame_from_number(hand)))
+			hand = (hand + 1) % memsize;
+		victim = hand;
+		hand = (hand + 1) % memsize;
+	}
+
 	return victim;
 }
 
@@ -37,6 +49,11 @@ void rr_ref(pfn_t framenum)
 	(void)framenum;
 }
 
+/**
+ * @brief Round Robin ignores references, so it may replay compacted traces.
+ */
+const bool rr_compaction_safe = true;
+
 /**
  * @brief Initialize data structures for the Round Robin algorithm.
  */
@@ -49,4 +66,12 @@ void rr_init(void)
  */
 void rr_cleanup(void)
 {
+}
+
+/**
+ * @brief Save or restore the state of the Round Robin algorithm.
+ */
+void rr_checkpoint(struct checkpoint *cp)
+{
+	checkpoint_var(cp, hand);
 }
\ No newline at end of file
@@ -2,9 +2,11 @@
 #include "coremap.h"
 #include "sim.h"
 #include "malloc369.h"
+#include "checkpoint.h"
 
 #include <assert.h>
-#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
 
 extern size_t memsize;
 
@@ -15,6 +17,11 @@ typedef enum
 	S2Q_STATE_A2 = 2
 } s2q_state_t;
 
+/* Per frame, mapped with mmap369 so that their untouched pages read as
+ * zero: every frame starts out in S2Q_STATE_NONE and unlinked without a pass
+ * over all of them. The links hold the frame number + 1, and 0 for
+ * INVALID_FRAME, see link_get() and link_set().
+ */
 static s2q_state_t *s2q_states = NULL;
 static pfn_t *s2q_next = NULL;
 static pfn_t *s2q_prev = NULL;
@@ -27,58 +34,45 @@ static size_t a1_size = 0;
 static size_t a2_size = 0;
 static size_t a1_threshold = 0;
 
+static inline pfn_t
+link_get(const pfn_t *links, pfn_t f)
+{
+	return links[f] == 0 ? INVALID_FRAME : links[f] - 1;
+}
+
+static inline void
+link_set(pfn_t *links, pfn_t f, pfn_t to)
+{
+	links[f] = to == INVALID_FRAME ? 0 : to + 1;
+}
+
 static void
 queue_push_back(pfn_t *head, pfn_t *tail, pfn_t f)
 {
 	if (*head == INVALID_FRAME)
 	{
 		*head = *tail = f;
-		s2q_prev[f] = INVALID_FRAME;
-		s2q_next[f] = INVALID_FRAME;
+		link_set(s2q_prev, f, INVALID_FRAME);
+		link_set(s2q_next, f, INVALID_FRAME);
 	}
 	else
 	{
-		s2q_prev[f] = *tail;
-		s2q_next[f] = INVALID_FRAME;
-		s2q_next[*tail] = f;
+		link_set(s2q_prev, f, *tail);
+		link_set(s2q_next, f, INVALID_FRAME);
+		link_set(s2q_next, *tail, f);
 		*tail = f;
 	}
 }
 
-static pfn_t
-queue_pop_front(pfn_t *head, pfn_t *tail)
-{
-	if (*head == INVALID_FRAME)
-	{
-		return INVALID_FRAME;
-	}
-
-	pfn_t f = *head;
-	pfn_t n = s2q_next[f];
-
-	if (n != INVALID_FRAME)
-	{
-		s2q_prev[n] = INVALID_FRAME;
-		*head = n;
-	}
-	else
-	{
-		*head = *tail = INVALID_FRAME;
-	}
-
-	s2q_next[f] = s2q_prev[f] = INVALID_FRAME;
-	return f;
-}
-
 static void
 queue_remove(pfn_t *head, pfn_t *tail, pfn_t f)
 {
-	pfn_t p = s2q_prev[f];
-	pfn_t n = s2q_next[f];
+	pfn_t p = link_get(s2q_prev, f);
+	pfn_t n = link_get(s2q_next, f);
 
 	if (p != INVALID_FRAME)
 	{
-		s2q_next[p] = n;
+		link_set(s2q_next, p, n);
 	}
 	else
 	{
@@ -87,14 +81,15 @@ queue_remove(pfn_t *head, pfn_t *tail, pfn_t f)
 
 	if (n != INVALID_FRAME)
 	{
-		s2q_prev[n] = p;
+		link_set(s2q_prev, n, p);
 	}
 	else
 	{
 		*tail = p;
 	}
 
-	s2q_next[f] = s2q_prev[f] = INVALID_FRAME;
+	link_set(s2q_next, f, INVALID_FRAME);
+	link_set(s2q_prev, f, INVALID_FRAME);
 }
 
 static void
@@ -104,17 +99,6 @@ a1_insert_back(pfn_t f)
 	a1_size++;
 }
 
-static pfn_t
-a1_pop_front(void)
-{
-	pfn_t f = queue_pop_front(&a1_head, &a1_tail);
-	if (f != INVALID_FRAME)
-	{
-		a1_size--;
-	}
-	return f;
-}
-
 static void
 a1_remove(pfn_t f)
 {
@@ -129,17 +113,6 @@ a2_insert_back(pfn_t f)
 	a2_size++;
 }
 
-static pfn_t
-a2_pop_front(void)
-{
-	pfn_t f = queue_pop_front(&a2_head, &a2_tail);
-	if (f != INVALID_FRAME)
-	{
-		a2_size--;
-	}
-	return f;
-}
-
 static void
 a2_remove(pfn_t f)
 {
@@ -147,37 +120,66 @@ a2_remove(pfn_t f)
 	a2_size--;
 }
 
+/* Return the frame closest to the front of the queue starting at `head`
+ * that may be reclaimed, or INVALID_FRAME if there is none.
+ */
+static pfn_t
+queue_find(pfn_t head)
+{
+	for (pfn_t f = head; f != INVALID_FRAME; f = link_get(s2q_next, f))
+	{
+		if (frame_reclaimable(frame_from_number(f)))
+		{
+			return f;
+		}
+	}
+	return INVALID_FRAME;
+}
+
 /**
  * @brief Select a page to evict using the simplified 2Q algorithm.
  *
+ * Frames that may not be reclaimed are skipped, staying where they are in
+ * their queue.
+ *
  * @return The frame number (index in the coremap) of the page to evict.
  */
 pfn_t s2q_evict(void)
 {
 	pfn_t victim = INVALID_FRAME;
-	if (a1_size > a1_threshold && a1_head != INVALID_FRAME)
+	const pfn_t a1_victim = queue_find(a1_head);
+	if (a1_size > a1_threshold && a1_victim != INVALID_FRAME)
 	{
-		victim = a1_pop_front();
+		victim = a1_victim;
+		a1_remove(victim);
 	}
-	else if (a2_head != INVALID_FRAME)
+	else if ((victim = queue_find(a2_head)) != INVALID_FRAME)
 	{
-		victim = a2_pop_front();
+		a2_remove(victim);
 	}
-	else if (a1_head != INVALID_FRAME)
+	else if (a1_victim != INVALID_FRAME)
 	{
-		victim = a1_pop_front();
+		victim = a1_victim;
+		a1_remove(victim);
 	}
 	else
 	{
 		for (pfn_t f = 0; f < (pfn_t)memsize; f++)
 		{
 			frame_t *fr = frame_from_number(f);
-			if (fr != NULL && frame_in_use(fr))
+			if (fr != NULL && frame_in_use(fr) && frame_reclaimable(fr))
 			{
 				victim = f;
 				break;
 			}
 		}
+		for (pfn_t f = 0; victim == INVALID_FRAME && f < (pfn_t)memsize; f++)
+		{
+			if (frame_reclaimable(frame_from_number(f)))
+			{
+				victim = f;
+			}
+		}
 		if (victim == INVALID_FRAME)
 		{
 			victim = 0;
@@ -185,8 +187,8 @@ pfn_t s2q_evict(void)
 	}
 
 	s2q_states[victim] = S2Q_STATE_NONE;
-	s2q_next[victim] = INVALID_FRAME;
-	s2q_prev[victim] = INVALID_FRAME;
+	link_set(s2q_next, victim, INVALID_FRAME);
+	link_set(s2q_prev, victim, INVALID_FRAME);
 
 	return victim;
 }
@@ -222,20 +224,48 @@ void s2q_ref(pfn_t framenum)
 	}
 }
 
+/**
+ * @brief The second reference to a page moves it to A2, and compacted
+ * traces drop it.
+ */
+const bool s2q_compaction_safe = false;
+
+/**
+ * @brief Take a frame evicted by another algorithm out of the queues, so
+ * that its next page starts over in A1.
+ *
+ * @param framenum[in] The frame number evicted.
+ */
+void s2q_forget(pfn_t framenum)
+{
+	switch (s2q_states[framenum])
+	{
+	case S2Q_STATE_NONE:
+		break;
+
+	case S2Q_STATE_A1:
+		a1_remove(framenum);
+		break;
+
+	case S2Q_STATE_A2:
+		a2_remove(framenum);
+		break;
+	}
+	s2q_states[framenum] = S2Q_STATE_NONE;
+}
+
 /**
  * @brief Initialize data structures for the simplified 2Q algorithm.
  */
 void s2q_init(void)
 {
-	s2q_states = malloc369(memsize * sizeof(s2q_state_t));
-	s2q_next = malloc369(memsize * sizeof(pfn_t));
-	s2q_prev = malloc369(memsize * sizeof(pfn_t));
-
-	memset(s2q_states, 0, memsize * sizeof(s2q_state_t));
-	for (size_t i = 0; i < memsize; i++)
+	s2q_states = mmap369(memsize * sizeof(s2q_state_t));
+	s2q_next = mmap369(memsize * sizeof(pfn_t));
+	s2q_prev = mmap369(memsize * sizeof(pfn_t));
+	if (s2q_states == NULL || s2q_next == NULL || s2q_prev == NULL)
 	{
-		s2q_next[i] = INVALID_FRAME;
-		s2q_prev[i] = INVALID_FRAME;
+		perror("Failed to map the s2q queues");
+		exit(1);
 	}
 
 	a1_head = a1_tail = INVALID_FRAME;
@@ -255,21 +285,12 @@ void s2q_init(void)
  */
 void s2q_cleanup(void)
 {
-	if (s2q_states != NULL)
-	{
-		free369(s2q_states);
-		s2q_states = NULL;
-	}
-	if (s2q_next != NULL)
-	{
-		free369(s2q_next);
-		s2q_next = NULL;
-	}
-	if (s2q_prev != NULL)
-	{
-		free369(s2q_prev);
-		s2q_prev = NULL;
-	}
+	munmap369(s2q_states, memsize * sizeof(s2q_state_t));
+	munmap369(s2q_next, memsize * sizeof(pfn_t));
+	munmap369(s2q_prev, memsize * sizeof(pfn_t));
+	s2q_states = NULL;
+	s2q_next = NULL;
+	s2q_prev = NULL;
 
 	a1_head = a1_tail = INVALID_FRAME;
 	a2_head = a2_tail = INVALID_FRAME;
@@ -277,3 +298,20 @@ void s2q_cleanup(void)
 	a2_size = 0;
 	a1_threshold = 0;
 }
+
+/**
+ * @brief Save or restore the state of the simplified 2Q algorithm.
+ */
+void s2q_checkpoint(struct checkpoint *cp)
+{
+	checkpoint_block(cp, s2q_states, memsize * sizeof(s2q_state_t));
+	checkpoint_block(cp, s2q_next, memsize * sizeof(pfn_t));
+	checkpoint_block(cp, s2q_prev, memsize * sizeof(pfn_t));
+	checkpoint_var(cp, a1_head);
+	checkpoint_var(cp, a1_tail);
+	checkpoint_var(cp, a2_head);
+	checkpoint_var(cp, a2_tail);
+	checkpoint_var(cp, a1_size);
+	checkpoint_var(cp, a2_size);
+	checkpoint_var(cp, a1_threshold);
+}
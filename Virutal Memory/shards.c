@@ -0,0 +1,389 @@
+/** @file shards.c
+ * @brief Sampled miss-ratio curves (fixed-size SHARDS).
+ *
+ * Sampled pages are kept in a hash table mapping them to the time of their
+ * last reference, where time only advances on sampled references. A
+ * Fenwick tree over time marks the last reference of every sampled page,
+ * so the reuse distance of a page last referenced at time t is the number
+ * of marks after t. Times are renumbered once they run past the end of the
+ * tree, which keeps it a small multiple of the sample size.
+ *
+ * A max-heap on the hash value of the sampled pages finds the pages to
+ * drop when the threshold is lowered. A reference sampled at rate R stands
+ * for 1/R references at a distance 1/R times larger; scaled distances are
+ * bucketed like an HDR histogram, exactly below SHARDS_SUBBUCKETS and
+ * with SHARDS_SUBBUCKETS buckets per power of two above.
+ *
+ * The curve is written as CSV rows
+ *
+ *   cache_pages,miss_ratio
+ *
+ * one per non-empty bucket, the miss ratio of an LRU memory holding
+ * cache_pages pages. Forked children start with no sampled pages, so their
+ * references to inherited pages count as cold misses.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "khash.h"
+#include "malloc369.h"
+#include "shards.h"
+#include "sim.h"
+#include "types.h"
+
+#define SHARDS_SUBBUCKET_SHIFT 5
+#define SHARDS_SUBBUCKETS (1 << SHARDS_SUBBUCKET_SHIFT)
+#define SHARDS_NBUCKETS ((64 - SHARDS_SUBBUCKET_SHIFT + 1) * SHARDS_SUBBUCKETS)
+
+/* Room in the Fenwick tree, in multiples of the sample size */
+#define SHARDS_TIME_SLACK 4
+
+/* Sampled page -> time of its last reference */
+KHASH_MAP_INIT_INT64(sample, u64)
+static khash_t(sample) *sample = NULL;
+
+static size_t max_samples = 0;
+static u64 threshold = SHARDS_MODULUS;
+
+/* Max-heap of the sampled pages, on their hash value */
+static u64 *heap = NULL;
+static size_t heap_len = 0;
+
+/* Fenwick tree over times 1..nr_slots */
+static u32 *fenwick = NULL;
+static u64 nr_slots = 0;
+static u64 now = 0;
+
+/* Scaled reference counts */
+static f64 hist[SHARDS_NBUCKETS];
+static f64 cold = 0;
+static f64 total = 0;
+
+static u64 refs = 0;
+static u64 sampled_refs = 0;
+static size_t peak_samples = 0;
+static const char *path = NULL;
+
+static inline u64
+sample_key(asid_t asid, vaddr_t vaddr)
+{
+	return (u64)asid << 36 | ((vaddr >> PAGE_SHIFT) & VPN_MASK);
+}
+
+static inline asid_t
+key_asid(u64 key)
+{
+	return key >> 36;
+}
+
+/* splitmix64 finalizer, reduced to the sampling modulus */
+static inline u64
+key_hash(u64 key)
+{
+	key ^= key >> 30;
+	key *= 0xbf58476d1ce4e5b9ULL;
+	key ^= key >> 27;
+	key *= 0x94d049bb133111ebULL;
+	key ^= key >> 31;
+	return key & (SHARDS_MODULUS - 1);
+}
+
+static inline void
+fenwick_add(u64 t, i32 delta)
+{
+	for (; t <= nr_slots; t += t & -t)
+		fenwick[t] += delta;
+}
+
+static inline u64
+fenwick_sum(u64 t)
+{
+	u64 sum = 0;
+	for (; t > 0; t -= t & -t)
+		sum += fenwick[t];
+	return sum;
+}
+
+static inline size_t
+bucket_of(u64 distance)
+{
+	if (distance < SHARDS_SUBBUCKETS)
+		return distance;
+
+	const u64 shift = 63 - __builtin_clzll(distance) - SHARDS_SUBBUCKET_SHIFT;
+	return (shift + 1) * SHARDS_SUBBUCKETS + (distance >> shift)
+		- SHARDS_SUBBUCKETS;
+}
+
+/* Smallest distance falling into bucket `i`, and one past the largest */
+static inline u64
+bucket_start(size_t i)
+{
+	if (i < SHARDS_SUBBUCKETS)
+		return i;
+
+	const u64 shift = i / SHARDS_SUBBUCKETS - 1;
+	return (SHARDS_SUBBUCKETS + i % SHARDS_SUBBUCKETS) << shift;
+}
+
+static inline u64
+bucket_end(size_t i)
+{
+	return i < SHARDS_SUBBUCKETS
+		? i + 1
+		: bucket_start(i) + (1ULL << (i / SHARDS_SUBBUCKETS - 1));
+}
+
+static void
+heap_sift_up(size_t i)
+{
+	const u64 key = heap[i];
+	const u64 hash = key_hash(key);
+	while (i > 0 && key_hash(heap[(i - 1) / 2]) < hash) {
+		heap[i] = heap[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	heap[i] = key;
+}
+
+static void
+heap_sift_down(size_t i)
+{
+	const u64 key = heap[i];
+	const u64 hash = key_hash(key);
+	for (;;) {
+		size_t child = 2 * i + 1;
+		if (child >= heap_len)
+			break;
+		if (child + 1 < heap_len
+		    && key_hash(heap[child + 1]) > key_hash(heap[child]))
+			child += 1;
+		if (key_hash(heap[child]) <= hash)
+			break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = key;
+}
+
+static u64
+heap_pop(void)
+{
+	const u64 top = heap[0];
+	heap[0] = heap[--heap_len];
+	if (heap_len > 0)
+		heap_sift_down(0);
+	return top;
+}
+
+static void
+drop_sample(khiter_t k)
+{
+	fenwick_add(kh_value(sample, k), -1);
+	kh_del(sample, sample, k);
+}
+
+/* Lower the threshold to the largest hash in the sample, dropping every
+ * page hashing at or above it.
+ */
+static void
+lower_threshold(void)
+{
+	threshold = key_hash(heap[0]);
+	while (heap_len > 0 && key_hash(heap[0]) >= threshold) {
+		const khiter_t k = kh_get(sample, sample, heap_pop());
+		drop_sample(k);
+	}
+}
+
+static int
+time_cmp(const void *lhs, const void *rhs)
+{
+	const u64 a = kh_value(sample, *(const khiter_t *)lhs);
+	const u64 b = kh_value(sample, *(const khiter_t *)rhs);
+	return (a > b) - (a < b);
+}
+
+/* Renumber the last references 1..n in the same order and rebuild the
+ * Fenwick tree over them.
+ */
+static void
+compact_times(void)
+{
+	const size_t n = kh_size(sample);
+	khiter_t *order = malloc369(n * sizeof(*order) + 1);
+	size_t i = 0;
+
+	for (khiter_t k = kh_begin(sample); k != kh_end(sample); ++k) {
+		if (kh_exist(sample, k))
+			order[i++] = k;
+	}
+	qsort(order, n, sizeof(*order), time_cmp);
+
+	memset(fenwick, 0, (nr_slots + 1) * sizeof(*fenwick));
+	for (i = 0; i < n; ++i) {
+		kh_value(sample, order[i]) = i + 1;
+		fenwick_add(i + 1, 1);
+	}
+	now = n;
+	free369(order);
+}
+
+void
+shards_init(struct shards_config *cfg)
+{
+	max_samples = cfg->samples;
+	path = cfg->path;
+	threshold = SHARDS_MODULUS;
+	refs = 0;
+	sampled_refs = 0;
+	peak_samples = 0;
+	cold = 0;
+	total = 0;
+	memset(hist, 0, sizeof(hist));
+
+	sample = kh_init(sample);
+	kh_resize(sample, sample, max_samples + 1);
+	heap = malloc369((max_samples + 1) * sizeof(*heap));
+	heap_len = 0;
+	nr_slots = SHARDS_TIME_SLACK * (max_samples + 1);
+	fenwick = malloc369((nr_slots + 1) * sizeof(*fenwick));
+	if (sample == NULL || heap == NULL || fenwick == NULL) {
+		perror("Failed to allocate SHARDS sample");
+		exit(1);
+	}
+	memset(fenwick, 0, (nr_slots + 1) * sizeof(*fenwick));
+	now = 0;
+}
+
+void
+shards_destroy(void)
+{
+	kh_destroy(sample, sample);
+	free369(heap);
+	free369(fenwick);
+	sample = NULL;
+	heap = NULL;
+	fenwick = NULL;
+}
+
+void
+shards_reference(asid_t asid, vaddr_t vaddr)
+{
+	const u64 key = sample_key(asid, vaddr);
+	int ret;
+
+	refs += 1;
+	if (key_hash(key) >= threshold)
+		return;
+
+	const f64 scale = (f64)SHARDS_MODULUS / threshold;
+	sampled_refs += 1;
+	total += scale;
+
+	if (now == nr_slots)
+		compact_times();
+	now += 1;
+
+	const khiter_t k = kh_put(sample, sample, key, &ret);
+	if (ret == 0) {
+		// Pages referenced since, not counting this one
+		const u64 last = kh_value(sample, k);
+		const u64 distance = kh_size(sample) - fenwick_sum(last);
+		hist[bucket_of((u64)(distance * scale))] += scale;
+		fenwick_add(last, -1);
+	} else {
+		cold += scale;
+		heap[heap_len++] = key;
+		heap_sift_up(heap_len - 1);
+	}
+	kh_value(sample, k) = now;
+	fenwick_add(now, 1);
+
+	if (kh_size(sample) > max_samples)
+		lower_threshold();
+	if (kh_size(sample) > peak_samples)
+		peak_samples = kh_size(sample);
+}
+
+void
+shards_exit(asid_t asid)
+{
+	for (khiter_t k = kh_begin(sample); k != kh_end(sample); ++k) {
+		if (kh_exist(sample, k) && key_asid(kh_key(sample, k)) == asid)
+			drop_sample(k);
+	}
+
+	// Rebuild the heap from what is left
+	heap_len = 0;
+	for (khiter_t k = kh_begin(sample); k != kh_end(sample); ++k) {
+		if (kh_exist(sample, k)) {
+			heap[heap_len++] = kh_key(sample, k);
+			heap_sift_up(heap_len - 1);
+		}
+	}
+}
+
+void
+shards_report(size_t memsize)
+{
+	FILE *out = fopen(path, "w");
+	if (out == NULL) {
+		perror(path);
+		exit(1);
+	}
+
+	fprintf(out, "cache_pages,miss_ratio\n");
+	f64 hits = 0;
+	for (size_t i = 0; i < SHARDS_NBUCKETS; ++i) {
+		if (hist[i] == 0)
+			continue;
+		hits += hist[i];
+		fprintf(out, "%lu,%.6f\n", bucket_end(i), 1.0 - hits / total);
+	}
+	fclose(out);
+
+	// A reference at distance d hits in a memory of more than d pages
+	if (memsize > 0) {
+		hits = 0;
+		for (size_t i = 0; i < SHARDS_NBUCKETS; ++i) {
+			const u64 start = bucket_start(i);
+			const u64 end = bucket_end(i);
+			if (start >= memsize)
+				break;
+			hits += end <= memsize
+				? hist[i]
+				: hist[i] * (memsize - start) / (end - start);
+		}
+	}
+
+	// The curve is a ratio estimated over the sampled pages, with a
+	// standard error of at most 0.5 / sqrt(pages), or exact if every page
+	// was sampled
+	const f64 rate = (f64)threshold / SHARDS_MODULUS;
+	const f64 pages = cold * rate;
+
+	printf("MRC sampling rate: %.6f (threshold %lu of %u)\n",
+	       rate, threshold, SHARDS_MODULUS);
+	printf("MRC sampled pages: %zu at peak (at most %zu)\n",
+	       peak_samples, max_samples);
+	printf("MRC sampled references: %lu of %lu\n", sampled_refs, refs);
+	printf("MRC estimated footprint: %.0f pages\n", cold);
+	if (threshold == SHARDS_MODULUS) {
+		printf("MRC error bound: 0 (every page sampled)\n");
+	} else {
+		printf("MRC error bound: %.4f (95%% confidence)\n",
+		       pages >= 1 ? 1.96 * 0.5 / sqrt(pages) : 1.0);
+	}
+	printf("MRC memory: %zu bytes\n",
+	       kh_n_buckets(sample) * (sizeof(u64) * 2 + 1)
+	       + (max_samples + 1) * sizeof(*heap)
+	       + (nr_slots + 1) * sizeof(*fenwick));
+	if (memsize > 0 && total > 0) {
+		printf("MRC miss ratio at %zu frames: %.4f\n",
+		       memsize, 1.0 - hits / total);
+	}
+}
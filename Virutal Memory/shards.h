@@ -0,0 +1,62 @@
+/** @file shards.h
+ * @brief Sampled miss-ratio curves (fixed-size SHARDS).
+ *
+ * Estimates the LRU miss-ratio curve of a whole trace without simulating
+ * it. Pages are sampled by a hash of (ASID, VPN) below an adaptive
+ * threshold, reuse distances are tracked on the sampled pages only and
+ * scaled back up by the sampling rate. The threshold is lowered whenever
+ * more than a fixed number of pages are sampled, so memory stays bounded
+ * whatever the footprint of the trace.
+ *
+ * See Waldspurger et al., "Efficient MRC Construction with SHARDS",
+ * FAST '15.
+ */
+
+#ifndef __SHARDS_H__
+#define __SHARDS_H__
+
+#include "types.h"
+
+/* Pages are sampled when hash(asid, vpn) mod SHARDS_MODULUS is below the
+ * threshold, i.e. at a rate of threshold / SHARDS_MODULUS.
+ */
+#define SHARDS_MODULUS (1U << 24)
+
+/* Default bound on the number of sampled pages; the paper reports a mean
+ * absolute error around 0.01 at this size.
+ */
+#define SHARDS_DEFAULT_SAMPLES 8192
+
+#define DEFAULT_MRC_PATH "mrc.csv"
+
+// SHARDS functions used in sim.c for initialization and teardown
+void shards_init(struct shards_config *cfg);
+void shards_destroy(void);
+
+/**
+ * @brief Account for one reference to `vaddr` by address space `asid`.
+ *
+ * @see shards.c
+ */
+void shards_reference(asid_t asid, vaddr_t vaddr);
+
+/**
+ * @brief Drop the sampled pages of an exiting address space, so that they
+ * no longer count towards the reuse distances of the others.
+ *
+ * @see shards.c
+ */
+void shards_exit(asid_t asid);
+
+/**
+ * @brief Write the estimated miss-ratio curve and print the sampling rate,
+ * the sample sizes and the error bound of the estimate.
+ *
+ * @param memsize[in] If non-zero, also print the miss ratio estimated for a
+ * memory of this many frames.
+ *
+ * @see shards.c
+ */
+void shards_report(size_t memsize);
+
+#endif /* __SHARDS_H__ */
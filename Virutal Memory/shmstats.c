@@ -0,0 +1,159 @@
+/** @file shmstats.c
+ * @brief Live counters of a running sim, see shmstats.h.
+ */
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "parse_trace.h"
+#include "shmstats.h"
+#include "sim.h"
+#include "swap.h"
+#include "tlb.h"
+#include "types.h"
+
+/* Counters for paging-related events. Set in pagetable.c */
+extern size_t ram_hit_count;
+extern size_t ram_miss_count;
+extern size_t evict_clean_count;
+extern size_t evict_dirty_count;
+extern size_t cow_fault_count;
+extern size_t write_fault_count;
+
+size_t shmstats_countdown = 0;
+
+static struct shmstats *seg = NULL;
+static char path[NAME_MAX];
+
+/* Trace lines between updates, or 0 to update every interval_ms */
+static size_t every = 0;
+static u32 interval_ms = 0;
+
+static f64 start_time;
+static f64 last_update;
+
+/* Unlike get_time(), which measures the cpu time of sim */
+static f64
+wall_time(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+i32
+shmstats_parse(struct shmstats_config *cfg, const char *spec)
+{
+	char *end;
+	const unsigned long n = strtoul(spec, &end, 10);
+
+	if (end == spec || n == 0)
+		return -1;
+	if (strcmp(end, "ms") == 0) {
+		cfg->every = 0;
+		cfg->interval_ms = n;
+	} else if (*end == '\0') {
+		cfg->every = n;
+	} else {
+		return -1;
+	}
+	return 0;
+}
+
+void
+shmstats_init(struct shmstats_config *cfg, const char *tracefile,
+	      const char *alg)
+{
+	if (cfg->name == NULL)
+		return;
+
+	snprintf(path, sizeof(path), "/%s", cfg->name);
+	const int fd = shm_open(path, O_CREAT | O_TRUNC | O_RDWR, 0644);
+	if (fd < 0 || ftruncate(fd, sizeof(*seg)) != 0) {
+		perror(path);
+		exit(1);
+	}
+	seg = mmap(NULL, sizeof(*seg), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (seg == MAP_FAILED) {
+		perror(path);
+		exit(1);
+	}
+
+	struct stat sb;
+	seg->version = SHMSTATS_VERSION;
+	seg->size = sizeof(*seg);
+	seg->pid = getpid();
+	seg->trace_lines = stat(tracefile, &sb) == 0
+		? sb.st_size / sizeof(struct trace_line) : 0;
+	strncpy(seg->alg, alg, sizeof(seg->alg) - 1);
+
+	// Readers recognise the segment once the header is complete
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(seg->magic, SHMSTATS_MAGIC, sizeof(seg->magic));
+
+	every = cfg->every;
+	interval_ms = cfg->interval_ms;
+	start_time = wall_time();
+	last_update = start_time;
+	shmstats_countdown = every > 0 ? every : SHMSTATS_CLOCK_LINES;
+}
+
+void
+shmstats_destroy(void)
+{
+	if (seg == NULL)
+		return;
+
+	munmap(seg, sizeof(*seg));
+	shm_unlink(path);
+	seg = NULL;
+	shmstats_countdown = 0;
+}
+
+void
+shmstats_update(size_t line, bool done)
+{
+	if (seg == NULL)
+		return;
+
+	const f64 now = wall_time();
+	if (done) {
+		shmstats_countdown = 0;
+	} else if (every > 0) {
+		shmstats_countdown = every;
+	} else {
+		shmstats_countdown = SHMSTATS_CLOCK_LINES;
+		if ((now - last_update) * 1000.0 < interval_ms)
+			return;
+	}
+	last_update = now;
+
+	const u64 seq = seg->seq;
+	__atomic_store_n(&seg->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	seg->elapsed = now - start_time;
+	seg->line = line;
+	seg->tlb_hits = tlb_hit_count();
+	seg->tlb_misses = tlb_miss_count();
+	seg->refs = seg->tlb_hits + seg->tlb_misses;
+	seg->ram_hits = ram_hit_count;
+	seg->ram_misses = ram_miss_count;
+	seg->cow_faults = cow_fault_count;
+	seg->write_faults = write_fault_count;
+	seg->evict_clean = evict_clean_count;
+	seg->evict_dirty = evict_dirty_count;
+	seg->swap_in = swap_pagein_count();
+	seg->swap_out = swap_pageout_count();
+	seg->done = done;
+
+	__atomic_store_n(&seg->seq, seq + 2, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,115 @@
+/** @file shmstats.h
+ * @brief Live counters of a running sim, in a shared memory segment.
+ *
+ * With `-E name`, sim creates the POSIX shared memory object /name holding a
+ * `struct shmstats` and copies its counters there every few trace lines or
+ * milliseconds, so that simtop can follow a long replay. The layout starts
+ * with a magic and a version bumped whenever it changes.
+ *
+ * Updates are published under a sequence lock: the writer makes `seq` odd,
+ * copies the counters and makes it even again, and a reader retries until it
+ * copied the segment between two reads of the same even `seq`. The writer
+ * never waits on readers, and the hot loop only decrements a countdown.
+ */
+
+#ifndef __SHMSTATS_H__
+#define __SHMSTATS_H__
+
+#include <string.h>
+
+#include "types.h"
+
+#define SHMSTATS_MAGIC "SIM369LS"
+#define SHMSTATS_VERSION 1
+
+#define SHMSTATS_DEFAULT_INTERVAL_MS 500
+
+/* Trace lines between two reads of the clock when updating by time */
+#define SHMSTATS_CLOCK_LINES 4096
+
+struct shmstats {
+	char magic[8];
+	u32 version;
+	u32 size;               /* sizeof(struct shmstats) of the writer */
+	u64 seq;                /* Odd while an update is in progress */
+
+	/* Set once, before the first update */
+	i64 pid;                /* Of the sim writing the segment */
+	u64 trace_lines;        /* Lines in the trace */
+	char alg[16];
+
+	/* As of the last update */
+	f64 elapsed;            /* Wall clock seconds since the replay started */
+	u64 line;               /* Trace lines replayed, the current offset */
+	u64 refs;               /* Memory references, tlb hits and misses */
+	u64 tlb_hits;
+	u64 tlb_misses;
+	u64 ram_hits;
+	u64 ram_misses;
+	u64 cow_faults;
+	u64 write_faults;
+	u64 evict_clean;
+	u64 evict_dirty;
+	u64 swap_in;
+	u64 swap_out;
+	u32 done;               /* Set by the last update, once the replay ended */
+	u32 pad;
+};
+
+/* Trace lines left before the next update, 0 when not exporting */
+extern size_t shmstats_countdown;
+
+// Live stats functions used in sim.c for initialization and teardown
+void shmstats_init(struct shmstats_config *cfg, const char *tracefile,
+		   const char *alg);
+void shmstats_destroy(void);
+
+/**
+ * @brief Parse how often to update, as a number of trace lines or of
+ * milliseconds with an ms suffix, e.g. 1000000 or 250ms.
+ *
+ * @return 0 on success, -1 if `spec` is not a positive number.
+ *
+ * @see shmstats.c
+ */
+i32 shmstats_parse(struct shmstats_config *cfg, const char *spec);
+
+/**
+ * @brief Copy the counters into the segment if the update is due, or
+ * unconditionally with `done` at the end of the replay.
+ *
+ * @param line[in] The trace lines replayed so far.
+ *
+ * @see shmstats.c
+ */
+void shmstats_update(size_t line, bool done);
+
+/**
+ * @brief Account for one more trace line replayed, called from
+ * replay_trace().
+ */
+static inline void
+shmstats_tick(size_t line)
+{
+	if (__builtin_expect(shmstats_countdown != 0, false)
+	    && --shmstats_countdown == 0)
+		shmstats_update(line, false);
+}
+
+/**
+ * @brief Copy a consistent snapshot of `shared` into `out`, retrying while
+ * the writer is updating it.
+ */
+static inline void
+shmstats_read(const struct shmstats *shared, struct shmstats *out)
+{
+	u64 seq;
+	do {
+		seq = __atomic_load_n(&shared->seq, __ATOMIC_ACQUIRE);
+		memcpy(out, (const void *)shared, sizeof(*out));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) != 0
+		 || __atomic_load_n(&shared->seq, __ATOMIC_RELAXED) != seq);
+}
+
+#endif /* __SHMSTATS_H__ */
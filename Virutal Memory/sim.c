@@ -9,10 +9,22 @@
 
 #include "malloc369.h"
 #include "sim.h"
+#include "adapt.h"
+#include "cache.h"
+#include "checkpoint.h"
 #include "coremap.h"
+#include "dedup.h"
+#include "latency.h"
+#include "numa.h"
+#include "profile.h"
+#include "quota.h"
+#include "readahead.h"
+#include "shards.h"
+#include "shmstats.h"
 #include "swap.h"
 #include "tlb.h"
 #include "multiprocessing.h"
+#include "trace_index.h"
 #include "types.h"
 #include "timer.h"
 #include "parse_trace.h"
@@ -42,6 +54,8 @@ struct functions {
 	void (*cleanup)();         // Cleanup any data initialized in init()
 	void (*ref)(pfn_t);          // Called on each reference
 	pfn_t (*evict)();            // Called to choose victim for eviction
+	void (*checkpoint)(struct checkpoint *); // Save or restore its state
+	const bool *compaction_safe; // May replay compacted traces
 };
 
 /* The algs array gives us a mapping between the name of an eviction
@@ -56,7 +70,8 @@ struct functions {
  */
 static struct functions algs[] = {
 #define RA(name) \
-	{ #name, name ## _init, name ## _cleanup, name ## _ref, name ## _evict },
+	{ #name, name ## _init, name ## _cleanup, name ## _ref, name ## _evict, \
+	  name ## _checkpoint, &name ## _compaction_safe },
 REPLACEMENT_ALGORITHMS
 #undef RA
 };
@@ -66,6 +81,33 @@ static void (*init_func)() = NULL;
 static void (*cleanup_func)() = NULL;
 void (*ref_func)(pfn_t) = NULL;
 pfn_t (*evict_func)() = NULL;
+static void (*checkpoint_func)(struct checkpoint *) = NULL;
+
+/* Snapshot to write once checkpoint_line trace lines have been replayed */
+static const char *checkpoint_path = DEFAULT_CHECKPOINT_PATH;
+static size_t checkpoint_line = 0;
+
+/* Replay of part of the trace only, from a given line or of some processes,
+ * found through the index of the trace. Loads may then read values written
+ * by lines that were skipped, which are counted rather than reported.
+ */
+static struct trace_index trace_idx;
+static bool partial_replay = false;
+
+/* Replay of a trace compacted by trace-compact, each line of which stands
+ * for `weight` references. The values of the writes it dropped are lost, so
+ * the loads that depend on them are counted rather than reported too.
+ */
+static bool compacted_trace = false;
+
+/* Whether each vpid is replayed, and the runs of those that are, in trace
+ * order. NULL when every process is replayed.
+ */
+static bool *replay_vpids = NULL;
+static struct trace_run *replay_runs = NULL;
+static size_t nr_replay_runs = 0;
+static size_t replay_run = 0;
+static size_t replay_end = 0;
 
 /* An actual memory access based on the vaddr from the trace file.
  *
@@ -80,38 +122,177 @@ pfn_t (*evict_func)() = NULL;
  * We then check that the memory has the expected content (just a copy of the
  * virtual address) and, in case of a write reference, increment the version
  * counter.
+ *
+ * The weight - 1 references that follow on a line of a compacted trace all
+ * hit in the tlb, and only add to the counters.
  */
 static void
-access_mem(char type, vaddr_t vaddr, u8 val, size_t linenum)
+access_mem(char type, vaddr_t vaddr, u8 val, u16 weight, size_t linenum)
 {
 	u8 *memptr;
 	const off_t offset = vaddr % PAGE_SIZE;
-	const asid_t asid = current_task_id();
+	const asid_t asid = get_asid(current_task()->mm);
 	pagetable_t *const pt = get_pagetable(current_task()->mm);
 
 	paddr_t memaddr = tlb_translate(type, asid, pt, vaddr);
 	pfn_t frame = memaddr >> PAGE_SHIFT;
 	memptr = &physmem[frame * SIMPAGESIZE] + offset;
+	ref_func(frame);
+	if (cache_nr_levels > 0)
+		cache_access(memaddr, type == 'S' || type == 'M');
 
 	if ((type == 'S') || (type == 'M')) {
 		// write access to page, update value in simulated memory
 		*memptr = val;
 	} else if ((type == 'L' || type == 'I')) {
-		if (*memptr != val) {
+		if (*memptr != val && (partial_replay || compacted_trace)) {
+			unchecked_load_count++;
+		} else if (*memptr != val) {
 			printf("ERROR at trace line %zu: vaddr has %hhu but should have %hhu\n",
 			       linenum, *memptr, val);
 		}
 	}
+
+	if (weight > 1)
+		tlb_repeat_hits(weight - 1);
+	for (u16 i = 0; i < weight; i++) {
+		if (numa_nr_nodes > 1)
+			numa_access(frame);
+		if (quota_nr_groups > 0)
+			quota_reference();
+	}
+}
+
+static int
+compare_run_starts(const void *a, const void *b)
+{
+	const struct trace_run *x = a;
+	const struct trace_run *y = b;
+	return x->start < y->start ? -1 : x->start > y->start;
+}
+
+/* Set up the replay of the processes listed in `vpids` (or all of them if
+ * NULL) from line `start`, creating the processes alive at that line.
+ */
+static void
+start_partial_replay(const char *tracefile, size_t start, char *vpids)
+{
+	char *path = malloc369(strlen(tracefile) + sizeof(TRACE_INDEX_SUFFIX));
+	assert(path != NULL);
+	strcpy(path, tracefile);
+	strcat(path, TRACE_INDEX_SUFFIX);
+	if (trace_index_open(&trace_idx, path, tracefile) != 0) {
+		fprintf(stderr, "Error: %s is missing or out of date, "
+			"run trace-index on %s first\n", path, tracefile);
+		exit(1);
+	}
+	free369(path);
+
+	const size_t nr_vpids = trace_idx.hdr->nr_vpids;
+	if (start > trace_idx.hdr->nr_records) {
+		fprintf(stderr, "Error: %s has fewer than %zu lines\n",
+			tracefile, start);
+		exit(1);
+	}
+	partial_replay = true;
+
+	if (vpids != NULL) {
+		replay_vpids = malloc369(nr_vpids * sizeof(*replay_vpids) + 1);
+		assert(replay_vpids != NULL);
+		memset(replay_vpids, 0, nr_vpids * sizeof(*replay_vpids));
+
+		size_t nr_runs = 0;
+		for (char *tok = strtok(vpids, ","); tok; tok = strtok(NULL, ",")) {
+			const size_t v = strtoul(tok, NULL, 10);
+			if (v >= nr_vpids || trace_idx.vpids[v].nr_runs == 0) {
+				fprintf(stderr, "Error: process %zu is not in %s\n",
+					v, tracefile);
+				exit(1);
+			}
+			if (!replay_vpids[v])
+				nr_runs += trace_idx.vpids[v].nr_runs;
+			replay_vpids[v] = true;
+		}
+
+		replay_runs = malloc369(nr_runs * sizeof(*replay_runs) + 1);
+		assert(replay_runs != NULL);
+		for (size_t v = 0; v < nr_vpids; v++) {
+			const struct trace_vpid *tv = &trace_idx.vpids[v];
+			if (!replay_vpids[v])
+				continue;
+			memcpy(&replay_runs[nr_replay_runs], &trace_idx.runs[tv->run],
+			       tv->nr_runs * sizeof(*replay_runs));
+			nr_replay_runs += tv->nr_runs;
+		}
+		qsort(replay_runs, nr_replay_runs, sizeof(*replay_runs),
+		      compare_run_starts);
+	}
+
+	if (start > 0) {
+		bool *live = malloc369(nr_vpids * sizeof(*live) + 1);
+		assert(live != NULL);
+		trace_index_live_at(&trace_idx, start, live);
+		for (size_t v = 0; v < nr_vpids; v++) {
+			if (live[v] && (replay_vpids == NULL || replay_vpids[v]))
+				create_task(v);
+		}
+		free369(live);
+		seek_parse_trace(start);
+	}
+}
+
+static void
+end_partial_replay(void)
+{
+	free369(replay_runs);
+	free369(replay_vpids);
+	trace_index_close(&trace_idx);
+}
+
+/* Read the next trace line to replay, skipping to the next run of the
+ * replayed processes when only some are.
+ */
+static bool
+next_traceline(struct trace_line *tl, size_t *linenum)
+{
+	while (replay_runs != NULL && *linenum >= replay_end) {
+		const struct trace_run *r;
+		do {
+			if (replay_run == nr_replay_runs)
+				return false;
+			r = &replay_runs[replay_run++];
+		} while (r->start + r->len <= *linenum);
+
+		if (r->start > *linenum) {
+			seek_parse_trace(r->start);
+			*linenum = r->start;
+		}
+		replay_end = r->start + r->len;
+	}
+	return get_traceline(tl);
+}
+
+/* Whether a task was created for `vpid`, which in a partial replay need
+ * not be the case when its creation was skipped.
+ */
+static bool
+task_exists(u32 vpid)
+{
+	return vpid < (u32)get_max_nr_tasks() && get_task_by_id(vpid)->mm != NULL;
 }
 
 static void
-replay_trace()
+replay_trace(const char *replacement_alg, size_t linenum)
 {
 	struct trace_line tl;
-	size_t linenum = 0;
-	u32 curtask_i = 0;
-	while (get_traceline(&tl)) {
+	u32 curtask_i = current_task() != NULL ? current_task_id() : 0;
+	while (next_traceline(&tl, &linenum)) {
+		if (linenum == checkpoint_line && checkpoint_line > 0) {
+			checkpoint_save(checkpoint_path, replacement_alg,
+					checkpoint_func, linenum);
+		}
 		++linenum;
+		shmstats_tick(linenum);
 
 		if (strchr("ILSMBEF", tl.reftype) == NULL) {
 			fprintf(stderr,"Invalid reftype, line %zu: reftype=%c\n",
@@ -129,7 +310,11 @@ replay_trace()
 			continue;
 		}
 		if (tl.reftype == 'E') {
-			free_task(get_task_by_id(tl.vpid));
+			if (!partial_replay || task_exists(tl.vpid))
+				free_task(get_task_by_id(tl.vpid));
+			// A new process with the same vpid must be switched to
+			if (tl.vpid == curtask_i)
+				curtask_i = UINT32_MAX;
 			continue;
 		}
 
@@ -138,15 +323,69 @@ replay_trace()
 		}
 		
 		if (current_task() == NULL || curtask_i != tl.vpid) {
+			// Processes forked by a skipped parent start out empty
+			if (partial_replay && !task_exists(tl.vpid))
+				create_task(tl.vpid);
 			task_switch(get_task_by_id(tl.vpid));
 			curtask_i = tl.vpid;
 		}
 		if (tl.reftype == 'F') {
-			fork369(current_task_id(), tl.vaddr);
+			if (replay_vpids == NULL
+			    || (tl.vaddr < (vaddr_t)trace_idx.hdr->nr_vpids
+				&& replay_vpids[tl.vaddr])) {
+				if (fork369(current_task_id(), tl.vaddr) != 0) {
+					fprintf(stderr, "Fork failed, line %zu: out of swap, "
+						"try running again with a larger swapsize\n",
+						linenum);
+					exit(1);
+				}
+			}
 			continue;
 		}
-		access_mem(tl.reftype, tl.vaddr, tl.value, linenum);
+		if (compacted_trace && tl.weight == 0) {
+			fprintf(stderr, "Invalid weight, line %zu: weight=0\n", linenum);
+			exit(1);
+		}
+		access_mem(tl.reftype, tl.vaddr, tl.value,
+			   compacted_trace ? tl.weight : 1, linenum);
+		dedup_tick();
+		profile_tick();
 	}
+	shmstats_update(linenum, true);
+}
+
+/* Estimate the miss-ratio curve of the trace from a sample of its pages,
+ * without simulating it.
+ */
+static void
+estimate_mrc(struct shards_config *cfg, const char *tracefile)
+{
+	struct trace_line tl;
+	f64 starttime;
+	f64 endtime;
+
+	init_csc369_malloc(false);
+	shards_init(cfg);
+	init_parse_trace(tracefile);
+
+	starttime = get_time();
+	while (get_traceline(&tl)) {
+		if (strchr("ILSM", tl.reftype) != NULL) {
+			const u16 weight = compacted_trace ? tl.weight : 1;
+			for (u16 i = 0; i < weight; i++)
+				shards_reference(tl.vpid, tl.vaddr);
+		} else if (tl.reftype == 'E') {
+			shards_exit(tl.vpid);
+		}
+	}
+	endtime = get_time();
+
+	shards_report(memsize);
+	printf("Time to estimate MRC: %f\n", endtime - starttime);
+
+	destroy_parse_trace();
+	shards_destroy();
+	destroy_csc369_malloc();
 }
 
 void
@@ -154,7 +393,16 @@ usage(char *prog)
 {
 	fprintf(stderr,
 		"USAGE: %s -f tracefile "
-		"-m memorysize -s swapsize -a algorithm -t tlbsize [-d num]\n", prog);
+		"-m memorysize -s swapsize -a algorithm -t tlbsize [-n cpus] [-A asids] "
+		"[-N nodes [-M policy] [-G refs]] [-q quotas] "
+		"[-L caches [-I inclusion] [-B line] [-K]] [-k interval] "
+		"[-D candidates [-W window] [-O phases]] "
+		"[-w window [-o profile]] [-l costs] [-p window] [-P pages] "
+		"[-c line] [-C checkpoint] "
+		"[-r checkpoint] [-S line] [-V vpids] [-Z] [-E name [-e every]] "
+		"[-d num]\n"
+		"       %s -f tracefile -x samples [-X mrc] [-m memorysize] [-Z]\n",
+		prog, prog);
 	fprintf(stderr, "\t-f tracefile  - path to trace file to simulate\n");
 	fprintf(stderr, "\t-m memorysize - number of physical memory frames\n");
 	fprintf(stderr, "\t-s swapsize   - number of frames in swapfile\n");
@@ -162,7 +410,68 @@ usage(char *prog)
 	for (i32 i = 0; i < num_algs; ++i) {
 		fprintf(stderr, "\t\t%s\n",algs[i].name);
 	}
+	fprintf(stderr, "\t-D candidates - algorithms dueling under adapt, leader first\n"
+		"\t                (default %s)\n", ADAPT_DEFAULT_CANDIDATES);
+	fprintf(stderr, "\t-W window     - references between adapt decisions (default %d)\n",
+		ADAPT_DEFAULT_WINDOW);
+	fprintf(stderr, "\t-O phases     - path of the adapt phase log csv (default %s)\n",
+		DEFAULT_PHASE_LOG_PATH);
 	fprintf(stderr, "\t-t tlbsize    - number of tlb entries (1-255, default 64)\n");
+	fprintf(stderr, "\t-n cpus       - number of cpus with a tlb each (1-%d, default 1),\n"
+		"\t                process vpid runs on cpu vpid %% cpus\n", TLB_MAX_CPUS);
+	fprintf(stderr, "\t-A asids      - number of ASIDs tagged in the tlb (1-%d,\n"
+		"\t                default %d), recycled by flushing every tlb\n",
+		INVALID_ASID - 1, DEFAULT_NR_ASIDS);
+	fprintf(stderr, "\t-N nodes      - number of NUMA nodes (1-%d, default 1),\n"
+		"\t                process vpid is homed on node vpid %% nodes\n",
+		NUMA_MAX_NODES);
+	fprintf(stderr, "\t-M policy     - page placement, one of first-touch (default),\n"
+		"\t                interleave, local-preferred\n");
+	fprintf(stderr, "\t-G refs       - migrate a private page to the node of its task\n"
+		"\t                after refs remote accesses\n");
+	fprintf(stderr, "\t-q quotas     - frame limits of groups, as max[:min],... (max 0 for\n"
+		"\t                no limit), process vpid is in group vpid %% groups\n");
+	fprintf(stderr, "\t-L caches     - cache levels on physical addresses, L1 first, as\n"
+		"\t                size:ways,... (e.g. 32k:8,256k:8,8m:16)\n");
+	fprintf(stderr, "\t-I inclusion  - inclusion of the levels, one of nine (default),\n"
+		"\t                inclusive, exclusive\n");
+	fprintf(stderr, "\t-B line       - bytes per cache line (default %d)\n",
+		CACHE_DEFAULT_LINE);
+	fprintf(stderr, "\t-K            - allocate frames in the cache colour of their page\n");
+	fprintf(stderr, "\t-k interval   - merge identical frames every interval references\n");
+	fprintf(stderr, "\t-w window     - profile each process every window references\n");
+	fprintf(stderr, "\t-o profile    - path of the profile csv (default %s)\n",
+		DEFAULT_PROFILE_PATH);
+	fprintf(stderr, "\t-l costs      - latency model, e.g. tlb=%d,walk=%d,fault=%d,\n"
+		"\t                swapin=%d,swapout=%d,ipi=%d,remote=%d,\n"
+		"\t                ghz=%.1f (the defaults)\n",
+		LAT_DEFAULT_TLB_LOOKUP, LAT_DEFAULT_WALK_STEP, LAT_DEFAULT_FAULT,
+		LAT_DEFAULT_SWAP_IN, LAT_DEFAULT_SWAP_OUT, LAT_DEFAULT_SHOOTDOWN,
+		LAT_DEFAULT_REMOTE, LAT_DEFAULT_GHZ);
+	fprintf(stderr, "\t-p window     - read up to window pages ahead of strided swap-ins\n");
+	fprintf(stderr, "\t-P pages      - load resident neighbours into the tlb on a tlb\n"
+		"\t                miss, within aligned blocks of pages pages\n");
+	fprintf(stderr, "\t-c line       - checkpoint after replaying line trace lines\n");
+	fprintf(stderr, "\t-C checkpoint - path of the checkpoint (default %s)\n",
+		DEFAULT_CHECKPOINT_PATH);
+	fprintf(stderr, "\t-r checkpoint - resume from a checkpoint of the same trace\n");
+	fprintf(stderr, "\t-S line       - start at line line, with the processes alive\n"
+		"\t                there but none of their pages\n");
+	fprintf(stderr, "\t-V vpids      - only replay the processes in the list vpid,...\n"
+		"\t                (-S and -V need the tracefile%s of trace-index)\n",
+		TRACE_INDEX_SUFFIX);
+	fprintf(stderr, "\t-Z            - the tracefile was compacted by trace-compact, which\n"
+		"\t                only rand, rr and clock replay exactly\n");
+	fprintf(stderr, "\t-E name       - publish live stats in shared memory /name, for\n"
+		"\t                simtop\n");
+	fprintf(stderr, "\t-e every      - update them every every trace lines, or every\n"
+		"\t                every milliseconds with an ms suffix (default %dms)\n",
+		SHMSTATS_DEFAULT_INTERVAL_MS);
+	fprintf(stderr, "\t-x samples    - only estimate the miss-ratio curve, sampling at\n"
+		"\t                most samples pages (e.g. %d)\n",
+		SHARDS_DEFAULT_SAMPLES);
+	fprintf(stderr, "\t-X mrc        - path of the miss-ratio curve csv (default %s)\n",
+		DEFAULT_MRC_PATH);
 	fprintf(stderr, "\t-d num        - debug level for output\n");
 }
 
@@ -177,14 +486,60 @@ main(i32 argc, char *argv[])
 	size_t swapsize = 0;
 	char *tracefile = NULL;
 	char *replacement_alg = NULL;
+	char *restore_path = NULL;
+	char *replay_list = NULL;
+	bool compaction_safe = false;
+	size_t first_line = 0;
 	i32 opt;
 
-	struct mp_config mp_cfg = { .max_nr_tasks = -1 };
+	struct mp_config mp_cfg = { .max_nr_tasks = -1, .nr_asids = 0 };
 	struct tlb_config tlb_cfg = {
 	    .seed = 369,
 	};
+	struct dedup_config dedup_cfg = { .interval = 0 };
+	struct profile_config profile_cfg = {
+	    .window = 0,
+	    .path = DEFAULT_PROFILE_PATH,
+	};
+	struct latency_config latency_cfg = {
+	    .tlb_lookup = LAT_DEFAULT_TLB_LOOKUP,
+	    .walk_step = LAT_DEFAULT_WALK_STEP,
+	    .fault = LAT_DEFAULT_FAULT,
+	    .swap_in = LAT_DEFAULT_SWAP_IN,
+	    .swap_out = LAT_DEFAULT_SWAP_OUT,
+	    .shootdown = LAT_DEFAULT_SHOOTDOWN,
+	    .remote = LAT_DEFAULT_REMOTE,
+	    .ghz = LAT_DEFAULT_GHZ,
+	};
+	struct readahead_config readahead_cfg = { .window = 0, .around = 0 };
+	struct quota_config quota_cfg = { .nr_groups = 0 };
+	struct numa_config numa_cfg = {
+	    .nodes = 1,
+	    .policy = NUMA_FIRST_TOUCH,
+	    .migrate = 0,
+	};
+	struct cache_config cache_cfg = {
+	    .nr_levels = 0,
+	    .line = CACHE_DEFAULT_LINE,
+	    .inclusion = CACHE_NINE,
+	    .colour = false,
+	};
+	struct adapt_config adapt_cfg = {
+	    .window = ADAPT_DEFAULT_WINDOW,
+	    .path = DEFAULT_PHASE_LOG_PATH,
+	};
+	adapt_parse(&adapt_cfg, ADAPT_DEFAULT_CANDIDATES);
+	struct shmstats_config shmstats_cfg = {
+	    .name = NULL,
+	    .every = 0,
+	    .interval_ms = SHMSTATS_DEFAULT_INTERVAL_MS,
+	};
+	struct shards_config shards_cfg = {
+	    .samples = 0,
+	    .path = DEFAULT_MRC_PATH,
+	};
 	
-	while ((opt = getopt(argc, argv, "f:m:a:s:d:t:h")) != -1) {
+	while ((opt = getopt(argc, argv, "f:m:a:D:W:O:s:d:t:n:A:N:M:G:q:L:I:B:Kk:w:o:l:p:P:c:C:r:S:V:ZE:e:x:X:h")) != -1) {
 		switch (opt) {
 		case 'f':
 			tracefile = optarg;
@@ -211,6 +566,140 @@ main(i32 argc, char *argv[])
 			tlb_cfg.size = tmp;
 			break;
 		}
+		case 'n': {
+			u64 tmp = strtoul(optarg, NULL, 10);
+			if (tmp > TLB_MAX_CPUS) {
+				fprintf(stderr, "Maximum number of cpus %d is exceeded.\n",
+					TLB_MAX_CPUS);
+				return 1;
+			}
+
+			tlb_cfg.nr_cpus = tmp;
+			break;
+		}
+		case 'A': {
+			u64 tmp = strtoul(optarg, NULL, 10);
+			if (tmp == 0 || tmp >= INVALID_ASID) {
+				fprintf(stderr, "Number of ASIDs must be 1-%d.\n",
+					INVALID_ASID - 1);
+				return 1;
+			}
+
+			mp_cfg.nr_asids = tmp;
+			break;
+		}
+		case 'N': {
+			u64 tmp = strtoul(optarg, NULL, 10);
+			if (tmp > NUMA_MAX_NODES) {
+				fprintf(stderr, "Maximum number of NUMA nodes %d is exceeded.\n",
+					NUMA_MAX_NODES);
+				return 1;
+			}
+
+			numa_cfg.nodes = tmp;
+			break;
+		}
+		case 'M':
+			numa_cfg.policy = numa_parse_policy(optarg);
+			if (numa_cfg.policy == NUMA_NR_POLICIES) {
+				fprintf(stderr, "Invalid placement policy - %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'G':
+			numa_cfg.migrate = strtoul(optarg, NULL, 10);
+			break;
+		case 'q':
+			if (quota_parse(&quota_cfg, optarg) != 0) {
+				fprintf(stderr, "Invalid quotas - %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'L':
+			if (cache_parse(&cache_cfg, optarg) != 0) {
+				fprintf(stderr, "Invalid caches - %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'I':
+			cache_cfg.inclusion = cache_parse_inclusion(optarg);
+			if (cache_cfg.inclusion == CACHE_NR_INCLUSIONS) {
+				fprintf(stderr, "Invalid cache inclusion - %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'B':
+			cache_cfg.line = strtoul(optarg, NULL, 10);
+			break;
+		case 'K':
+			cache_cfg.colour = true;
+			break;
+		case 'D':
+			if (adapt_parse(&adapt_cfg, optarg) != 0) {
+				fprintf(stderr, "Invalid candidates - %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'W':
+			adapt_cfg.window = strtoul(optarg, NULL, 10);
+			break;
+		case 'O':
+			adapt_cfg.path = optarg;
+			break;
+		case 'k':
+			dedup_cfg.interval = strtoul(optarg, NULL, 10);
+			break;
+		case 'w':
+			profile_cfg.window = strtoul(optarg, NULL, 10);
+			break;
+		case 'o':
+			profile_cfg.path = optarg;
+			break;
+		case 'l':
+			if (latency_parse(&latency_cfg, optarg) != 0) {
+				fprintf(stderr, "Invalid latency model - %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'p':
+			readahead_cfg.window = strtoul(optarg, NULL, 10);
+			break;
+		case 'P':
+			readahead_cfg.around = strtoul(optarg, NULL, 10);
+			break;
+		case 'c':
+			checkpoint_line = strtoul(optarg, NULL, 10);
+			break;
+		case 'C':
+			checkpoint_path = optarg;
+			break;
+		case 'r':
+			restore_path = optarg;
+			break;
+		case 'S':
+			first_line = strtoul(optarg, NULL, 10);
+			break;
+		case 'V':
+			replay_list = optarg;
+			break;
+		case 'Z':
+			compacted_trace = true;
+			break;
+		case 'E':
+			shmstats_cfg.name = optarg;
+			break;
+		case 'e':
+			if (shmstats_parse(&shmstats_cfg, optarg) != 0) {
+				fprintf(stderr, "Invalid stats interval - %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'x':
+			shards_cfg.samples = strtoul(optarg, NULL, 10);
+			break;
+		case 'X':
+			shards_cfg.path = optarg;
+			break;
 		case 'h':
 		default:
 			usage(argv[0]);
@@ -218,11 +707,37 @@ main(i32 argc, char *argv[])
 		}
 	}
 
+	if (tracefile && shards_cfg.samples > 0) {
+		estimate_mrc(&shards_cfg, tracefile);
+		return 0;
+	}
+
 	if (!tracefile || !memsize || !swapsize || !replacement_alg) {
 		usage(argv[0]);
 		return 1;
 	}
 
+	if ((first_line > 0 || replay_list != NULL)
+	    && (restore_path != NULL || checkpoint_line > 0)) {
+		fprintf(stderr, "Error: -S and -V cannot be used with checkpoints\n");
+		return 1;
+	}
+
+	if (numa_cfg.nodes > memsize) {
+		fprintf(stderr, "Error: %u NUMA nodes cannot share %zu frames\n",
+			numa_cfg.nodes, memsize);
+		return 1;
+	}
+
+	if (cache_cfg.nr_levels > 0 && cache_config_error(&cache_cfg) != NULL) {
+		fprintf(stderr, "Error: %s\n", cache_config_error(&cache_cfg));
+		return 1;
+	}
+	if (cache_cfg.colour && cache_cfg.nr_levels == 0) {
+		fprintf(stderr, "Error: -K needs the caches of -L\n");
+		return 1;
+	}
+
 	// Initialize the page replacement algorithm function pointers
 	for (i32 i = 0; i < num_algs; ++i) {
 		if (strcmp(algs[i].name, replacement_alg) == 0) {
@@ -230,6 +745,8 @@ main(i32 argc, char *argv[])
 			cleanup_func = algs[i].cleanup;
 			ref_func = algs[i].ref;
 			evict_func = algs[i].evict;
+			checkpoint_func = algs[i].checkpoint;
+			compaction_safe = *algs[i].compaction_safe;
 			break;
 		}
 	}
@@ -239,6 +756,18 @@ main(i32 argc, char *argv[])
 				replacement_alg);
 		return 1;
 	}
+
+	// Compacted traces drop references that these would see
+	if (compacted_trace && !compaction_safe) {
+		fprintf(stderr, "Error: %s cannot replay compacted traces\n",
+			replacement_alg);
+		return 1;
+	}
+	if (compacted_trace && (dedup_cfg.interval > 0 || profile_cfg.window > 0
+				|| cache_cfg.nr_levels > 0 || numa_cfg.migrate > 0)) {
+		fprintf(stderr, "Error: -k, -w, -L and -G cannot be used with -Z\n");
+		return 1;
+	}
 	
 	// Initialize main data structures for simulation.
 	// This happens before calling the replacement algorithm init function
@@ -250,10 +779,18 @@ main(i32 argc, char *argv[])
 	start_mallocs = get_current_num_mallocs();
 	start_bytes = get_current_bytes_malloced();
 
+	// Physical memory, the coremap and swap are zeroed lazily as they are
+	// touched, so their size does not add to the startup time.
 	init_coremap();
-	physmem = malloc369(memsize * SIMPAGESIZE);
-	memset(physmem, 0, memsize*SIMPAGESIZE);
+	physmem = mmap369(memsize * SIMPAGESIZE);
+	if (physmem == NULL) {
+		perror("Failed to map simulated physical memory");
+		return 1;
+	}
 	swap_init(swapsize);
+	numa_init(&numa_cfg);
+	quota_init(&quota_cfg);
+	cache_init(&cache_cfg);
 
 	// Timed section of code starts here. This includes:
 	//     - initialization of the multiprocessing code
@@ -262,9 +799,26 @@ main(i32 argc, char *argv[])
 	starttime = get_time();
 
 	init_multiprocessing(&mp_cfg);
+	dedup_init(&dedup_cfg);
+	profile_init(&profile_cfg);
+	latency_init(&latency_cfg);
+	readahead_init(&readahead_cfg);
+	shmstats_init(&shmstats_cfg, tracefile, replacement_alg);
+	adapt_configure(&adapt_cfg);
 	init_func();      /* replacement algorithm initialization */
 	init_parse_trace(tracefile);
-	replay_trace();
+	if (restore_path != NULL) {
+		first_line = checkpoint_restore(restore_path, replacement_alg,
+						checkpoint_func);
+		if (!seek_parse_trace(first_line)) {
+			fprintf(stderr, "Error: %s has fewer than %zu lines\n",
+				tracefile, first_line);
+			return 1;
+		}
+	} else if (first_line > 0 || replay_list != NULL) {
+		start_partial_replay(tracefile, first_line, replay_list);
+	}
+	replay_trace(replacement_alg, first_line);
 
 	endtime = get_time();
 	// End of timed section of code.
@@ -283,13 +837,47 @@ main(i32 argc, char *argv[])
 	printf("Write Fault count: %zu\n", write_fault_count);
 	printf("Clean evictions: %zu\n", evict_clean_count);
 	printf("Dirty evictions: %zu\n", evict_dirty_count);
+	if (tlb_nr_cpus() > 1) {
+		const size_t evictions = evict_clean_count + evict_dirty_count;
+		printf("Eviction shootdown IPIs: %zu\n",
+		       tlb_shootdown_count(TLB_SHOOTDOWN_EVICT));
+		printf("CoW shootdown IPIs: %zu\n",
+		       tlb_shootdown_count(TLB_SHOOTDOWN_COW));
+		printf("Fork shootdown IPIs: %zu\n",
+		       tlb_shootdown_count(TLB_SHOOTDOWN_FORK));
+		printf("Merge shootdown IPIs: %zu\n",
+		       tlb_shootdown_count(TLB_SHOOTDOWN_MERGE));
+		printf("Migration shootdown IPIs: %zu\n",
+		       tlb_shootdown_count(TLB_SHOOTDOWN_MIGRATE));
+		printf("Shootdown IPIs per eviction: %.4f\n", evictions > 0
+		       ? (f64)tlb_shootdown_count(TLB_SHOOTDOWN_EVICT) / evictions
+		       : 0.0);
+	}
+	if (asid_rollover_count() > 0) {
+		printf("ASID rollovers: %zu\n", asid_rollover_count());
+		printf("Deferred TLB flushes: %zu\n", tlb_flush_count());
+	}
 	printf("Swap In count: %zu\n", swap_pagein_count());
 	printf("Swap Out count: %zu\n", swap_pageout_count());
 	printf("Total references: %zu\n", ref_count);
+	if (partial_replay || compacted_trace) {
+		printf("Loads depending on skipped stores: %zu\n",
+		       unchecked_load_count);
+	}
 	printf("TLB Hit rate: %.4f\n", ((f64)tlb_hit_count() / access_count) * 100.0);
 	printf("TLB Miss rate: %.4f\n", ((f64)tlb_miss_count() / access_count) * 100.0);
 	printf("RAM Hit rate: %.4f\n", ((f64)ram_hit_count / ref_count) * 100.0);
 	printf("RAM Miss rate: %.4f\n", ((f64)ram_miss_count / ref_count) * 100.0);
+	if (dedup_cfg.interval > 0) {
+		printf("Dedup scans: %zu\n", dedup_scan_count());
+		printf("Dedup frames saved: %zu\n", dedup_merge_count());
+	}
+	readahead_report();
+	numa_report();
+	quota_report();
+	cache_report();
+	adapt_report();
+	latency_report();
 
 	printf("Time to run simulation: %f\n",endtime - starttime);
 	printf("Memory used by simulation: %ld bytes\n", bytes_used);
@@ -298,10 +886,18 @@ main(i32 argc, char *argv[])
 
 	// Cleanup data structures and remove temporary swapfile
 	// fclose(tfp);
+	dedup_destroy();
+	profile_destroy();
+	shmstats_destroy();
+	latency_destroy();
+	numa_destroy();
+	cache_destroy();
 	destroy_coremap();
-	free369(physmem);
+	munmap369(physmem, memsize * SIMPAGESIZE);
 	swap_destroy();
 	free_multiprocessing();
+	if (partial_replay)
+		end_partial_replay();
 
 	// Check for memory leaks
 	if (is_leak_free(start_mallocs, start_bytes)) {
@@ -20,6 +20,8 @@
 
 #define SIMPAGESIZE 16         /* Simulated physical memory page frame size */
 
+#define DEFAULT_PROFILE_PATH "profile.csv"
+
 extern u8 *physmem;			   /* Array of bytes to simulate physical memory */
 extern size_t memsize;         /* Number of frames of physical memory */
 extern i32 debug;              /* Control amount of debugging output */
@@ -30,13 +32,96 @@ extern i32 debug;              /* Control amount of debugging output */
 
 // multiprocessing
 struct mp_config {
-	i32 max_nr_tasks;
+	i32 max_nr_tasks;       /* Initial size of the task table */
+	u32 nr_asids;           /* ASIDs tagged in the tlb */
 };
 
 // tlb
 struct tlb_config {
 	unsigned int seed;
 	tlb_index_t size;
+	u32 nr_cpus;
+};
+
+// profiler
+struct profile_config {
+	size_t window;
+	const char *path;
+};
+
+// dedup
+struct dedup_config {
+	size_t interval;
+	size_t max_sharing;
+};
+
+// latency model, costs in cycles
+struct latency_config {
+	u64 tlb_lookup;
+	u64 walk_step;
+	u64 fault;
+	u64 swap_in;
+	u64 swap_out;
+	u64 shootdown;
+	u64 remote;
+	f64 ghz;
+};
+
+// swap readahead and fault-around, in pages
+struct readahead_config {
+	size_t window;
+	size_t around;
+};
+
+// NUMA nodes, see numa.h
+struct numa_config {
+	u32 nodes;
+	u32 policy;         /* enum numa_policy */
+	size_t migrate;     /* Remote accesses before migrating, 0 to never */
+};
+
+// per-group frame quotas, see quota.h
+#define QUOTA_MAX_GROUPS 32
+
+struct quota_config {
+	u32 nr_groups;
+	size_t max[QUOTA_MAX_GROUPS];   /* Frames a group may hold, 0 if unlimited */
+	size_t min[QUOTA_MAX_GROUPS];   /* Frames kept from global reclaim */
+};
+
+// caches on physical addresses, see cache.h
+#define CACHE_MAX_LEVELS 4
+
+struct cache_config {
+	u32 nr_levels;
+	size_t size[CACHE_MAX_LEVELS];  /* Bytes, L1 first */
+	u32 ways[CACHE_MAX_LEVELS];
+	u32 line;                       /* Bytes per line */
+	u32 inclusion;                  /* enum cache_inclusion */
+	bool colour;                    /* Allocate frames by page colour */
+};
+
+// adaptive replacement, see adapt.h
+#define ADAPT_MAX_CANDIDATES 8
+
+struct adapt_config {
+	u32 nr_candidates;
+	u32 candidates[ADAPT_MAX_CANDIDATES];   /* Indices in adapt.c, leader first */
+	size_t window;                          /* References between decisions */
+	const char *path;                       /* Phase log, NULL for none */
+};
+
+// live stats, see shmstats.h
+struct shmstats_config {
+	const char *name;       /* Shared memory object, NULL for none */
+	size_t every;           /* Trace lines between updates, 0 to go by time */
+	u32 interval_ms;        /* Milliseconds between updates when every is 0 */
+};
+
+// sampled miss-ratio curves
+struct shards_config {
+	size_t samples;
+	const char *path;
 };
 
 struct task_s;
@@ -0,0 +1,166 @@
+/** @file simtop.c
+ * @brief Follows a running sim through its live stats, see shmstats.h.
+ *
+ *   simtop [-i interval] [-n count] name
+ *
+ * Prints a line every interval milliseconds with the progress through the
+ * trace, the rates since the previous line and the time left at that pace,
+ * until sim ends.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdnoreturn.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shmstats.h"
+#include "types.h"
+
+#define DEFAULT_INTERVAL_MS 1000
+#define HEADER_EVERY 20
+
+noreturn void help_usage(char **argv)
+{
+	fprintf(stdout,
+		"Follows the progress of a sim started with -E name.\n"
+	);
+	fprintf(stdout, "usage: %s [-i interval] [-n count] name\n", argv[0]);
+	fprintf(stdout, "\t-i interval - milliseconds between lines (default %d)\n",
+		DEFAULT_INTERVAL_MS);
+	fprintf(stdout, "\t-n count    - stop after count lines\n");
+	exit(EXIT_FAILURE);
+}
+
+static f64 percent(u64 part, u64 whole)
+{
+	return whole > 0 ? (f64)part / whole * 100.0 : 0.0;
+}
+
+static void print_header(void)
+{
+	printf("%8s %7s %10s %10s %7s %7s %10s %10s %10s %9s\n",
+	       "elapsed", "done%", "lines/s", "refs/s", "tlbhit%", "ramhit%",
+	       "faults", "evictions", "swapouts", "eta");
+}
+
+/* Print `secs` as h:mm:ss, or - if unknown. */
+static void print_duration(f64 secs)
+{
+	if (secs < 0) {
+		printf(" %9s\n", "-");
+		return;
+	}
+	const u64 s = secs + 0.5;
+	printf(" %3lu:%02lu:%02lu\n", s / 3600, s / 60 % 60, s % 60);
+}
+
+static void print_line(const struct shmstats *cur, const struct shmstats *prev)
+{
+	const f64 dt = cur->elapsed - prev->elapsed;
+	const f64 lines_rate = dt > 0 ? (cur->line - prev->line) / dt : 0.0;
+	const f64 refs_rate = dt > 0 ? (cur->refs - prev->refs) / dt : 0.0;
+	const u64 left = cur->trace_lines > cur->line
+		? cur->trace_lines - cur->line : 0;
+
+	printf("%8.1f %7.2f %10.0f %10.0f %7.2f %7.2f %10lu %10lu %10lu",
+	       cur->elapsed, percent(cur->line, cur->trace_lines), lines_rate,
+	       refs_rate, percent(cur->tlb_hits, cur->refs),
+	       percent(cur->ram_hits, cur->ram_hits + cur->ram_misses),
+	       cur->ram_misses, cur->evict_clean + cur->evict_dirty,
+	       cur->swap_out);
+	print_duration(cur->done ? 0.0 : lines_rate > 0 ? left / lines_rate : -1.0);
+}
+
+int main(int argc, char ** argv)
+{
+	int opt;
+	long interval_ms = DEFAULT_INTERVAL_MS;
+	long count = -1;
+	while ((opt = getopt(argc, argv, "i:n:h")) != -1) {
+		switch (opt) {
+			case 'i':
+			interval_ms = strtol(optarg, NULL, 10);
+			break;
+			case 'n':
+			count = strtol(optarg, NULL, 10);
+			break;
+			case 'h':
+			default:
+			help_usage(argv);
+		}
+	}
+
+	if (optind != argc - 1 || interval_ms <= 0) {
+		help_usage(argv);
+	}
+
+	char path[256];
+	snprintf(path, sizeof(path), "/%s", argv[optind]);
+	const int fd = shm_open(path, O_RDONLY, 0);
+	if (fd < 0) {
+		fprintf(stderr, "%s: %s, is sim running with -E %s?\n", path,
+			strerror(errno), argv[optind]);
+		return 1;
+	}
+	const struct shmstats *shared = mmap(NULL, sizeof(*shared), PROT_READ,
+					     MAP_SHARED, fd, 0);
+	close(fd);
+	if (shared == MAP_FAILED) {
+		perror(path);
+		return 1;
+	}
+
+	const struct timespec pause = {
+		.tv_sec = interval_ms / 1000,
+		.tv_nsec = interval_ms % 1000 * 1000000,
+	};
+
+	// sim may still be filling in the header
+	for (int tries = 0; memcmp(shared->magic, SHMSTATS_MAGIC,
+				   sizeof(shared->magic)) != 0; tries++) {
+		if (tries == 10) {
+			fprintf(stderr, "%s is not a sim stats segment\n", path);
+			return 1;
+		}
+		nanosleep(&pause, NULL);
+	}
+	if (shared->version != SHMSTATS_VERSION
+	    || shared->size != sizeof(*shared)) {
+		fprintf(stderr, "%s has version %u, simtop reads version %d\n",
+			path, shared->version, SHMSTATS_VERSION);
+		return 1;
+	}
+
+	struct shmstats prev;
+	struct shmstats cur;
+	shmstats_read(shared, &prev);
+	printf("sim %ld replaying %lu lines with %s\n", prev.pid,
+	       prev.trace_lines, prev.alg);
+
+	for (long n = 0; count < 0 || n < count; n++) {
+		nanosleep(&pause, NULL);
+		shmstats_read(shared, &cur);
+		if (n % HEADER_EVERY == 0)
+			print_header();
+		print_line(&cur, &prev);
+		fflush(stdout);
+
+		if (cur.done) {
+			printf("sim finished\n");
+			break;
+		}
+		if (kill(cur.pid, 0) != 0 && errno == ESRCH) {
+			printf("sim exited before the end of the trace\n");
+			break;
+		}
+		prev = cur;
+	}
+	return 0;
+}
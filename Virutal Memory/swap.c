@@ -10,6 +10,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "checkpoint.h"
+#include "latency.h"
 #include "malloc369.h"
 #include "sim.h"
 #include "types.h"
@@ -43,12 +45,11 @@ static i32
 bitmap_init(struct bitmap *b, size_t nbits)
 {
 	size_t nwords = nwords_for_nbits(nbits);
-	b->words = malloc369(nwords * sizeof(size_t));
+	b->words = mmap369(nwords * sizeof(size_t));
 	if (!b->words) {
 		return -1;
 	}
 
-	memset(b->words, 0, nwords * sizeof(size_t));
 	b->nbits = nbits;
 
 	// Mark any leftover bits at the end in use
@@ -102,7 +103,7 @@ bitmap_free(struct bitmap *b, size_t index)
 static void
 bitmap_destroy(struct bitmap *b)
 {
-	free369(b->words);
+	munmap369(b->words, nwords_for_nbits(b->nbits) * sizeof(size_t));
 }
 
 /*
@@ -117,7 +118,7 @@ swap_init(size_t size)
 {
 	// Initialize the swap space
 	assert(swap_addr == NULL);
-	swap_addr = malloc369(size * SIMPAGESIZE);
+	swap_addr = mmap369(size * SIMPAGESIZE);
 	if (swap_addr == NULL) {
 		perror("Failed to allocate memory for virtual swap");
 		exit(1);
@@ -125,7 +126,7 @@ swap_init(size_t size)
 
 	// Initialize the bitmap
 	if (bitmap_init(&swapmap, size) != 0) {
-		free369(swap_addr);
+		munmap369(swap_addr, size * SIMPAGESIZE);
 		swap_addr = NULL;
 		perror("Failed to create bitmap for swap\n");
 		exit(1);
@@ -135,7 +136,7 @@ swap_init(size_t size)
 void
 swap_destroy(void)
 {
-	free369(swap_addr);
+	munmap369(swap_addr, swapmap.nbits * SIMPAGESIZE);
 	swap_addr = NULL;
 	bitmap_destroy(&swapmap);
 }
@@ -144,6 +145,7 @@ i32
 swap_pagein(pfn_t frame, off_t offset)
 {
 	swapin_count++;
+	latency_charge(LAT_SWAP_IN);
 	assert(offset != INVALID_SWAP);
 
 	// Get pointer to page data in (simulated) physical memory
@@ -158,6 +160,7 @@ off_t
 swap_pageout(pfn_t frame, off_t offset)
 {
 	swapout_count++;
+	latency_charge(LAT_SWAP_OUT);
 	// Check if swap has already been allocated for this page
 	if (offset == INVALID_SWAP) {
 		size_t idx;
@@ -178,6 +181,22 @@ swap_pageout(pfn_t frame, off_t offset)
 	return offset;
 }
 
+off_t
+swap_dup(off_t offset)
+{
+	assert(offset != INVALID_SWAP);
+
+	size_t idx;
+	if (bitmap_alloc(&swapmap, &idx) != 0) {
+		fprintf(stderr, "swap_dup: Could not allocate swap space. "
+		                "Try running again with a larger swapsize.\n");
+		return INVALID_SWAP;
+	}
+
+	memcpy(&swap_addr[idx * SIMPAGESIZE], &swap_addr[offset], SIMPAGESIZE);
+	return idx * SIMPAGESIZE;
+}
+
 void
 swap_free(off_t offset)
 {
@@ -195,3 +214,14 @@ swap_pageout_count(void)
 {
 	return swapout_count;
 }
+
+void
+swap_checkpoint(struct checkpoint *cp)
+{
+	checkpoint_check(cp, swapmap.nbits, "swap size");
+	checkpoint_block(cp, swap_addr, swapmap.nbits * SIMPAGESIZE);
+	checkpoint_data(cp, swapmap.words,
+			nwords_for_nbits(swapmap.nbits) * sizeof(size_t));
+	checkpoint_var(cp, swapin_count);
+	checkpoint_var(cp, swapout_count);
+}
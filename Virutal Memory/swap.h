@@ -35,6 +35,19 @@ extern i32 swap_pagein(pfn_t frame, off_t offset);
  */
 extern off_t swap_pageout(pfn_t frame, off_t offset);
 
+/**
+ * @brief Copy the swap page at `offset` into a newly allocated swap page.
+ *
+ * Used when a swapped out page is inherited by a forked child, so that each
+ * address space owns its swap pages.
+ *
+ * @param offset[in] The byte position in the swap file.
+ * @return the offset of the copy on success, or INVALID_SWAP on failure.
+ *
+ * @see swap.c
+ */
+extern off_t swap_dup(off_t offset);
+
 /**
  * @brief Free a swap space at the given offset.
  * 
@@ -62,5 +75,12 @@ extern size_t swap_pagein_count(void);
  */
 extern size_t swap_pageout_count(void);
 
+/**
+ * @brief Save or restore the swap space and its allocation bitmap.
+ *
+ * @see swap.c, checkpoint.h
+ */
+extern void swap_checkpoint(struct checkpoint *cp);
+
 
 #endif /* __SWAP_H__ */
@@ -20,6 +20,11 @@
 
 #include "tlb.h"
 #include "sim.h"
+#include "checkpoint.h"
+#include "latency.h"
+#include "multiprocessing.h"
+#include "profile.h"
+#include "readahead.h"
 #include "types.h"
 
 typedef enum tlb_result_e {
@@ -28,31 +33,111 @@ typedef enum tlb_result_e {
     TLB_SUCCESS = 0
 } tlb_result_t;
 
-static alignas(4096) struct {
-	u64 keys[255];
+/* The tlb of one cpu. Like the instructions they model, the primitives
+ * below act on the tlb of the cpu the simulation currently runs on.
+ */
+struct soft_tlb {
+	alignas(32) u64 keys[255];
 	u8 _padding;
 	u64 values[255];
 	u8 size;
-} tlb;
+
+	/* Profiler stamp of the page mapped by each slot, see profile.h */
+	u64 *stamps[TLB_MAXIMUM_SIZE];
+};
+
+static alignas(4096) struct soft_tlb tlbs[TLB_MAX_CPUS];
+static struct soft_tlb *tlb = &tlbs[0];
+static u32 nr_cpus = 1;
 
 #define VALID_MASK (1ULL << 40)
+#define PREMAPPED_MASK (1ULL << 48)
 
 static size_t __tlb_hit_count = 0;
 static size_t __tlb_miss_count = 0;
+static size_t shootdown_counts[TLB_NR_SHOOTDOWNS];
+
+/* Cpus whose tlb awaits the flush requested by tlb_flush_deferred() */
+static u64 flush_pending = 0;
+static size_t flush_count = 0;
 
 void
 init_soft_tlb(struct tlb_config * cfg)
 {
 	assert(cfg->size <= TLB_MAXIMUM_SIZE);
+	assert(cfg->nr_cpus <= TLB_MAX_CPUS);
 	srand(cfg->seed);
-	memset(&tlb, 0, sizeof(tlb));
-	tlb.size = cfg->size > 0 ? cfg->size : TLB_DEFAULT_SIZE;
+	nr_cpus = cfg->nr_cpus > 0 ? cfg->nr_cpus : 1;
+	memset(tlbs, 0, nr_cpus * sizeof(*tlbs));
+	for (u32 cpu = 0; cpu < nr_cpus; cpu++)
+		tlbs[cpu].size = cfg->size > 0 ? cfg->size : TLB_DEFAULT_SIZE;
+	tlb = &tlbs[0];
+	memset(shootdown_counts, 0, sizeof(shootdown_counts));
+	flush_pending = 0;
+	flush_count = 0;
 }
 
 void
 destroy_soft_tlb(void)
 {
-	memset(&tlb, 0, sizeof(tlb));
+	memset(tlbs, 0, nr_cpus * sizeof(*tlbs));
+}
+
+void
+tlb_set_cpu(u32 cpu)
+{
+	assert(cpu < nr_cpus);
+	tlb = &tlbs[cpu];
+}
+
+u32
+tlb_current_cpu(void)
+{
+	return tlb - tlbs;
+}
+
+u32
+tlb_nr_cpus(void)
+{
+	return nr_cpus;
+}
+
+void
+tlb_activate(u32 cpu)
+{
+	tlb_set_cpu(cpu);
+	if ((flush_pending & (1ULL << cpu)) == 0)
+		return;
+
+	flush_pending &= ~(1ULL << cpu);
+	flush_count += 1;
+	for (tlb_index_t idx = 0; idx < tlb->size; idx++)
+		tlb->keys[idx] &= ~VALID_MASK;
+}
+
+void
+tlb_flush_deferred(void)
+{
+	flush_pending = nr_cpus < 64 ? (1ULL << nr_cpus) - 1 : ~0ULL;
+}
+
+size_t
+tlb_flush_count(void)
+{
+	return flush_count;
+}
+
+void
+tlb_shootdown(enum tlb_shootdown_event event)
+{
+	shootdown_counts[event] += 1;
+	latency_charge(LAT_SHOOTDOWN);
+}
+
+size_t
+tlb_shootdown_count(enum tlb_shootdown_event event)
+{
+	return shootdown_counts[event];
 }
 
 // for the following functions, registers are reassigned to follow
@@ -62,22 +147,22 @@ destroy_soft_tlb(void)
 i32
 tlbwi(tlb_index_t idx, const tlb_entry_t *entry)
 {
-	if (__builtin_expect(idx >= tlb.size, false))
+	if (__builtin_expect(idx >= tlb->size, false))
 		return TLB_FAULT;
 
-	tlb.keys[idx] = entry->half.high;
-	tlb.values[idx] = entry->half.low;
+	tlb->keys[idx] = entry->half.high;
+	tlb->values[idx] = entry->half.low;
 	return TLB_SUCCESS;
 }
 
 i32
 tlbr(tlb_index_t idx, tlb_entry_t *entry)
 {
-	if (__builtin_expect(idx >= tlb.size, false))
+	if (__builtin_expect(idx >= tlb->size, false))
 		return TLB_FAULT;
 
-	entry->half.high = tlb.keys[idx];
-	entry->half.low = tlb.values[idx];
+	entry->half.high = tlb->keys[idx];
+	entry->half.low = tlb->values[idx];
 	return TLB_SUCCESS;
 }
 
@@ -97,9 +182,9 @@ tlbp(asid_t asid, vpn_t vpn)
 	__m256i target_vec = _mm256_set1_epi64x(target);
 
 	#pragma GCC unroll 4
-	for (u16 i = 0; i < tlb.size; i += 4) {
+	for (u16 i = 0; i < tlb->size; i += 4) {
 		__m256i current_vec =
-			_mm256_load_si256((const __m256i *)&tlb.keys[i]);
+			_mm256_load_si256((const __m256i *)&tlb->keys[i]);
 
 		__m256i current_masked =
 			_mm256_and_si256(current_vec, mask_vec);
@@ -134,8 +219,8 @@ tlbp(asid_t asid, vpn_t vpn)
 {
 	const u64 target = ((u64)asid << 48) | VALID_MASK | vpn;
 
-	for (u16 i = 0; i < tlb.size; i += 1) {
-		if (tlb.keys[i] == target)
+	for (u16 i = 0; i < tlb->size; i += 1) {
+		if (tlb->keys[i] == target)
 			return i;
 	}
 	return TLB_PROBE_NOTFOUND;
@@ -145,15 +230,23 @@ tlbp(asid_t asid, vpn_t vpn)
 i32 
 tlbwr(const tlb_entry_t * entry)
 {
-	tlb_index_t vacant = random() % tlb.size;
+	tlb_index_t vacant = random() % tlb->size;
 
-	tlb.keys[vacant] = entry->half.high;
-	tlb.values[vacant] = entry->half.low;
+	tlb->keys[vacant] = entry->half.high;
+	tlb->values[vacant] = entry->half.low;
 	return 0;
 }
 
+void
+tlb_set_stamp(tlb_index_t idx, u64 *stamp)
+{
+	assert(idx < tlb->size);
+	tlb->stamps[idx] = stamp;
+}
+
 static tlb_result_t
-tlb_resolve_addr(char type, asid_t asid, vaddr_t vaddr, paddr_t * res)
+tlb_resolve_addr(char type, asid_t asid, vaddr_t vaddr, paddr_t * res,
+		 tlb_index_t * res_idx)
 {
 	u64 offset = vaddr % PAGE_SIZE;
 	vpn_t vpn = vaddr >> PAGE_SHIFT;
@@ -163,6 +256,8 @@ tlb_resolve_addr(char type, asid_t asid, vaddr_t vaddr, paddr_t * res)
 	if (idx == TLB_PROBE_NOTFOUND)
 		return TLB_FAULT;
 
+	*res_idx = idx;
+
 	tlb_entry_t to_read;
 	tlbr(idx, &to_read);
 	assert(to_read.fields.valid);
@@ -183,25 +278,32 @@ paddr_t
 tlb_translate(char type, asid_t asid, pagetable_t *const pt, vaddr_t vaddr)
 {
 	paddr_t memaddr;
+	tlb_index_t idx;
 
 	enum {
 		NO_FAULT,
 		WRITE_FAULT,
 		MISS_FAULT,
 	} fault_type = NO_FAULT;
-	tlb_result_t err = tlb_resolve_addr(type, asid, vaddr, &memaddr);
+	latency_reference();
+	tlb_result_t err = tlb_resolve_addr(type, asid, vaddr, &memaddr, &idx);
 
 retry:
 	switch (err) {
 		case TLB_SUCCESS:
 			__tlb_hit_count += (fault_type == NO_FAULT) ? 1 : 0;
+			if (__builtin_expect(tlb->values[idx] & PREMAPPED_MASK, false)
+			    && fault_type == NO_FAULT) {
+				tlb->values[idx] &= ~PREMAPPED_MASK;
+				readahead_stats.around_hits++;
+			}
 			break;
 		case TLB_FAULT:
 			// can only get here if haven't previously faulted
 			assert(fault_type == NO_FAULT);
 
 			handle_tlb_fault(asid, pt, vaddr, type, false);
-			err = tlb_resolve_addr(type, asid, vaddr, &memaddr); // retry
+			err = tlb_resolve_addr(type, asid, vaddr, &memaddr, &idx); // retry
 			__tlb_miss_count += (fault_type == NO_FAULT) ? 1 : 0;  // don't double count
 
 			// can only write fault or succeed
@@ -213,7 +315,7 @@ retry:
 			assert(fault_type == NO_FAULT || fault_type == MISS_FAULT);
 
 			handle_tlb_fault(asid, pt, vaddr, type, true);
-			err = tlb_resolve_addr(type, asid, vaddr, &memaddr); // retry
+			err = tlb_resolve_addr(type, asid, vaddr, &memaddr, &idx); // retry
 			__tlb_miss_count += (fault_type == NO_FAULT) ? 1 : 0;  // don't double count
 			
 			assert(err == TLB_SUCCESS); // if fail again something is wrong
@@ -221,9 +323,21 @@ retry:
 			goto retry;
 	}
 
+	if (profiling) {
+		profile_touch(get_mm_profile(current_task()->mm), tlb->stamps[idx],
+			      fault_type != NO_FAULT);
+	}
+
 	return memaddr;
 }
 
+void
+tlb_repeat_hits(size_t n)
+{
+	latency_reference_n(n);
+	__tlb_hit_count += n;
+}
+
 size_t
 tlb_hit_count(void)
 {
@@ -235,3 +349,47 @@ tlb_miss_count(void)
 {
 	return __tlb_miss_count;
 }
+
+void
+tlb_checkpoint(struct checkpoint *cp)
+{
+	// Stale entries left behind by exited address spaces
+	static u64 orphan_stamp;
+
+	checkpoint_check(cp, nr_cpus, "number of cpus");
+	checkpoint_check(cp, tlb->size, "tlb size");
+	for (u32 cpu = 0; cpu < nr_cpus; cpu++) {
+		checkpoint_data(cp, tlbs[cpu].keys, tlb->size * sizeof(u64));
+		checkpoint_data(cp, tlbs[cpu].values, tlb->size * sizeof(u64));
+	}
+	u32 current = tlb_current_cpu();
+	checkpoint_var(cp, current);
+	checkpoint_var(cp, __tlb_hit_count);
+	checkpoint_var(cp, __tlb_miss_count);
+	checkpoint_var(cp, shootdown_counts);
+	checkpoint_var(cp, flush_pending);
+	checkpoint_var(cp, flush_count);
+
+	if (!checkpoint_restoring(cp))
+		return;
+
+	// Stamps point into page table entries, look them up again
+	for (u32 cpu = 0; cpu < nr_cpus; cpu++) {
+		struct soft_tlb *t = &tlbs[cpu];
+		for (tlb_index_t idx = 0; idx < t->size; idx++) {
+			tlb_entry_t entry = { .half = { t->values[idx], t->keys[idx] } };
+
+			t->stamps[idx] = NULL;
+			if (!entry.fields.valid)
+				continue;
+
+			mm_t *mm = get_mm_by_asid(entry.fields.asid);
+			if (mm != NULL)
+				t->stamps[idx] = pagetable_stamp(get_pagetable(mm),
+								 entry.fields.vpn);
+			if (t->stamps[idx] == NULL)
+				t->stamps[idx] = &orphan_stamp;
+		}
+	}
+	tlb_set_cpu(current);
+}
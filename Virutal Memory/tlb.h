@@ -28,17 +28,19 @@
  * V: Valid flag
  * P: Virtual page number
  * D: Dirty flag
+ * R: Loaded by fault-around and not hit yet, see readahead.h
  * F: Physical frame number
  *
  * 127 | AAAAAAAA AAAAAAAA -------V ----PPPP | 96
  *  95 | PPPPPPPP PPPPPPPP PPPPPPPP PPPPPPPP | 64
- *  63 | -------D -------- FFFFFFFF FFFFFFFF | 32
+ *  63 | -------D -------R FFFFFFFF FFFFFFFF | 32
  *  31 | FFFFFFFF FFFFFFFF FFFFFFFF FFFFFFFF |  0
  */
 typedef union {
 	struct {
 		pfn_t pfn	: 48;
-		u8 _padding;
+		u8 premapped	: 1;
+		u8 _padding	: 7;
 		bool dirty;
 		vpn_t vpn	: 36;
 		bool valid;
@@ -75,6 +77,19 @@ void destroy_soft_tlb(void);
 #define TLB_MAXIMUM_SIZE 255
 #define TLB_PROBE_NOTFOUND ((tlb_index_t) -1)
 
+/* Number of simulated cpus, each with a tlb of its own */
+#define TLB_MAX_CPUS 64
+
+/* Events that may invalidate translations cached by other cpus */
+enum tlb_shootdown_event {
+	TLB_SHOOTDOWN_EVICT,    /* Frame evicted */
+	TLB_SHOOTDOWN_COW,      /* CoW fault moved a page to a frame of its own */
+	TLB_SHOOTDOWN_FORK,     /* Parent write-protected by fork */
+	TLB_SHOOTDOWN_MERGE,    /* Dedup merged two frames */
+	TLB_SHOOTDOWN_MIGRATE,  /* Page migrated to another NUMA node */
+	TLB_NR_SHOOTDOWNS
+};
+
 /*
  * hardware primitives
  * nonzero return means tlb fault, to be handled by software
@@ -133,6 +148,68 @@ tlb_index_t tlbp(asid_t asid, vpn_t vpn);
  */
 i32 tlbwr(const tlb_entry_t * entry);
 
+/**
+ * @brief Attach the profiler stamp of the page mapped by a tlb entry.
+ *
+ * Called after a tlb fault has written the entry at `idx`, so that later
+ * hits on it can be accounted to the page without a page walk.
+ *
+ * @param idx[in] The index of the tlb entry.
+ * @param stamp[in] The stamp of the page the entry maps, see profile.h.
+ *
+ * @see tlb.c
+ */
+void tlb_set_stamp(tlb_index_t idx, u64 *stamp);
+
+/**
+ * @brief Switch to the tlb of `cpu`, which the primitives above act on
+ * from now on.
+ *
+ * @see tlb.c
+ */
+void tlb_set_cpu(u32 cpu);
+u32 tlb_current_cpu(void);
+u32 tlb_nr_cpus(void);
+
+/**
+ * @brief Switch to the tlb of `cpu` to run a task there, first flushing it
+ * if tlb_flush_deferred() was called since it last ran one.
+ *
+ * @see tlb.c
+ */
+void tlb_activate(u32 cpu);
+
+/**
+ * @brief Invalidate every entry of every tlb, each cpu doing so the next
+ * time it runs a task. Called once the ASIDs cached by the tlbs may be
+ * given to other address spaces, see multiprocessing.c.
+ *
+ * @see tlb.c
+ */
+void tlb_flush_deferred(void);
+
+/**
+ * @brief Return the number of full flushes done by tlb_activate().
+ *
+ * @see tlb.c
+ */
+size_t tlb_flush_count(void);
+
+/**
+ * @brief Account for one shootdown IPI sent to another cpu because of
+ * `event`, charging its cost to the current task.
+ *
+ * @see tlb.c
+ */
+void tlb_shootdown(enum tlb_shootdown_event event);
+
+/**
+ * @brief Return the number of shootdown IPIs sent because of `event`.
+ *
+ * @see tlb.c
+ */
+size_t tlb_shootdown_count(enum tlb_shootdown_event event);
+
 /**
  * @brief Return the number of tlb hits thus far in the simulation.
  *
@@ -142,6 +219,14 @@ i32 tlbwr(const tlb_entry_t * entry);
  */
 extern size_t tlb_hit_count(void);
 
+/**
+ * @brief Account for `n` more references that hit the entry the last
+ * tlb_translate() used, as the dropped lines of a compacted trace do.
+ *
+ * @see tlb.c
+ */
+void tlb_repeat_hits(size_t n);
+
 /**
  * @brief Return the number of tlb misses thus far in the simulation.
  *
@@ -151,4 +236,14 @@ extern size_t tlb_hit_count(void);
  */
 extern size_t tlb_miss_count(void);
 
+/**
+ * @brief Save or restore the tlb entries of every cpu and the counters.
+ *
+ * Must run after the page tables are restored, to find the profiler stamp
+ * of every valid entry again.
+ *
+ * @see tlb.c, checkpoint.h
+ */
+void tlb_checkpoint(struct checkpoint *cp);
+
 #endif
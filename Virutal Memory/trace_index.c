@@ -0,0 +1,478 @@
+/** @file trace_index.c
+ * @brief Sidecar index of a binary trace.
+ *
+ * Building is split two ways between the threads. Lines are split into
+ * contiguous ranges, each thread recording the runs, events and counts of
+ * its range, and the ranges are stitched together afterwards. Distinct
+ * pages need a set shared by the whole trace instead, so every thread reads
+ * all of it but only keeps the pages whose hash falls in its share, and the
+ * per-vpid page counts of the threads simply add up.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "khash.h"
+#include "parse_trace.h"
+#include "sim.h"
+#include "trace_index.h"
+#include "types.h"
+
+/* Distinct (vpid, vpn) pages of one thread's share -> written */
+KHASH_MAP_INIT_INT64(pages, u8)
+
+struct worker_run {
+	u32 vpid;
+	u64 start;
+	u64 len;
+};
+
+struct index_worker {
+	pthread_t thread;
+	const struct trace_line *trace;
+	u64 nr_records;
+	u64 lo;                 /* Range of lines indexed by this thread */
+	u64 hi;
+	u32 id;
+	u32 nr_threads;
+	bool failed;
+
+	struct trace_vpid *vpids;
+	size_t nr_vpids;
+	size_t cap_vpids;
+	struct worker_run *runs;
+	size_t nr_runs;
+	size_t cap_runs;
+	struct trace_event *events;
+	size_t nr_events;
+	size_t cap_events;
+};
+
+static bool
+grow(void **arr, size_t *cap, size_t need, size_t size)
+{
+	if (need <= *cap)
+		return true;
+
+	size_t n = *cap > 0 ? *cap : 64;
+	while (n < need)
+		n *= 2;
+	void *p = realloc(*arr, n * size);
+	if (p == NULL)
+		return false;
+	*arr = p;
+	*cap = n;
+	return true;
+}
+
+static struct trace_vpid *
+worker_vpid(struct index_worker *w, u32 vpid)
+{
+	if (vpid >= w->nr_vpids) {
+		if (!grow((void **)&w->vpids, &w->cap_vpids, (size_t)vpid + 1,
+			  sizeof(*w->vpids)))
+			return NULL;
+		for (size_t v = w->nr_vpids; v <= vpid; v++)
+			w->vpids[v] = (struct trace_vpid) { .first = UINT64_MAX };
+		w->nr_vpids = (size_t)vpid + 1;
+	}
+	return &w->vpids[vpid];
+}
+
+static inline u32
+page_share(u64 key, u32 nr_threads)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	return key % nr_threads;
+}
+
+static bool
+index_line(struct index_worker *w, u64 i, const struct trace_line *tl)
+{
+	struct trace_vpid *v = worker_vpid(w, tl->vpid);
+	if (v == NULL)
+		return false;
+
+	if (v->first == UINT64_MAX)
+		v->first = i;
+	v->last = i;
+	if (strchr("ILSM", tl->reftype) != NULL)
+		v->refs += 1;
+
+	struct worker_run *r = w->nr_runs > 0 ? &w->runs[w->nr_runs - 1] : NULL;
+	if (r != NULL && r->vpid == tl->vpid && r->start + r->len == i) {
+		r->len += 1;
+	} else {
+		if (!grow((void **)&w->runs, &w->cap_runs, w->nr_runs + 1,
+			  sizeof(*w->runs)))
+			return false;
+		w->runs[w->nr_runs++] = (struct worker_run) { tl->vpid, i, 1 };
+	}
+
+	if (tl->reftype != 'B' && tl->reftype != 'F' && tl->reftype != 'E')
+		return true;
+
+	if (!grow((void **)&w->events, &w->cap_events, w->nr_events + 1,
+		  sizeof(*w->events)))
+		return false;
+	w->events[w->nr_events++] = (struct trace_event) {
+		.record = i,
+		.vpid = tl->vpid,
+		.child = tl->reftype == 'F' ? (u32)tl->vaddr : 0,
+		.type = tl->reftype,
+	};
+	// A forked process counts as seen, even if it never runs
+	return tl->reftype != 'F' || worker_vpid(w, tl->vaddr) != NULL;
+}
+
+static void *
+index_worker(void *arg)
+{
+	struct index_worker *w = arg;
+	khash_t(pages) *pages = kh_init(pages);
+
+	w->failed = pages == NULL;
+	for (u64 i = 0; i < w->nr_records && !w->failed; i++) {
+		const struct trace_line *tl = &w->trace[i];
+
+		if (i >= w->lo && i < w->hi && !index_line(w, i, tl)) {
+			w->failed = true;
+			break;
+		}
+		if (strchr("ILSM", tl->reftype) == NULL)
+			continue;
+
+		// vpids are assumed to fit in the 28 bits above the vpn
+		const u64 key = (u64)tl->vpid << 36
+			| ((u64)(tl->vaddr >> PAGE_SHIFT) & VPN_MASK);
+		if (page_share(key, w->nr_threads) != w->id)
+			continue;
+
+		i32 ret;
+		khiter_t k = kh_put(pages, pages, key, &ret);
+		struct trace_vpid *v = worker_vpid(w, tl->vpid);
+		if (ret < 0 || v == NULL) {
+			w->failed = true;
+			break;
+		}
+		if (ret > 0) {
+			kh_value(pages, k) = 0;
+			v->pages += 1;
+		}
+		if ((tl->reftype == 'S' || tl->reftype == 'M')
+		    && kh_value(pages, k) == 0) {
+			kh_value(pages, k) = 1;
+			v->dirty += 1;
+		}
+	}
+
+	kh_destroy(pages, pages);
+	return NULL;
+}
+
+static int
+compare_runs(const void *a, const void *b)
+{
+	const struct worker_run *x = a;
+	const struct worker_run *y = b;
+
+	if (x->vpid != y->vpid)
+		return x->vpid < y->vpid ? -1 : 1;
+	return x->start < y->start ? -1 : x->start > y->start;
+}
+
+/* Write everything gathered by the workers to `path`. */
+static i32
+write_index(const char *path, struct index_worker *workers, u32 nr_threads,
+	    u64 nr_records, u32 stride)
+{
+	struct trace_index_header hdr = {
+		.version = TRACE_INDEX_VERSION,
+		.stride = stride,
+		.nr_records = nr_records,
+		.nr_seeks = nr_records / stride + 1,
+	};
+	memcpy(hdr.magic, TRACE_INDEX_MAGIC, sizeof(hdr.magic));
+	for (u32 t = 0; t < nr_threads; t++) {
+		if (workers[t].nr_vpids > hdr.nr_vpids)
+			hdr.nr_vpids = workers[t].nr_vpids;
+		hdr.nr_events += workers[t].nr_events;
+		hdr.nr_runs += workers[t].nr_runs;
+	}
+
+	struct trace_vpid *vpids = calloc(hdr.nr_vpids + 1, sizeof(*vpids));
+	struct worker_run *wruns = malloc((hdr.nr_runs + 1) * sizeof(*wruns));
+	struct trace_run *runs = malloc((hdr.nr_runs + 1) * sizeof(*runs));
+	struct trace_event *events = malloc((hdr.nr_events + 1) * sizeof(*events));
+	struct trace_seek *seeks = malloc(hdr.nr_seeks * sizeof(*seeks));
+	bool *live = calloc(hdr.nr_vpids + 1, sizeof(*live));
+	u32 *lists = NULL;
+	size_t cap_lists = 0;
+	FILE *out = NULL;
+	i32 ret = -1;
+
+	if (!vpids || !wruns || !runs || !events || !seeks || !live)
+		goto done;
+
+	// Sum up the counts, and stitch runs cut at the edge of two ranges
+	for (u64 v = 0; v < hdr.nr_vpids; v++)
+		vpids[v].first = UINT64_MAX;
+	size_t nr_runs = 0;
+	size_t nr_events = 0;
+	for (u32 t = 0; t < nr_threads; t++) {
+		const struct index_worker *w = &workers[t];
+		for (size_t v = 0; v < w->nr_vpids; v++) {
+			const struct trace_vpid *wv = &w->vpids[v];
+			vpids[v].refs += wv->refs;
+			vpids[v].pages += wv->pages;
+			vpids[v].dirty += wv->dirty;
+			if (wv->first < vpids[v].first)
+				vpids[v].first = wv->first;
+			if (wv->first != UINT64_MAX && wv->last > vpids[v].last)
+				vpids[v].last = wv->last;
+		}
+		for (size_t r = 0; r < w->nr_runs; r++) {
+			struct worker_run *prev = nr_runs > 0 ? &wruns[nr_runs - 1] : NULL;
+			if (r == 0 && prev != NULL && prev->vpid == w->runs[0].vpid
+			    && prev->start + prev->len == w->runs[0].start)
+				prev->len += w->runs[0].len;
+			else
+				wruns[nr_runs++] = w->runs[r];
+		}
+		if (w->nr_events > 0)
+			memcpy(&events[nr_events], w->events,
+			       w->nr_events * sizeof(*events));
+		nr_events += w->nr_events;
+	}
+	hdr.nr_runs = nr_runs;
+
+	qsort(wruns, nr_runs, sizeof(*wruns), compare_runs);
+	for (size_t r = 0; r < nr_runs; r++) {
+		struct trace_vpid *v = &vpids[wruns[r].vpid];
+		if (v->nr_runs++ == 0)
+			v->run = r;
+		runs[r] = (struct trace_run) { wruns[r].start, wruns[r].len };
+	}
+
+	// Replay the events to find the live processes at every seek point
+	size_t e = 0;
+	for (u64 s = 0; s < hdr.nr_seeks; s++) {
+		struct trace_seek *seek = &seeks[s];
+
+		seek->record = s * stride;
+		for (; e < nr_events && events[e].record < seek->record; e++) {
+			const struct trace_event *ev = &events[e];
+			if (ev->type == 'F')
+				live[ev->child] = true;
+			else
+				live[ev->vpid] = ev->type == 'B';
+		}
+		seek->event = e;
+		seek->live = hdr.nr_live;
+		seek->nr_live = 0;
+		for (u64 v = 0; v < hdr.nr_vpids; v++) {
+			if (!live[v])
+				continue;
+			if (!grow((void **)&lists, &cap_lists, hdr.nr_live + 1,
+				  sizeof(*lists)))
+				goto done;
+			lists[hdr.nr_live++] = v;
+			seek->nr_live += 1;
+		}
+	}
+
+	out = fopen(path, "wb");
+	if (out == NULL)
+		goto done;
+	if (fwrite(&hdr, sizeof(hdr), 1, out) != 1
+	    || fwrite(seeks, sizeof(*seeks), hdr.nr_seeks, out) != hdr.nr_seeks
+	    || fwrite(vpids, sizeof(*vpids), hdr.nr_vpids, out) != hdr.nr_vpids
+	    || fwrite(events, sizeof(*events), hdr.nr_events, out) != hdr.nr_events
+	    || fwrite(runs, sizeof(*runs), hdr.nr_runs, out) != hdr.nr_runs
+	    || fwrite(lists, sizeof(*lists), hdr.nr_live, out) != hdr.nr_live)
+		goto done;
+	ret = 0;
+
+done:
+	if (out != NULL && fclose(out) != 0)
+		ret = -1;
+	free(lists);
+	free(live);
+	free(seeks);
+	free(events);
+	free(runs);
+	free(wruns);
+	free(vpids);
+	return ret;
+}
+
+i32
+trace_index_build(const char *trace, const char *path, u32 stride,
+		  u32 nr_threads)
+{
+	assert(stride > 0 && nr_threads > 0);
+
+	const int fd = open(trace, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	struct stat sb;
+	if (fstat(fd, &sb) != 0) {
+		close(fd);
+		return -1;
+	}
+
+	const u64 nr_records = sb.st_size / sizeof(struct trace_line);
+	const struct trace_line *lines = NULL;
+	if (nr_records > 0) {
+		lines = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (lines == MAP_FAILED) {
+			close(fd);
+			return -1;
+		}
+	}
+	close(fd);
+
+	struct index_worker *workers = calloc(nr_threads, sizeof(*workers));
+	if (workers == NULL) {
+		munmap((void *)lines, sb.st_size);
+		return -1;
+	}
+
+	u32 started = 0;
+	bool failed = false;
+	for (u32 t = 0; t < nr_threads; t++) {
+		workers[t] = (struct index_worker) {
+			.trace = lines,
+			.nr_records = nr_records,
+			.lo = nr_records * t / nr_threads,
+			.hi = nr_records * (t + 1) / nr_threads,
+			.id = t,
+			.nr_threads = nr_threads,
+		};
+		if (pthread_create(&workers[t].thread, NULL, index_worker,
+				   &workers[t]) != 0) {
+			failed = true;
+			break;
+		}
+		started++;
+	}
+	for (u32 t = 0; t < started; t++) {
+		pthread_join(workers[t].thread, NULL);
+		failed |= workers[t].failed;
+	}
+
+	i32 ret = -1;
+	if (failed)
+		errno = ENOMEM;
+	else
+		ret = write_index(path, workers, nr_threads, nr_records, stride);
+
+	for (u32 t = 0; t < nr_threads; t++) {
+		free(workers[t].vpids);
+		free(workers[t].runs);
+		free(workers[t].events);
+	}
+	free(workers);
+	if (lines != NULL)
+		munmap((void *)lines, sb.st_size);
+	return ret;
+}
+
+i32
+trace_index_open(struct trace_index *idx, const char *path, const char *trace)
+{
+	struct stat sb;
+	struct stat trace_sb;
+
+	memset(idx, 0, sizeof(*idx));
+	if (stat(trace, &trace_sb) != 0)
+		return -1;
+
+	const int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &sb) != 0 || (size_t)sb.st_size < sizeof(*idx->hdr)) {
+		close(fd);
+		return -1;
+	}
+	void *map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+
+	const struct trace_index_header *hdr = map;
+	const u8 *p = (const u8 *)(hdr + 1);
+	const size_t size = sizeof(*hdr)
+		+ hdr->nr_seeks * sizeof(*idx->seeks)
+		+ hdr->nr_vpids * sizeof(*idx->vpids)
+		+ hdr->nr_events * sizeof(*idx->events)
+		+ hdr->nr_runs * sizeof(*idx->runs)
+		+ hdr->nr_live * sizeof(*idx->live);
+	if (memcmp(hdr->magic, TRACE_INDEX_MAGIC, sizeof(hdr->magic)) != 0
+	    || hdr->version != TRACE_INDEX_VERSION
+	    || size != (size_t)sb.st_size || hdr->nr_seeks == 0
+	    || hdr->nr_records
+	       != (u64)trace_sb.st_size / sizeof(struct trace_line)) {
+		munmap(map, sb.st_size);
+		return -1;
+	}
+
+	idx->hdr = hdr;
+	idx->seeks = (const struct trace_seek *)p;
+	p += hdr->nr_seeks * sizeof(*idx->seeks);
+	idx->vpids = (const struct trace_vpid *)p;
+	p += hdr->nr_vpids * sizeof(*idx->vpids);
+	idx->events = (const struct trace_event *)p;
+	p += hdr->nr_events * sizeof(*idx->events);
+	idx->runs = (const struct trace_run *)p;
+	p += hdr->nr_runs * sizeof(*idx->runs);
+	idx->live = (const u32 *)p;
+	idx->map = map;
+	idx->map_size = sb.st_size;
+	return 0;
+}
+
+void
+trace_index_close(struct trace_index *idx)
+{
+	if (idx->map != NULL)
+		munmap(idx->map, idx->map_size);
+	memset(idx, 0, sizeof(*idx));
+}
+
+size_t
+trace_index_live_at(const struct trace_index *idx, u64 record, bool *live)
+{
+	u64 s = record / idx->hdr->stride;
+	if (s >= idx->hdr->nr_seeks)
+		s = idx->hdr->nr_seeks - 1;
+	const struct trace_seek *seek = &idx->seeks[s];
+
+	memset(live, 0, idx->hdr->nr_vpids * sizeof(*live));
+	for (u64 i = 0; i < seek->nr_live; i++)
+		live[idx->live[seek->live + i]] = true;
+
+	for (u64 e = seek->event;
+	     e < idx->hdr->nr_events && idx->events[e].record < record; e++) {
+		const struct trace_event *ev = &idx->events[e];
+		if (ev->type == 'F')
+			live[ev->child] = true;
+		else
+			live[ev->vpid] = ev->type == 'B';
+	}
+
+	size_t nr_live = 0;
+	for (u64 v = 0; v < idx->hdr->nr_vpids; v++)
+		nr_live += live[v];
+	return nr_live;
+}
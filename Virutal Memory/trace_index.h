@@ -0,0 +1,128 @@
+/** @file trace_index.h
+ * @brief Sidecar index of a binary trace.
+ *
+ * A binary trace (see convert.c) can only be read front to back: which
+ * processes exist at a given line, or where the lines of one process lie,
+ * is only known after reading everything before. The index, built once by
+ * `trace-index` into `<trace>.idx`, records:
+ *
+ *   - a seek point every `stride` lines, with the processes alive there,
+ *   - every B, F and E line, in trace order,
+ *   - for every vpid, its runs of consecutive lines, its references, and
+ *     the pages it touches and writes,
+ *
+ * so that sim can start replaying at any line or replay only some
+ * processes, and a trace can be split into ranges whose starting state is
+ * known, without rescanning it.
+ *
+ * The file is the header followed by the seek points, the vpids, the
+ * events, the runs and the live lists, each an array of the structs below
+ * in host byte order. It is mapped as is by trace_index_open().
+ */
+
+#ifndef __TRACE_INDEX_H__
+#define __TRACE_INDEX_H__
+
+#include "types.h"
+
+#define TRACE_INDEX_MAGIC "SIM369IX"
+#define TRACE_INDEX_VERSION 1
+#define TRACE_INDEX_SUFFIX ".idx"
+
+/* Lines between seek points unless set otherwise, 1 MB of trace */
+#define TRACE_INDEX_DEFAULT_STRIDE 65536
+
+struct trace_index_header {
+	char magic[8];
+	u32 version;
+	u32 stride;             /* Lines between seek points */
+	u64 nr_records;         /* Lines in the trace */
+	u64 nr_seeks;
+	u64 nr_vpids;           /* Highest vpid plus one */
+	u64 nr_events;
+	u64 nr_runs;
+	u64 nr_live;
+};
+
+struct trace_seek {
+	u64 record;             /* Line of the seek point, a multiple of stride */
+	u64 event;              /* First event at or after it */
+	u64 live;               /* Processes alive there, in the live lists */
+	u64 nr_live;
+};
+
+struct trace_vpid {
+	u64 refs;               /* I, L, S and M lines */
+	u64 pages;              /* Distinct pages referenced */
+	u64 dirty;              /* Of those, pages written */
+	u64 first;              /* First and last lines of any kind, first is */
+	u64 last;               /* UINT64_MAX if the vpid never shows up */
+	u64 run;                /* First of its runs */
+	u64 nr_runs;
+};
+
+struct trace_event {
+	u64 record;
+	u32 vpid;
+	u32 child;              /* Forked process for F lines */
+	u8 type;                /* 'B', 'F' or 'E' */
+	u8 _padding[7];
+};
+
+/* Consecutive lines of one process. Runs are sorted by vpid, then line. */
+struct trace_run {
+	u64 start;
+	u64 len;
+};
+
+struct trace_index {
+	const struct trace_index_header *hdr;
+	const struct trace_seek *seeks;
+	const struct trace_vpid *vpids;
+	const struct trace_event *events;
+	const struct trace_run *runs;
+	const u32 *live;
+	void *map;
+	size_t map_size;
+};
+
+/**
+ * @brief Index the trace at `trace` into `path`.
+ *
+ * The trace is split into `nr_threads` ranges of lines indexed in parallel.
+ * Distinct pages are counted in parallel as well, every thread counting
+ * those whose hash falls in its share across the whole trace.
+ *
+ * @return 0 on success, -1 with errno set if a file could not be read or
+ * written.
+ *
+ * @see trace_index.c
+ */
+i32 trace_index_build(const char *trace, const char *path, u32 stride,
+		      u32 nr_threads);
+
+/**
+ * @brief Map the index at `path` of the trace at `trace`.
+ *
+ * @return 0 on success, -1 if the index is missing, malformed or was built
+ * from a trace of a different length.
+ *
+ * @see trace_index.c
+ */
+i32 trace_index_open(struct trace_index *idx, const char *path,
+		     const char *trace);
+void trace_index_close(struct trace_index *idx);
+
+/**
+ * @brief Find the processes alive just before line `record`, starting
+ * from the seek point before it.
+ *
+ * @param live[out] Room for nr_vpids flags, set for the live processes.
+ * @return The number of live processes.
+ *
+ * @see trace_index.c
+ */
+size_t trace_index_live_at(const struct trace_index *idx, u64 record,
+			   bool *live);
+
+#endif /* __TRACE_INDEX_H__ */
@@ -51,6 +51,17 @@ typedef i64 off_t;
 
 struct tlb_config;
 struct mp_config;
+struct dedup_config;
+struct profile_config;
+struct latency_config;
+struct readahead_config;
+struct shards_config;
+struct numa_config;
+struct quota_config;
+struct cache_config;
+struct adapt_config;
+struct shmstats_config;
+struct checkpoint;
 
 
 #endif // __TYPES_H__